@@ -0,0 +1,101 @@
+#!/usr/bin/python3
+'''
+Aggregate throughput of a parallel ranged download. Fetches one file from a
+running server as 1, 2, 4 ... byte ranges, each over its own protocol v2
+connection, and reports the aggregate rate for every stream count. The data is
+received and dropped so only the network and the server are measured.
+
+usage: python3 bench/download_bench.py HOST PORT FILE [--max-streams N] [--rounds R]
+
+On loopback the single connection is rarely the bottleneck, the gain shows on
+links with a large bandwidth-delay product, e.g. after
+    tc qdisc add dev lo root netem delay 20ms
+'''
+import argparse
+import socket
+import struct
+import threading
+import time
+
+V2_HELLO = struct.Struct("<4sHH")
+V2_HDR = struct.Struct("<HHIQ")
+V2_RANGE_HEAD = struct.Struct("<QQQ")
+V2_OP_BYE = 4
+V2_OP_DOWNLOAD_RANGE = 7
+V2_FLAG_ERROR = 0x0002
+CHUNK = 1024 * 1024
+
+def recv_exact(sock, length):
+    data = bytearray()
+    while len(data) < length:
+        chunk = sock.recv(length - len(data))
+        if not chunk:
+            raise RuntimeError("server closed the connection")
+        data += chunk
+    return bytes(data)
+
+def connect(host, port):
+    sock = socket.create_connection((host, port))
+    sock.sendall(V2_HELLO.pack(b"FSV2", 2, 0))
+    recv_exact(sock, V2_HELLO.size)
+    return sock
+
+def request_range(sock, name, offset, length):
+    payload = struct.pack("<QQ", offset, length) + name.encode('utf-8')
+    sock.sendall(V2_HDR.pack(V2_OP_DOWNLOAD_RANGE, 0, 1, len(payload)) + payload)
+    _, flags, _, payload_len = V2_HDR.unpack(recv_exact(sock, V2_HDR.size))
+    if flags & V2_FLAG_ERROR:
+        raise RuntimeError(f"server refused {name}: errno {struct.unpack('<I', recv_exact(sock, payload_len))[0]}")
+    return V2_RANGE_HEAD.unpack(recv_exact(sock, V2_RANGE_HEAD.size))
+
+def fetch(sock, name, offset, length, received):
+    _, _, length = request_range(sock, name, offset, length)
+    buffer = memoryview(bytearray(CHUNK))
+    while length > 0:
+        count = sock.recv_into(buffer, min(length, CHUNK))
+        if count == 0:
+            raise RuntimeError("server closed the connection")
+        length -= count
+        received.append(count)
+    sock.sendall(V2_HDR.pack(V2_OP_BYE, 0, 2, 0))
+    sock.close()
+
+def run(host, port, name, size, streams):
+    chunk = -(-size // streams)
+    sockets = [connect(host, port) for _ in range(streams)]
+    received = []
+    start = time.monotonic()
+    workers = [threading.Thread(target=fetch, args=(sock, name, idx * chunk, chunk, received))
+               for idx, sock in enumerate(sockets)]
+    for worker in workers:
+        worker.start()
+    for worker in workers:
+        worker.join()
+    elapsed = time.monotonic() - start
+    if sum(received) != size:
+        raise RuntimeError(f"received {sum(received)} of {size} bytes")
+    return size / elapsed / 1e6
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument("host")
+    parser.add_argument("port", type=int)
+    parser.add_argument("file")
+    parser.add_argument("--max-streams", type=int, default=8)
+    parser.add_argument("--rounds", type=int, default=3)
+    args = parser.parse_args()
+
+    probe = connect(args.host, args.port)
+    size, _, _ = request_range(probe, args.file, 0, 0)
+    probe.close()
+    print(f"{args.file}: {size} bytes, best of {args.rounds} rounds")
+    print(f"{'streams':>8} {'MB/s':>10}")
+
+    streams = 1
+    while streams <= args.max_streams:
+        best = max(run(args.host, args.port, args.file, size, streams) for _ in range(args.rounds))
+        print(f"{streams:>8} {best:>10.1f}")
+        streams *= 2
+
+if __name__ == "__main__":
+    main()
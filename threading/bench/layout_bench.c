@@ -0,0 +1,155 @@
+#define _XOPEN_SOURCE 700
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <time.h>
+#include <sys/stat.h>
+
+#include "../includes/file_operations.h"
+#include "../includes/storage_layout.h"
+
+/*
+ * Create and lookup throughput of the flat and the sharded storage layout.
+ * For each layout a scratch FileServer/ is made under a temporary directory in
+ * the current one (so it lives on the same filesystem as the real store), N
+ * empty files are created through layout_path, looked up in random order
+ * through layout_lstat, then removed. The page cache stays warm, the numbers
+ * show the directory lookup cost rather than the disk.
+ *
+ * usage: ./bin/layout_bench [FILES]
+ */
+
+#define BENCH_DEFAULT_FILES 200000
+#define BENCH_NAME_FMT      "bench_file_%09zu"
+
+/**
+ * DOUBLE ELAPSED:
+ * @brief - seconds between two CLOCK_MONOTONIC readings
+ */
+static double elapsed (const struct timespec * p_start, const struct timespec * p_end)
+{
+    return (double)(p_end->tv_sec - p_start->tv_sec) + ((double)(p_end->tv_nsec - p_start->tv_nsec) / 1e9);
+}
+
+/**
+ * INT RUN_LAYOUT:
+ * @brief - creates, looks up and removes num_files files in one layout and
+ *          prints the rates
+ * @return - 0 on success, -1 on error
+ */
+static int run_layout (layout_t layout, size_t num_files)
+{
+    char            p_name[NAME_MAX]  = { 0 };
+    char            p_path[PATH_MAX]  = { 0 };
+    struct stat     file_stat         = { 0 };
+    struct timespec start             = { 0 };
+    struct timespec end               = { 0 };
+    double          create_rate       = 0;
+    double          lookup_rate       = 0;
+    double          remove_rate       = 0;
+    uint64_t        state             = 0x9e3779b97f4a7c15ULL;
+
+    storage_layout = layout;
+    if ((-1 == mkdir(FILE_SERVER_DIR, 0755)) ||
+        ((LAYOUT_SHARDED == layout) && (-1 == layout_create_shards())))
+    {
+        fprintf(stderr, "%s could not create %s: %s\n", __func__, FILE_SERVER_DIR, strerror(errno));
+        return -1;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (size_t idx = 0; idx < num_files; idx++)
+    {
+        snprintf(p_name, sizeof(p_name), BENCH_NAME_FMT, idx);
+        layout_path(p_name, p_path, sizeof(p_path));
+        int file_fd = open(p_path, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+        if (-1 == file_fd)
+        {
+            fprintf(stderr, "%s could not create %s: %s\n", __func__, p_path, strerror(errno));
+            return -1;
+        }
+        close(file_fd);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    create_rate = num_files / elapsed(&start, &end);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (size_t idx = 0; idx < num_files; idx++)
+    {
+        // xorshift, a random order keeps the lookups from walking the
+        // directory blocks in creation order
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        snprintf(p_name, sizeof(p_name), BENCH_NAME_FMT, (size_t)(state % num_files));
+        if (-1 == layout_lstat(p_name, &file_stat))
+        {
+            fprintf(stderr, "%s could not find %s: %s\n", __func__, p_name, strerror(errno));
+            return -1;
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    lookup_rate = num_files / elapsed(&start, &end);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (size_t idx = 0; idx < num_files; idx++)
+    {
+        snprintf(p_name, sizeof(p_name), BENCH_NAME_FMT, idx);
+        layout_path(p_name, p_path, sizeof(p_path));
+        unlink(p_path);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    remove_rate = num_files / elapsed(&start, &end);
+
+    for (unsigned shard = 0; (LAYOUT_SHARDED == layout) && (shard < SHARD_COUNT); shard++)
+    {
+        layout_shard_dir(shard, p_path, sizeof(p_path));
+        rmdir(p_path);
+        p_path[strlen(FILE_SERVER_DIR) + 2] = '\0';
+        rmdir(p_path);
+    }
+    unlink(LAYOUT_MARKER);
+    rmdir(FILE_SERVER_DIR);
+
+    printf("%-10s %12zu %14.0f %14.0f %14.0f\n", (LAYOUT_SHARDED == layout) ? LAYOUT_NAME_SHARDED : LAYOUT_NAME_FLAT,
+           num_files, create_rate, lookup_rate, remove_rate);
+    return 0;
+}
+
+int main (int argc, char ** argv)
+{
+    char   p_scratch[] = "layout_bench.XXXXXX";
+    char   p_cwd[PATH_MAX] = { 0 };
+    size_t num_files   = (1 < argc) ? strtoull(argv[1], NULL, 10) : BENCH_DEFAULT_FILES;
+    int    ret_val     = 0;
+
+    if ((0 == num_files) || (NULL == getcwd(p_cwd, sizeof(p_cwd))) || (NULL == mkdtemp(p_scratch)) ||
+        (-1 == chdir(p_scratch)))
+    {
+        fprintf(stderr, "%s could not set up the scratch directory: %s\n", __func__, strerror(errno));
+        return EXIT_FAILURE;
+    }
+
+    printf("%-10s %12s %14s %14s %14s\n", "layout", "files", "creates/s", "lookups/s", "removes/s");
+    if ((-1 == run_layout(LAYOUT_FLAT, num_files)) || (-1 == run_layout(LAYOUT_SHARDED, num_files)))
+    {
+        fprintf(stderr, "%s left its files in %s/%s\n", __func__, p_cwd, p_scratch);
+        ret_val = -1;
+    }
+
+    if ((-1 == chdir(p_cwd)) || ((0 == ret_val) && (-1 == rmdir(p_scratch))))
+    {
+        ret_val = -1;
+    }
+    return (-1 == ret_val) ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+/*** end layout_bench.c ***/
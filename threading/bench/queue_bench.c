@@ -0,0 +1,151 @@
+#define _XOPEN_SOURCE 700
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+
+#include "../includes/my_queue.h"
+
+/*
+ * Contention microbenchmark for the fd queue. Runs N producers against N
+ * consumers for N = 1, 2, 4 ... and reports enqueue/dequeue throughput, once for
+ * the lock-free ring and once with the same ring serialized behind a mutex and
+ * condition variable the way the worker pool used to share it.
+ *
+ * usage: ./bin/queue_bench [MAX_THREADS] [OPS_PER_PRODUCER]
+ */
+
+#define BENCH_QUEUE_LEN 4096
+
+typedef struct bench_ctx
+{
+    queue           * p_queue;
+    bool              locked;
+    pthread_mutex_t   lock;
+    pthread_cond_t    condition;
+    size_t            ops;
+    _Atomic size_t    consumed;
+    size_t            total;
+} bench_ctx_t;
+
+static bool bench_enqueue (bench_ctx_t * p_ctx, int value)
+{
+    item q_item = { .data = value };
+
+    if (false == p_ctx->locked)
+    {
+        return enqueue(p_ctx->p_queue, q_item);
+    }
+
+    pthread_mutex_lock(&p_ctx->lock);
+    bool queued = enqueue(p_ctx->p_queue, q_item);
+    pthread_mutex_unlock(&p_ctx->lock);
+    pthread_cond_broadcast(&p_ctx->condition);
+    return queued;
+}
+
+static int bench_dequeue (bench_ctx_t * p_ctx)
+{
+    if (false == p_ctx->locked)
+    {
+        return dequeue(p_ctx->p_queue);
+    }
+
+    pthread_mutex_lock(&p_ctx->lock);
+    int value = dequeue(p_ctx->p_queue);
+    pthread_mutex_unlock(&p_ctx->lock);
+    return value;
+}
+
+static void * producer (void * p_arg)
+{
+    bench_ctx_t * p_ctx = p_arg;
+
+    for (size_t idx = 0; idx < p_ctx->ops; idx++)
+    {
+        while (false == bench_enqueue(p_ctx, (int)idx))
+        {
+            sched_yield();
+        }
+    }
+    return NULL;
+}
+
+static void * consumer (void * p_arg)
+{
+    bench_ctx_t * p_ctx = p_arg;
+
+    while (atomic_load(&p_ctx->consumed) < p_ctx->total)
+    {
+        if (-1 == bench_dequeue(p_ctx))
+        {
+            sched_yield();
+            continue;
+        }
+        atomic_fetch_add(&p_ctx->consumed, 1);
+    }
+    return NULL;
+}
+
+static double run_once (size_t num_threads, size_t ops, bool locked)
+{
+    bench_ctx_t ctx = { 0 };
+    ctx.p_queue = init_queue(BENCH_QUEUE_LEN);
+    ctx.locked  = locked;
+    ctx.ops     = ops;
+    ctx.total   = ops * num_threads;
+    atomic_init(&ctx.consumed, 0);
+    pthread_mutex_init(&ctx.lock, NULL);
+    pthread_cond_init(&ctx.condition, NULL);
+
+    pthread_t * p_threads = calloc(num_threads * 2, sizeof(pthread_t));
+    if ((NULL == ctx.p_queue) || (NULL == p_threads))
+    {
+        fprintf(stderr, "%s could not allocate benchmark state\n", __func__);
+        exit(EXIT_FAILURE);
+    }
+
+    struct timespec start;
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    for (size_t idx = 0; idx < num_threads; idx++)
+    {
+        pthread_create(&p_threads[idx], NULL, producer, &ctx);
+        pthread_create(&p_threads[num_threads + idx], NULL, consumer, &ctx);
+    }
+    for (size_t idx = 0; idx < num_threads * 2; idx++)
+    {
+        pthread_join(p_threads[idx], NULL);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double secs = (end.tv_sec - start.tv_sec) + ((end.tv_nsec - start.tv_nsec) / 1e9);
+
+    pthread_mutex_destroy(&ctx.lock);
+    pthread_cond_destroy(&ctx.condition);
+    CLEAN(p_threads);
+    CLEAN(ctx.p_queue);
+
+    return ctx.total / secs;
+}
+
+int main (int argc, char ** argv)
+{
+    size_t max_threads = (argc > 1) ? strtoul(argv[1], NULL, 10) : 8;
+    size_t ops         = (argc > 2) ? strtoul(argv[2], NULL, 10) : 1000000;
+
+    printf("%-10s %-10s %18s %18s\n", "producers", "consumers", "lock-free ops/s", "mutex ops/s");
+    for (size_t num_threads = 1; num_threads <= max_threads; num_threads *= 2)
+    {
+        double lock_free = run_once(num_threads, ops, false);
+        double locked    = run_once(num_threads, ops, true);
+        printf("%-10zu %-10zu %18.0f %18.0f\n", num_threads, num_threads, lock_free, locked);
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -5,6 +5,10 @@ import os
 import argparse
 import signal
 import struct
+import errno
+import hashlib
+import threading
+import time
 
 '''
 GLOBAL VARIABLE: FILE_LIST
@@ -14,6 +18,56 @@ GLOBAL VARIABLE: FILE_LIST
 '''
 file_list = []
 
+'''
+GLOBAL VARIABLES: PROTOCOL V2
+    BRIEF: constants for the framed protocol v2, every frame starts with a
+            little-endian header of u16 opcode, u16 flags, u32 request id and
+            u64 payload length
+    USAGE: used by the v2_* methods, see includes/protocol.h on the server
+'''
+V2_MAGIC = b"FSV2"
+V2_VERSION = 2
+V2_HELLO = struct.Struct("<4sHH")
+V2_HDR = struct.Struct("<HHIQ")
+V2_OP_LIST = 1
+V2_OP_DOWNLOAD = 2
+V2_OP_UPLOAD = 3
+V2_OP_BYE = 4
+V2_OP_DATA = 5
+V2_OP_WINDOW = 6
+V2_OP_DOWNLOAD_RANGE = 7
+V2_OP_UPLOAD_QUERY = 8
+V2_OP_UPLOAD_RESUME = 9
+V2_OP_SESSION_OPEN = 10
+V2_OP_SESSION_CHUNK = 11
+V2_OP_SESSION_COMMIT = 12
+V2_OP_LIST_DETAIL = 13
+V2_OP_LIST_PAGE = 14
+V2_OP_EXTENTS = 15
+V2_OP_UPLOAD_SPARSE = 16
+V2_FLAG_REPLY = 0x0001
+V2_FLAG_ERROR = 0x0002
+V2_FLAG_END = 0x0004
+V2_HELLO_MUX = 0x0001
+V2_MAX_FRAME = 128 * 1024
+V2_MUX_WINDOW = 1024 * 1024
+V2_CHUNK = 1024 * 1024
+V2_RANGE_HEAD = struct.Struct("<QQQ")
+V2_RANGE_TO_END = 0xFFFFFFFFFFFFFFFF
+V2_LIST_HEAD = struct.Struct("<II")
+V2_LIST_ENTRY = struct.Struct("<QQH")
+V2_LIST_PAGE_REQ = struct.Struct("<QI")
+V2_LIST_CURSOR = struct.Struct("<Q")
+V2_LIST_PAGE_SIZE = 1000
+V2_EXTENTS_HEAD = struct.Struct("<QQQI")
+V2_EXTENT = struct.Struct("<QQ")
+SPARSE_WINDOW = 64
+PARALLEL_MIN_RANGE = 8 * 1024 * 1024
+LEGACY_INT_MAX = 0x7fffffff
+LEGACY_SIZE64 = -2
+next_request_id = 0
+mux = False
+
 def socket_info():
     '''
     SOCKET_INFO:
@@ -24,10 +78,18 @@ def socket_info():
     parser = argparse.ArgumentParser()
     parser.add_argument("host")
     parser.add_argument("port", type=int)
+    parser.add_argument("--proto", type=int, choices=[1, 2], default=2,
+                        help="1 for the legacy protocol, 2 (default) for the framed pipelined protocol")
+    parser.add_argument("--mux", action="store_true",
+                        help="multiplex concurrent transfers over the connection (protocol 2 only)")
+    parser.add_argument("--streams", type=int, default=1,
+                        help="download and upload each large file as this many byte ranges over separate connections (protocol 2 only)")
+    parser.add_argument("--sparse", action="store_true",
+                        help="send only the data of sparse files and recreate their holes (protocol 2 only, not with --mux)")
     args = parser.parse_args()
     host = args.host
     port = args.port
-    return host, port
+    return host, port, args.proto, args.mux, max(1, args.streams), args.sparse
 
 def signal_handler(sig, frame):
     '''
@@ -38,6 +100,15 @@ def signal_handler(sig, frame):
                 sends exit command to server
         RETURN: None
     '''
+    if proto == 2:
+        try:
+            v2_send_request(V2_OP_BYE)
+        except OSError:
+            pass
+        print("\nCtrl+C caught and handled... Goodbye!")
+        cli_socket.close()
+        sys.exit(0)
+
     command = -1
     exit = struct.pack("i", command)
     sent = cli_socket.send(exit)
@@ -64,7 +135,7 @@ GLOBAL: CLI_SOCKET, SERVER_ADDR, PORT
             exits program on failure
 '''
 cli_socket = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
-server_addr, port = socket_info()
+server_addr, port, proto, want_mux, streams, sparse = socket_info()
 try:
     cli_socket.connect((server_addr, port))
     print(f"Connected to {server_addr}:{port}")
@@ -74,6 +145,305 @@ except OSError as msg:
     cli_socket = None
     exit()
 
+def recv_exact(length, sock=None):
+    '''
+    RECV_EXACT:
+        PARAMETER: LENGTH - number of bytes to receive
+        PARAMETER: SOCK - socket to read from, defaults to CLI_SOCKET
+        BRIEF: keeps calling recv until exactly LENGTH bytes have arrived
+        RETURN: the received bytes, raises RuntimeError if the server hangs up
+    '''
+    sock = sock or cli_socket
+    data = bytearray()
+    while len(data) < length:
+        chunk = sock.recv(length - len(data))
+        if not chunk:
+            raise RuntimeError("Socket connection broken: short read")
+        data += chunk
+    return bytes(data)
+
+def v2_hello(flags):
+    '''
+    V2_HELLO:
+        PARAMETER: FLAGS - V2_HELLO_* features to ask for
+        BRIEF: negotiates protocol v2, the server answers with its own hello
+                carrying the features it accepted
+        RETURN: the accepted flags, raises RuntimeError if the server does not
+                speak v2
+    '''
+    cli_socket.sendall(V2_HELLO.pack(V2_MAGIC, V2_VERSION, flags))
+    magic, version, accepted = V2_HELLO.unpack(recv_exact(V2_HELLO.size))
+    if magic != V2_MAGIC or version < V2_VERSION:
+        raise RuntimeError("Server does not support protocol v2")
+    return accepted
+
+def v2_send_request(opcode, payload=b"", payload_len=None):
+    '''
+    V2_SEND_REQUEST:
+        PARAMETER: OPCODE - one of the V2_OP_* values
+        PARAMETER: PAYLOAD - bytes sent right after the header
+        PARAMETER: PAYLOAD_LEN - total payload length when the caller streams
+                    more bytes after PAYLOAD (uploads), defaults to len(PAYLOAD)
+        BRIEF: sends one request frame without waiting for its reply, so
+                several requests can be pipelined
+        RETURN: the request id the reply will carry
+    '''
+    global next_request_id
+    next_request_id += 1
+    if payload_len is None:
+        payload_len = len(payload)
+    cli_socket.sendall(V2_HDR.pack(opcode, 0, next_request_id, payload_len) + payload)
+    return next_request_id
+
+def v2_recv_reply(request_id):
+    '''
+    V2_RECV_REPLY:
+        PARAMETER: REQUEST_ID - id of the request the next reply must answer
+        BRIEF: reads the next reply header, replies arrive in request order
+        RETURN: (payload length, error) where error is the errno reported by
+                the server or 0, the payload of a successful reply is left on
+                the socket for the caller
+    '''
+    _, flags, reply_id, payload_len = V2_HDR.unpack(recv_exact(V2_HDR.size))
+    if reply_id != request_id or not flags & V2_FLAG_REPLY:
+        raise RuntimeError(f"Unexpected reply {reply_id} for request {request_id}")
+    if flags & V2_FLAG_ERROR:
+        err, = struct.unpack("<I", recv_exact(payload_len))
+        return 0, err
+    return payload_len, 0
+
+def v2_recv_to_file(file_ptr, length):
+    '''
+    V2_RECV_TO_FILE:
+        PARAMETER: FILE_PTR - open binary file to write to
+        PARAMETER: LENGTH - exact number of payload bytes to store
+        BRIEF: streams a reply payload to disk without buffering it whole
+        RETURN: None
+    '''
+    bytes_left = length
+    while bytes_left > 0:
+        contents = cli_socket.recv(min(bytes_left, V2_CHUNK))
+        if not contents:
+            raise RuntimeError("Socket connection broken: download")
+        file_ptr.write(contents)
+        bytes_left -= len(contents)
+
+def resume_point(path):
+    '''
+    RESUME_POINT:
+        PARAMETER: PATH - final location of the download
+        BRIEF: looks for a partial download left by an interrupted transfer,
+                PATH.part holds the bytes received so far and PATH.part.info
+                the size and mtime of the server file they came from
+        RETURN: (offset, size, mtime_ns), (0, None, None) when there is
+                nothing to resume
+    '''
+    try:
+        with open(path + ".part.info") as info:
+            size, mtime_ns = (int(field) for field in info.read().split())
+        return os.path.getsize(path + ".part"), size, mtime_ns
+    except (OSError, ValueError):
+        return 0, None, None
+
+def range_request(name, offset):
+    '''
+    RANGE_REQUEST:
+        PARAMETER: NAME - file to download
+        PARAMETER: OFFSET - first byte wanted
+        BRIEF: sends a DOWNLOAD_RANGE request for everything from OFFSET on
+        RETURN: the request id
+    '''
+    payload = struct.pack("<QQ", offset, V2_RANGE_TO_END) + name.encode('utf-8')
+    return v2_send_request(V2_OP_DOWNLOAD_RANGE, payload)
+
+def start_part(path, offset, size, mtime_ns, resumed):
+    '''
+    START_PART:
+        PARAMETER: PATH - final location of the download
+        PARAMETER: OFFSET - offset the reply data starts at
+        PARAMETER: SIZE, MTIME_NS - the server file the data comes from
+        PARAMETER: RESUMED - (size, mtime_ns) recorded for the existing part
+        BRIEF: opens PATH.part positioned at OFFSET and records which server
+                file it belongs to before any data is written
+        RETURN: the open file, None if the existing part is for a different
+                version of the file and the download must start over
+    '''
+    if offset > 0 and resumed != (size, mtime_ns):
+        return None
+    with open(path + ".part.info", 'w') as info:
+        info.write(f"{size} {mtime_ns}\n")
+    file_ptr = open(path + ".part", 'r+b' if offset > 0 else 'wb')
+    file_ptr.seek(offset)
+    file_ptr.truncate()
+    return file_ptr
+
+def finish_part(path):
+    '''
+    FINISH_PART:
+        PARAMETER: PATH - final location of the download
+        BRIEF: publishes a completed download under its real name
+        RETURN: None
+    '''
+    os.replace(path + ".part", path)
+    os.remove(path + ".part.info")
+
+def mux_read_frame():
+    '''
+    MUX_READ_FRAME:
+        PARAMETER: None
+        BRIEF: reads the next frame of a multiplexed connection, payloads are
+                bounded by V2_MAX_FRAME so they are read whole
+        RETURN: (opcode, flags, request id, payload)
+    '''
+    opcode, flags, request_id, payload_len = V2_HDR.unpack(recv_exact(V2_HDR.size))
+    return opcode, flags, request_id, recv_exact(payload_len)
+
+def mux_grant(request_id, consumed):
+    '''
+    MUX_GRANT:
+        PARAMETER: REQUEST_ID - the stream to return credit to
+        PARAMETER: CONSUMED - reply bytes consumed since the last grant
+        BRIEF: gives the server more credit once half a window has been used
+        RETURN: the bytes still not granted back
+    '''
+    if consumed >= V2_MUX_WINDOW // 2:
+        cli_socket.sendall(V2_HDR.pack(V2_OP_WINDOW, 0, request_id, 4) + struct.pack("<I", consumed))
+        return 0
+    return consumed
+
+def mux_download(names):
+    '''
+    MUX_DOWNLOAD:
+        PARAMETER: NAMES - the files to download, stored under the same names
+        BRIEF: runs every download as its own stream, the server interleaves
+                their frames so small files finish without waiting on big ones.
+                Partial downloads are resumed where they stopped
+        RETURN: None
+    '''
+    streams = {}
+
+    def request(name, offset):
+        path = "../ClientDir/" + name
+        resumed = resume_point(path)[1:] if offset > 0 else (None, None)
+        streams[range_request(name, offset)] = {"name": name, "path": path, "offset": offset,
+                                                "resumed": resumed, "file": None, "head": b"",
+                                                "discard": False, "consumed": 0}
+
+    for name in names:
+        request(name, resume_point("../ClientDir/" + name)[0])
+
+    while streams:
+        opcode, flags, request_id, payload = mux_read_frame()
+        stream = streams.get(request_id)
+        if stream is None:
+            continue
+        if flags & V2_FLAG_ERROR:
+            err, = struct.unpack("<I", payload)
+            del streams[request_id]
+            if err == errno.ERANGE and stream["offset"] > 0:
+                print(f"{stream['name']} shrank on the server, starting over")
+                request(stream["name"], 0)
+            else:
+                print(f"Could not download {stream['name']}: {os.strerror(err)}")
+            continue
+
+        stream["consumed"] = mux_grant(request_id, stream["consumed"] + len(payload))
+        if stream["file"] is None and not stream["discard"]:
+            # the reply starts with the file size, mtime and range length
+            stream["head"] += payload
+            if len(stream["head"]) < V2_RANGE_HEAD.size:
+                continue
+            size, mtime_ns, length = V2_RANGE_HEAD.unpack_from(stream["head"])
+            payload = stream["head"][V2_RANGE_HEAD.size:]
+            stream["file"] = start_part(stream["path"], stream["offset"], size, mtime_ns, stream["resumed"])
+            if stream["file"] is None:
+                stream["discard"] = True
+            else:
+                print(f"Receiving {stream['name']} ({size} bytes, {stream['offset']} already here)")
+        if not stream["discard"]:
+            stream["file"].write(payload)
+
+        if flags & V2_FLAG_END:
+            del streams[request_id]
+            if stream["discard"]:
+                print(f"{stream['name']} changed on the server, starting over")
+                request(stream["name"], 0)
+                continue
+            received = stream["file"].tell() - stream["offset"]
+            stream["file"].close()
+            finish_part(stream["path"])
+            print(f"Total bytes downloaded for {stream['name']}: {received}")
+    print("DONE")
+
+def mux_upload(path, file, file_size, file_id, offset):
+    '''
+    MUX_UPLOAD:
+        PARAMETER: PATH - local file to send
+        PARAMETER: FILE - name to store it under on the server
+        PARAMETER: FILE_SIZE - size of the local file
+        PARAMETER: FILE_ID - upload id of the local file
+        PARAMETER: OFFSET - bytes the server already has
+        BRIEF: sends the rest of the file in DATA frames within the credit the
+                server grants as it stores the data
+        RETURN: the errno reported by the server, 0 on success
+    '''
+    name = file.encode('utf-8')
+    request_id = v2_send_request(V2_OP_UPLOAD_RESUME,
+                                 struct.pack("<QQQH", file_id, offset, file_size, len(name)) + name)
+    window = V2_MUX_WINDOW
+    sent = offset
+
+    with open(path, "rb") as file_ptr:
+        file_ptr.seek(offset)
+        while True:
+            while window > 0 and sent < file_size:
+                contents = file_ptr.read(min(V2_MAX_FRAME, window, file_size - sent))
+                flags = V2_FLAG_END if sent + len(contents) == file_size else 0
+                cli_socket.sendall(V2_HDR.pack(V2_OP_DATA, flags, request_id, len(contents)) + contents)
+                sent += len(contents)
+                window -= len(contents)
+
+            opcode, flags, reply_id, payload = mux_read_frame()
+            if reply_id != request_id:
+                continue
+            if opcode == V2_OP_WINDOW:
+                window += struct.unpack("<I", payload)[0]
+            elif flags & V2_FLAG_ERROR:
+                return struct.unpack("<I", payload)[0]
+            elif flags & V2_FLAG_END:
+                return 0
+
+def mux_list(payload):
+    '''
+    MUX_LIST:
+        PARAMETER: PAYLOAD - cursor, page size and filter of a LIST_PAGE request
+        BRIEF: collects the frames of a LIST_PAGE reply
+        RETURN: (payload, error)
+    '''
+    request_id = v2_send_request(V2_OP_LIST_PAGE, payload)
+    data = bytearray()
+    consumed = 0
+    while True:
+        opcode, flags, reply_id, payload = mux_read_frame()
+        if reply_id != request_id:
+            continue
+        if flags & V2_FLAG_ERROR:
+            return b"", struct.unpack("<I", payload)[0]
+        data += payload
+        consumed = mux_grant(request_id, consumed + len(payload))
+        if flags & V2_FLAG_END:
+            return bytes(data), 0
+
+if proto == 2:
+    try:
+        mux = bool(v2_hello(V2_HELLO_MUX if want_mux else 0) & V2_HELLO_MUX)
+        if want_mux and not mux:
+            print("Server declined multiplexing, transfers will run one at a time")
+    except (OSError, RuntimeError) as msg:
+        print(f"Could not negotiate protocol v2: {msg}")
+        cli_socket.close()
+        exit()
+
 def main_menu():
     '''
     MAIN_MENU:
@@ -127,7 +497,11 @@ def exit_server(menu_option):
         BRIEF: allows for a graceful client connection closure
         RETURN: None
     '''
-    if menu_option == 5:
+    if menu_option == 5 and proto == 2:
+        v2_send_request(V2_OP_BYE)
+        print("Thank you.... Goodbye!")
+        cli_socket.close()
+    elif menu_option == 5:
         command = 500
         exit = struct.pack("I", command)
         sent = cli_socket.send(exit)
@@ -149,7 +523,7 @@ def get_file_size():
         BRIEF: gets the size of the file to be used in the download_file method
         RETURN: FILE_SIZE - int value size of file to be downloaded
     '''
-    data = cli_socket.recv(8)
+    data = recv_exact(8)
     file_size = int.from_bytes(data, byteorder='big', signed=True)
     return file_size
 
@@ -196,16 +570,328 @@ def download_file():
                 file_ptr.seek(0)
 
             while bytes_left > 0:
-                contents = cli_socket.recv(1024)
-                if contents is None:
+                contents = cli_socket.recv(min(bytes_left, V2_CHUNK))
+                if not contents:
                     raise RuntimeError("Socket connection broken: download")
                 file_ptr.write(contents)
-                bytes_left -= 1024
+                bytes_left -= len(contents)
         print("Total bytes downloaded: {}".format(requested_file_sz))
         print("DONE")
     except OSError as file_err:
         print(f"Could not download file from server: {file_err}")
 
+def v2_connect():
+    '''
+    V2_CONNECT:
+        PARAMETER: None
+        BRIEF: opens an extra protocol v2 connection to the server, used for
+                the byte ranges of a parallel download
+        RETURN: the connected socket
+    '''
+    sock = socket.create_connection((server_addr, port))
+    sock.sendall(V2_HELLO.pack(V2_MAGIC, V2_VERSION, 0))
+    magic, version, _ = V2_HELLO.unpack(recv_exact(V2_HELLO.size, sock))
+    if magic != V2_MAGIC or version < V2_VERSION:
+        sock.close()
+        raise RuntimeError("Server does not support protocol v2")
+    return sock
+
+def range_reply(sock, name, offset, length):
+    '''
+    RANGE_REPLY:
+        PARAMETER: SOCK - a v2 connection with no request outstanding
+        PARAMETER: NAME - file to download
+        PARAMETER: OFFSET, LENGTH - the byte range wanted
+        BRIEF: requests a byte range and reads the reply up to its data
+        RETURN: (size, mtime_ns, length) of the range header, raises OSError
+                with the server's errno on an error reply
+    '''
+    payload = struct.pack("<QQ", offset, length) + name.encode('utf-8')
+    sock.sendall(V2_HDR.pack(V2_OP_DOWNLOAD_RANGE, 0, 1, len(payload)) + payload)
+    _, flags, _, payload_len = V2_HDR.unpack(recv_exact(V2_HDR.size, sock))
+    if flags & V2_FLAG_ERROR:
+        err, = struct.unpack("<I", recv_exact(payload_len, sock))
+        raise OSError(err, os.strerror(err))
+    return V2_RANGE_HEAD.unpack(recv_exact(V2_RANGE_HEAD.size, sock))
+
+def fetch_range(sock, name, offset, length, source, file_fd, failures):
+    '''
+    FETCH_RANGE:
+        PARAMETER: SOCK - the range's own connection
+        PARAMETER: NAME - file to download
+        PARAMETER: OFFSET, LENGTH - the byte range to fetch
+        PARAMETER: SOURCE - (size, mtime_ns) every range must come from
+        PARAMETER: FILE_FD - destination, written with positional writes
+        PARAMETER: FAILURES - list the error is appended to on failure
+        BRIEF: thread body of a parallel download, stores one byte range
+        RETURN: None
+    '''
+    try:
+        size, mtime_ns, sent = range_reply(sock, name, offset, length)
+        if (size, mtime_ns) != source or sent != length:
+            raise RuntimeError(f"{name} changed on the server during the download")
+
+        buffer = memoryview(bytearray(V2_CHUNK))
+        while length > 0:
+            received = sock.recv_into(buffer, min(length, V2_CHUNK))
+            if received == 0:
+                raise RuntimeError("Socket connection broken: download")
+            os.pwrite(file_fd, buffer[:received], offset)
+            offset += received
+            length -= received
+        sock.sendall(V2_HDR.pack(V2_OP_BYE, 0, 2, 0))
+    except (OSError, RuntimeError) as err:
+        failures.append(err)
+    finally:
+        sock.close()
+
+def parallel_download(name, path, streams):
+    '''
+    PARALLEL_DOWNLOAD:
+        PARAMETER: NAME - file to download
+        PARAMETER: PATH - where to store it
+        PARAMETER: STREAMS - number of connections to spread the file over
+        BRIEF: splits the file into byte ranges of at least PARALLEL_MIN_RANGE
+                bytes and fetches each over its own connection into a
+                preallocated file, so one TCP window no longer caps the
+                transfer. The server serves every range from its own worker
+        RETURN: None
+    '''
+    try:
+        probe = v2_connect()
+        size, mtime_ns, _ = range_reply(probe, name, 0, 0)
+    except (OSError, RuntimeError) as err:
+        print(f"Could not download {name}: {err}")
+        return None
+
+    chunk = max(PARALLEL_MIN_RANGE, -(-size // streams))
+    ranges = [(offset, min(chunk, size - offset)) for offset in range(0, size, chunk)]
+    print(f"The requested file is {size} bytes in length, fetching it over {max(1, len(ranges))} connection(s)")
+
+    file_fd = os.open(path + ".part", os.O_WRONLY | os.O_CREAT | os.O_TRUNC, 0o644)
+    try:
+        if size > 0:
+            os.posix_fallocate(file_fd, 0, size)
+    except OSError:
+        os.ftruncate(file_fd, size)
+
+    failures = []
+    workers = []
+    start = time.monotonic()
+    for idx, (offset, length) in enumerate(ranges):
+        try:
+            # the probe connection is reused for the first range
+            sock = probe if idx == 0 else v2_connect()
+        except (OSError, RuntimeError) as err:
+            failures.append(err)
+            break
+        worker = threading.Thread(target=fetch_range,
+                                  args=(sock, name, offset, length, (size, mtime_ns), file_fd, failures))
+        worker.start()
+        workers.append(worker)
+    if not ranges:
+        probe.close()
+    for worker in workers:
+        worker.join()
+    elapsed = time.monotonic() - start
+    os.close(file_fd)
+
+    if failures:
+        os.remove(path + ".part")
+        print(f"Could not download {name}: {failures[0]}")
+        return None
+    os.replace(path + ".part", path)
+    print("Total bytes downloaded: {} ({:.1f} MB/s)".format(size, size / max(elapsed, 1e-6) / 1e6))
+    print("DONE")
+
+def extent_map(name):
+    '''
+    EXTENT_MAP:
+        PARAMETER: NAME - file to map
+        BRIEF: asks the server for the data extents of the whole file, a page
+                of extents at a time
+        RETURN: (size, mtime_ns, [(offset, length), ...]), raises OSError with
+                the server's errno on an error reply
+    '''
+    extents = []
+    offset = 0
+    source = None
+    while True:
+        request_id = v2_send_request(V2_OP_EXTENTS, struct.pack("<QQ", offset, V2_RANGE_TO_END) + name.encode('utf-8'))
+        payload_len, err = v2_recv_reply(request_id)
+        if err != 0:
+            raise OSError(err, os.strerror(err))
+        size, mtime_ns, map_end, count = V2_EXTENTS_HEAD.unpack(recv_exact(V2_EXTENTS_HEAD.size))
+        records = recv_exact(count * V2_EXTENT.size)
+        if source is not None and source != (size, mtime_ns):
+            raise RuntimeError(f"{name} changed on the server during the download")
+        source = (size, mtime_ns)
+        extents += [V2_EXTENT.unpack_from(records, idx * V2_EXTENT.size) for idx in range(count)]
+        if map_end >= size:
+            return size, mtime_ns, extents
+        offset = map_end
+
+def sparse_download(name, path):
+    '''
+    SPARSE_DOWNLOAD:
+        PARAMETER: NAME - file to download
+        PARAMETER: PATH - where to store it
+        BRIEF: fetches only the data extents of the file with ranged
+                downloads, at most SPARSE_WINDOW of them in flight, and writes
+                each into place. The file is created at its full size, so
+                whatever no extent covers stays a hole
+        RETURN: None, False if the server cannot map extents
+    '''
+    try:
+        size, mtime_ns, extents = extent_map(name)
+    except OSError as err:
+        if err.errno == errno.ENOSYS:
+            return False
+        print(f"Could not download {name}: {err}")
+        return None
+    except RuntimeError as err:
+        print(f"Could not download {name}: {err}")
+        return None
+    data = sum(length for _, length in extents)
+    print(f"The requested file is {size} bytes in length, {data} bytes of data in {len(extents)} extent(s)")
+
+    # a partial download of the file is of no use to this one
+    if os.path.exists(path + ".part.info"):
+        os.remove(path + ".part.info")
+    try:
+        file_fd = os.open(path + ".part", os.O_WRONLY | os.O_CREAT | os.O_TRUNC, 0o644)
+        os.ftruncate(file_fd, size)
+    except OSError as err:
+        print(f"Could not store {name}: {err}")
+        return None
+
+    # a failed range stops new requests, the replies already asked for are
+    # still read to keep the connection in sync
+    failure = None
+    pending = list(extents)
+    in_flight = []
+    buffer = memoryview(bytearray(V2_CHUNK))
+    while pending or in_flight:
+        # bounded, so the requests never fill the socket while the server
+        # waits for the replies to be read
+        while pending and len(in_flight) < SPARSE_WINDOW:
+            offset, length = pending.pop(0)
+            payload = struct.pack("<QQ", offset, length) + name.encode('utf-8')
+            in_flight.append((offset, length, v2_send_request(V2_OP_DOWNLOAD_RANGE, payload)))
+        offset, length, request_id = in_flight.pop(0)
+        _, err = v2_recv_reply(request_id)
+        if err != 0:
+            failure = failure or OSError(err, os.strerror(err))
+            pending = []
+            continue
+        reply_size, reply_mtime_ns, sent = V2_RANGE_HEAD.unpack(recv_exact(V2_RANGE_HEAD.size))
+        if failure is None and (reply_size, reply_mtime_ns, sent) != (size, mtime_ns, length):
+            failure = RuntimeError(f"{name} changed on the server during the download")
+            pending = []
+        while sent > 0:
+            received = cli_socket.recv_into(buffer, min(sent, V2_CHUNK))
+            if received == 0:
+                raise RuntimeError("Socket connection broken: download")
+            if failure is None:
+                try:
+                    os.pwrite(file_fd, buffer[:received], offset)
+                except OSError as err:
+                    failure = err
+                    pending = []
+            offset += received
+            sent -= received
+    os.close(file_fd)
+
+    if failure is not None:
+        os.remove(path + ".part")
+        print(f"Could not download {name}: {failure}")
+        return None
+    os.replace(path + ".part", path)
+    print("Total bytes downloaded: {} of {}".format(data, size))
+    print("DONE")
+
+def download_files_v2():
+    '''
+    DOWNLOAD_FILES_V2:
+        PARAMETER: None
+        BRIEF: pipelines one ranged download request per requested file, then
+                stores the replies as they arrive. A single file can be stored
+                under a new name, several files keep their server names. A
+                download interrupted earlier resumes from the bytes already
+                on disk unless the server file changed since. With --streams
+                every file is fetched as parallel byte ranges instead, with
+                --sparse only the data extents of every file are fetched
+        RETURN: None
+    '''
+    choice = input("Type the name(s) of the file(s) you wish to download: ")
+    names = choice.split()
+    if not names:
+        return None
+    if mux and streams == 1:
+        print("You chose to download {} from the server".format(", ".join(names)))
+        mux_download(names)
+        return None
+
+    newfiles = names
+    if len(names) == 1:
+        newfiles = [input("Enter the name you wish to store your file as: ").rstrip()]
+    if sparse and not mux:
+        print("You chose to download {} from the server".format(", ".join(names)))
+        for name, newfile in zip(names, newfiles):
+            if sparse_download(name, "../ClientDir/" + newfile) is False:
+                print("Server does not support sparse downloads, downloading every byte")
+                break
+        else:
+            return None
+    if streams > 1:
+        print("You chose to download {} from the server".format(", ".join(names)))
+        for name, newfile in zip(names, newfiles):
+            parallel_download(name, "../ClientDir/" + newfile, streams)
+        return None
+
+    # every request goes out before the first reply is read
+    requests = []
+    for name, newfile in zip(names, newfiles):
+        path = "../ClientDir/" + newfile
+        offset = resume_point(path)[0]
+        requests.append((name, path, offset, range_request(name, offset)))
+    print("You chose to download {} from the server".format(", ".join(names)))
+
+    # a request that has to start over goes to the back of the pipeline
+    while requests:
+        name, path, offset, request_id = requests.pop(0)
+        payload_len, err = v2_recv_reply(request_id)
+        if err == errno.ERANGE and offset > 0:
+            print(f"{name} shrank on the server, starting over")
+            requests.append((name, path, 0, range_request(name, 0)))
+            continue
+        if err != 0:
+            print(f"Could not download {name}: {os.strerror(err)}")
+            continue
+
+        size, mtime_ns, length = V2_RANGE_HEAD.unpack(recv_exact(V2_RANGE_HEAD.size))
+        try:
+            file_ptr = start_part(path, offset, size, mtime_ns, resume_point(path)[1:])
+        except OSError as file_err:
+            # the payload still has to be drained to keep the connection in sync
+            print(f"Could not store {name}: {file_err}")
+            recv_exact(length)
+            continue
+        if file_ptr is None:
+            print(f"{name} changed on the server, starting over")
+            recv_exact(length)
+            requests.append((name, path, 0, range_request(name, 0)))
+            continue
+
+        if offset > 0:
+            print(f"Resuming {name} at byte {offset}")
+        print(f"The requested file is {size} bytes in length")
+        with file_ptr:
+            v2_recv_to_file(file_ptr, length)
+        finish_part(path)
+        print("Total bytes downloaded: {}".format(length))
+        print("DONE")
+
 def download_existing_file(menu_option):
     '''
     DOWNLOAD_EXISTING_FILE:
@@ -214,7 +900,9 @@ def download_existing_file(menu_option):
                 a file located on the server
         RETURN: None
     '''
-    if menu_option == 1:
+    if menu_option == 1 and proto == 2:
+        download_files_v2()
+    elif menu_option == 1:
         command = 200
         d_load = struct.pack("I", command)
         sent = cli_socket.send(d_load)
@@ -236,6 +924,288 @@ def download_existing_file(menu_option):
     else:
         raise RuntimeError("Invalid menu option received: download existing")
 
+def upload_id(path, file_size):
+    '''
+    UPLOAD_ID:
+        PARAMETER: PATH - local file to upload
+        PARAMETER: FILE_SIZE - size of the local file
+        BRIEF: derives the upload id from the file's path, size and mtime, so
+                sending the same file again resumes it while a modified file
+                starts over
+        RETURN: a non zero 64 bit id
+    '''
+    mtime_ns = os.stat(path).st_mtime_ns
+    key = f"{os.path.abspath(path)}:{file_size}:{mtime_ns}".encode('utf-8')
+    return struct.unpack_from("<Q", hashlib.sha1(key).digest())[0] or 1
+
+def upload_query(file, file_id, file_size):
+    '''
+    UPLOAD_QUERY:
+        PARAMETER: FILE - name the file is stored under on the server
+        PARAMETER: FILE_ID - upload id of the local file
+        PARAMETER: FILE_SIZE - size of the local file
+        BRIEF: asks the server how much of an earlier attempt it kept
+        RETURN: (offset to continue from, error)
+    '''
+    request_id = v2_send_request(V2_OP_UPLOAD_QUERY,
+                                 struct.pack("<QQ", file_id, file_size) + file.encode('utf-8'))
+    if mux:
+        data = b""
+        while True:
+            opcode, flags, reply_id, payload = mux_read_frame()
+            if reply_id != request_id:
+                continue
+            if flags & V2_FLAG_ERROR:
+                return 0, struct.unpack("<I", payload)[0]
+            data += payload
+            if flags & V2_FLAG_END:
+                return struct.unpack("<Q", data)[0], 0
+
+    payload_len, err = v2_recv_reply(request_id)
+    if err != 0:
+        return 0, err
+    return struct.unpack("<Q", recv_exact(payload_len))[0], 0
+
+def session_call(sock, opcode, payload, chunk=None):
+    '''
+    SESSION_CALL:
+        PARAMETER: SOCK - a plain v2 connection with no request outstanding
+        PARAMETER: OPCODE - one of the V2_OP_SESSION_* values
+        PARAMETER: PAYLOAD - the fields that lead the request
+        PARAMETER: CHUNK - (file object, offset, length) of the chunk a
+                    SESSION_CHUNK request carries after PAYLOAD
+        BRIEF: sends one upload session request and waits for its reply
+        RETURN: the reply payload, raises OSError with the server's errno on
+                an error reply
+    '''
+    length = chunk[2] if chunk else 0
+    sock.sendall(V2_HDR.pack(opcode, 0, 1, len(payload) + length) + payload)
+    if chunk:
+        sock.sendfile(chunk[0], chunk[1], length)
+    _, flags, _, payload_len = V2_HDR.unpack(recv_exact(V2_HDR.size, sock))
+    reply = recv_exact(payload_len, sock)
+    if flags & V2_FLAG_ERROR:
+        err, = struct.unpack("<I", reply)
+        raise OSError(err, os.strerror(err))
+    return reply
+
+def send_chunks(path, name, file_id, chunk_size, file_size, pending, failures):
+    '''
+    SEND_CHUNKS:
+        PARAMETER: PATH - local file to upload
+        PARAMETER: NAME - encoded name the file is stored under on the server
+        PARAMETER: FILE_ID - id of the upload session
+        PARAMETER: CHUNK_SIZE, FILE_SIZE - how the file is split
+        PARAMETER: PENDING - offsets of the chunks still to send, shared by
+                    every connection of the upload
+        PARAMETER: FAILURES - list the error is appended to on failure
+        BRIEF: thread body of a parallel upload, opens its own connection and
+                sends chunks until none are left
+        RETURN: None
+    '''
+    try:
+        sock = v2_connect()
+    except (OSError, RuntimeError) as err:
+        failures.append(err)
+        return None
+    try:
+        with open(path, "rb") as file_ptr:
+            while not failures:
+                try:
+                    # list.pop() is atomic, every chunk goes to one connection
+                    offset = pending.pop()
+                except IndexError:
+                    break
+                length = min(chunk_size, file_size - offset)
+                session_call(sock, V2_OP_SESSION_CHUNK,
+                             struct.pack("<QQH", file_id, offset, len(name)) + name,
+                             (file_ptr, offset, length))
+        sock.sendall(V2_HDR.pack(V2_OP_BYE, 0, 2, 0))
+    except (OSError, RuntimeError) as err:
+        failures.append(err)
+    finally:
+        sock.close()
+
+def parallel_upload(path, file, file_size, file_id, streams):
+    '''
+    PARALLEL_UPLOAD:
+        PARAMETER: PATH - local file to upload
+        PARAMETER: FILE - name to store it under on the server
+        PARAMETER: FILE_SIZE - size of the local file
+        PARAMETER: FILE_ID - upload id of the local file
+        PARAMETER: STREAMS - number of connections to spread the file over
+        BRIEF: opens an upload session, sends the chunks the server does not
+                hold yet over STREAMS connections in whatever order they
+                finish, then commits the session. An interrupted upload sent
+                again only sends the missing chunks
+        RETURN: 0 on success, otherwise the errno reported by the server
+    '''
+    name = file.encode('utf-8')
+    # a few chunks per connection keeps them all busy to the end, and a chunk
+    # lost to a dropped connection is cheap to send again
+    chunk_size = min(max(PARALLEL_MIN_RANGE, -(-file_size // (streams * 4))), 32 * PARALLEL_MIN_RANGE)
+    try:
+        control = v2_connect()
+    except (OSError, RuntimeError) as err:
+        print(f"Upload failed: {err}")
+        return errno.EIO
+
+    try:
+        bitmap = session_call(control, V2_OP_SESSION_OPEN,
+                              struct.pack("<QQQ", file_id, file_size, chunk_size) + name)
+        offsets = range(0, file_size, chunk_size)
+        pending = [offset for idx, offset in enumerate(offsets) if not (bitmap[idx // 8] >> (idx % 8)) & 1]
+        if len(pending) < len(offsets):
+            print(f"Resuming upload, {len(offsets) - len(pending)} of {len(offsets)} chunks already stored")
+        print(f"Sending {len(pending)} chunk(s) of {chunk_size} bytes over {min(streams, len(pending))} connection(s)")
+
+        # pop() takes from the end, send the file front to back
+        pending.reverse()
+        failures = []
+        start = time.monotonic()
+        workers = [threading.Thread(target=send_chunks,
+                                    args=(path, name, file_id, chunk_size, file_size, pending, failures))
+                   for _ in range(min(streams, len(pending)))]
+        for worker in workers:
+            worker.start()
+        for worker in workers:
+            worker.join()
+        if failures:
+            raise failures[0]
+        elapsed = time.monotonic() - start
+
+        session_call(control, V2_OP_SESSION_COMMIT, struct.pack("<QQ", file_id, file_size) + name)
+        control.sendall(V2_HDR.pack(V2_OP_BYE, 0, 2, 0))
+        print("Total bytes uploaded: {} ({:.1f} MB/s)".format(file_size, file_size / max(elapsed, 1e-6) / 1e6))
+    except OSError as err:
+        return err.errno or errno.EIO
+    except RuntimeError as err:
+        print(err)
+        return errno.EIO
+    finally:
+        control.close()
+    return 0
+
+def file_extents(file_ptr, file_size):
+    '''
+    FILE_EXTENTS:
+        PARAMETER: FILE_PTR - the open local file
+        PARAMETER: FILE_SIZE - size of the local file
+        BRIEF: maps the data of the file with SEEK_DATA / SEEK_HOLE, a system
+                or file system without them reports the whole file as data
+        RETURN: [(offset, length), ...] of the data extents in file order
+    '''
+    if not hasattr(os, "SEEK_DATA"):
+        return [(0, file_size)] if file_size > 0 else []
+    extents = []
+    offset = 0
+    fd = file_ptr.fileno()
+    while offset < file_size:
+        try:
+            data = os.lseek(fd, offset, os.SEEK_DATA)
+        except OSError as err:
+            if err.errno == errno.ENXIO:
+                break
+            extents.append((offset, file_size - offset))
+            break
+        if data >= file_size:
+            break
+        hole = min(os.lseek(fd, data, os.SEEK_HOLE), file_size)
+        extents.append((data, hole - data))
+        offset = hole
+    return extents
+
+def sparse_upload(path, file, file_size):
+    '''
+    SPARSE_UPLOAD:
+        PARAMETER: PATH - local file to upload
+        PARAMETER: FILE - name to store it under on the server
+        PARAMETER: FILE_SIZE - size of the local file
+        BRIEF: sends only the data extents of the file, each led by its
+                offset and length, the server stores the rest as holes.
+                Sparse uploads are never resumed
+        RETURN: 0 on success, otherwise the errno reported by the server
+    '''
+    name = file.encode('utf-8')
+    with open(path, "rb") as file_ptr:
+        extents = file_extents(file_ptr, file_size)
+        data = sum(length for _, length in extents)
+        print(f"Sending {data} of {file_size} bytes in {len(extents)} extent(s)")
+        payload_len = 10 + len(name) + len(extents) * V2_EXTENT.size + data
+        request_id = v2_send_request(V2_OP_UPLOAD_SPARSE, struct.pack("<QH", file_size, len(name)) + name,
+                                     payload_len=payload_len)
+        for offset, length in extents:
+            cli_socket.sendall(V2_EXTENT.pack(offset, length))
+            if length > 0 and cli_socket.sendfile(file_ptr, offset, length) != length:
+                raise RuntimeError("Socket connection broken: upload")
+    _, err = v2_recv_reply(request_id)
+    return err
+
+def upload_file_v2():
+    '''
+    UPLOAD_FILE_V2:
+        PARAMETER: None
+        BRIEF: sends a single framed upload request, the name and contents
+                travel in the payload so nothing is sent for an invalid file.
+                The server is asked first how much of the file it kept from an
+                interrupted attempt, only the rest is sent. With --streams a
+                large file is sent as chunks of an upload session instead,
+                with --sparse only the file's data extents are sent
+        RETURN: None
+    '''
+    user_in = input("Enter the directory location of your file: ").rstrip()
+    dir = "../" + user_in + "/"
+    if not os.path.isdir(dir):
+        print(f"{dir} is not a valid directory location...")
+        return None
+
+    file = input("Enter the file you wish to upload: hint - include extension\n").rstrip()
+    if is_client_file(dir, file) is not True:
+        print(f"file not found: {file} is not a valid file or directory...")
+        return None
+
+    path = dir + file
+    name = file.encode('utf-8')
+    file_size = os.path.getsize(path)
+    file_id = upload_id(path, file_size)
+    if sparse and not mux:
+        print("Sending {} to File Server".format(path))
+        err = sparse_upload(path, file, file_size)
+        if err != errno.ENOSYS:
+            print(f"Upload failed: {os.strerror(err)}" if err != 0 else "Upload Complete")
+            return None
+        print("Server does not support sparse uploads, sending every byte")
+    if streams > 1 and file_size > PARALLEL_MIN_RANGE:
+        print("Sending {} to File Server".format(path))
+        err = parallel_upload(path, file, file_size, file_id, streams)
+        if err != errno.EOPNOTSUPP:
+            print(f"Upload failed: {os.strerror(err)}" if err != 0 else "Upload Complete")
+            return None
+        # a server without upload sessions (e.g. -d ram) takes a single upload
+        print("Server does not support upload sessions, sending over one connection")
+
+    offset, err = upload_query(file, file_id, file_size)
+    if err != 0:
+        print(f"Upload failed: {os.strerror(err)}")
+        return None
+    if offset > 0:
+        print(f"Resuming upload at byte {offset}")
+
+    print("Sending {} to File Server".format(path))
+    if mux:
+        err = mux_upload(path, file, file_size, file_id, offset)
+    else:
+        with open(path, "rb") as file_ptr:
+            request_id = v2_send_request(V2_OP_UPLOAD_RESUME,
+                                         struct.pack("<QQH", file_id, offset, len(name)) + name,
+                                         payload_len=18 + len(name) + file_size - offset)
+            cli_socket.sendfile(file_ptr, offset, file_size - offset)
+        _, err = v2_recv_reply(request_id)
+    if err != 0:
+        print(f"Upload failed: {os.strerror(err)}")
+    else:
+        print("Upload Complete")
+
 def upload_file(menu_option):
     '''
     UPLOAD_FILE:
@@ -243,7 +1213,9 @@ def upload_file(menu_option):
         BRIEF: allows the client to specify a file to send to the server
         RETURN: None
     '''
-    if menu_option == 2:
+    if menu_option == 2 and proto == 2:
+        upload_file_v2()
+    elif menu_option == 2:
         command = 300
         upload = struct.pack("I", command)
         sent = cli_socket.send(upload)
@@ -274,7 +1246,11 @@ def upload_file(menu_option):
             if is_client_file(dir, file) is True:
                 path = dir + file
                 file_size = os.path.getsize(path)
-                size = struct.pack("I", file_size)
+                # sizes that do not fit a signed int go after the UPLOAD_SIZE64 marker
+                if file_size > LEGACY_INT_MAX:
+                    size = struct.pack("=iQ", LEGACY_SIZE64, file_size)
+                else:
+                    size = struct.pack("I", file_size)
                 sent = cli_socket.send(size)
 
                 if sent == 0:
@@ -297,12 +1273,9 @@ def upload_file(menu_option):
                 print("Sending {} to File Server".format(path))
 
                 with open(path, "br") as file_ptr:
-                    while totalsent < file_size:
-                        contents = file_ptr.read(1024)
-                        sent = cli_socket.send(contents)
-                        if sent == 0:
-                            raise RuntimeError("Socket connection broken: sending contents")
-                        totalsent += sent
+                    totalsent = cli_socket.sendfile(file_ptr, 0, file_size)
+                if totalsent < file_size:
+                    raise RuntimeError(f"{path} was truncated while it was being sent")
                 print("Upload Complete")
             else:
                 print(f"file not found: {file} is not a valid file or directory...")
@@ -324,22 +1297,92 @@ def recv_file_list():
     '''
     RECV_FILE_LIST:
         PARAMETER: None
-        BRIEF: receives file list from the server and prints them to the user
+        BRIEF: receives file list from the server and prints them to the user.
+                The legacy reply does not carry its length, so it is received
+                in large blocks and decoded as the entries complete
         RETURN: None
     '''
-    file_count = cli_socket.recv(4)
-    file_count = int.from_bytes(file_count, "little", signed=True)
-    received = 0
-    data = b''
-
-    while received < file_count:
-        file_len = cli_socket.recv(8)
-        file_len = int.from_bytes(file_len, "little", signed=True)
-        data = cli_socket.recv(file_len)
-        file_list.append(data.decode('utf-8'))
-        received += 1
+    data = bytearray(recv_exact(4))
+    file_count = int.from_bytes(data, "little", signed=True)
+    offset = 4
+
+    while len(file_list) < file_count:
+        if len(data) - offset >= 8:
+            file_len = int.from_bytes(data[offset:offset + 8], "little", signed=True)
+            if len(data) - offset >= 8 + file_len:
+                file_list.append(data[offset + 8:offset + 8 + file_len].decode('utf-8'))
+                offset += 8 + file_len
+                continue
+        chunk = cli_socket.recv(V2_CHUNK)
+        if not chunk:
+            raise RuntimeError("Socket connection broken: file list")
+        data += chunk
     print(file_list)
 
+def parse_file_list_detail(data):
+    '''
+    PARSE_FILE_LIST_DETAIL:
+        PARAMETER: DATA - a listing in the v2 LIST_DETAIL layout
+        BRIEF: decodes the fixed size records and the name table behind them,
+                and prints every file with its size and modification time
+        RETURN: the number of files printed
+    '''
+    file_count, names_len = V2_LIST_HEAD.unpack_from(data, 0)
+    records_end = V2_LIST_HEAD.size + file_count * V2_LIST_ENTRY.size
+    names = memoryview(data)[records_end:records_end + names_len]
+    offset = 0
+    rows = []
+    for size, mtime_ns, name_len in V2_LIST_ENTRY.iter_unpack(memoryview(data)[V2_LIST_HEAD.size:records_end]):
+        name = bytes(names[offset:offset + name_len]).decode('utf-8')
+        offset += name_len
+        file_list.append(name)
+        rows.append((name, size, time.strftime("%Y-%m-%d %H:%M", time.localtime(mtime_ns // 1000000000))))
+
+    width = max((len(row[0]) for row in rows), default=0)
+    for name, size, mtime in sorted(rows):
+        print(f"{name:<{width}}  {size:>14}  {mtime}")
+    return file_count
+
+def list_filter():
+    '''
+    LIST_FILTER:
+        PARAMETER: None
+        BRIEF: asks which files to list, a name without wildcards is taken as
+                a prefix
+        RETURN: the fnmatch pattern to send, empty to list every file
+    '''
+    pattern = input("Enter a prefix or a pattern such as *.txt, or press ENTER to list every file: ").strip()
+    if pattern and not any(char in pattern for char in "*?["):
+        pattern += "*"
+    return pattern
+
+def list_pages(pattern):
+    '''
+    LIST_PAGES:
+        PARAMETER: PATTERN - fnmatch pattern the names must match, may be empty
+        BRIEF: pages through the server directory with LIST_PAGE requests and
+                prints every page as it arrives, only one page is held at a time
+        RETURN: None
+    '''
+    cursor = 0
+    total = 0
+    while True:
+        payload = V2_LIST_PAGE_REQ.pack(cursor, V2_LIST_PAGE_SIZE) + pattern.encode('utf-8')
+        if mux:
+            data, err = mux_list(payload)
+        else:
+            request_id = v2_send_request(V2_OP_LIST_PAGE, payload)
+            list_len, err = v2_recv_reply(request_id)
+            data = recv_exact(list_len) if err == 0 else b""
+        if err != 0:
+            print(f"Could not list files: {os.strerror(err)}")
+            return
+        cursor, = V2_LIST_CURSOR.unpack_from(data, 0)
+        total += parse_file_list_detail(memoryview(data)[V2_LIST_CURSOR.size:])
+        if cursor == 0:
+            break
+    print(f"{total} file(s)")
+
 def get_file_list(menu_option):
     '''
     GET_FILE_LIST:
@@ -347,7 +1390,11 @@ def get_file_list(menu_option):
         BRIEF: sends command to the server to obtain list of current files
         RETURN: None
     '''
-    if menu_option == 3:
+    if menu_option == 3 and proto == 2:
+        pattern = list_filter()
+        print("Sent list directory command to server...")
+        list_pages(pattern)
+    elif menu_option == 3:
         request = 100
         list_dir = struct.pack("I", request)
         sent = cli_socket.send(list_dir)
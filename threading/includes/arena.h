@@ -0,0 +1,114 @@
+#ifndef __ARENA_H__
+#define __ARENA_H__
+
+#define _XOPEN_SOURCE 700
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <errno.h>
+
+#define ARENA_BLOCK_SZ  (32 * 1024)
+#define ARENA_ALIGN     16
+
+/*
+ * Every connection owns an arena that the memory built for one request comes
+ * from: listing replies, the scratch lists of a listing page and the bitmap of
+ * an upload session. Allocating is bumping an offset in the arena's block,
+ * and the whole arena is reset once the reply has been sent, so a stream of
+ * small requests never reaches malloc and never contends on its locks with
+ * the other workers. The first block (ARENA_BLOCK_SZ) is allocated on first
+ * use and kept across resets, larger replies get extra blocks that are freed
+ * again on reset.
+ *
+ * An arena is only ever used by the one thread running its connection.
+ */
+
+/**
+ * @brief - a block the arena hands memory out of
+ */
+typedef struct arena_block arena_block_t;
+
+/**
+ * @brief - the arena of one connection, all zero is an empty arena
+ * @member p_block - newest block, the oldest one is kept across resets
+ * @member p_last - the latest allocation, it can grow in place
+ * @member allocs - allocations since the last reset
+ * @member extra_blocks - blocks allocated past the first since the last reset
+ */
+typedef struct arena
+{
+    arena_block_t   * p_block;
+    char            * p_last;
+    uint32_t          allocs;
+    uint32_t          extra_blocks;
+} arena_t;
+
+/**
+ * @brief - what the arenas of all connections did, counted per request
+ * @member requests - requests that allocated from their arena
+ * @member allocations - allocations served by the arenas
+ * @member max_allocations - most allocations of a single request
+ * @member extra_blocks - blocks past the first taken from the heap
+ */
+typedef struct arena_stats
+{
+    uint64_t    requests;
+    uint64_t    allocations;
+    uint64_t    max_allocations;
+    uint64_t    extra_blocks;
+} arena_stats_t;
+
+/**
+ * VOID * ARENA_ALLOC:
+ * @brief - bumps size bytes, aligned to ARENA_ALIGN, out of the arena
+ * @param p_arena - the arena
+ * @param size - bytes wanted
+ * @return - the memory (not zeroed), NULL with errno set if a block could not
+ *           be allocated
+ */
+void * arena_alloc (arena_t * p_arena, size_t size);
+
+/**
+ * VOID * ARENA_GROW:
+ * @brief - the arena's realloc. The latest allocation grows in place while its
+ *          block has room, anything else is copied into a new allocation
+ * @param p_arena - the arena
+ * @param p_old - an allocation from the arena, NULL to allocate
+ * @param old_size - its size
+ * @param new_size - the size wanted
+ * @return - the grown allocation, NULL with errno set on error (p_old stays
+ *           valid)
+ */
+void * arena_grow (arena_t * p_arena, void * p_old, size_t old_size, size_t new_size);
+
+/**
+ * VOID ARENA_RESET:
+ * @brief - ends the request, everything allocated since the last reset is
+ *          gone. Keeps the first block and frees the others
+ * @param p_arena - the arena
+ * @return - N/A
+ */
+void arena_reset (arena_t * p_arena);
+
+/**
+ * VOID ARENA_RELEASE:
+ * @brief - frees every block, the arena is empty afterwards
+ * @param p_arena - the arena
+ * @return - N/A
+ */
+void arena_release (arena_t * p_arena);
+
+/**
+ * VOID ARENA_GET_STATS:
+ * @brief - reads the counters of all arenas
+ * @param p_stats - filled in with the current counters
+ * @return - N/A
+ */
+void arena_get_stats (arena_stats_t * p_stats);
+
+#endif
@@ -0,0 +1,102 @@
+#ifndef __BUFFER_POOL_H__
+#define __BUFFER_POOL_H__
+
+#define _XOPEN_SOURCE 700
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/mman.h>
+
+#include "my_queue.h"
+
+#define POOL_DEFAULT_MB     32
+#define POOL_MIN_MB         1
+#define POOL_MAX_MB         4096
+#define POOL_HUGE_PAGE_SZ   (2 * 1024 * 1024)
+
+/*
+ * Every buffer a transfer, a listing or the segment compactor reads into comes
+ * from one pool of fixed-size, page-aligned buffers, carved out of a single
+ * mapping whose size is the in-flight budget (-i). A buffer is held for one
+ * call at a time and handed back, so the memory the server spends on buffers
+ * never grows with the number of connections, workers or listeners. When all
+ * of them are in use the caller waits on the free list (a futex, see
+ * my_queue.h) until one comes back, which is never longer than one chunk of
+ * another transfer.
+ *
+ * With -H the mapping asks for explicit huge pages and falls back to
+ * transparent huge pages if none are reserved.
+ */
+
+/**
+ * @brief - the pool counters
+ * @member buffers / buffer_size - size of the pool
+ * @member in_use / peak_in_use - buffers handed out now and at most so far
+ * @member acquisitions - buffers handed out
+ * @member waits - acquisitions that found the pool empty and waited
+ * @member wait_ns / max_wait_ns - total and longest time spent waiting
+ * @member huge_pages - the pool is backed by explicit huge pages
+ */
+typedef struct buffer_pool_stats
+{
+    uint64_t    buffers;
+    uint64_t    buffer_size;
+    uint64_t    in_use;
+    uint64_t    peak_in_use;
+    uint64_t    acquisitions;
+    uint64_t    waits;
+    uint64_t    wait_ns;
+    uint64_t    max_wait_ns;
+    bool        huge_pages;
+} buffer_pool_stats_t;
+
+/**
+ * INT BUFFER_POOL_INIT:
+ * @brief - maps the pool and fills its free list
+ * @param buffer_size - size of every buffer, a multiple of the page size
+ * @param budget - bytes of buffers in the pool, at least one buffer
+ * @param huge_pages - back the pool with explicit huge pages if possible
+ * @return - 0 on success, -1 on error
+ */
+int buffer_pool_init (size_t buffer_size, uint64_t budget, bool huge_pages);
+
+/**
+ * VOID BUFFER_POOL_CLEANUP:
+ * @brief - wakes every waiter and unmaps the pool, nothing may hold a buffer
+ * @return - N/A
+ */
+void buffer_pool_cleanup ();
+
+/**
+ * CHAR * BUFFER_GET:
+ * @brief - takes a buffer from the pool, waiting for one if all are in use
+ * @return - the buffer, NULL with errno set if the pool is not set up or is
+ *           shutting down
+ */
+char * buffer_get ();
+
+/**
+ * VOID BUFFER_PUT:
+ * @brief - hands a buffer back to the pool and wakes a waiter
+ * @param p_buffer - a buffer from buffer_get, may be NULL
+ * @return - N/A
+ */
+void buffer_put (char * p_buffer);
+
+/**
+ * VOID BUFFER_POOL_GET_STATS:
+ * @brief - reads the pool counters
+ * @param p_stats - filled in with the current counters
+ * @return - N/A
+ */
+void buffer_pool_get_stats (buffer_pool_stats_t * p_stats);
+
+#endif
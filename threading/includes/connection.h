@@ -0,0 +1,264 @@
+#ifndef __CONNECTION_H__
+#define __CONNECTION_H__
+
+#define _XOPEN_SOURCE 700
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <dirent.h>
+#include <endian.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+
+#include "reactor.h"
+#include "transfer.h"
+#include "protocol.h"
+#include "upload_journal.h"
+#include "file_cache.h"
+#include "arena.h"
+
+#define CONN_IN_BUF_SZ  1024
+#define CONN_HDR_SZ     64
+#define JOB_BUDGET      (8 * 1024 * 1024)
+
+/**
+ * @brief - the wire protocol a client speaks, decided by its first bytes
+ */
+typedef enum proto_version
+{
+    PROTO_LEGACY = 1,
+    PROTO_V2     = 2
+} proto_version_t;
+
+/**
+ * @brief - where a connection is in the LIST/DOWNLOAD/UPLOAD/EXIT protocol
+ * @member CONN_READ_CMD - waiting for the 4 byte numerical command (or the v2
+ *                         hello)
+ * @member CONN_READ_MSG - waiting for the plaintext word that follows LIST,
+ *                         UPLOAD and EXIT
+ * @member CONN_READ_DL_NAME - waiting for the name of the file to download
+ * @member CONN_READ_UL_SIZE - waiting for the 4 byte upload size (12 bytes for
+ *                              UPLOAD_SIZE64)
+ * @member CONN_READ_UL_NAME_LEN - waiting for the 4 byte upload name length
+ * @member CONN_READ_UL_NAME - waiting for the upload file name
+ * @member CONN_READ_HELLO - waiting for the rest of the v2 hello
+ * @member CONN_V2_READ_HDR - waiting for the next v2 request header
+ * @member CONN_V2_READ_NAME - waiting for the whole payload of a v2 request
+ *                             that names a file (download, ranged download,
+ *                             extent map, upload query, session open and
+ *                             commit)
+ * @member CONN_V2_READ_UL_NAME - waiting for the name of a v2 upload, sparse
+ *                                upload or session chunk
+ * @member CONN_UL_DISCARD - throwing away the payload of a failed upload
+ * @member CONN_UL_DATA - streaming an upload to disk (for a sparse upload
+ *                        also reading the extent records)
+ * @member CONN_DL_DATA - streaming a download to the client
+ * @member CONN_MUX - multiplexed v2 connection, all further work is done by
+ *                    JOB_MUX on a worker
+ * @member CONN_WRITE_OUT - flushing p_out, then moving to next_state
+ * @member CONN_IN_JOB - owned by a worker thread
+ * @member CONN_CLOSE - the connection should be torn down
+ */
+typedef enum conn_state
+{
+    CONN_READ_CMD = 0,
+    CONN_READ_MSG,
+    CONN_READ_DL_NAME,
+    CONN_READ_UL_SIZE,
+    CONN_READ_UL_NAME_LEN,
+    CONN_READ_UL_NAME,
+    CONN_READ_HELLO,
+    CONN_V2_READ_HDR,
+    CONN_V2_READ_NAME,
+    CONN_V2_READ_UL_NAME,
+    CONN_UL_DISCARD,
+    CONN_UL_DATA,
+    CONN_DL_DATA,
+    CONN_MUX,
+    CONN_WRITE_OUT,
+    CONN_IN_JOB,
+    CONN_CLOSE
+} conn_state_t;
+
+/**
+ * @brief - the blocking disk work a connection can hand to the worker threads
+ */
+typedef enum job_type
+{
+    JOB_NONE = 0,
+    JOB_LIST,
+    JOB_OPEN_DOWNLOAD,
+    JOB_SEND_FILE,
+    JOB_OPEN_UPLOAD,
+    JOB_RECV_FILE,
+    JOB_UPLOAD_QUERY,
+    JOB_SESSION_OPEN,
+    JOB_SESSION_COMMIT,
+    JOB_MAP_EXTENTS,
+    JOB_MUX
+} job_type_t;
+
+struct mux;
+
+/**
+ * @brief - per client state, owned by the reactor except while a job is running
+ * @member sockfd - the non-blocking client socket
+ * @member p_reactor - the reactor the socket is registered with
+ * @member p_next_pending - link for the reactor's pending job list
+ * @member proto - the protocol negotiated by the client's first bytes
+ * @member state - current protocol state
+ * @member next_state - state to enter once p_out has been flushed
+ * @member command - the numerical command being served
+ * @member opcode / request_id / payload_len - the v2 request being served
+ * @member p_expected_msg - the plaintext word expected in CONN_READ_MSG
+ * @member io_wait - set when the last transfer job stopped because the socket
+ *                   would block, cleared when epoll reports it ready again
+ * @member job - the job to run (or running) on a worker thread
+ * @member in_buf / in_len - bytes received but not yet parsed
+ * @member hdr - inline storage for small replies
+ * @member hdr_len - length of a reply parked in hdr to be sent once a rejected
+ *                   payload has been discarded, 0 if there is none
+ * @member p_out / out_len / out_off - the reply being flushed
+ * @member out_owned - p_out lives in the arena, which is reset once it is
+ *                     flushed
+ * @member filename - name of the file being transferred
+ * @member name_len - upload name length announced by the client
+ * @member file_fd - file being transferred, -1 when idle
+ * @member p_fill - the cache copy being downloaded while it is still being
+ *                  filled in, NULL otherwise
+ * @member xfer_size / xfer_off - end of and progress through the transfer
+ * @member range_off / range_len - byte range asked for by a ranged download
+ * @member upload_id / upload_off - upload id and starting offset of a resumed
+ *                                 upload or session chunk (or the id of an
+ *                                 upload query or session request)
+ * @member chunk_size - chunk size asked for by a session open
+ * @member chunk_off - where the session chunk being received starts
+ * @member sparse_size - size of the file a sparse upload stores
+ * @member extent_end - end of the last extent of a sparse upload, the next
+ *                      one may not start before it
+ * @member file_base - where the file of a sparse upload starts in file_fd
+ * @member upload - journal of the upload being received
+ * @member p_session - session the chunk being received belongs to, NULL for
+ *                     any other upload
+ * @member splice_fell_back - splice was not supported for this upload
+ * @member p_mux - stream table of a multiplexed connection, NULL otherwise
+ * @member arena - memory of the request being served, see arena.h
+ */
+typedef struct conn
+{
+    int                sockfd;
+    reactor_t        * p_reactor;
+    struct conn      * p_next_pending;
+    proto_version_t    proto;
+    conn_state_t       state;
+    conn_state_t       next_state;
+    int                command;
+    uint16_t           opcode;
+    uint32_t           request_id;
+    uint64_t           payload_len;
+    const char       * p_expected_msg;
+    bool               io_wait;
+    job_type_t         job;
+    char               in_buf[CONN_IN_BUF_SZ];
+    size_t             in_len;
+    char               hdr[CONN_HDR_SZ];
+    size_t             hdr_len;
+    char             * p_out;
+    size_t             out_len;
+    size_t             out_off;
+    bool               out_owned;
+    char               filename[MAXNAMLEN + 1];
+    uint32_t           name_len;
+    int                file_fd;
+    cache_fill_t     * p_fill;
+    uint64_t           xfer_size;
+    off_t              xfer_off;
+    uint64_t           range_off;
+    uint64_t           range_len;
+    uint64_t           upload_id;
+    uint64_t           upload_off;
+    uint64_t           chunk_size;
+    uint64_t           chunk_off;
+    uint64_t           sparse_size;
+    uint64_t           extent_end;
+    uint64_t           file_base;
+    upload_t           upload;
+    upload_session_t * p_session;
+    bool               splice_fell_back;
+    struct mux       * p_mux;
+    arena_t            arena;
+} conn_t;
+
+/**
+ * CONN_T * CONN_CREATE:
+ * @brief - allocates the state for a newly accepted client socket
+ * @param p_reactor - the reactor that owns the socket
+ * @param sockfd - client socket file descriptor
+ * @return - pointer to the connection, NULL on failure
+ */
+conn_t * conn_create (reactor_t * p_reactor, int sockfd);
+
+/**
+ * VOID CONN_DESTROY:
+ * @brief - releases any file and reply buffer held by the connection and frees
+ *          it, the socket itself is closed by the reactor
+ * @param p_conn - the connection
+ * @return - N/A
+ */
+void conn_destroy (conn_t * p_conn);
+
+/**
+ * VOID CONN_HANDLE_EVENT:
+ * @brief - called by the reactor when epoll reports the socket ready, advances
+ *          the protocol state machine as far as it can without blocking
+ * @param p_conn - the connection
+ * @param events - the epoll events reported
+ * @return - N/A
+ */
+void conn_handle_event (conn_t * p_conn, uint32_t events);
+
+/**
+ * VOID CONN_JOB_DONE:
+ * @brief - called by the reactor once a worker has finished the connection's
+ *          job, resumes the state machine
+ * @param p_conn - the connection
+ * @return - N/A
+ */
+void conn_job_done (conn_t * p_conn);
+
+/**
+ * VOID CONN_CONSUME_INPUT:
+ * @brief - drops len parsed bytes from the front of the input buffer
+ * @param p_conn - the connection
+ * @param len - number of bytes to drop, at most in_len
+ * @return - N/A
+ */
+void conn_consume_input (conn_t * p_conn, size_t len);
+
+/**
+ * INT CONN_FILL_INPUT:
+ * @brief - reads whatever the socket has into the free space of the input buffer
+ * @param p_conn - the connection
+ * @return - 1 if bytes were read, 0 if the socket would block, -1 if the client
+ *           hung up or the buffer is full without a complete message
+ */
+int conn_fill_input (conn_t * p_conn);
+
+/**
+ * VOID RUN_JOB:
+ * @brief - runs a connection's blocking disk job, only called from the worker
+ *          threads. The job leaves the connection in the state the reactor
+ *          should resume from
+ * @param p_conn - the connection
+ * @return - N/A
+ */
+void run_job (conn_t * p_conn);
+
+#endif
@@ -0,0 +1,181 @@
+#ifndef __FILE_CACHE_H__
+#define __FILE_CACHE_H__
+
+#define _XOPEN_SOURCE 700
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+
+#include "file_index.h"
+
+#define CACHE_MAX_MB            (64 * 1024)
+#define CACHE_MAX_ENTRIES       1024
+#define CACHE_STRIPES           64
+#define CACHE_STRIPE_BUCKETS    32
+#define CACHE_SMALL_PCT         10
+#define CACHE_OBJECT_DIV        8
+#define CACHE_FREQ_MAX          3
+#define CACHE_FILL_CHUNK        (1024 * 1024)
+
+/*
+ * The hot-file cache keeps whole copies of frequently downloaded files in
+ * memfds, up to a byte budget set with -c. Downloads already go through
+ * sendfile and the page cache, but the page cache is a plain LRU: one client
+ * reading every large file once pushes the few hundred files that take most
+ * of the downloads out of memory. The cache holds on to those, and a hit
+ * skips the path lookup and the open as well.
+ *
+ * Eviction follows S3-FIFO. A new file goes into a small FIFO (about
+ * CACHE_SMALL_PCT of the budget). When it reaches the end of it, it moves on
+ * to the main FIFO if it was read again in the meantime, otherwise it is
+ * dropped and its name is remembered in a ghost FIFO. A file that comes back
+ * while its name is still a ghost goes straight to the main FIFO. The main
+ * FIFO gives every file that was read since its last pass another round
+ * (CLOCK), so a one-off scan only ever churns the small FIFO.
+ *
+ * Lookups only take the read lock of one of CACHE_STRIPES stripes of the
+ * table and bump the file's counter atomically, so concurrent readers never
+ * wait on each other. Inserting and evicting take the queue lock, then the
+ * write lock of the stripe they change. An entry only matches while its size,
+ * modification time and inode match the index, and the index drops it as soon
+ * as it sees the file change, so a replaced file is never served from the
+ * cache.
+ *
+ * A file is copied in as it is downloaded, not up front. The download that
+ * missed puts an empty copy in the cache and every download of the file from
+ * then on reads that copy, so when many clients ask for the same file at once
+ * the disk is read only once. A download that has sent everything copied so
+ * far copies the next CACHE_FILL_CHUNK bytes itself (or waits for the chunk
+ * being copied), one that is behind sends what is there at its own pace, so a
+ * slow client never holds up the others.
+ *
+ * Every entry holds a descriptor (three while it is being copied), the cache
+ * never keeps more than CACHE_MAX_ENTRIES files, and no file larger than
+ * 1/CACHE_OBJECT_DIV of the budget.
+ */
+
+/**
+ * @brief - a copy that is still being filled in, see file_cache.c
+ */
+typedef struct cache_fill cache_fill_t;
+
+/**
+ * @brief - the cache counters
+ * @member hits / misses - lookups answered from the cache or not
+ * @member inserts - files copied into the cache
+ * @member evictions - files dropped to make room
+ * @member invalidations - files dropped because they changed
+ * @member coalesced - downloads that read a copy still being filled in
+ *                     instead of the file
+ * @member entries / bytes - what the cache holds now
+ * @member budget - the byte budget, 0 when the cache is off
+ */
+typedef struct file_cache_stats
+{
+    uint64_t    hits;
+    uint64_t    misses;
+    uint64_t    inserts;
+    uint64_t    evictions;
+    uint64_t    invalidations;
+    uint64_t    coalesced;
+    uint64_t    entries;
+    uint64_t    bytes;
+    uint64_t    budget;
+} file_cache_stats_t;
+
+/**
+ * INT FILE_CACHE_INIT:
+ * @brief - sets the cache up, it stays off with a budget of 0
+ * @param budget - the most bytes of file data the cache holds
+ * @return - 0 on success, -1 on error
+ */
+int file_cache_init (uint64_t budget);
+
+/**
+ * VOID FILE_CACHE_CLEANUP:
+ * @brief - drops every cached file, descriptors already handed out stay valid
+ * @return - N/A
+ */
+void file_cache_cleanup ();
+
+/**
+ * INT FILE_CACHE_OPEN:
+ * @brief - looks up the cached copy of a file
+ * @param p_filename - the file name
+ * @param p_info - what the index knows about the file, the copy must match
+ *                 its size, modification time and inode
+ * @param pp_fill - set to the copy while it is still being filled in, NULL
+ *                  otherwise. Pass it to file_cache_ready before every send
+ *                  and to file_cache_release once done
+ * @return - a new descriptor holding the file from offset 0, -1 on a miss
+ */
+int file_cache_open (const char * p_filename, const file_info_t * p_info, cache_fill_t ** pp_fill);
+
+/**
+ * INT FILE_CACHE_FILL:
+ * @brief - puts a file that missed into the cache if it fits, evicting older
+ *          files to make room. Its copy is filled in by the downloads reading
+ *          it. If a concurrent download already cached the file, that copy is
+ *          returned instead
+ * @param p_filename - the file name
+ * @param p_info - size, modification time and inode of the opened file
+ * @param file_fd - descriptor holding the file, the cache keeps its own
+ * @param base - where the file starts in file_fd
+ * @param pp_fill - as for file_cache_open
+ * @return - a new descriptor holding the copy from offset 0, -1 if the file
+ *           is not cached (the cache is off or the file is too large) and
+ *           file_fd has to be read instead
+ */
+int file_cache_fill (const char * p_filename, const file_info_t * p_info, int file_fd, uint64_t base,
+                     cache_fill_t ** pp_fill);
+
+/**
+ * SSIZE_T FILE_CACHE_READY:
+ * @brief - how many bytes of a copy can be sent from offset on, copies the
+ *          next chunk first if none are there yet
+ * @param p_fill - the copy, NULL for a complete copy or any other file
+ * @param offset - offset in the file of the next byte to send
+ * @param count - bytes the caller wants to send
+ * @return - count or fewer bytes (at least one), -1 with errno set if the
+ *           file could not be read
+ */
+ssize_t file_cache_ready (cache_fill_t * p_fill, uint64_t offset, size_t count);
+
+/**
+ * VOID FILE_CACHE_RELEASE:
+ * @brief - drops a reference handed out by file_cache_open or file_cache_fill
+ * @param p_fill - the copy, may be NULL
+ * @return - N/A
+ */
+void file_cache_release (cache_fill_t * p_fill);
+
+/**
+ * VOID FILE_CACHE_INVALIDATE:
+ * @brief - drops the cached copy of a file that changed or was removed
+ * @param p_filename - the file name
+ * @param p_info - what the file is now, a copy that still matches it is kept.
+ *                 NULL if the file was removed
+ * @return - N/A
+ */
+void file_cache_invalidate (const char * p_filename, const file_info_t * p_info);
+
+/**
+ * VOID FILE_CACHE_GET_STATS:
+ * @brief - reads the cache counters
+ * @param p_stats - filled in with the current counters
+ * @return - N/A
+ */
+void file_cache_get_stats (file_cache_stats_t * p_stats);
+
+#endif
@@ -0,0 +1,112 @@
+#ifndef __FILE_INDEX_H__
+#define __FILE_INDEX_H__
+
+#define _XOPEN_SOURCE 700
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/stat.h>
+#include <sys/inotify.h>
+#include <sys/eventfd.h>
+
+#define INDEX_MIN_BUCKETS   1024
+#define INDEX_EVENT_BUF_SZ  (64 * 1024)
+
+/*
+ * The served directory is indexed in memory once at startup: every regular
+ * file with its size, modification time and inode. LIST, existence checks and
+ * size lookups read the index instead of the filesystem. A watcher thread
+ * keeps it current from inotify events, and rescans the directory if the
+ * kernel reports that events were lost. The server updates the index itself
+ * when it publishes an upload, so its own uploads are visible immediately.
+ * Files packed into segments are indexed along with the stored ones.
+ *
+ * Readers share a read-mostly rwlock that prefers the writer, so a steady
+ * stream of listings cannot starve the watcher.
+ */
+
+/**
+ * @brief - what the index knows about one file
+ * @member p_name / name_len - the file name, not NUL terminated in listings
+ * @member size - file size in bytes
+ * @member mtime_ns - modification time in nanoseconds since the epoch
+ * @member ino - inode number, 0 for a packed file
+ * @member packed - the file is stored in a segment, see segment_store.h
+ */
+typedef struct file_info
+{
+    const char    * p_name;
+    uint16_t        name_len;
+    uint64_t        size;
+    uint64_t        mtime_ns;
+    uint64_t        ino;
+    bool            packed;
+} file_info_t;
+
+/**
+ * INT (*FILE_INDEX_VISIT_T):
+ * @brief - called by file_index_walk for every indexed file, with the index
+ *          locked for reading
+ * @param p_info - the file, only valid during the call
+ * @param p_arg - the caller's argument
+ * @return - 0 to continue, -1 to stop the walk
+ */
+typedef int (*file_index_visit_t) (const file_info_t * p_info, void * p_arg);
+
+/**
+ * INT FILE_INDEX_INIT:
+ * @brief - starts watching the file server directory, indexes its contents
+ *          and starts the watcher thread
+ * @return - 0 on success, -1 on error
+ */
+int file_index_init ();
+
+/**
+ * VOID FILE_INDEX_CLEANUP:
+ * @brief - stops the watcher thread and frees the index
+ * @return - N/A
+ */
+void file_index_cleanup ();
+
+/**
+ * BOOL FILE_INDEX_LOOKUP:
+ * @brief - looks a file up by name without touching the filesystem
+ * @param p_filename - the file name
+ * @param p_info - filled in if the file is indexed, may be NULL. p_name is
+ *                 set to p_filename
+ * @return - true if the file is indexed, false otherwise
+ */
+bool file_index_lookup (const char * p_filename, file_info_t * p_info);
+
+/**
+ * VOID FILE_INDEX_REFRESH:
+ * @brief - stats one name in the file server directory and adds, updates or
+ *          drops its entry to match
+ * @param p_filename - the file name
+ * @return - N/A
+ */
+void file_index_refresh (const char * p_filename);
+
+/**
+ * INT FILE_INDEX_WALK:
+ * @brief - calls p_visit for every indexed file, in no particular order
+ * @param p_visit - the callback
+ * @param p_arg - passed to the callback
+ * @param p_count - set before the first callback to the number of files the
+ *                  walk will visit, may be NULL
+ * @return - 0 once every file was visited, -1 if the callback stopped the walk
+ */
+int file_index_walk (file_index_visit_t p_visit, void * p_arg, size_t * p_count);
+
+#endif
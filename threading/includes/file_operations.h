@@ -13,53 +13,147 @@
 #include <string.h>
 #include <errno.h>
 #include <dirent.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <endian.h>
+#include <fnmatch.h>
+#include <sys/stat.h>
 #include <sys/socket.h>
 
 #include "global_data.h"
+#include "transfer.h"
+#include "file_cache.h"
+#include "arena.h"
 
 #define MAX_STR_LEN     255
+#define LIST_BUF_SZ     4096
+#define LIST_SCAN_MAX   65536
+#define FILE_SERVER_DIR "FileServer/"
+
+/*
+ * Everything in here is blocking disk work. These functions are only ever
+ * called from the worker threads, never from the reactor. They serialize and
+ * validate, the files themselves are found through the storage backend in
+ * storage_backend.h.
+ */
 
 /**
- * INT GET_FILE_COUNT:
- * @brief - determines the number of files located within the file server
- * @param sockfd - client socket file descriptor
- * @return - (int) number of DT_REG files in FileServer directory, -1 on error
+ * @brief - a buffer being filled in a request's arena, e.g. a listing during a
+ *          walk
+ * @member p_arena - the arena the buffer grows in
+ * @member p_list / list_len / list_cap - the growing buffer
+ * @member file_count - entries appended so far
  */
-int get_file_count (int sockfd);
+typedef struct list_ctx
+{
+    arena_t   * p_arena;
+    char      * p_list;
+    size_t      list_len;
+    size_t      list_cap;
+    uint32_t    file_count;
+} list_ctx_t;
 
 /**
- * VOID LIST_DIR:
- * @brief - creates a list of DT_REG files to send to client (similar to basic ls cmd)
- * @param sockfd - client socket file descriptor
- * @return - N/A
+ * INT LIST_APPEND:
+ * @brief - appends len bytes to a list buffer, doubling its capacity (starting
+ *          at LIST_BUF_SZ) as needed
+ * @param p_ctx - the buffer
+ * @param p_data - the bytes to append
+ * @param len - how many
+ * @return - 0 on success, -1 if the buffer could not grow
  */
-void list_dir(int sockfd);
+int list_append (list_ctx_t * p_ctx, const void * p_data, size_t len);
 
 /**
- * BOOL IS_FILE:
- * @brief - determine whether passed file exists within the directory
- * @param p_filename - name of file for validity check
- * @return - true/false value whether file exists
+ * CHAR * LIST_DIR:
+ * @brief - serializes the files of the storage backend into a single buffer
+ *          (similar to basic ls cmd). The buffer holds an int file count
+ *          followed by a size_t name length and the name for every file
+ * @param p_arena - arena of the request, the buffer lives until it is reset
+ * @param p_len - set to the length of the returned buffer
+ * @return - (char *) the buffer, NULL on error
+ */
+char * list_dir (arena_t * p_arena, size_t * p_len);
+
+/**
+ * CHAR * LIST_DIR_V2:
+ * @brief - same listing as list_dir, serialized for protocol v2: a little-endian
+ *          u32 file count followed by a u16 name length and the name per file
+ * @param p_arena - arena of the request, the buffer lives until it is reset
+ * @param reserve - number of bytes to leave free at the front of the buffer for
+ *                  the caller's frame header
+ * @param p_len - set to the length of the returned buffer, including reserve
+ * @return - (char *) the buffer, NULL on error
+ */
+char * list_dir_v2 (arena_t * p_arena, size_t reserve, size_t * p_len);
+
+/**
+ * CHAR * LIST_DIR_DETAIL:
+ * @brief - serializes the backend's files for a V2_OP_LIST_DETAIL reply: the
+ *          file count, the length of the name table, a fixed size record with
+ *          the size, mtime and name length of every file, then the name table
+ * @param p_arena - arena of the request, the buffer lives until it is reset
+ * @param reserve - number of bytes to leave free at the front of the buffer for
+ *                  the caller's frame header
+ * @param p_len - set to the length of the returned buffer, including reserve
+ * @return - (char *) the buffer, NULL on error
+ */
+char * list_dir_detail (arena_t * p_arena, size_t reserve, size_t * p_len);
+
+/**
+ * CHAR * LIST_DIR_PAGE:
+ * @brief - serializes one page of a V2_OP_LIST_PAGE reply: the cursor of the
+ *          next page, then the files in the V2_OP_LIST_DETAIL layout. What the
+ *          cursor means is up to the backend, a sparse filter can return a
+ *          short page
+ * @param p_arena - arena of the request, the buffer and the backend's scratch
+ *                  memory live until it is reset
+ * @param reserve - number of bytes to leave free at the front of the buffer for
+ *                  the caller's frame header
+ * @param cursor - where to continue, 0 for the start of the directory
+ * @param page_size - most files to return, 0 for V2_LIST_PAGE_DEFAULT
+ * @param p_pattern - fnmatch() pattern the names must match, "" for every file
+ * @param p_len - set to the length of the returned buffer, including reserve
+ * @return - (char *) the buffer, NULL on error
+ */
+char * list_dir_page (arena_t * p_arena, size_t reserve, uint64_t cursor, uint32_t page_size, const char * p_pattern,
+                      size_t * p_len);
+
+/**
+ * BOOL IS_VALID_FILENAME:
+ * @brief - rejects names that would escape the file server directory
+ * @param p_filename - name of file received from the client
+ * @return - true if the name is a plain file name, false otherwise
  */
-bool is_file(char * p_filename);
+bool is_valid_filename (const char * p_filename);
 
 /**
- * VOID DOWNLOAD_FILE:
- * @brief - function that sents file (in bytes) to client for transfer
- * @param p_file_passed - file within server to be sent to client
- * @param sockfd - client socket file descriptor
- * @return - N/A
+ * BOOL IS_FILE:
+ * @brief - determine whether passed file exists within the directory, answered
+ *          by the storage backend
+ * @param p_filename - name of file for validity check
+ * @return - true/false value whether file exists
  */
-void download_file(char * p_file_passed, int sockfd);
+bool is_file (char * p_filename);
 
 /**
- * VOID UPLOAD_FILE:
- * @brief - received file (in bytes) to be transfered to server from client
- * @param p_file_passed - file name received from client for upload
- * @param file_size - size of file to be uploaded
- * @param sockfd - client socket file descriptor
- * @return - N/A
+ * INT OPEN_DOWNLOAD_FILE:
+ * @brief - opens a file within the server to be sent to the client, the file
+ *          is then streamed with sendfile() so memory use stays flat regardless
+ *          of file size. A packed file is served from its segment, a file
+ *          of the ram backend from memory
+ * @param p_filename - file within server to be sent to client
+ * @param p_size - set to the size of the file
+ * @param p_mtime_ns - set to the modification time of the file in nanoseconds
+ *                     since the epoch, may be NULL
+ * @param p_base - set to where the file starts in the descriptor, 0 unless
+ *                 the file is packed
+ * @param pp_fill - set when the descriptor is a hot-file cache copy that is
+ *                  still being filled in, NULL otherwise. Every send has to
+ *                  go through file_cache_ready, file_cache_release drops it
+ * @return - (int) file descriptor on success, -1 on error
  */
-void upload_file(char * p_file_passed, int file_size, int sockfd);
+int open_download_file (const char * p_filename, uint64_t * p_size, uint64_t * p_mtime_ns, uint64_t * p_base,
+                        cache_fill_t ** pp_fill);
 
-#endif
\ No newline at end of file
+#endif
@@ -10,50 +10,54 @@
 #include <inttypes.h>
 #include <unistd.h>
 #include <pthread.h>
+#include <stdatomic.h>
 #include <errno.h>
 
+#include "transfer.h"
 #include "server.h"
 #include "my_queue.h"
+#include "reactor.h"
 
 #define SERV_ADDR       "127.0.0.1"
 #define MAX_CLIENTS     50
 
 /**
- * @brief - the structure storing the threadpool data for client connections
- * @member threads - an array of pthread_t types for each connection made
- * @member condition - the condition variable used for locks to set as wait or 
- *                     broadcast
- * @member lock - the pthread_mutex_lock variable to lock critical sections during
- *                execution
- * @member max_thread_cnt - the total number of allowable client connections
- *                          (set at server program execution from the cmdline)
- * @member thread_cnt - the current number of active threads
+ * @brief - the structure storing the threadpool data for the disk workers
+ * @member threads - an array of pthread_t types for each worker thread
+ * @member max_thread_cnt - the total number of worker threads (set at server
+ *                          program execution from the cmdline)
+ * @member thread_cnt - the current number of threads busy running a job
+ * @member p_reactors - the reactors the workers serve, worker idx takes jobs
+ *                     only from reactor (idx % num_reactors)
+ * @member num_reactors - the number of reactors
+ *
+ * Idle workers park on their reactor's job queue itself (see dequeue_wait), so
+ * the pool needs no lock or condition variable of its own.
  */
 typedef struct thread_pool
 {
     pthread_t       * threads;
-    pthread_cond_t    condition;
-    pthread_mutex_t   lock;
     size_t            max_thread_cnt;
-    size_t            thread_cnt;
+    _Atomic size_t    thread_cnt;
+    reactor_t       * p_reactors;
+    size_t            num_reactors;
 } threadpool_t;
 
 /**
  * @brief - a list of global variables used throughout the lifespan of the program
  * @var serv_running - a global boolean flag to determine life of server
- * @var exiting - a thread specific boolean flag to determine if client is connected
- * @var clients_con - a count of all active connections
+ * @var clients_con - a count of all active connections across every reactor
  * @var p_tpool - a pointer to the threadpool structure
- * @var p_queue - a pointer to the queue structure
+ * @var upload_mode - how uploads move data from the socket to disk (set at
+ *                    startup from the cmdline)
  */
 extern bool            serv_running;
-extern bool            exiting;
-extern size_t          clients_con;
+extern _Atomic size_t  clients_con;
 extern threadpool_t  * p_tpool;
-extern queue         * p_queue;
+extern upload_mode_t   upload_mode;
 
 /**
- * @brief - initializes all global variables to include the threadpool and queue
+ * @brief - initializes all global variables to include the threadpool
  * @param - N/A
  * @return - 0 on success, -1 on failure
  */
@@ -61,17 +65,22 @@ int init_globals ();
 
 /**
  * INT INIT_THREADPOOL:
- * @brief initializes threadpool holding specified number of threads setting
- *        them to an idle state waiting for handoff to the client
+ * @brief initializes threadpool holding specified number of worker threads
+ *        setting them to an idle state waiting for disk jobs from the reactors,
+ *        the workers are dealt out round robin so every reactor gets at least one
  * @param p_tpool - pointer to the pool struct
- * @param num_of_clients - number of current connections
+ * @param num_of_clients - number of worker threads to start, raised to
+ *                         num_reactors if smaller
+ * @param p_reactors - the initialized reactors
+ * @param num_reactors - the number of reactors
  * @return - (int) 0 on success, -1 on error
  */
-int init_threadpool (threadpool_t * p_tpool, size_t num_of_clients);
+int init_threadpool (threadpool_t * p_tpool, size_t num_of_clients, reactor_t * p_reactors, size_t num_reactors);
 
 /**
  * VOID POOL_CLEANUP:
- * @brief - joins all active threads and cleans up resources for proper clean up
+ * @brief - wakes and joins all worker threads and cleans up resources for proper
+ *          clean up
  * @param num_threads - number of actual threads created and connected
  * @return - N/A
  */
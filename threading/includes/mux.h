@@ -0,0 +1,128 @@
+#ifndef __MUX_H__
+#define __MUX_H__
+
+#define _XOPEN_SOURCE 700
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+
+#include "protocol.h"
+#include "connection.h"
+
+#define MUX_CTRL_SZ         1024
+#define MUX_CTRL_RESERVE    64
+
+/**
+ * @brief - one in-flight request on a multiplexed connection
+ * @member active - the slot is in use
+ * @member id - request id chosen by the client, names the stream
+ * @member opcode - the V2_OP_* of the request
+ * @member head - inline storage for the download size prefix or range header
+ * @member p_reply / reply_len / reply_off - in-memory part of the reply, sent
+ *                                          before any file data
+ * @member reply_owned - p_reply lives in the connection's arena
+ * @member file_fd - file being downloaded or uploaded, -1 if none
+ * @member p_fill - the cache copy being downloaded while it is still being
+ *                  filled in, NULL otherwise
+ * @member xfer_size / xfer_off - end of and progress through the file
+ * @member upload - journal of an upload stream
+ * @member send_window - reply bytes the client is still willing to accept
+ * @member recv_window - upload bytes the client may still send
+ * @member recv_unacked - upload bytes stored since the last window update
+ */
+typedef struct mux_stream
+{
+    bool            active;
+    uint32_t        id;
+    uint16_t        opcode;
+    char            head[V2_RANGE_HEAD_SZ];
+    char          * p_reply;
+    size_t          reply_len;
+    size_t          reply_off;
+    bool            reply_owned;
+    int             file_fd;
+    cache_fill_t  * p_fill;
+    uint64_t        xfer_size;
+    off_t           xfer_off;
+    upload_t        upload;
+    uint64_t        send_window;
+    uint64_t        recv_window;
+    uint64_t        recv_unacked;
+} mux_stream_t;
+
+/**
+ * @brief - the stream table and framing state of a multiplexed connection,
+ *          only ever touched by the worker running the connection's JOB_MUX
+ * @member streams - the stream slots
+ * @member next_stream - round robin cursor, the stream served last
+ * @member in_stream - slot the DATA frame being received belongs to, -1 when
+ *                     its payload is being discarded
+ * @member in_left - payload bytes of that frame still to be received
+ * @member out_stream - slot of the frame being sent, -1 between frames
+ * @member out_hdr / out_hdr_off - header of that frame and how much of it
+ *                                 has been sent
+ * @member out_body_left - payload bytes of that frame still to be sent
+ * @member ctrl / ctrl_len / ctrl_off - small frames (window updates, errors,
+ *                                      upload replies) sent between data frames
+ * @member wait_events - what the reactor should wait for when the last job
+ *                       stopped because the socket was not ready
+ * @member p_arena - the connection's arena, listing replies are built in it
+ * @member arena_replies - streams whose reply lives in the arena, it is reset
+ *                         whenever none is left
+ */
+typedef struct mux
+{
+    mux_stream_t    streams[V2_MAX_STREAMS];
+    size_t          next_stream;
+    int             in_stream;
+    uint64_t        in_left;
+    int             out_stream;
+    char            out_hdr[V2_HDR_SZ];
+    size_t          out_hdr_off;
+    uint64_t        out_body_left;
+    char            ctrl[MUX_CTRL_SZ];
+    size_t          ctrl_len;
+    size_t          ctrl_off;
+    uint32_t        wait_events;
+    arena_t       * p_arena;
+    uint32_t        arena_replies;
+} mux_t;
+
+/**
+ * MUX_T * MUX_CREATE:
+ * @brief - allocates the multiplexing state once a client negotiates it
+ * @param p_arena - the connection's arena
+ * @return - pointer to the state, NULL on failure
+ */
+mux_t * mux_create (arena_t * p_arena);
+
+/**
+ * VOID MUX_DESTROY:
+ * @brief - closes every stream's file, frees every reply and the state itself
+ * @param p_mux - the state, may be NULL
+ * @return - N/A
+ */
+void mux_destroy (mux_t * p_mux);
+
+/**
+ * VOID JOB_MUX:
+ * @brief - worker side of a multiplexed connection. Parses as many frames as
+ *          have arrived (running the disk work of new requests and storing
+ *          upload data), then sends reply frames round robin over the streams
+ *          that have credit, until the socket is not ready or JOB_BUDGET bytes
+ *          have moved. Leaves the connection in CONN_MUX or CONN_CLOSE
+ * @param p_conn - the connection
+ * @return - N/A
+ */
+void job_mux (conn_t * p_conn);
+
+#endif
@@ -9,10 +9,13 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <stdatomic.h>
 #include <errno.h>
 
 #define CLEAN(a) if (a)free(a);(a)=NULL;
 #define MAXQUEUE 50
+#define CACHE_LINE 64
 
 /**
  * @brief - stores the file descriptor within the queue node
@@ -23,38 +26,52 @@ typedef struct item {
 } item;
 
 /**
- * @brief - the structure of the actual queue node
- * @member item - the node item storing the data
- * @member next - a pointer to the next node in the queue
+ * @brief - a single slot of the ring
+ * @member sequence - the ticket that tells producers and consumers whether the
+ *                    slot is free (== pos) or holds an item (== pos + 1)
+ * @member item - the slot item storing the data
  */
-typedef struct node {
-    item          item;
-    struct node * next;
-} node;
+typedef struct cell {
+    _Atomic size_t sequence;
+    item           item;
+} cell;
 
 /**
- * @brief - the queue data structure itself
- * @member head - the pointer the front of the queue
- * @member tail - the pointer to the last item in the queue
- * @member queue_len - the current length of the queue
+ * @brief - the queue data structure itself, a bounded lock-free multi-producer
+ *          multi-consumer ring (Vyukov). The producer and consumer cursors sit on
+ *          their own cache lines so enqueue and dequeue never false share, and
+ *          the whole queue is one allocation made by init_queue
+ * @member enqueue_pos - the next position a producer will claim
+ * @member dequeue_pos - the next position a consumer will claim
+ * @member waiters - number of threads parked in dequeue_wait
+ * @member wake_seq - futex word bumped whenever a parked consumer may proceed
+ * @member capacity - the number of slots, always a power of two
+ * @member mask - capacity - 1
+ * @member cells - the slots
  */
 typedef struct queue {
-    node * head;
-    node * tail;
-    size_t queue_len;
+    _Alignas(CACHE_LINE) _Atomic size_t   enqueue_pos;
+    _Alignas(CACHE_LINE) _Atomic size_t   dequeue_pos;
+    _Alignas(CACHE_LINE) _Atomic uint32_t waiters;
+    _Atomic uint32_t                      wake_seq;
+    _Alignas(CACHE_LINE) size_t           capacity;
+    size_t                                mask;
+    cell                                  cells[];
 } queue;
 
 /**
  * QUEUE* INIT_QUEUE:
  * @brief - initialize everything required for the client socket fd queue
- * @param - N/A
+ * @param capacity - the maximum number of items the queue can hold, rounded up
+ *                   to the next power of two
  * @return - (queue *) pointer to queue structure, NULL on failure
  */
-queue * init_queue();
+queue * init_queue(size_t capacity);
 
 /**
  * BOOL IS_FULL:
- * @brief - determine if current queue is at max capacity
+ * @brief - determine if current queue is at max capacity (a snapshot, other
+ *          threads may change it immediately)
  * @param fd_queue - pointer to current queue structure
  * @return - true if full, false otherwise
  */
@@ -62,7 +79,8 @@ bool is_full(const queue* fd_queue);
 
 /**
  * BOOL IS_EMPTY:
- * @brief - determine if current queue is empty
+ * @brief - determine if current queue is empty (a snapshot, other threads may
+ *          change it immediately)
  * @param fd_queue - pointer to current queue structure
  * @return: true if empty, false otherwise
  */
@@ -78,7 +96,8 @@ size_t get_queue_len(const queue* fd_queue);
 
 /**
  * VOID TRAVERSE_QUEUE --- OPTIONAL, MEANT TO PRINT QUEUE NODE VALUES ---:
- * @brief - allows the user to traverse the current queue if need be
+ * @brief - allows the user to traverse the current queue if need be, only
+ *          meaningful while no other thread is using the queue
  * @param fd_queue - pointer to current queue structure
  * @param (* func_ptr)(item q_item) - function pointer with an item param
  * @return - N/A
@@ -95,24 +114,46 @@ void peek(queue* fd_queue);
 
 /**
  * BOOL ENQUEUE:
- * @brief - place item into queue, head if empty, tail otherwise
+ * @brief - place item at the tail of the queue without taking a lock and wake a
+ *          parked consumer if there is one
  * @param fd_queue - pointer to current queue structure
  * @param q_item - item to be placed within the queue structure
- * @return - true upon success, false upon failure
+ * @return - true upon success, false if the queue is full
  */
 bool enqueue(queue* fd_queue, item q_item);
 
 /**
  * INT DEQUEUE:
- * @brief - pop current queue head and return its item for use
+ * @brief - pop current queue head and return its item for use, never blocks
  * @param fd_queue - pointer to current queue structure
- * @return - sockfd value upon success, -1 upon failure
+ * @return - sockfd value upon success, -1 if the queue is empty
  */
 int dequeue(queue* fd_queue);
 
+/**
+ * INT DEQUEUE_WAIT:
+ * @brief - pop current queue head, parking the calling thread on a futex while
+ *          the queue is empty
+ * @param fd_queue - pointer to current queue structure
+ * @param p_running - flag checked after every wakeup, the call gives up once it
+ *                    is cleared (see wake_all)
+ * @return - sockfd value upon success, -1 once *p_running is false
+ */
+int dequeue_wait(queue* fd_queue, const bool * p_running);
+
+/**
+ * VOID WAKE_ALL:
+ * @brief - wakes every thread parked in dequeue_wait so it can recheck its
+ *          running flag
+ * @param fd_queue - pointer to current queue structure
+ * @return - N/A
+ */
+void wake_all(queue* fd_queue);
+
 /**
  * VOID CLEAR:
- * @brief - properly cleans up queue resources
+ * @brief - drops every item still in the queue, the queue itself is released
+ *          with a single free()
  * @param fd_queue - pointer to current queue structure
  * @return - N/A
  */
@@ -8,6 +8,7 @@
 #include <getopt.h>
 #include <netdb.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <stdlib.h>
@@ -18,12 +19,23 @@
 #include <errno.h>
 
 #include "global_data.h"
+#include "reactor.h"
+#include "storage_layout.h"
+#include "segment_store.h"
+#include "storage_backend.h"
+#include "file_cache.h"
+#include "buffer_pool.h"
 
 #define MAX_PORT_LEN 6
 #define BASE_10      10
 #define MIN_PORT     1025
 #define MAX_PORT     65535
 
+#define DEFAULT_BACKLOG      SOMAXCONN
+
+#define UPLOAD_MODE_BUFFERED "buffered"
+#define UPLOAD_MODE_SPLICE   "splice"
+
 /**
  * @brief - a struct to store server specific data, the port received from
  *          the command line upon server file execution and the total number
@@ -31,13 +43,39 @@
  *          upon execution
  * @member port - a string representation of the port passed by the user to setup
  *                the TCP client connections
- * @member num_allowable_clients - received either from the command line or within
- *                                 setup 
+ * @member num_allowable_clients - the number of disk worker threads, received
+ *                                 either from the command line or within setup
+ * @member upload_mode - the upload path selected with -u (buffered or splice),
+ *                       defaults to buffered
+ * @member num_reactors - the number of SO_REUSEPORT listeners, each with its
+ *                        own reactor thread and workers (-r, defaults to 1)
+ * @member backlog - the listen() backlog of every listener (-b, defaults to
+ *                   SOMAXCONN)
+ * @member layout - the storage layout asked for with -l (flat or sharded),
+ *                  LAYOUT_AUTO keeps whatever the directory uses
+ * @member pack_max - largest upload packed into a segment (-s, up to
+ *                    SEGMENT_MAX_FILE), 0 (the default) packs nothing
+ * @member p_backend - the storage backend picked with -d (posix or ram),
+ *                     defaults to posix
+ * @member cache_mb - budget of the hot-file cache in MiB (-c, up to
+ *                    CACHE_MAX_MB), 0 (the default) turns it off
+ * @member pool_mb - in-flight budget of the I/O buffer pool in MiB (-i,
+ *                   defaults to POOL_DEFAULT_MB)
+ * @member huge_pages - back the buffer pool with huge pages (-H)
  */
 typedef struct setup_info
 {
-    char   * port;
-    size_t   num_allowable_clients;
+    char                    * port;
+    size_t                    num_allowable_clients;
+    upload_mode_t             upload_mode;
+    size_t                    num_reactors;
+    int                       backlog;
+    layout_t                  layout;
+    size_t                    pack_max;
+    const storage_backend_t * p_backend;
+    size_t                    cache_mb;
+    size_t                    pool_mb;
+    bool                      huge_pages;
 } setup_info_t;
 
 /**
@@ -66,18 +104,21 @@ struct addrinfo setup_server (struct addrinfo * p_serv);
  * @param p_serv - a pointer to the addrinfo struct storing the server's data
  * @param p_port - a string representation of the port used for the socket connection
  *                 upon initial execution of the server program (passed as cmdline argument)
+ * @param reuse_port - set SO_REUSEPORT so several listeners can bind the same
+ *                     port and have the kernel spread new connections over them
  * @return - returns the working TCP socket file descriptor on success or -1 on failure
  */
-int setup_socket (struct addrinfo * p_serv, char * p_port);
+int setup_socket (struct addrinfo * p_serv, char * p_port, bool reuse_port);
 
 /**
  * VOID HANDLE_INCOMING_CLIENT:
- * @brief - obtain socket fd from queue and hand it off to thread for
- *          for network connection to server
- * @param client_fd - client socket file descriptor
+ * @brief - sets the socket options for a newly accepted client and hands the
+ *          socket to the reactor
+ * @param p_reactor - the reactor that accepted the client
+ * @param client_fd - non-blocking client socket file descriptor
  * @return - N/A
  */
-void handle_incoming_client (int client_fd);
+void handle_incoming_client (reactor_t * p_reactor, int client_fd);
 
 /**
  * VOID END_CONNECTION:
@@ -0,0 +1,353 @@
+#ifndef __PROTOCOL_H__
+#define __PROTOCOL_H__
+
+#define _XOPEN_SOURCE 700
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <endian.h>
+
+/*
+ * Protocol v2
+ *
+ * A v2 client opens the connection with an 8 byte hello: the V2_MAGIC bytes
+ * followed by a little-endian u16 version and a u16 of reserved flags. The
+ * magic read as a native int is never a legacy command, so clients that start
+ * with a 4 byte command keep the legacy protocol. The server answers with its
+ * own hello and from then on every message in both directions is a frame:
+ *
+ *      u16 opcode | u16 flags | u32 request id | u64 payload length | payload
+ *
+ * with every header field little-endian. Requests are served in order and a
+ * client may send as many as it likes without waiting for the replies, each
+ * reply echoes the opcode and request id of its request with V2_FLAG_REPLY
+ * set. A failed request is answered with V2_FLAG_ERROR and a u32 errno payload.
+ *
+ *  V2_OP_LIST      request: no payload
+ *                  reply:   u32 count, then u16 name length + name per file
+ *  V2_OP_DOWNLOAD  request: the file name
+ *                  reply:   the file contents
+ *  V2_OP_UPLOAD    request: u16 name length, the name, then the file contents
+ *                  reply:   no payload once the file has been stored
+ *  V2_OP_BYE       request: no payload, the server closes the connection
+ *  V2_OP_DOWNLOAD_RANGE
+ *                  request: u64 offset, u64 length (V2_RANGE_TO_END for the rest
+ *                           of the file), then the file name
+ *                  reply:   u64 file size, u64 mtime in nanoseconds, u64 length
+ *                           of the range actually sent (clipped to the end of
+ *                           the file), then that many bytes. An offset past the
+ *                           end of the file is answered with ERANGE
+ *  V2_OP_UPLOAD_QUERY
+ *                  request: u64 upload id, u64 file size, then the file name
+ *                  reply:   u64 number of bytes of that upload the server has
+ *                           already stored, 0 if it has to start over
+ *  V2_OP_UPLOAD_RESUME
+ *                  request: u64 upload id, u64 offset, then a V2_OP_UPLOAD
+ *                           payload whose contents start at that offset. An
+ *                           offset of 0 starts a new resumable upload, any
+ *                           other offset must not exceed what UPLOAD_QUERY
+ *                           reported or the request fails with ESTALE
+ *                  reply:   as V2_OP_UPLOAD
+ *  V2_OP_SESSION_OPEN
+ *                  request: u64 upload id, u64 file size, u64 chunk size, then
+ *                           the file name
+ *                  reply:   a bitmap of the chunks the server already holds,
+ *                           bit (i % 8) of byte (i / 8) for chunk i
+ *  V2_OP_SESSION_CHUNK
+ *                  request: u64 upload id, u64 offset, u16 name length, the
+ *                           name, then the chunk. The offset must be a multiple
+ *                           of the chunk size and the chunk must be whole (only
+ *                           the last one may be short). Chunks may arrive in any
+ *                           order over any number of connections, a repeated
+ *                           chunk must carry the same bytes and is stored again
+ *                  reply:   no payload once the chunk is on disk
+ *  V2_OP_SESSION_COMMIT
+ *                  request: u64 upload id, u64 file size, then the file name
+ *                  reply:   no payload once the file has been published, ENODATA
+ *                           if chunks are missing, EBUSY while chunks are
+ *                           still being received
+ *  V2_OP_LIST_DETAIL
+ *                  request: no payload
+ *                  reply:   u32 count, u32 length of the name table, then per
+ *                           file a V2_LIST_ENTRY_SZ record of u64 size, u64
+ *                           mtime_ns and u16 name length, then the name table:
+ *                           every name back to back in record order
+ *  V2_OP_LIST_PAGE
+ *                  request: u64 cursor (0 for the first page), u32 page size
+ *                           (0 for V2_LIST_PAGE_DEFAULT, at most
+ *                           V2_LIST_PAGE_MAX), then an optional fnmatch()
+ *                           pattern the names must match
+ *                  reply:   u64 cursor of the next page (0 after the last
+ *                           page), then a page in the V2_OP_LIST_DETAIL
+ *                           layout. A page may hold fewer entries than asked
+ *                           for, even none, the listing only ends at cursor 0
+ *  V2_OP_EXTENTS   request: as V2_OP_DOWNLOAD_RANGE
+ *                  reply:   u64 file size, u64 mtime in nanoseconds, u64 offset
+ *                           the map ends at, u32 count, then count
+ *                           V2_EXTENT_SZ records of u64 offset and u64 length:
+ *                           the data extents of the range, everything between
+ *                           them is a hole that reads as zeros. At most
+ *                           V2_EXTENTS_MAX extents are sent at once, the map
+ *                           ends where the next request should start (the end
+ *                           of the range once it has all been mapped)
+ *  V2_OP_UPLOAD_SPARSE
+ *                  request: u64 file size, u16 name length, the name, then
+ *                           per data extent a V2_EXTENT_SZ record and that
+ *                           many bytes. The extents must be in ascending order
+ *                           and may not overlap, everything they leave out is
+ *                           stored as a hole. Sparse uploads cannot be resumed
+ *                  reply:   as V2_OP_UPLOAD
+ *
+ * The session and sparse requests are served on connections that did not
+ * negotiate multiplexing, a client gets its parallelism from opening several
+ * of them.
+ *
+ * Multiplexing
+ *
+ * A client that sets V2_HELLO_MUX in its hello flags (and sees it echoed) may
+ * have up to V2_MAX_STREAMS requests in flight at once, each one a stream named
+ * by its request id. Replies are no longer sent whole: the server interleaves
+ * the streams in frames of at most V2_MAX_FRAME payload bytes, each carrying
+ * the opcode and id of its request, with V2_FLAG_END on the last frame of a
+ * reply. The concatenated payloads of a stream are the reply, except that a
+ * download reply starts with the u64 file size (a ranged download reply has
+ * its usual 24 byte prefix). Error replies are a single
+ * V2_FLAG_ERROR | V2_FLAG_END frame as before.
+ *
+ * Every stream starts with V2_MUX_WINDOW bytes of credit in each direction.
+ * The server never sends more reply payload on a stream than the client has
+ * granted with V2_OP_WINDOW frames (u32 increment, request id = stream), so a
+ * client that stops reading one stream does not stall the others.
+ *
+ * Uploads are split the same way: the V2_OP_UPLOAD request carries a u64 file
+ * size, u16 name length and the name, and the contents follow in V2_OP_DATA
+ * frames for that stream, within the credit the server grants back as it
+ * commits data to disk. The server answers with an empty V2_FLAG_END reply
+ * once the whole file has been stored. V2_OP_UPLOAD_RESUME works the same way
+ * with its 16 byte prefix in front, the DATA frames carry the contents from
+ * the offset on.
+ */
+
+#define V2_MAGIC            "FSV2"
+#define V2_MAGIC_LEN        4
+#define V2_VERSION          2
+#define V2_HELLO_SZ         8
+#define V2_HDR_SZ           16
+
+#define V2_OP_LIST          1
+#define V2_OP_DOWNLOAD      2
+#define V2_OP_UPLOAD        3
+#define V2_OP_BYE           4
+#define V2_OP_DATA          5
+#define V2_OP_WINDOW        6
+#define V2_OP_DOWNLOAD_RANGE 7
+#define V2_OP_UPLOAD_QUERY  8
+#define V2_OP_UPLOAD_RESUME 9
+#define V2_OP_SESSION_OPEN  10
+#define V2_OP_SESSION_CHUNK 11
+#define V2_OP_SESSION_COMMIT 12
+#define V2_OP_LIST_DETAIL   13
+#define V2_OP_LIST_PAGE     14
+#define V2_OP_EXTENTS       15
+#define V2_OP_UPLOAD_SPARSE 16
+
+#define V2_FLAG_REPLY       0x0001
+#define V2_FLAG_ERROR       0x0002
+#define V2_FLAG_END         0x0004
+
+#define V2_RANGE_REQ_SZ     16
+#define V2_RANGE_HEAD_SZ    24
+#define V2_RANGE_TO_END     UINT64_MAX
+#define V2_UPLOAD_REQ_SZ    16
+#define V2_SESSION_REQ_SZ   24
+#define V2_LIST_HEAD_SZ     8
+#define V2_LIST_ENTRY_SZ    18
+#define V2_LIST_PAGE_REQ_SZ 12
+#define V2_LIST_PAGE_DEFAULT 1000
+#define V2_LIST_PAGE_MAX    10000
+#define V2_EXTENTS_HEAD_SZ  28
+#define V2_EXTENT_SZ        16
+#define V2_EXTENTS_MAX      1024
+#define V2_SPARSE_REQ_SZ    8
+
+#define V2_HELLO_MUX        0x0001
+#define V2_MAX_STREAMS      16
+#define V2_MAX_FRAME        (128 * 1024)
+#define V2_MUX_WINDOW       (1024 * 1024)
+
+/**
+ * @brief - a decoded v2 frame header
+ * @member opcode - one of the V2_OP_* values
+ * @member flags - V2_FLAG_* bits
+ * @member request_id - chosen by the client, echoed in the reply
+ * @member payload_len - number of payload bytes following the header
+ */
+typedef struct v2_hdr
+{
+    uint16_t    opcode;
+    uint16_t    flags;
+    uint32_t    request_id;
+    uint64_t    payload_len;
+} v2_hdr_t;
+
+/**
+ * VOID V2_ENCODE_HDR:
+ * @brief - serializes a frame header into V2_HDR_SZ bytes
+ * @param p_buf - destination, at least V2_HDR_SZ bytes
+ * @param p_hdr - header to serialize
+ * @return - N/A
+ */
+void v2_encode_hdr (char * p_buf, const v2_hdr_t * p_hdr);
+
+/**
+ * VOID V2_DECODE_HDR:
+ * @brief - parses V2_HDR_SZ bytes into a frame header
+ * @param p_buf - source, at least V2_HDR_SZ bytes
+ * @param p_hdr - header to fill in
+ * @return - N/A
+ */
+void v2_decode_hdr (const char * p_buf, v2_hdr_t * p_hdr);
+
+/**
+ * SIZE_T V2_ENCODE_HELLO:
+ * @brief - serializes the server's hello
+ * @param p_buf - destination, at least V2_HELLO_SZ bytes
+ * @param flags - the V2_HELLO_* features the server accepted
+ * @return - (size_t) V2_HELLO_SZ
+ */
+size_t v2_encode_hello (char * p_buf, uint16_t flags);
+
+/**
+ * BOOL V2_IS_HELLO:
+ * @brief - checks whether the first bytes a client sent are the v2 magic
+ * @param p_buf - the first V2_MAGIC_LEN bytes received
+ * @return - true if the client speaks v2, false for a legacy client
+ */
+bool v2_is_hello (const char * p_buf);
+
+/**
+ * SIZE_T V2_ENCODE_REPLY:
+ * @brief - serializes the reply header for a request
+ * @param p_buf - destination, at least V2_HDR_SZ bytes
+ * @param opcode - opcode of the request being answered
+ * @param request_id - id of the request being answered
+ * @param payload_len - number of payload bytes that will follow
+ * @return - (size_t) V2_HDR_SZ
+ */
+size_t v2_encode_reply (char * p_buf, uint16_t opcode, uint32_t request_id, uint64_t payload_len);
+
+/**
+ * SIZE_T V2_ENCODE_ERROR:
+ * @brief - serializes a complete error reply (header and errno payload)
+ * @param p_buf - destination, at least V2_HDR_SZ + 4 bytes
+ * @param opcode - opcode of the request being answered
+ * @param request_id - id of the request being answered
+ * @param err - errno value describing the failure
+ * @return - (size_t) number of bytes written
+ */
+size_t v2_encode_error (char * p_buf, uint16_t opcode, uint32_t request_id, int err);
+
+/**
+ * VOID V2_DECODE_RANGE:
+ * @brief - parses the offset and length that lead a DOWNLOAD_RANGE payload
+ * @param p_buf - source, at least V2_RANGE_REQ_SZ bytes
+ * @param p_offset - set to the requested offset
+ * @param p_length - set to the requested length
+ * @return - N/A
+ */
+void v2_decode_range (const char * p_buf, uint64_t * p_offset, uint64_t * p_length);
+
+/**
+ * INT V2_CLIP_RANGE:
+ * @brief - fits a requested range to the current size of the file
+ * @param file_size - current size of the file
+ * @param offset - requested offset
+ * @param p_length - requested length, clipped to the end of the file
+ * @return - 0 on success, -1 with errno set to ERANGE if offset is past the end
+ */
+int v2_clip_range (uint64_t file_size, uint64_t offset, uint64_t * p_length);
+
+/**
+ * SIZE_T V2_ENCODE_RANGE_HEAD:
+ * @brief - serializes the prefix of a DOWNLOAD_RANGE reply
+ * @param p_buf - destination, at least V2_RANGE_HEAD_SZ bytes
+ * @param file_size - current size of the file
+ * @param mtime_ns - current modification time of the file in nanoseconds
+ * @param length - number of file bytes that follow
+ * @return - (size_t) V2_RANGE_HEAD_SZ
+ */
+size_t v2_encode_range_head (char * p_buf, uint64_t file_size, uint64_t mtime_ns, uint64_t length);
+
+/**
+ * VOID V2_DECODE_UPLOAD:
+ * @brief - parses the two u64 values that lead an UPLOAD_QUERY payload (upload
+ *          id and size) or an UPLOAD_RESUME payload (upload id and offset)
+ * @param p_buf - source, at least V2_UPLOAD_REQ_SZ bytes
+ * @param p_upload_id - set to the upload id
+ * @param p_value - set to the size or offset
+ * @return - N/A
+ */
+void v2_decode_upload (const char * p_buf, uint64_t * p_upload_id, uint64_t * p_value);
+
+/**
+ * VOID V2_DECODE_LIST_PAGE:
+ * @brief - parses the cursor and page size that lead a LIST_PAGE payload
+ * @param p_buf - source, at least V2_LIST_PAGE_REQ_SZ bytes
+ * @param p_cursor - set to the cursor
+ * @param p_page_size - set to the page size
+ * @return - N/A
+ */
+void v2_decode_list_page (const char * p_buf, uint64_t * p_cursor, uint32_t * p_page_size);
+
+/**
+ * VOID V2_DECODE_SESSION:
+ * @brief - parses the upload id, file size and chunk size that lead a
+ *          SESSION_OPEN payload
+ * @param p_buf - source, at least V2_SESSION_REQ_SZ bytes
+ * @param p_upload_id - set to the upload id
+ * @param p_size - set to the file size
+ * @param p_chunk_size - set to the chunk size
+ * @return - N/A
+ */
+void v2_decode_session (const char * p_buf, uint64_t * p_upload_id, uint64_t * p_size, uint64_t * p_chunk_size);
+
+/**
+ * SIZE_T V2_ENCODE_EXTENTS_HEAD:
+ * @brief - serializes the prefix of an EXTENTS reply
+ * @param p_buf - destination, at least V2_EXTENTS_HEAD_SZ bytes
+ * @param file_size - current size of the file
+ * @param mtime_ns - current modification time of the file in nanoseconds
+ * @param map_end - offset the extents that follow were mapped up to
+ * @param count - number of extent records that follow
+ * @return - (size_t) V2_EXTENTS_HEAD_SZ
+ */
+size_t v2_encode_extents_head (char * p_buf, uint64_t file_size, uint64_t mtime_ns, uint64_t map_end,
+                               uint32_t count);
+
+/**
+ * SIZE_T V2_ENCODE_EXTENT:
+ * @brief - serializes one extent record of an EXTENTS reply
+ * @param p_buf - destination, at least V2_EXTENT_SZ bytes
+ * @param offset - where the extent starts in the file
+ * @param length - number of bytes in the extent
+ * @return - (size_t) V2_EXTENT_SZ
+ */
+size_t v2_encode_extent (char * p_buf, uint64_t offset, uint64_t length);
+
+/**
+ * VOID V2_DECODE_EXTENT:
+ * @brief - parses the extent record that leads every extent of an
+ *          UPLOAD_SPARSE payload
+ * @param p_buf - source, at least V2_EXTENT_SZ bytes
+ * @param p_offset - set to where the extent starts in the file
+ * @param p_length - set to the number of bytes in the extent
+ * @return - N/A
+ */
+void v2_decode_extent (const char * p_buf, uint64_t * p_offset, uint64_t * p_length);
+
+#endif
@@ -0,0 +1,177 @@
+#ifndef __REACTOR_H__
+#define __REACTOR_H__
+
+#define _XOPEN_SOURCE 700
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <sched.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+
+#include "my_queue.h"
+
+#define MAX_EVENTS      256
+#define JOB_QUEUE_LEN   4096
+#define MAX_REACTORS    64
+
+struct conn;
+
+/**
+ * @brief - an event loop that owns one listening socket and every client socket
+ *          accepted on it. With -r N the server runs N reactors, each on its own
+ *          SO_REUSEPORT listener and thread, with its own set of worker threads
+ * @member id - index of the reactor, also the core its thread is pinned to
+ * @member epoll_fd - the epoll instance all sockets are registered with
+ * @member listen_fd - the non-blocking listening socket
+ * @member event_fd - written by worker threads to wake the reactor when a job
+ *                    has finished
+ * @member thread - the thread running the event loop (reactor 0 runs on main)
+ * @member p_jobs - fds of connections waiting for one of this reactor's workers
+ * @member p_done - fds of connections whose disk job has finished, filled by the
+ *                  workers and drained by the reactor (lock-free)
+ * @member p_pending / p_pending_tail - connections whose job could not be
+ *                     queued because the worker queue was full, retried in
+ *                     order after every wakeup
+ */
+typedef struct reactor
+{
+    size_t            id;
+    int               epoll_fd;
+    int               listen_fd;
+    int               event_fd;
+    pthread_t         thread;
+    queue           * p_jobs;
+    queue           * p_done;
+    struct conn     * p_pending;
+    struct conn     * p_pending_tail;
+} reactor_t;
+
+/**
+ * INT REACTOR_INIT:
+ * @brief - creates the epoll instance and job/completion queues and registers
+ *          the listening socket, the shared connection table is sized from
+ *          RLIMIT_NOFILE by the first call. Not thread safe, initialize every
+ *          reactor before any of them is started
+ * @param p_reactor - pointer to the reactor to initialize
+ * @param id - index of the reactor
+ * @param listen_fd - the non-blocking listening socket
+ * @return - 0 on success, -1 on failure
+ */
+int reactor_init (reactor_t * p_reactor, size_t id, int listen_fd);
+
+/**
+ * INT REACTOR_RUN:
+ * @brief - runs the event loop on the calling thread until serv_running is
+ *          cleared
+ * @param p_reactor - pointer to the reactor
+ * @return - 0 on a clean shutdown, -1 on failure
+ */
+int reactor_run (reactor_t * p_reactor);
+
+/**
+ * INT REACTOR_START:
+ * @brief - runs the event loop on a new thread pinned to core (id % cores),
+ *          the thread blocks SIGINT so ctrl+c is always seen by main
+ * @param p_reactor - pointer to an initialized reactor
+ * @return - 0 on success, -1 on failure
+ */
+int reactor_start (reactor_t * p_reactor);
+
+/**
+ * VOID REACTOR_STOP:
+ * @brief - wakes a reactor started with reactor_start and joins its thread,
+ *          serv_running must already be cleared
+ * @param p_reactor - pointer to the reactor
+ * @return - N/A
+ */
+void reactor_stop (reactor_t * p_reactor);
+
+/**
+ * VOID REACTOR_WAKE:
+ * @brief - interrupts the reactor's epoll_wait through its eventfd
+ * @param p_reactor - pointer to the reactor
+ * @return - N/A
+ */
+void reactor_wake (reactor_t * p_reactor);
+
+/**
+ * INT PIN_TO_CORE:
+ * @brief - restricts the calling thread to core (id % online cores)
+ * @param id - index of the reactor the thread serves
+ * @return - 0 on success, -1 on failure
+ */
+int pin_to_core (size_t id);
+
+/**
+ * VOID REACTOR_CLEANUP:
+ * @brief - closes every connection still owned by the reactor and releases its
+ *          resources, must only be called once the workers have been joined
+ * @param p_reactor - pointer to the reactor
+ * @return - N/A
+ */
+void reactor_cleanup (reactor_t * p_reactor);
+
+/**
+ * INT REACTOR_ADD_CONN:
+ * @brief - takes ownership of a newly accepted non-blocking client socket
+ * @param p_reactor - pointer to the reactor
+ * @param client_fd - client socket file descriptor
+ * @return - 0 on success, -1 on failure (the socket is closed)
+ */
+int reactor_add_conn (reactor_t * p_reactor, int client_fd);
+
+/**
+ * INT REACTOR_ARM:
+ * @brief - (re)arms the one-shot epoll registration of a connection
+ * @param p_conn - the connection
+ * @param events - EPOLLIN and/or EPOLLOUT
+ * @return - 0 on success, -1 on failure
+ */
+int reactor_arm (struct conn * p_conn, uint32_t events);
+
+/**
+ * VOID REACTOR_CLOSE_CONN:
+ * @brief - unregisters, closes and frees a connection
+ * @param p_conn - the connection
+ * @return - N/A
+ */
+void reactor_close_conn (struct conn * p_conn);
+
+/**
+ * VOID REACTOR_SUBMIT_JOB:
+ * @brief - hands a connection's pending disk job to its reactor's workers. The
+ *          reactor does not touch the connection again until the job completes
+ * @param p_conn - the connection, with its job member already set
+ * @return - N/A
+ */
+void reactor_submit_job (struct conn * p_conn);
+
+/**
+ * VOID REACTOR_COMPLETE_JOB:
+ * @brief - called by a worker thread once it has run a connection's job, hands
+ *          the connection back to its reactor
+ * @param p_conn - the connection
+ * @return - N/A
+ */
+void reactor_complete_job (struct conn * p_conn);
+
+/**
+ * STRUCT CONN * GET_CONN:
+ * @brief - looks up the connection that owns a socket
+ * @param fd - client socket file descriptor
+ * @return - the connection, NULL if the fd is not a client socket
+ */
+struct conn * get_conn (int fd);
+
+#endif
@@ -0,0 +1,198 @@
+#ifndef __SEGMENT_STORE_H__
+#define __SEGMENT_STORE_H__
+
+#define _XOPEN_SOURCE 700
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <dirent.h>
+#include <endian.h>
+#include <time.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/stat.h>
+
+#include "file_index.h"
+#include "storage_layout.h"
+
+#define SEGMENT_DIR             FILE_SERVER_DIR ".segments/"
+#define SEGMENT_SIZE            (64 * 1024 * 1024)
+#define SEGMENT_MAX_FILE        (64 * 1024)
+#define SEGMENT_HDR_SZ          32
+#define SEGMENT_MIN_BUCKETS     1024
+#define SEGMENT_COMPACT_SECS    10
+#define SEGMENT_COMPACT_PCT     50
+#define SEGMENT_ALL_SHARDS      SHARD_COUNT
+
+/*
+ * Small files can be packed into large append-only segment files under
+ * SEGMENT_DIR instead of getting a file (and an inode) of their own. Every
+ * record is a SEGMENT_HDR_SZ header, the name and the contents, and an
+ * in-memory index maps each name to its newest record. A download is served
+ * from the segment with the segment's descriptor and the record's offset, an
+ * upload writes straight into the space reserved for its record.
+ *
+ * A record is PENDING while its upload runs, LIVE once the upload finished
+ * (after its contents were flushed) and DEAD once it was abandoned or a newer
+ * copy of the name was published. Every LIVE record carries a sequence number,
+ * a restart keeps the highest one of each name. A compactor thread copies the
+ * live records out of sealed segments that are mostly dead and removes them.
+ *
+ * A stored file and a packed copy of the same name never both stay: whichever
+ * is newer is kept and the other is dropped. The file index lists packed files
+ * like any other, with file_info_t.packed set.
+ */
+
+typedef struct segment segment_t;
+
+/**
+ * BOOL (*SEGMENT_KEEP_T):
+ * @brief - decides whether a packed file stays, see segment_reconcile
+ * @param p_info - the packed file
+ * @param p_arg - the caller's argument
+ * @return - true to keep the packed file, false to drop it
+ */
+typedef bool (*segment_keep_t) (const file_info_t * p_info, void * p_arg);
+
+/**
+ * @brief - the record an upload is packed into
+ * @member p_segment - the segment holding it, NULL if there is none
+ * @member record_off - where the record starts in the segment
+ * @member base - where the file's contents start in the segment
+ * @member size - size of the file
+ */
+typedef struct segment_slot
+{
+    segment_t * p_segment;
+    uint64_t    record_off;
+    uint64_t    base;
+    uint64_t    size;
+} segment_slot_t;
+
+/**
+ * INT SEGMENT_INIT:
+ * @brief - loads every segment left in SEGMENT_DIR into the index and starts
+ *          the compactor. Packed files are always served, new uploads are only
+ *          packed when max_file is non zero
+ * @param max_file - largest upload to pack, 0 to store every upload on its own
+ * @return - 0 on success, -1 on error
+ */
+int segment_init (size_t max_file);
+
+/**
+ * VOID SEGMENT_CLEANUP:
+ * @brief - stops the compactor, closes the segments and frees the index
+ * @return - N/A
+ */
+void segment_cleanup ();
+
+/**
+ * BOOL SEGMENT_PACKS:
+ * @brief - whether an upload of this size is packed into a segment
+ * @param size - size of the file
+ * @return - true if packing is enabled and the file is small enough
+ */
+bool segment_packs (uint64_t size);
+
+/**
+ * INT SEGMENT_RESERVE:
+ * @brief - reserves a PENDING record for an upload at the end of the active
+ *          segment, starting a new segment when it is full
+ * @param p_filename - name of the file, already validated
+ * @param size - size of the file, segment_packs must be true for it
+ * @param p_slot - filled in with the reserved record
+ * @return - (int) descriptor of the segment to write the contents at
+ *           p_slot->base plus their own offsets and close afterwards, -1 with
+ *           errno set on error
+ */
+int segment_reserve (const char * p_filename, uint64_t size, segment_slot_t * p_slot);
+
+/**
+ * INT SEGMENT_COMMIT:
+ * @brief - flushes the contents of a reserved record, marks it LIVE and makes
+ *          it the copy of the name that is served, the copy it replaces is
+ *          marked DEAD. The slot is released either way
+ * @param p_slot - the record
+ * @param p_filename - name of the file
+ * @param file_fd - descriptor returned by segment_reserve
+ * @return - 0 on success, -1 on error
+ */
+int segment_commit (segment_slot_t * p_slot, const char * p_filename, int file_fd);
+
+/**
+ * VOID SEGMENT_ABANDON:
+ * @brief - marks a reserved record DEAD and releases the slot, does nothing
+ *          for an empty slot
+ * @param p_slot - the record
+ * @return - N/A
+ */
+void segment_abandon (segment_slot_t * p_slot);
+
+/**
+ * BOOL SEGMENT_LOOKUP:
+ * @brief - looks a packed file up by name
+ * @param p_filename - the file name
+ * @param p_info - filled in if the file is packed, may be NULL. p_name is set
+ *                 to p_filename
+ * @return - true if the name is packed, false otherwise
+ */
+bool segment_lookup (const char * p_filename, file_info_t * p_info);
+
+/**
+ * INT SEGMENT_OPEN:
+ * @brief - opens the segment a packed file is stored in
+ * @param p_filename - the file name
+ * @param p_size - set to the size of the file
+ * @param p_mtime_ns - set to the time the file was published in nanoseconds
+ *                     since the epoch, may be NULL
+ * @param p_base - set to where the contents start in the segment
+ * @return - (int) descriptor of the segment to read p_size bytes from at
+ *           p_base and close afterwards, -1 with errno set on error (ENOENT if
+ *           the name is not packed)
+ */
+int segment_open (const char * p_filename, uint64_t * p_size, uint64_t * p_mtime_ns, uint64_t * p_base);
+
+/**
+ * VOID SEGMENT_DROP:
+ * @brief - marks the packed copy of a name DEAD and forgets it, unless it was
+ *          published after mtime_ns
+ * @param p_filename - the file name
+ * @param mtime_ns - time of the copy that replaces it, UINT64_MAX to drop the
+ *                   packed copy regardless
+ * @return - N/A
+ */
+void segment_drop (const char * p_filename, uint64_t mtime_ns);
+
+/**
+ * INT SEGMENT_WALK:
+ * @brief - calls p_visit for every packed file of a shard, with the index
+ *          locked for reading. The names are NUL terminated
+ * @param shard - 0 - SHARD_COUNT - 1, SEGMENT_ALL_SHARDS for every file
+ * @param p_visit - the callback
+ * @param p_arg - passed to the callback
+ * @return - 0 once every file was visited, -1 if the callback stopped the walk
+ */
+int segment_walk (unsigned shard, file_index_visit_t p_visit, void * p_arg);
+
+/**
+ * VOID SEGMENT_RECONCILE:
+ * @brief - calls p_keep for every packed file with the index locked for
+ *          writing and drops the ones it returns false for. p_keep must not
+ *          call back into the segment store
+ * @param p_keep - decides whether a packed file stays
+ * @param p_arg - passed to p_keep
+ * @return - N/A
+ */
+void segment_reconcile (segment_keep_t p_keep, void * p_arg);
+
+#endif
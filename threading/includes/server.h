@@ -6,7 +6,6 @@
 
 #include <stdio.h>
 #include <netdb.h>
-#include <poll.h>
 #include <netinet/in.h>
 #include <sys/types.h>
 #include <sys/socket.h>
@@ -20,7 +19,13 @@
 
 #include "my_queue.h"
 #include "file_operations.h"
+#include "file_index.h"
+#include "storage_backend.h"
+#include "file_cache.h"
+#include "buffer_pool.h"
 #include "network_handler.h"
+#include "reactor.h"
+#include "connection.h"
 
 #define LIST            100
 #define DOWNLOAD        200
@@ -28,18 +33,14 @@
 #define EXIT            500
 #define ERROR           -1
 
+// a legacy upload size of UPLOAD_SIZE64 is followed by the real size as a
+// native u64, clients send it for files of 2 GiB and more
+#define UPLOAD_SIZE64   -2
+
 #define LIST_DIR        "ls"
 #define UPLOAD_FILE     "upload"
 #define CLIENT_EXIT     "exit"
 
-typedef struct upload_file
-{
-    int         name_len;
-    char        filename[MAXNAMLEN];
-} upload_file_t;
-
-
-
 /**
  * VOID HANDLE_SIGNAL:
  * @brief - handle ctrl+c input from user
@@ -48,82 +49,14 @@ typedef struct upload_file
  */
 void handle_signal (int sig_no);
 
-/**
- * INT RECV_CLIENT_COMMAND:
- * @brief - interprets the numerical command protocol sent by the client amd
- *          calls the determine operation function continuously until error occurs
- *          or client disconnects
- * @param sock_fd - the client's socket file descriptor
- * @return - 0 on success, -1 on failure
- */
-int recv_client_command (int sock_fd);
-
-/**
- * CHAR * GET_CLIENT_MSG:
- * @brief - after numerical protocol is received, the client sends a command in plaintext
- *          this function interprets the plain text to determine which command is sent by
- *          the client
- * @param sock_fd - the client's socket file descriptor
- * @return - returns the plaintext command on success or NULL on failure 
- */
-char * get_client_msg (int sock_fd);
-
-/**
- * INT DETERMINE_OPERATION:
- * @brief - receives a numerical command from the client and determines which file operation
- *          to perform
- * @param sock_fd - the client's socket file descriptor
- * @param command - the numerical value representing a client command
- * @return - returns 0 on success or -1 on failure
- *           (NOTE: some operations although invalid, can still return succes. This allows
- *            the user to make an accidental call and still remain connected to the server. 
- *            These errors include incorrect file or directory selection)
- */
-int determine_operation (int sock_fd, int command);
-
 /**
  * VOID * SERVER_FUNC:
- * @brief - handles the server functionality to be passed to each thread
- * @param - N/A
- * @return - (void *) NULL on success, err_code 999 on failure
- */
-void * server_func ();
-
-/**
- * INT RECV_UPLOAD_SZ:
- * @brief - if the client requests to upload a file to the file server, this
- *          function should receive the size of the file meant to be uploaded
- * @param sock_fd - the client's socket file descriptor
- * @return - 0 on success, -1 on error
- */
-int recv_upload_sz (int sock_fd);
-
-/**
- * UPLOAD_FILE_T * RECV_UPLOAD_FNAME:
- * @brief - receives the name length and the file name meant to be uploaded to the
- *          file server
- * @param sock_fd - the client's socket file descriptor
- * @return - a pointer to the struct storing the file name data (i.e. name length and
- *           the filename itself) or NULL on failure
- */
-upload_file_t * recv_upload_fname (int sock_fd);
-
-/**
- * INT SEND_DATA_TO_CLIENT:
- * @brief - this function sends the appropriate data to the client if a directory list or
- *          download request is received from the client
- * @param sock_fd - the client's socket file descriptor
- * @param operation - the operation to be performed (list or download)
- * @return - 0 on success or -1 on error 
- */
-int send_data_to_client (int sock_fd, int operation);
-
-/**
- * STRUCT POLLFD * SETUP_POLL:
- * @brief - sets up the poll structure to handle incoming client socket connections
- * @param server_fd - the server's socket file descriptor
- * @param fd_size - the max allowable number of client connections
+ * @brief - the worker thread body. Client sockets are owned by the reactor, the
+ *          workers only pick up connections that need blocking disk work done
+ *          (listing, opening files, moving file data) and hand them back
+ * @param p_arg - the reactor_t whose job queue this worker serves
+ * @return - (void *) NULL
  */
-struct pollfd * setup_poll (int server_fd, int fd_size);
+void * server_func (void * p_arg);
 
-#endif
+#endif
\ No newline at end of file
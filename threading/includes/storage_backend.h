@@ -0,0 +1,116 @@
+#ifndef __STORAGE_BACKEND_H__
+#define __STORAGE_BACKEND_H__
+
+#define _XOPEN_SOURCE 700
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+
+#include "file_index.h"
+#include "storage_layout.h"
+#include "upload_journal.h"
+#include "file_cache.h"
+#include "arena.h"
+
+#define BACKEND_NAME_POSIX  "posix"
+#define BACKEND_NAME_RAM    "ram"
+#define RAM_MIN_BUCKETS     1024
+#define RAM_BLOCK_SIZE      (16 * 1024 * 1024)
+#define RAM_PACK_MAX        (64 * 1024)
+#define RAM_COMPACT_PCT     50
+
+/*
+ * Every file the server stores or serves goes through a storage backend: the
+ * posix backend keeps them in FILE_SERVER_DIR (with its layout, segments,
+ * index and upload journals), the ram backend keeps them in memory only, so
+ * protocol throughput can be measured without the disk. The backend is picked
+ * once at startup with -d.
+ *
+ * The ram backend keeps the files in memfds: files of up to RAM_PACK_MAX bytes
+ * are packed into shared RAM_BLOCK_SIZE blocks, a larger one gets a memfd to
+ * itself, so a million small files cost a few hundred descriptors. A block
+ * that is mostly made of replaced files is copied out and dropped. It starts
+ * out with a copy of the stored files of FILE_SERVER_DIR (packed files and
+ * staged uploads are left out) and never writes anything back, uploads only
+ * live until the server stops. Uploads cannot be resumed and there are no
+ * upload sessions.
+ *
+ * The file data itself never goes through the table. open and create hand
+ * out a descriptor and the offset the file starts at in it, and the workers
+ * move byte ranges of that descriptor with sendfile, pread, pwrite and splice
+ * as before, so a backend only has to be able to give a file a descriptor.
+ * upload_checkpoint and upload_release do nothing for an upload_t a backend
+ * set up without a journal.
+ */
+
+/**
+ * @brief - the operations of a storage backend
+ * @member p_name - the name selecting it on the command line
+ * @member sessions - whether it supports chunked upload sessions
+ * @member init - sets the backend up, takes the -l layout and the -s packed
+ *                file size, which only the posix backend uses. Returns 0 on
+ *                success, -1 on error
+ * @member cleanup - releases everything init set up
+ * @member stat - file_index_lookup: true if the file exists, p_info (may be
+ *                NULL) is filled in
+ * @member walk - file_index_walk: calls p_visit for every file and sets
+ *                p_count (may be NULL), -1 if the callback stopped the walk
+ * @member list - calls p_visit for up to page_size files past cursor whose
+ *                names match p_pattern ("" for every file) and sets p_next to
+ *                the cursor of the next page, 0 after the last one. Scratch
+ *                memory comes from p_arena, the arena of the request. Returns
+ *                0 on success, -1 on error
+ * @member open - opens a file for reading, sets its size, modification time
+ *                (p_mtime_ns may be NULL), where it starts in the descriptor
+ *                and, for a hot-file cache copy that is still being filled
+ *                in, pp_fill (NULL otherwise). Returns the descriptor, -1
+ *                with errno set on error
+ * @member create - upload_begin: sets up p_upload for receiving a file from
+ *                  offset on and returns the descriptor to write it to, its
+ *                  contents start at p_base. -1 with errno set on error
+ * @member commit - upload_finish: publishes a complete upload, -1 on error
+ * @member discard - upload_abandon: drops an unfinished upload, keeping what
+ *                   can be resumed
+ * @member query - upload_query: how much of an upload is already stored
+ */
+typedef struct storage_backend
+{
+    const char    * p_name;
+    bool            sessions;
+    int           (*init) (layout_t layout, size_t pack_max);
+    void          (*cleanup) ();
+    bool          (*stat) (const char * p_filename, file_info_t * p_info);
+    int           (*walk) (file_index_visit_t p_visit, void * p_arg, size_t * p_count);
+    int           (*list) (arena_t * p_arena, uint64_t cursor, uint32_t page_size, const char * p_pattern,
+                           file_index_visit_t p_visit, void * p_arg, uint64_t * p_next);
+    int           (*open) (const char * p_filename, uint64_t * p_size, uint64_t * p_mtime_ns, uint64_t * p_base,
+                           cache_fill_t ** pp_fill);
+    int           (*create) (upload_t * p_upload, const char * p_filename, uint64_t upload_id, uint64_t size,
+                             uint64_t offset, uint64_t * p_base);
+    int           (*commit) (upload_t * p_upload, int file_fd);
+    void          (*discard) (upload_t * p_upload, int file_fd, uint64_t stored);
+    int           (*query) (const char * p_filename, uint64_t upload_id, uint64_t size, uint64_t * p_committed);
+} storage_backend_t;
+
+extern const storage_backend_t posix_backend;
+extern const storage_backend_t ram_backend;
+
+/**
+ * @brief - the backend the server runs with, set once at startup
+ */
+extern const storage_backend_t * storage_backend;
+
+/**
+ * CONST STORAGE_BACKEND_T * STORAGE_BACKEND_FIND:
+ * @brief - looks a backend up by the name given on the command line
+ * @param p_name - BACKEND_NAME_POSIX or BACKEND_NAME_RAM
+ * @return - the backend, NULL if there is none of that name
+ */
+const storage_backend_t * storage_backend_find (const char * p_name);
+
+#endif
@@ -0,0 +1,162 @@
+#ifndef __STORAGE_LAYOUT_H__
+#define __STORAGE_LAYOUT_H__
+
+#define _XOPEN_SOURCE 700
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+
+#define LAYOUT_MARKER_NAME  ".layout"
+#define LAYOUT_MARKER       FILE_SERVER_DIR LAYOUT_MARKER_NAME
+#define LAYOUT_NAME_FLAT    "flat"
+#define LAYOUT_NAME_SHARDED "sharded"
+#define SHARD_FANOUT        16
+#define SHARD_COUNT         (SHARD_FANOUT * SHARD_FANOUT)
+#define SHARD_SHIFT         56
+
+/*
+ * Files are stored either flat in FILE_SERVER_DIR or sharded over two levels
+ * of SHARD_FANOUT subdirectories picked by the FNV-1a hash of the name, e.g.
+ * FileServer/3/e/name. Clients see the same flat namespace either way. The
+ * fanout is kept at 16 x 16 so the index can watch every leaf with inotify,
+ * which still leaves only a few thousand files per directory at a million.
+ *
+ * A sharded directory holds the LAYOUT_MARKER file. Files left at the top
+ * level of a sharded directory are still found there, which lets
+ * bin/migrate_layout move them into their shards while the server is running.
+ * The server holds a shared flock on FILE_SERVER_DIR for as long as it runs so
+ * the migration tool can tell whether it is.
+ */
+
+/**
+ * @brief - the storage layout of FILE_SERVER_DIR
+ * @member LAYOUT_AUTO - only as a request: whatever the directory already uses
+ * @member LAYOUT_FLAT - every file directly in FILE_SERVER_DIR
+ * @member LAYOUT_SHARDED - files in their hashed shard directories
+ */
+typedef enum layout
+{
+    LAYOUT_AUTO,
+    LAYOUT_FLAT,
+    LAYOUT_SHARDED,
+} layout_t;
+
+/**
+ * @brief - the layout the server runs with, set once by layout_init
+ */
+extern layout_t storage_layout;
+
+/**
+ * INT LAYOUT_INIT:
+ * @brief - locks FILE_SERVER_DIR for the lifetime of the server and settles its
+ *          layout. Asking for the sharded layout on a flat directory creates
+ *          the shards, its files are served from the top level until they are
+ *          migrated. A sharded directory is never run flat
+ * @param requested - the layout asked for on the cmdline, LAYOUT_AUTO if none
+ * @return - 0 on success, -1 on error
+ */
+int layout_init (layout_t requested);
+
+/**
+ * VOID LAYOUT_CLEANUP:
+ * @brief - releases the lock taken by layout_init
+ * @return - N/A
+ */
+void layout_cleanup ();
+
+/**
+ * LAYOUT_T LAYOUT_READ:
+ * @brief - reports the layout FILE_SERVER_DIR is marked with
+ * @return - LAYOUT_SHARDED if it holds LAYOUT_MARKER, LAYOUT_FLAT otherwise
+ */
+layout_t layout_read ();
+
+/**
+ * INT LAYOUT_CREATE_SHARDS:
+ * @brief - creates every shard directory, then marks FILE_SERVER_DIR sharded
+ * @return - 0 on success, -1 on error
+ */
+int layout_create_shards ();
+
+/**
+ * UINT64_T LAYOUT_HASH:
+ * @brief - FNV-1a hash of a file name, its top byte is the shard
+ * @param p_filename - the file name
+ * @return - the hash
+ */
+uint64_t layout_hash (const char * p_filename);
+
+/**
+ * UNSIGNED LAYOUT_SHARD:
+ * @brief - the shard a name hash belongs to
+ * @param hash - from layout_hash
+ * @return - 0 - SHARD_COUNT - 1
+ */
+unsigned layout_shard (uint64_t hash);
+
+/**
+ * INT LAYOUT_SHARD_DIR:
+ * @brief - builds the path of a shard directory, with a trailing slash
+ * @param shard - 0 - SHARD_COUNT - 1
+ * @param p_path / path_len - destination
+ * @return - 0 on success, -1 if the path does not fit
+ */
+int layout_shard_dir (unsigned shard, char * p_path, size_t path_len);
+
+/**
+ * INT LAYOUT_PATH:
+ * @brief - builds the path a file is stored under in the current layout
+ * @param p_filename - the file name
+ * @param p_path / path_len - destination
+ * @return - 0 on success, -1 if the path does not fit
+ */
+int layout_path (const char * p_filename, char * p_path, size_t path_len);
+
+/**
+ * INT LAYOUT_OPEN:
+ * @brief - opens a stored file, in the sharded layout also at the top level if
+ *          it has not been migrated yet
+ * @param p_filename - the file name
+ * @param flags - open() flags, without O_CREAT
+ * @return - (int) the file descriptor, -1 with errno set on error
+ */
+int layout_open (const char * p_filename, int flags);
+
+/**
+ * INT LAYOUT_LSTAT:
+ * @brief - lstat() of a stored file, with the same fallback as layout_open
+ * @param p_filename - the file name
+ * @param p_stat - filled in on success
+ * @return - 0 on success, -1 with errno set on error
+ */
+int layout_lstat (const char * p_filename, struct stat * p_stat);
+
+/**
+ * VOID LAYOUT_DROP_FLAT_COPY:
+ * @brief - once a file has been published in its shard, removes a copy of it
+ *          still waiting at the top level for migration, it is stale
+ * @param p_filename - the file name
+ * @return - N/A
+ */
+void layout_drop_flat_copy (const char * p_filename);
+
+/**
+ * VOID LAYOUT_UNLINK:
+ * @brief - removes the stored file of a name wherever the layout keeps it,
+ *          once a packed copy has replaced it
+ * @param p_filename - the file name
+ * @return - N/A
+ */
+void layout_unlink (const char * p_filename);
+
+#endif
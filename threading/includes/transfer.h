@@ -0,0 +1,147 @@
+#ifndef __TRANSFER_H__
+#define __TRANSFER_H__
+
+#define _XOPEN_SOURCE 700
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/sendfile.h>
+
+#include "my_queue.h"
+#include "buffer_pool.h"
+
+#define XFER_BUF_SZ     (128 * 1024)
+#define SENDFILE_MAX    0x7ffff000
+#define SPLICE_PIPE_SZ  (1024 * 1024)
+
+/**
+ * @brief - selects how uploads move bytes from the socket to disk
+ * @member UPLOAD_BUFFERED - recv() into a pool buffer then pwrite()
+ * @member UPLOAD_SPLICE - socket -> pipe -> file with splice(), payload bytes
+ *                         never enter user space
+ */
+typedef enum upload_mode
+{
+    UPLOAD_BUFFERED = 0,
+    UPLOAD_SPLICE
+} upload_mode_t;
+
+/**
+ * @brief - a run of data in a sparse file, see find_extents
+ * @member offset - where the run starts in the file
+ * @member length - number of bytes in the run
+ */
+typedef struct extent
+{
+    uint64_t    offset;
+    uint64_t    length;
+} extent_t;
+
+/*
+ * All of the *_some transfer functions below expect a non-blocking socket. They
+ * move as many bytes as the socket allows (up to count) and return as soon as it
+ * would block, so a worker thread never parks on a slow client. The caller waits
+ * for readiness in the reactor and calls again.
+ */
+
+/**
+ * SSIZE_T PWRITE_ALL:
+ * @brief - writes the entire buffer to the file at the given offset, retrying
+ *          on short writes and EINTR
+ * @param file_fd - file descriptor of the destination file
+ * @param p_buf - pointer to the data to write
+ * @param len - number of bytes to write
+ * @param offset - offset within the file to write to
+ * @return - (ssize_t) number of bytes written (always len) on success, -1 on error
+ */
+ssize_t pwrite_all (int file_fd, const void * p_buf, size_t len, off_t offset);
+
+/**
+ * SSIZE_T SEND_FILE_SOME:
+ * @brief - zero-copy transfer of a byte range of an open file to a socket with
+ *          sendfile(), falling back to a fixed size pread()/send() loop when the
+ *          file system does not support sendfile
+ * @param sockfd - non-blocking client socket file descriptor
+ * @param file_fd - file descriptor of the file being sent
+ * @param p_offset - offset within the file to send from, advanced by the number
+ *                   of bytes sent
+ * @param count - maximum number of bytes to send
+ * @return - (ssize_t) number of bytes sent (0 if the socket was not writable),
+ *           -1 on error
+ */
+ssize_t send_file_some (int sockfd, int file_fd, off_t * p_offset, size_t count);
+
+/**
+ * SSIZE_T RECV_FILE_SOME:
+ * @brief - moves bytes from the socket into a file, batching socket reads into
+ *          a buffer from the pool and flushing it with pwrite() so memory
+ *          use is constant regardless of file size
+ * @param sockfd - non-blocking client socket file descriptor
+ * @param file_fd - file descriptor of the destination file
+ * @param p_offset - offset within the file to write at, advanced by the number
+ *                   of bytes written
+ * @param count - maximum number of bytes to receive
+ * @return - (ssize_t) number of bytes received and written (0 if the socket had
+ *           nothing to read), -1 on error. A client that hangs up before count
+ *           bytes arrive is reported as -1 with errno set to ECONNRESET
+ */
+ssize_t recv_file_some (int sockfd, int file_fd, off_t * p_offset, size_t count);
+
+/**
+ * SSIZE_T RECV_FILE_SPLICE_SOME:
+ * @brief - zero-copy counterpart of recv_file_some, moves bytes from the socket
+ *          into the file through the thread's pipe with splice(). If the socket
+ *          or file system does not support splice the call is finished with
+ *          recv_file_some
+ * @param sockfd - non-blocking client socket file descriptor
+ * @param file_fd - file descriptor of the destination file
+ * @param p_offset - offset within the file to write at, advanced by the number
+ *                   of bytes written
+ * @param count - maximum number of bytes to receive
+ * @param p_fell_back - set to true if splice was found to be unsupported, the
+ *                      caller should use recv_file_some from then on
+ * @return - same as recv_file_some
+ */
+ssize_t recv_file_splice_some (int sockfd, int file_fd, off_t * p_offset, size_t count, bool * p_fell_back);
+
+/**
+ * SSIZE_T FIND_EXTENTS:
+ * @brief - maps the data of a byte range of a file with SEEK_DATA/SEEK_HOLE,
+ *          whatever lies between the extents found is a hole. A file system
+ *          that does not track holes reports the whole range as data
+ * @param file_fd - the file
+ * @param base - where the file starts in file_fd, the offsets are relative to it
+ * @param p_offset - where to start mapping, advanced to where mapping stopped
+ *                   (end once the whole range has been mapped)
+ * @param end - end of the range
+ * @param p_extents - filled in with the extents found, in ascending order
+ * @param max - at most this many extents are filled in
+ * @return - (ssize_t) number of extents found, -1 on error
+ */
+ssize_t find_extents (int file_fd, uint64_t base, uint64_t * p_offset, uint64_t end, extent_t * p_extents,
+                      size_t max);
+
+/**
+ * INT PUNCH_RANGE:
+ * @brief - turns a byte range of a file into a hole that reads as zeros and
+ *          grows the file to cover it, the disk space the range held is freed.
+ *          Where holes cannot be punched the range is left as it is, the
+ *          caller must know it reads as zeros already
+ * @param file_fd - file descriptor of the file, open for writing
+ * @param offset - where the range starts
+ * @param length - number of bytes in the range
+ * @return - 0 on success, -1 on error
+ */
+int punch_range (int file_fd, uint64_t offset, uint64_t length);
+
+#endif
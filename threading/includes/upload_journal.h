@@ -0,0 +1,245 @@
+#ifndef __UPLOAD_JOURNAL_H__
+#define __UPLOAD_JOURNAL_H__
+
+#define _XOPEN_SOURCE 700
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <dirent.h>
+#include <endian.h>
+#include <pthread.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+
+#include "segment_store.h"
+#include "arena.h"
+
+#define UPLOAD_STAGING_DIR      FILE_SERVER_DIR ".uploads/"
+#define UPLOAD_CHECKPOINT_SZ    (64 * 1024 * 1024)
+#define UPLOAD_ANONYMOUS        0
+#define SESSION_MIN_CHUNK       (64 * 1024)
+#define SESSION_MAX_CHUNKS      (1024 * 1024)
+
+/*
+ * Uploads never write to the published file. The contents go to a staging
+ * file under UPLOAD_STAGING_DIR next to a small journal holding the upload id,
+ * the expected size and how many bytes are known to be on disk. The journal
+ * is brought up to date every UPLOAD_CHECKPOINT_SZ bytes (after the staged
+ * data has been flushed) and whenever an upload is abandoned, so a client
+ * that reconnects can ask how far it got and send only the rest. A finished
+ * upload is flushed and renamed over the published name in one step, readers
+ * only ever see the old file or the complete new one.
+ *
+ * Uploads with id UPLOAD_ANONYMOUS (legacy clients and plain v2 uploads)
+ * are staged the same way but cannot be resumed, their staging files are
+ * removed when they fail. The journal is also locked while its upload is
+ * running, a second upload of the same name fails with EBUSY.
+ *
+ * An upload session stages a file that arrives as fixed size chunks in any
+ * order over any number of connections. Its journal is followed by a bitmap
+ * with one bit per chunk, set once the chunk has been flushed, so a repeated
+ * chunk is simply stored again and a client (or a restarted server) knows
+ * which chunks are still missing. The session keeps its journal locked until
+ * it is committed, committing publishes the file like a finished upload.
+ *
+ * A new upload small enough for segment_packs is packed instead: it is
+ * written straight into a record reserved in the active segment, which needs
+ * neither a journal nor a staging file, and publishing it marks the record
+ * LIVE. A failed one leaves a DEAD record for the compactor and starts over
+ * when it is sent again.
+ */
+
+typedef struct upload_session upload_session_t;
+
+/**
+ * @brief - an upload in progress
+ * @member journal_fd - the locked journal, -1 when no upload is open
+ * @member upload_id - id chosen by the client, UPLOAD_ANONYMOUS if none
+ * @member size - final size of the file
+ * @member committed - bytes recorded as stored in the journal
+ * @member filename - name the file is published under
+ * @member slot - the record of a packed upload, slot.p_segment is NULL for a
+ *                staged one
+ */
+typedef struct upload
+{
+    int             journal_fd;
+    uint64_t        upload_id;
+    uint64_t        size;
+    uint64_t        committed;
+    char            filename[MAXNAMLEN + 1];
+    segment_slot_t  slot;
+} upload_t;
+
+/**
+ * VOID UPLOAD_INIT:
+ * @brief - marks an upload slot as unused
+ * @param p_upload - the slot
+ * @return - N/A
+ */
+void upload_init (upload_t * p_upload);
+
+/**
+ * INT UPLOAD_QUERY:
+ * @brief - reports how much of an interrupted upload is already stored
+ * @param p_filename - name the upload will be published under
+ * @param upload_id - id the client gave the upload
+ * @param size - final size of the file
+ * @param p_committed - set to the bytes the client can skip, 0 if there is no
+ *                      staged upload with this id and size
+ * @return - 0 on success, -1 on error
+ */
+int upload_query (const char * p_filename, uint64_t upload_id, uint64_t size, uint64_t * p_committed);
+
+/**
+ * INT UPLOAD_BEGIN:
+ * @brief - opens the staging file for an upload. Offset 0 starts a new upload
+ *          (discarding any staged one) and preallocates the file, a non zero
+ *          offset continues the staged upload with the same id and size
+ * @param p_upload - the slot to fill in
+ * @param p_filename - name to publish the file under
+ * @param upload_id - id the client gave the upload, UPLOAD_ANONYMOUS if none
+ * @param size - final size of the file
+ * @param offset - where the client's data starts, at most the committed size
+ * @return - (int) file descriptor of the staging file to write at the file's
+ *           own offsets (plus p_upload->slot.base for a packed upload), -1 on
+ *           error with errno set (ESTALE if the staged upload does not match,
+ *           EBUSY if it is being written right now)
+ */
+int upload_begin (upload_t * p_upload, const char * p_filename, uint64_t upload_id, uint64_t size, uint64_t offset);
+
+/**
+ * INT UPLOAD_CHECKPOINT:
+ * @brief - records progress in the journal once UPLOAD_CHECKPOINT_SZ bytes
+ *          have been stored since the last record, flushing the staged data
+ *          first so the journal never claims bytes that are not on disk
+ * @param p_upload - the upload
+ * @param file_fd - its staging file
+ * @param stored - bytes stored so far
+ * @param force - record the progress regardless of how much was stored
+ * @return - 0 on success, -1 on error
+ */
+int upload_checkpoint (upload_t * p_upload, int file_fd, uint64_t stored, bool force);
+
+/**
+ * INT UPLOAD_FINISH:
+ * @brief - flushes a complete upload and atomically renames it over the
+ *          published name, then drops the journal. A packed upload is
+ *          published by committing its record. The caller still closes
+ *          file_fd and releases the slot
+ * @param p_upload - the upload
+ * @param file_fd - its staging file
+ * @return - 0 on success, -1 on error
+ */
+int upload_finish (upload_t * p_upload, int file_fd);
+
+/**
+ * VOID UPLOAD_ABANDON:
+ * @brief - stops an upload that could not be completed. A resumable upload
+ *          keeps its staging file and records its progress, an anonymous one
+ *          is removed (a packed one marked DEAD). The caller still closes
+ *          file_fd and releases the slot
+ * @param p_upload - the upload
+ * @param file_fd - its staging file
+ * @param stored - bytes stored so far
+ * @return - N/A
+ */
+void upload_abandon (upload_t * p_upload, int file_fd, uint64_t stored);
+
+/**
+ * VOID UPLOAD_RELEASE:
+ * @brief - unlocks and closes the journal (or abandons a packed record that
+ *          is still reserved), the slot can be reused afterwards
+ * @param p_upload - the slot
+ * @return - N/A
+ */
+void upload_release (upload_t * p_upload);
+
+/**
+ * CHAR * UPLOAD_SESSION_OPEN:
+ * @brief - opens the upload session of a name, or returns the one already
+ *          open with the same id, size and chunk size. A session left on disk
+ *          with the same parameters is continued, anything else staged under
+ *          the name is discarded
+ * @param p_filename - name to publish the file under
+ * @param upload_id - id the client gave the upload, not UPLOAD_ANONYMOUS
+ * @param size - final size of the file
+ * @param chunk_size - size of every chunk but the last, at least
+ *                     SESSION_MIN_CHUNK and at most SESSION_MAX_CHUNKS chunks
+ * @param p_arena - arena of the request the reply is allocated from
+ * @param reserve - free bytes to leave in front of the bitmap
+ * @param p_len - set to reserve plus the length of the bitmap
+ * @return - (char *) buffer with the bitmap of the chunks already stored
+ *           after reserve bytes, NULL with errno set on error (EBUSY if the
+ *           name is being uploaded some other way)
+ */
+char * upload_session_open (const char * p_filename, uint64_t upload_id, uint64_t size, uint64_t chunk_size,
+                            arena_t * p_arena, size_t reserve, size_t * p_len);
+
+/**
+ * INT UPLOAD_SESSION_ATTACH:
+ * @brief - checks a chunk against the open session of a name and lets the
+ *          caller write it
+ * @param p_filename - name the session publishes
+ * @param upload_id - id of the session
+ * @param offset - where the chunk starts, a multiple of the chunk size
+ * @param length - length of the chunk, the chunk size except for the last one
+ * @param pp_session - set to the session, to be passed to
+ *                     upload_session_store and upload_session_detach
+ * @return - (int) descriptor of the staging file to write the chunk at its
+ *           own offsets and close afterwards, -1 with errno set on error
+ *           (ENOENT if no session is open, ESTALE if it has another id,
+ *           EINVAL for a chunk that does not fit the session)
+ */
+int upload_session_attach (const char * p_filename, uint64_t upload_id, uint64_t offset, uint64_t length,
+                           upload_session_t ** pp_session);
+
+/**
+ * INT UPLOAD_SESSION_STORE:
+ * @brief - flushes a complete chunk and marks it stored in the journal
+ * @param p_session - the session
+ * @param file_fd - descriptor returned by upload_session_attach
+ * @param offset - where the chunk starts
+ * @return - 0 on success, -1 on error
+ */
+int upload_session_store (upload_session_t * p_session, int file_fd, uint64_t offset);
+
+/**
+ * VOID UPLOAD_SESSION_DETACH:
+ * @brief - ends a chunk started with upload_session_attach, whether or not it
+ *          was stored
+ * @param p_session - the session
+ * @return - N/A
+ */
+void upload_session_detach (upload_session_t * p_session);
+
+/**
+ * INT UPLOAD_SESSION_COMMIT:
+ * @brief - publishes the file of a session once every chunk is stored and
+ *          closes the session
+ * @param p_filename - name the session publishes
+ * @param upload_id - id of the session
+ * @param size - final size of the file
+ * @return - 0 on success, -1 with errno set on error (ENODATA if chunks are
+ *           missing, EBUSY while chunks are being received)
+ */
+int upload_session_commit (const char * p_filename, uint64_t upload_id, uint64_t size);
+
+/**
+ * VOID UPLOAD_SESSION_CLEANUP:
+ * @brief - closes every open session at shutdown, their journals stay on disk
+ *          so they can be continued
+ * @return - N/A
+ */
+void upload_session_cleanup ();
+
+#endif
@@ -0,0 +1,168 @@
+#include "../includes/arena.h"
+
+/**
+ * @brief - a block of an arena, the blocks are chained newest first
+ * @member p_next - the next older block
+ * @member size / used - bytes in data and bytes handed out
+ * @member data - the memory handed out
+ */
+struct arena_block
+{
+    struct arena_block  * p_next;
+    size_t                size;
+    size_t                used;
+    char                  data[];
+};
+
+static atomic_uint_fast64_t arena_requests     = 0;
+static atomic_uint_fast64_t arena_allocations  = 0;
+static atomic_uint_fast64_t arena_max_allocs   = 0;
+static atomic_uint_fast64_t arena_extra_blocks = 0;
+
+/**
+ * SIZE_T ALIGN_PAD:
+ * @brief - bytes to skip in a block so the next allocation is aligned
+ */
+static size_t align_pad (const arena_block_t * p_block)
+{
+    return (size_t)(-(uintptr_t)(p_block->data + p_block->used)) & (ARENA_ALIGN - 1);
+}
+
+/**
+ * VOID RECORD_REQUEST:
+ * @brief - adds the allocations since the last reset to the counters
+ */
+static void record_request (arena_t * p_arena)
+{
+    if (0 == p_arena->allocs)
+    {
+        return;
+    }
+
+    atomic_fetch_add_explicit(&arena_requests, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&arena_allocations, p_arena->allocs, memory_order_relaxed);
+    atomic_fetch_add_explicit(&arena_extra_blocks, p_arena->extra_blocks, memory_order_relaxed);
+
+    uint_fast64_t seen = atomic_load_explicit(&arena_max_allocs, memory_order_relaxed);
+    while ((seen < p_arena->allocs) &&
+           (false == atomic_compare_exchange_weak_explicit(&arena_max_allocs, &seen, p_arena->allocs,
+                                                           memory_order_relaxed, memory_order_relaxed)))
+    {
+        continue;
+    }
+    p_arena->allocs       = 0;
+    p_arena->extra_blocks = 0;
+}
+
+/**
+ * ARENA_BLOCK_T * ADD_BLOCK:
+ * @brief - puts a new block of data_sz bytes in front of the arena's blocks
+ */
+static arena_block_t * add_block (arena_t * p_arena, size_t data_sz)
+{
+    arena_block_t * p_block = malloc(sizeof(arena_block_t) + data_sz + ARENA_ALIGN);
+
+    if (NULL == p_block)
+    {
+        errno = ENOMEM;
+        fprintf(stderr, "%s could not allocate arena block: %s\n", __func__, strerror(errno));
+        return NULL;
+    }
+    p_block->size = data_sz + ARENA_ALIGN;
+    p_block->used = 0;
+    if (NULL != p_arena->p_block)
+    {
+        p_arena->extra_blocks++;
+    }
+    p_block->p_next  = p_arena->p_block;
+    p_arena->p_block = p_block;
+    return p_block;
+}
+
+void * arena_alloc (arena_t * p_arena, size_t size)
+{
+    arena_block_t * p_block = p_arena->p_block;
+
+    // the first block always has the standard size, it is the one kept
+    if ((NULL == p_block) && (NULL == (p_block = add_block(p_arena, ARENA_BLOCK_SZ))))
+    {
+        return NULL;
+    }
+    if (p_block->used + align_pad(p_block) + size > p_block->size)
+    {
+        // room to double the allocation in place, the way listings grow
+        size_t data_sz = (ARENA_BLOCK_SZ / 2 > size) ? ARENA_BLOCK_SZ : (2 * size);
+        if (NULL == (p_block = add_block(p_arena, data_sz)))
+        {
+            return NULL;
+        }
+    }
+
+    p_block->used   += align_pad(p_block);
+    p_arena->p_last  = p_block->data + p_block->used;
+    p_block->used   += size;
+    p_arena->allocs++;
+
+    return p_arena->p_last;
+}
+
+void * arena_grow (arena_t * p_arena, void * p_old, size_t old_size, size_t new_size)
+{
+    arena_block_t * p_block = p_arena->p_block;
+
+    if (NULL == p_old)
+    {
+        return arena_alloc(p_arena, new_size);
+    }
+
+    if ((p_old == p_arena->p_last) && ((size_t)((char *)p_old - p_block->data) + new_size <= p_block->size))
+    {
+        p_block->used = ((char *)p_old - p_block->data) + new_size;
+        return p_old;
+    }
+
+    void * p_new = arena_alloc(p_arena, new_size);
+    if (NULL != p_new)
+    {
+        memcpy(p_new, p_old, (old_size < new_size) ? old_size : new_size);
+    }
+    return p_new;
+}
+
+void arena_reset (arena_t * p_arena)
+{
+    arena_block_t * p_block = p_arena->p_block;
+
+    record_request(p_arena);
+    if (NULL == p_block)
+    {
+        return;
+    }
+
+    while (NULL != p_block->p_next)
+    {
+        arena_block_t * p_older = p_block->p_next;
+        free(p_block);
+        p_block = p_older;
+    }
+    p_block->used    = 0;
+    p_arena->p_block = p_block;
+    p_arena->p_last  = NULL;
+}
+
+void arena_release (arena_t * p_arena)
+{
+    arena_reset(p_arena);
+    free(p_arena->p_block);
+    p_arena->p_block = NULL;
+}
+
+void arena_get_stats (arena_stats_t * p_stats)
+{
+    p_stats->requests        = atomic_load_explicit(&arena_requests, memory_order_relaxed);
+    p_stats->allocations     = atomic_load_explicit(&arena_allocations, memory_order_relaxed);
+    p_stats->max_allocations = atomic_load_explicit(&arena_max_allocs, memory_order_relaxed);
+    p_stats->extra_blocks    = atomic_load_explicit(&arena_extra_blocks, memory_order_relaxed);
+}
+
+/*** end arena.c ***/
@@ -0,0 +1,209 @@
+#include "../includes/buffer_pool.h"
+
+/**
+ * @brief - the pool
+ * @member running - cleared by buffer_pool_cleanup to release the waiters
+ * @member p_base / map_size - the mapping every buffer is carved out of
+ * @member buffer_size / buffers - size and number of the buffers
+ * @member huge_pages - the mapping uses explicit huge pages
+ * @member p_free - indices of the free buffers
+ * @member in_use ... max_wait_ns - the counters of buffer_pool_stats_t
+ */
+typedef struct buffer_pool
+{
+    bool                    running;
+    char                  * p_base;
+    size_t                  map_size;
+    size_t                  buffer_size;
+    size_t                  buffers;
+    bool                    huge_pages;
+    queue                 * p_free;
+    atomic_uint_fast64_t    in_use;
+    atomic_uint_fast64_t    peak_in_use;
+    atomic_uint_fast64_t    acquisitions;
+    atomic_uint_fast64_t    waits;
+    atomic_uint_fast64_t    wait_ns;
+    atomic_uint_fast64_t    max_wait_ns;
+} buffer_pool_t;
+
+static buffer_pool_t pool = { .running = false };
+
+/**
+ * UINT64_T MONOTONIC_NS:
+ * @brief - the monotonic clock in nanoseconds
+ */
+static uint64_t monotonic_ns ()
+{
+    struct timespec now = { 0 };
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return ((uint64_t)now.tv_sec * 1000000000ULL) + (uint64_t)now.tv_nsec;
+}
+
+/**
+ * VOID RAISE_MAX:
+ * @brief - raises an atomic maximum to value
+ */
+static void raise_max (atomic_uint_fast64_t * p_max, uint64_t value)
+{
+    uint_fast64_t seen = atomic_load_explicit(p_max, memory_order_relaxed);
+    while ((seen < value) &&
+           (false == atomic_compare_exchange_weak_explicit(p_max, &seen, value,
+                                                           memory_order_relaxed, memory_order_relaxed)))
+    {
+        continue;
+    }
+}
+
+/**
+ * CHAR * MAP_POOL:
+ * @brief - maps size bytes for the pool, with explicit huge pages if asked and
+ *          available, otherwise with regular pages that may become transparent
+ *          huge pages
+ */
+static char * map_pool (size_t size, bool huge_pages)
+{
+    void * p_map = MAP_FAILED;
+
+    if (true == huge_pages)
+    {
+        p_map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (MAP_FAILED != p_map)
+        {
+            pool.huge_pages = true;
+            return p_map;
+        }
+        fprintf(stderr, "%s no huge pages reserved, using transparent huge pages: %s\n",
+                __func__, strerror(errno));
+    }
+
+    p_map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (MAP_FAILED == p_map)
+    {
+        fprintf(stderr, "%s could not map the buffer pool: %s\n", __func__, strerror(errno));
+        return NULL;
+    }
+    if (true == huge_pages)
+    {
+        // only a hint, the pool works the same without it
+        madvise(p_map, size, MADV_HUGEPAGE);
+    }
+    return p_map;
+}
+
+int buffer_pool_init (size_t buffer_size, uint64_t budget, bool huge_pages)
+{
+    long page_size = sysconf(_SC_PAGESIZE);
+
+    if ((0 == buffer_size) || (0 != (buffer_size % (size_t)page_size)) || (budget < buffer_size))
+    {
+        errno = EINVAL;
+        fprintf(stderr, "%s invalid buffer size or budget: %s\n", __func__, strerror(errno));
+        return -1;
+    }
+
+    memset(&pool, 0, sizeof(pool));
+    pool.buffer_size = buffer_size;
+    pool.buffers     = budget / buffer_size;
+    pool.map_size    = pool.buffers * buffer_size;
+    if (true == huge_pages)
+    {
+        pool.map_size = (pool.map_size + POOL_HUGE_PAGE_SZ - 1) & ~((size_t)POOL_HUGE_PAGE_SZ - 1);
+    }
+
+    pool.p_base = map_pool(pool.map_size, huge_pages);
+    if (NULL == pool.p_base)
+    {
+        return -1;
+    }
+
+    pool.p_free = init_queue(pool.buffers);
+    if (NULL == pool.p_free)
+    {
+        munmap(pool.p_base, pool.map_size);
+        pool.p_base = NULL;
+        return -1;
+    }
+    for (size_t idx = 0; idx < pool.buffers; idx++)
+    {
+        enqueue(pool.p_free, (item){ .data = (int)idx });
+    }
+
+    pool.running = true;
+    return 0;
+}
+
+void buffer_pool_cleanup ()
+{
+    if (NULL == pool.p_free)
+    {
+        return;
+    }
+
+    pool.running = false;
+    wake_all(pool.p_free);
+
+    clear(pool.p_free);
+    CLEAN(pool.p_free);
+    munmap(pool.p_base, pool.map_size);
+    pool.p_base = NULL;
+}
+
+char * buffer_get ()
+{
+    if ((NULL == pool.p_free) || (false == pool.running))
+    {
+        errno = ESHUTDOWN;
+        return NULL;
+    }
+
+    int idx = dequeue(pool.p_free);
+    if (-1 == idx)
+    {
+        // every buffer is in flight, wait for one to come back
+        uint64_t start = monotonic_ns();
+        idx = dequeue_wait(pool.p_free, &pool.running);
+        uint64_t waited = monotonic_ns() - start;
+
+        atomic_fetch_add_explicit(&pool.waits, 1, memory_order_relaxed);
+        atomic_fetch_add_explicit(&pool.wait_ns, waited, memory_order_relaxed);
+        raise_max(&pool.max_wait_ns, waited);
+        if (-1 == idx)
+        {
+            errno = ESHUTDOWN;
+            return NULL;
+        }
+    }
+
+    uint64_t in_use = atomic_fetch_add_explicit(&pool.in_use, 1, memory_order_relaxed) + 1;
+    raise_max(&pool.peak_in_use, in_use);
+    atomic_fetch_add_explicit(&pool.acquisitions, 1, memory_order_relaxed);
+
+    return pool.p_base + ((size_t)idx * pool.buffer_size);
+}
+
+void buffer_put (char * p_buffer)
+{
+    if ((NULL == p_buffer) || (NULL == pool.p_free))
+    {
+        return;
+    }
+
+    size_t idx = (size_t)(p_buffer - pool.p_base) / pool.buffer_size;
+    atomic_fetch_sub_explicit(&pool.in_use, 1, memory_order_relaxed);
+    enqueue(pool.p_free, (item){ .data = (int)idx });
+}
+
+void buffer_pool_get_stats (buffer_pool_stats_t * p_stats)
+{
+    p_stats->buffers      = pool.buffers;
+    p_stats->buffer_size  = pool.buffer_size;
+    p_stats->in_use       = atomic_load_explicit(&pool.in_use, memory_order_relaxed);
+    p_stats->peak_in_use  = atomic_load_explicit(&pool.peak_in_use, memory_order_relaxed);
+    p_stats->acquisitions = atomic_load_explicit(&pool.acquisitions, memory_order_relaxed);
+    p_stats->waits        = atomic_load_explicit(&pool.waits, memory_order_relaxed);
+    p_stats->wait_ns      = atomic_load_explicit(&pool.wait_ns, memory_order_relaxed);
+    p_stats->max_wait_ns  = atomic_load_explicit(&pool.max_wait_ns, memory_order_relaxed);
+    p_stats->huge_pages   = pool.huge_pages;
+}
+
+/*** end buffer_pool.c ***/
@@ -0,0 +1,1522 @@
+#include "../includes/connection.h"
+#include "../includes/server.h"
+#include "../includes/mux.h"
+
+#define PARSE_JOB       2
+#define EXTENT_BATCH    64
+
+conn_t * conn_create (reactor_t * p_reactor, int sockfd)
+{
+    conn_t * p_conn = calloc(1, sizeof(conn_t));
+    if (NULL == p_conn)
+    {
+        errno = ENOMEM;
+        fprintf(stderr, "%s could not allocate connection: %s\n", __func__, strerror(errno));
+        return NULL;
+    }
+
+    p_conn->sockfd    = sockfd;
+    p_conn->p_reactor = p_reactor;
+    p_conn->proto     = PROTO_LEGACY;
+    p_conn->state     = CONN_READ_CMD;
+    p_conn->file_fd   = -1;
+    upload_init(&p_conn->upload);
+
+    return p_conn;
+}
+
+/**
+ * VOID CLEAR_OUTPUT:
+ * @brief - drops the reply currently attached to the connection
+ */
+static void clear_output (conn_t * p_conn)
+{
+    if (true == p_conn->out_owned)
+    {
+        // the reply is gone, and with it the request
+        arena_reset(&p_conn->arena);
+    }
+    p_conn->p_out     = NULL;
+    p_conn->out_len   = 0;
+    p_conn->out_off   = 0;
+    p_conn->out_owned = false;
+}
+
+/**
+ * VOID CLOSE_FILE:
+ * @brief - closes the file (and upload journal) of a finished or abandoned
+ *          transfer
+ */
+static void close_file (conn_t * p_conn)
+{
+    if (-1 != p_conn->file_fd)
+    {
+        close(p_conn->file_fd);
+        p_conn->file_fd = -1;
+    }
+    file_cache_release(p_conn->p_fill);
+    p_conn->p_fill = NULL;
+    if (NULL != p_conn->p_session)
+    {
+        upload_session_detach(p_conn->p_session);
+        p_conn->p_session = NULL;
+    }
+    upload_release(&p_conn->upload);
+    p_conn->xfer_size = 0;
+    p_conn->xfer_off  = 0;
+}
+
+void conn_destroy (conn_t * p_conn)
+{
+    if (NULL == p_conn)
+    {
+        return;
+    }
+
+    close_file(p_conn);
+    clear_output(p_conn);
+    mux_destroy(p_conn->p_mux);
+    arena_release(&p_conn->arena);
+    free(p_conn);
+}
+
+/**
+ * VOID SET_OUTPUT:
+ * @brief - queues a reply to be flushed before entering next_state
+ */
+static void set_output (conn_t * p_conn, char * p_out, size_t out_len, bool owned, conn_state_t next_state)
+{
+    clear_output(p_conn);
+    p_conn->p_out      = p_out;
+    p_conn->out_len    = out_len;
+    p_conn->out_owned  = owned;
+    p_conn->next_state = next_state;
+    p_conn->state      = CONN_WRITE_OUT;
+}
+
+/**
+ * CONN_STATE_T IDLE_STATE:
+ * @brief - the state that waits for the next request in the client's protocol
+ */
+static conn_state_t idle_state (conn_t * p_conn)
+{
+    return (PROTO_V2 == p_conn->proto) ? CONN_V2_READ_HDR : CONN_READ_CMD;
+}
+
+/**
+ * VOID REPLY_ERROR:
+ * @brief - queues a v2 error reply for the request being served
+ */
+static void reply_error (conn_t * p_conn, int err)
+{
+    size_t len = v2_encode_error(p_conn->hdr, p_conn->opcode, p_conn->request_id, err);
+    set_output(p_conn, p_conn->hdr, len, false, CONN_V2_READ_HDR);
+}
+
+/**
+ * VOID REJECT_REQUEST:
+ * @brief - skips the rest of a v2 request's payload and then answers it with an
+ *          error, so a bad request never desynchronizes the connection
+ */
+static void reject_request (conn_t * p_conn, int err, uint64_t payload_left)
+{
+    p_conn->hdr_len   = v2_encode_error(p_conn->hdr, p_conn->opcode, p_conn->request_id, err);
+    p_conn->xfer_size = payload_left;
+    p_conn->xfer_off  = 0;
+    p_conn->state     = CONN_UL_DISCARD;
+}
+
+/**
+ * INT SUBMIT:
+ * @brief - hands the connection to the worker threads to run the given job. The
+ *          worker may finish before this returns, so the caller must not touch
+ *          the connection afterwards
+ * @return - PARSE_JOB
+ */
+static int submit (conn_t * p_conn, job_type_t job)
+{
+    p_conn->job   = job;
+    p_conn->state = CONN_IN_JOB;
+    reactor_submit_job(p_conn);
+    return PARSE_JOB;
+}
+
+void conn_consume_input (conn_t * p_conn, size_t len)
+{
+    memmove(p_conn->in_buf, p_conn->in_buf + len, p_conn->in_len - len);
+    p_conn->in_len -= len;
+}
+
+int conn_fill_input (conn_t * p_conn)
+{
+    if (CONN_IN_BUF_SZ == p_conn->in_len)
+    {
+        fprintf(stderr, "%s client message does not fit the input buffer\n", __func__);
+        return -1;
+    }
+
+    for (;;)
+    {
+        ssize_t bytes_recv = recv(p_conn->sockfd, p_conn->in_buf + p_conn->in_len,
+                                  CONN_IN_BUF_SZ - p_conn->in_len, 0);
+        if (0 < bytes_recv)
+        {
+            p_conn->in_len += bytes_recv;
+            return 1;
+        }
+        if (0 == bytes_recv)
+        {
+            return -1;
+        }
+        if (EINTR == errno)
+        {
+            continue;
+        }
+        if ((EAGAIN == errno) || (EWOULDBLOCK == errno))
+        {
+            return 0;
+        }
+        fprintf(stderr, "%s could not receive from client: %s\n", __func__, strerror(errno));
+        return -1;
+    }
+}
+
+/**
+ * INT FLUSH_OUTPUT:
+ * @brief - sends as much of the pending reply as the socket accepts
+ * @return - 1 once the reply has been sent, 0 if the socket would block, -1 on error
+ */
+static int flush_output (conn_t * p_conn)
+{
+    // let a download header share a segment with the first bytes of the file
+    int flags = MSG_NOSIGNAL;
+    if ((CONN_DL_DATA == p_conn->next_state) && ((uint64_t)p_conn->xfer_off < p_conn->xfer_size))
+    {
+        flags |= MSG_MORE;
+    }
+
+    while (p_conn->out_off < p_conn->out_len)
+    {
+        ssize_t bytes_sent = send(p_conn->sockfd, p_conn->p_out + p_conn->out_off,
+                                  p_conn->out_len - p_conn->out_off, flags);
+        if (-1 == bytes_sent)
+        {
+            if (EINTR == errno)
+            {
+                continue;
+            }
+            if ((EAGAIN == errno) || (EWOULDBLOCK == errno))
+            {
+                return 0;
+            }
+            fprintf(stderr, "%s could not send reply to client: %s\n", __func__, strerror(errno));
+            return -1;
+        }
+        p_conn->out_off += bytes_sent;
+    }
+
+    clear_output(p_conn);
+    return 1;
+}
+
+/**
+ * INT READ_INT:
+ * @brief - parses a 4 byte native int from the input buffer
+ * @return - 1 if the value was read, 0 if more input is needed
+ */
+static int read_int (conn_t * p_conn, int * p_value)
+{
+    if (sizeof(int) > p_conn->in_len)
+    {
+        return 0;
+    }
+    memcpy(p_value, p_conn->in_buf, sizeof(int));
+    conn_consume_input(p_conn, sizeof(int));
+    return 1;
+}
+
+/**
+ * INT READ_UPLOAD_SIZE:
+ * @brief - parses a legacy upload size, a native int or UPLOAD_SIZE64 and a
+ *          native u64. Older clients send sizes up to 4 GiB as an unsigned int
+ * @return - 1 if the size was read (ERROR if the client sent ERROR instead), 0
+ *           if more input is needed
+ */
+static int read_upload_size (conn_t * p_conn, int * p_value, uint64_t * p_size)
+{
+    if (sizeof(int) > p_conn->in_len)
+    {
+        return 0;
+    }
+    memcpy(p_value, p_conn->in_buf, sizeof(int));
+    if (UPLOAD_SIZE64 != *p_value)
+    {
+        *p_size = (uint32_t)*p_value;
+        conn_consume_input(p_conn, sizeof(int));
+        return 1;
+    }
+
+    if (sizeof(int) + sizeof(uint64_t) > p_conn->in_len)
+    {
+        return 0;
+    }
+    memcpy(p_size, p_conn->in_buf + sizeof(int), sizeof(uint64_t));
+    conn_consume_input(p_conn, sizeof(int) + sizeof(uint64_t));
+    return 1;
+}
+
+/**
+ * INT DETERMINE_OPERATION:
+ * @brief - receives a numerical command from the client and determines which
+ *          state to parse the rest of the request in
+ * @return - 1 (the command has been consumed)
+ */
+static int determine_operation (conn_t * p_conn, int command)
+{
+    p_conn->command = command;
+
+    switch (command)
+    {
+        // command = 100, send dir list to client
+        case LIST:
+            p_conn->p_expected_msg = LIST_DIR;
+            p_conn->state          = CONN_READ_MSG;
+            break;
+
+        // command = 200, prepare file for download
+        case DOWNLOAD:
+            p_conn->state = CONN_READ_DL_NAME;
+            break;
+
+        // command = 300, prepare server for file upload
+        case UPLOAD:
+            printf("upload request received\n");
+            p_conn->p_expected_msg = UPLOAD_FILE;
+            p_conn->state          = CONN_READ_MSG;
+            break;
+
+        // command = 500, graceful client exit from connection
+        case EXIT:
+            p_conn->p_expected_msg = CLIENT_EXIT;
+            p_conn->state          = CONN_READ_MSG;
+            break;
+
+        case ERROR:
+            fprintf(stderr, "error occurred during client communication, disconnecting client...\n");
+            p_conn->state = CONN_CLOSE;
+            break;
+
+        // if invalid command is received from client
+        default:
+            fprintf(stderr, "%s invalid operation received from client\n", __func__);
+            p_conn->state = CONN_CLOSE;
+            break;
+    }
+
+    return 1;
+}
+
+/**
+ * INT GET_CLIENT_MSG:
+ * @brief - after the numerical command is received, the client sends a command
+ *          word in plaintext, check it matches the command
+ * @return - 1 if the word was consumed, 0 if more input is needed, PARSE_JOB if
+ *           the connection was handed to a worker
+ */
+static int get_client_msg (conn_t * p_conn)
+{
+    size_t msg_len = strlen(p_conn->p_expected_msg);
+    if (msg_len > p_conn->in_len)
+    {
+        return 0;
+    }
+
+    bool match = (0 == memcmp(p_conn->in_buf, p_conn->p_expected_msg, msg_len));
+    conn_consume_input(p_conn, msg_len);
+
+    switch (p_conn->command)
+    {
+        case LIST:
+            if (false == match)
+            {
+                fprintf(stderr, "%s invalid directory list command received\n", __func__);
+                p_conn->state = CONN_CLOSE;
+                break;
+            }
+            return submit(p_conn, JOB_LIST);
+
+        case UPLOAD:
+            if (false == match)
+            {
+                // not fatal, the client stays connected
+                fprintf(stderr, "%s invalid file upload command received\n", __func__);
+                p_conn->state = CONN_READ_CMD;
+                break;
+            }
+            p_conn->state = CONN_READ_UL_SIZE;
+            break;
+
+        default:
+            printf("Client has ended the connection...\n");
+            p_conn->state = CONN_CLOSE;
+            break;
+    }
+
+    return 1;
+}
+
+/**
+ * INT READ_HELLO:
+ * @brief - completes the v2 negotiation and queues the server's hello
+ * @return - 1 once the hello has been consumed, 0 if more input is needed
+ */
+static int read_hello (conn_t * p_conn)
+{
+    uint16_t version = 0;
+    uint16_t flags   = 0;
+
+    if (V2_HELLO_SZ > p_conn->in_len)
+    {
+        return 0;
+    }
+    memcpy(&version, p_conn->in_buf + V2_MAGIC_LEN, sizeof(version));
+    memcpy(&flags, p_conn->in_buf + V2_MAGIC_LEN + sizeof(version), sizeof(flags));
+    conn_consume_input(p_conn, V2_HELLO_SZ);
+
+    if (V2_VERSION > le16toh(version))
+    {
+        fprintf(stderr, "%s unsupported protocol version %u\n", __func__, le16toh(version));
+        p_conn->state = CONN_CLOSE;
+        return 1;
+    }
+
+    // a client asking for multiplexing falls back to plain v2 if the stream
+    // table cannot be allocated, it sees the flag missing from our hello
+    p_conn->proto = PROTO_V2;
+    flags         = le16toh(flags) & V2_HELLO_MUX;
+    if (0 != flags)
+    {
+        p_conn->p_mux = mux_create(&p_conn->arena);
+        flags         = (NULL == p_conn->p_mux) ? 0 : flags;
+    }
+
+    size_t len = v2_encode_hello(p_conn->hdr, flags);
+    set_output(p_conn, p_conn->hdr, len, false, (0 != flags) ? CONN_MUX : CONN_V2_READ_HDR);
+    return 1;
+}
+
+/**
+ * INT READ_V2_REQUEST:
+ * @brief - parses a v2 request header and picks the state that reads the rest
+ *          of the request
+ * @return - 1 if the header was consumed, 0 if more input is needed, PARSE_JOB
+ *           if the connection was handed to a worker
+ */
+static int read_v2_request (conn_t * p_conn)
+{
+    v2_hdr_t hdr = { 0 };
+
+    if (V2_HDR_SZ > p_conn->in_len)
+    {
+        return 0;
+    }
+    v2_decode_hdr(p_conn->in_buf, &hdr);
+    conn_consume_input(p_conn, V2_HDR_SZ);
+
+    p_conn->opcode      = hdr.opcode;
+    p_conn->request_id  = hdr.request_id;
+    p_conn->payload_len = hdr.payload_len;
+
+    switch (hdr.opcode)
+    {
+        case V2_OP_LIST:
+        case V2_OP_LIST_DETAIL:
+            if (0 != hdr.payload_len)
+            {
+                reject_request(p_conn, EINVAL, hdr.payload_len);
+                return 1;
+            }
+            return submit(p_conn, JOB_LIST);
+
+        case V2_OP_LIST_PAGE:
+            if ((V2_LIST_PAGE_REQ_SZ > hdr.payload_len) || (V2_LIST_PAGE_REQ_SZ + MAXNAMLEN < hdr.payload_len))
+            {
+                reject_request(p_conn, EINVAL, hdr.payload_len);
+                return 1;
+            }
+            p_conn->state = CONN_V2_READ_NAME;
+            return 1;
+
+        case V2_OP_DOWNLOAD:
+            if ((0 == hdr.payload_len) || (MAXNAMLEN < hdr.payload_len))
+            {
+                reject_request(p_conn, ENAMETOOLONG, hdr.payload_len);
+                return 1;
+            }
+            p_conn->state = CONN_V2_READ_NAME;
+            return 1;
+
+        case V2_OP_DOWNLOAD_RANGE:
+        case V2_OP_EXTENTS:
+            if ((V2_RANGE_REQ_SZ >= hdr.payload_len) || (V2_RANGE_REQ_SZ + MAXNAMLEN < hdr.payload_len))
+            {
+                reject_request(p_conn, EINVAL, hdr.payload_len);
+                return 1;
+            }
+            p_conn->state = CONN_V2_READ_NAME;
+            return 1;
+
+        case V2_OP_UPLOAD_QUERY:
+        case V2_OP_SESSION_COMMIT:
+            if ((V2_UPLOAD_REQ_SZ >= hdr.payload_len) || (V2_UPLOAD_REQ_SZ + MAXNAMLEN < hdr.payload_len))
+            {
+                reject_request(p_conn, EINVAL, hdr.payload_len);
+                return 1;
+            }
+            p_conn->state = CONN_V2_READ_NAME;
+            return 1;
+
+        case V2_OP_SESSION_OPEN:
+            if ((V2_SESSION_REQ_SZ >= hdr.payload_len) || (V2_SESSION_REQ_SZ + MAXNAMLEN < hdr.payload_len))
+            {
+                reject_request(p_conn, EINVAL, hdr.payload_len);
+                return 1;
+            }
+            p_conn->state = CONN_V2_READ_NAME;
+            return 1;
+
+        case V2_OP_UPLOAD:
+        case V2_OP_UPLOAD_RESUME:
+        case V2_OP_SESSION_CHUNK:
+            if (((V2_OP_UPLOAD == hdr.opcode) ? 0 : V2_UPLOAD_REQ_SZ) + sizeof(uint16_t) > hdr.payload_len)
+            {
+                reject_request(p_conn, EINVAL, hdr.payload_len);
+                return 1;
+            }
+            printf("upload request received\n");
+            p_conn->state = CONN_V2_READ_UL_NAME;
+            return 1;
+
+        case V2_OP_UPLOAD_SPARSE:
+            if (V2_SPARSE_REQ_SZ + sizeof(uint16_t) > hdr.payload_len)
+            {
+                reject_request(p_conn, EINVAL, hdr.payload_len);
+                return 1;
+            }
+            printf("sparse upload request received\n");
+            p_conn->state = CONN_V2_READ_UL_NAME;
+            return 1;
+
+        case V2_OP_BYE:
+            printf("Client has ended the connection...\n");
+            p_conn->state = CONN_CLOSE;
+            return 1;
+
+        default:
+            fprintf(stderr, "%s invalid operation received from client\n", __func__);
+            reject_request(p_conn, ENOSYS, hdr.payload_len);
+            return 1;
+    }
+}
+
+/**
+ * INT READ_V2_UPLOAD_NAME:
+ * @brief - reads the name (and for a resumed upload or a session chunk the id
+ *          and offset, for a sparse upload the file size) that leads a v2
+ *          upload payload, the rest of the payload is the file, the chunk or
+ *          the extents
+ * @return - 1 if progress was made, 0 if more input is needed, PARSE_JOB if the
+ *           connection was handed to a worker
+ */
+static int read_v2_upload_name (conn_t * p_conn)
+{
+    uint16_t name_len   = 0;
+    size_t   prefix_len = (V2_OP_UPLOAD_SPARSE == p_conn->opcode) ? V2_SPARSE_REQ_SZ : 0;
+
+    if ((V2_OP_UPLOAD != p_conn->opcode) && (V2_OP_UPLOAD_SPARSE != p_conn->opcode) && (0 == p_conn->upload_id))
+    {
+        if (V2_UPLOAD_REQ_SZ + sizeof(name_len) > p_conn->in_len)
+        {
+            return 0;
+        }
+        v2_decode_upload(p_conn->in_buf, &p_conn->upload_id, &p_conn->upload_off);
+        conn_consume_input(p_conn, V2_UPLOAD_REQ_SZ);
+        p_conn->payload_len -= V2_UPLOAD_REQ_SZ;
+        if (UPLOAD_ANONYMOUS == p_conn->upload_id)
+        {
+            reject_request(p_conn, EINVAL, p_conn->payload_len);
+            return 1;
+        }
+    }
+    if (prefix_len + sizeof(name_len) > p_conn->in_len)
+    {
+        return 0;
+    }
+    memcpy(&name_len, p_conn->in_buf + prefix_len, sizeof(name_len));
+    name_len = le16toh(name_len);
+
+    uint64_t header_len = prefix_len + sizeof(name_len) + (uint64_t)name_len;
+    if ((0 == name_len) || (MAXNAMLEN < name_len) || (header_len > p_conn->payload_len))
+    {
+        conn_consume_input(p_conn, prefix_len + sizeof(name_len));
+        reject_request(p_conn, EINVAL, p_conn->payload_len - prefix_len - sizeof(name_len));
+        return 1;
+    }
+    if (header_len > p_conn->in_len)
+    {
+        return 0;
+    }
+
+    memcpy(p_conn->filename, p_conn->in_buf + prefix_len + sizeof(name_len), name_len);
+    p_conn->filename[name_len] = '\0';
+    if (V2_OP_UPLOAD_SPARSE == p_conn->opcode)
+    {
+        // payload_len counts down the extents still to come
+        memcpy(&p_conn->sparse_size, p_conn->in_buf, sizeof(p_conn->sparse_size));
+        p_conn->sparse_size  = le64toh(p_conn->sparse_size);
+        p_conn->xfer_size    = p_conn->sparse_size;
+        p_conn->payload_len -= header_len;
+        conn_consume_input(p_conn, header_len);
+        printf("File name received: %s\n", p_conn->filename);
+        printf("Uploading sparse file of size %" PRIu64 " from client\n", p_conn->sparse_size);
+        return submit(p_conn, JOB_OPEN_UPLOAD);
+    }
+    conn_consume_input(p_conn, header_len);
+
+    // the contents continue the file at upload_off (0 unless resuming)
+    p_conn->xfer_size = p_conn->upload_off + (p_conn->payload_len - header_len);
+    printf("File name received: %s\n", p_conn->filename);
+    printf("Uploading file of size %" PRIu64 " from client\n", p_conn->xfer_size);
+    return submit(p_conn, JOB_OPEN_UPLOAD);
+}
+
+/**
+ * INT PARSE_INPUT:
+ * @brief - advances the request parsing states with the bytes already buffered
+ * @return - 1 if progress was made, 0 if more input is needed, PARSE_JOB if the
+ *           connection was handed to a worker
+ */
+static int parse_input (conn_t * p_conn)
+{
+    int    value    = -1;
+    size_t name_len = 0;
+
+    switch (p_conn->state)
+    {
+        case CONN_READ_CMD:
+            if (sizeof(int) > p_conn->in_len)
+            {
+                return 0;
+            }
+            if ((PROTO_LEGACY == p_conn->proto) && (true == v2_is_hello(p_conn->in_buf)))
+            {
+                p_conn->state = CONN_READ_HELLO;
+                return 1;
+            }
+            read_int(p_conn, &value);
+            return determine_operation(p_conn, value);
+
+        case CONN_READ_HELLO:
+            return read_hello(p_conn);
+
+        case CONN_V2_READ_HDR:
+            return read_v2_request(p_conn);
+
+        case CONN_V2_READ_NAME:
+            if (p_conn->payload_len > p_conn->in_len)
+            {
+                return 0;
+            }
+            if ((V2_OP_DOWNLOAD_RANGE == p_conn->opcode) || (V2_OP_EXTENTS == p_conn->opcode))
+            {
+                v2_decode_range(p_conn->in_buf, &p_conn->range_off, &p_conn->range_len);
+                conn_consume_input(p_conn, V2_RANGE_REQ_SZ);
+                p_conn->payload_len -= V2_RANGE_REQ_SZ;
+            }
+            if ((V2_OP_UPLOAD_QUERY == p_conn->opcode) || (V2_OP_SESSION_COMMIT == p_conn->opcode))
+            {
+                // xfer_size carries the size of the upload asked about
+                v2_decode_upload(p_conn->in_buf, &p_conn->upload_id, &p_conn->xfer_size);
+                conn_consume_input(p_conn, V2_UPLOAD_REQ_SZ);
+                p_conn->payload_len -= V2_UPLOAD_REQ_SZ;
+            }
+            if (V2_OP_SESSION_OPEN == p_conn->opcode)
+            {
+                v2_decode_session(p_conn->in_buf, &p_conn->upload_id, &p_conn->xfer_size, &p_conn->chunk_size);
+                conn_consume_input(p_conn, V2_SESSION_REQ_SZ);
+                p_conn->payload_len -= V2_SESSION_REQ_SZ;
+            }
+            if (V2_OP_LIST_PAGE == p_conn->opcode)
+            {
+                // range_off / range_len carry the cursor and page size, the
+                // filter pattern takes the place of the name
+                uint32_t page_size = 0;
+
+                v2_decode_list_page(p_conn->in_buf, &p_conn->range_off, &page_size);
+                p_conn->range_len = page_size;
+                conn_consume_input(p_conn, V2_LIST_PAGE_REQ_SZ);
+                p_conn->payload_len -= V2_LIST_PAGE_REQ_SZ;
+            }
+            memcpy(p_conn->filename, p_conn->in_buf, p_conn->payload_len);
+            p_conn->filename[p_conn->payload_len] = '\0';
+            conn_consume_input(p_conn, p_conn->payload_len);
+            if (V2_OP_LIST_PAGE == p_conn->opcode)
+            {
+                return submit(p_conn, JOB_LIST);
+            }
+            if (V2_OP_UPLOAD_QUERY == p_conn->opcode)
+            {
+                return submit(p_conn, JOB_UPLOAD_QUERY);
+            }
+            if (V2_OP_SESSION_OPEN == p_conn->opcode)
+            {
+                return submit(p_conn, JOB_SESSION_OPEN);
+            }
+            if (V2_OP_SESSION_COMMIT == p_conn->opcode)
+            {
+                return submit(p_conn, JOB_SESSION_COMMIT);
+            }
+            if (V2_OP_EXTENTS == p_conn->opcode)
+            {
+                return submit(p_conn, JOB_MAP_EXTENTS);
+            }
+            printf("Sending client %s contents ...\n", p_conn->filename);
+            return submit(p_conn, JOB_OPEN_DOWNLOAD);
+
+        case CONN_V2_READ_UL_NAME:
+            return read_v2_upload_name(p_conn);
+
+        case CONN_READ_MSG:
+            return get_client_msg(p_conn);
+
+        case CONN_READ_DL_NAME:
+            // the legacy protocol does not frame the name, it is whatever the
+            // client sent after the command
+            if (0 == p_conn->in_len)
+            {
+                return 0;
+            }
+            name_len = (p_conn->in_len > MAXNAMLEN) ? MAXNAMLEN : p_conn->in_len;
+            memcpy(p_conn->filename, p_conn->in_buf, name_len);
+            p_conn->filename[name_len] = '\0';
+            conn_consume_input(p_conn, name_len);
+            printf("Sending client %s contents ...\n", p_conn->filename);
+            return submit(p_conn, JOB_OPEN_DOWNLOAD);
+
+        case CONN_READ_UL_SIZE:
+            if (0 == read_upload_size(p_conn, &value, &p_conn->xfer_size))
+            {
+                return 0;
+            }
+            if (ERROR == value)
+            {
+                fprintf(stderr, "Error received from client\n");
+                fprintf(stderr, "Upload failed...\n");
+                p_conn->xfer_size = 0;
+                p_conn->state     = CONN_READ_CMD;
+                return 1;
+            }
+            printf("Uploading file of size %" PRIu64 " from client\n", p_conn->xfer_size);
+            p_conn->state = CONN_READ_UL_NAME_LEN;
+            return 1;
+
+        case CONN_READ_UL_NAME_LEN:
+            if (0 == read_int(p_conn, &value))
+            {
+                return 0;
+            }
+            if ((0 >= value) || (MAXNAMLEN < value))
+            {
+                fprintf(stderr, "%s invalid file name length received: %d\n", __func__, value);
+                p_conn->state = CONN_CLOSE;
+                return 1;
+            }
+            p_conn->name_len = value;
+            p_conn->state    = CONN_READ_UL_NAME;
+            return 1;
+
+        case CONN_READ_UL_NAME:
+            if (p_conn->name_len > p_conn->in_len)
+            {
+                return 0;
+            }
+            memcpy(p_conn->filename, p_conn->in_buf, p_conn->name_len);
+            p_conn->filename[p_conn->name_len] = '\0';
+            conn_consume_input(p_conn, p_conn->name_len);
+            printf("File name received: %s\n", p_conn->filename);
+            return submit(p_conn, JOB_OPEN_UPLOAD);
+
+        default:
+            return 1;
+    }
+}
+
+/**
+ * INT DISCARD_INPUT:
+ * @brief - drops the payload of an upload that could not be stored so the
+ *          connection stays in sync with the client
+ * @return - 1 once the payload has been consumed, 0 if the socket would block,
+ *           -1 on error
+ */
+static int discard_input (conn_t * p_conn)
+{
+    for (;;)
+    {
+        uint64_t left  = p_conn->xfer_size - p_conn->xfer_off;
+        size_t   chunk = (p_conn->in_len > left) ? left : p_conn->in_len;
+
+        conn_consume_input(p_conn, chunk);
+        p_conn->xfer_off += chunk;
+
+        if ((uint64_t)p_conn->xfer_off == p_conn->xfer_size)
+        {
+            p_conn->xfer_size = 0;
+            p_conn->xfer_off  = 0;
+            return 1;
+        }
+
+        int ret_val = conn_fill_input(p_conn);
+        if (1 != ret_val)
+        {
+            return ret_val;
+        }
+    }
+}
+
+/**
+ * VOID CONN_ADVANCE:
+ * @brief - drives the state machine until it needs the socket to become ready,
+ *          hands the connection to a worker, or closes it
+ */
+static void conn_advance (conn_t * p_conn)
+{
+    int ret_val = -1;
+
+    for (;;)
+    {
+        switch (p_conn->state)
+        {
+            case CONN_READ_CMD:
+            case CONN_READ_MSG:
+            case CONN_READ_DL_NAME:
+            case CONN_READ_UL_SIZE:
+            case CONN_READ_UL_NAME_LEN:
+            case CONN_READ_UL_NAME:
+            case CONN_READ_HELLO:
+            case CONN_V2_READ_HDR:
+            case CONN_V2_READ_NAME:
+            case CONN_V2_READ_UL_NAME:
+                ret_val = parse_input(p_conn);
+                if (PARSE_JOB == ret_val)
+                {
+                    return;
+                }
+                if (1 == ret_val)
+                {
+                    continue;
+                }
+                ret_val = conn_fill_input(p_conn);
+                if (-1 == ret_val)
+                {
+                    p_conn->state = CONN_CLOSE;
+                    continue;
+                }
+                if (0 == ret_val)
+                {
+                    reactor_arm(p_conn, EPOLLIN);
+                    return;
+                }
+                continue;
+
+            case CONN_UL_DISCARD:
+                ret_val = discard_input(p_conn);
+                if (-1 == ret_val)
+                {
+                    p_conn->state = CONN_CLOSE;
+                    continue;
+                }
+                if (0 == ret_val)
+                {
+                    reactor_arm(p_conn, EPOLLIN);
+                    return;
+                }
+                if (0 < p_conn->hdr_len)
+                {
+                    set_output(p_conn, p_conn->hdr, p_conn->hdr_len, false, idle_state(p_conn));
+                    p_conn->hdr_len = 0;
+                    continue;
+                }
+                p_conn->state = idle_state(p_conn);
+                continue;
+
+            case CONN_WRITE_OUT:
+                ret_val = flush_output(p_conn);
+                if (-1 == ret_val)
+                {
+                    p_conn->state = CONN_CLOSE;
+                    continue;
+                }
+                if (0 == ret_val)
+                {
+                    reactor_arm(p_conn, EPOLLOUT);
+                    return;
+                }
+                p_conn->state = p_conn->next_state;
+                continue;
+
+            case CONN_DL_DATA:
+                if (true == p_conn->io_wait)
+                {
+                    reactor_arm(p_conn, EPOLLOUT);
+                    return;
+                }
+                submit(p_conn, JOB_SEND_FILE);
+                return;
+
+            case CONN_UL_DATA:
+                // a sparse upload between two extents waits for the whole
+                // extent record, however much of it is buffered
+                if ((true == p_conn->io_wait) &&
+                    ((0 == p_conn->in_len) || ((uint64_t)p_conn->xfer_off == p_conn->xfer_size)))
+                {
+                    reactor_arm(p_conn, EPOLLIN);
+                    return;
+                }
+                submit(p_conn, JOB_RECV_FILE);
+                return;
+
+            case CONN_MUX:
+                if (true == p_conn->io_wait)
+                {
+                    reactor_arm(p_conn, p_conn->p_mux->wait_events);
+                    return;
+                }
+                submit(p_conn, JOB_MUX);
+                return;
+
+            case CONN_IN_JOB:
+                return;
+
+            case CONN_CLOSE:
+            default:
+                reactor_close_conn(p_conn);
+                return;
+        }
+    }
+}
+
+void conn_handle_event (conn_t * p_conn, uint32_t events)
+{
+    // an upload in progress still goes to its worker, which sees the error and
+    // records how far the upload got
+    if ((events & EPOLLERR) && (CONN_UL_DATA != p_conn->state) && (CONN_MUX != p_conn->state))
+    {
+        p_conn->state = CONN_CLOSE;
+    }
+
+    p_conn->io_wait = false;
+    conn_advance(p_conn);
+}
+
+void conn_job_done (conn_t * p_conn)
+{
+    p_conn->job = JOB_NONE;
+    conn_advance(p_conn);
+}
+
+/**
+ * VOID JOB_OPEN_DOWNLOAD_FILE:
+ * @brief - opens the requested file and queues the size header (or -1 when the
+ *          file cannot be served)
+ */
+static void job_open_download_file (conn_t * p_conn)
+{
+    uint64_t file_sz  = 0;
+    uint64_t mtime_ns = 0;
+    uint64_t base     = 0;
+    int64_t  wire_sz  = -1;
+
+    p_conn->file_fd = open_download_file(p_conn->filename, &file_sz, &mtime_ns, &base, &p_conn->p_fill);
+    if ((-1 == p_conn->file_fd) && (PROTO_V2 == p_conn->proto))
+    {
+        reply_error(p_conn, errno);
+        return;
+    }
+    if (-1 == p_conn->file_fd)
+    {
+        memcpy(p_conn->hdr, &wire_sz, sizeof(wire_sz));
+        set_output(p_conn, p_conn->hdr, sizeof(wire_sz), false, CONN_READ_CMD);
+        return;
+    }
+
+    // the transfer offsets are offsets in the descriptor, a packed file starts
+    // at its base in the segment
+    printf("Sending file of size %" PRIu64 " to client...\n", file_sz);
+    p_conn->xfer_size = base + file_sz;
+    p_conn->xfer_off  = base;
+    p_conn->io_wait   = false;
+
+    if (V2_OP_DOWNLOAD_RANGE == p_conn->opcode)
+    {
+        uint64_t length = p_conn->range_len;
+        if (-1 == v2_clip_range(file_sz, p_conn->range_off, &length))
+        {
+            close_file(p_conn);
+            reply_error(p_conn, ERANGE);
+            return;
+        }
+        printf("Sending bytes %" PRIu64 " - %" PRIu64 " of %s\n",
+               p_conn->range_off, p_conn->range_off + length, p_conn->filename);
+
+        // sendfile() starts from the range offset, the rest of the file is never read
+        p_conn->xfer_off  = base + p_conn->range_off;
+        p_conn->xfer_size = base + p_conn->range_off + length;
+        size_t len = v2_encode_reply(p_conn->hdr, p_conn->opcode, p_conn->request_id, V2_RANGE_HEAD_SZ + length);
+        len += v2_encode_range_head(p_conn->hdr + len, file_sz, mtime_ns, length);
+        set_output(p_conn, p_conn->hdr, len, false, CONN_DL_DATA);
+        return;
+    }
+
+    if (PROTO_V2 == p_conn->proto)
+    {
+        size_t len = v2_encode_reply(p_conn->hdr, p_conn->opcode, p_conn->request_id, file_sz);
+        set_output(p_conn, p_conn->hdr, len, false, CONN_DL_DATA);
+        return;
+    }
+
+    wire_sz = htobe64(file_sz);
+    memcpy(p_conn->hdr, &wire_sz, sizeof(wire_sz));
+    set_output(p_conn, p_conn->hdr, sizeof(wire_sz), false, CONN_DL_DATA);
+}
+
+/**
+ * VOID JOB_SEND_FILE:
+ * @brief - pushes up to JOB_BUDGET bytes of the download to the client
+ */
+static void job_send_file (conn_t * p_conn)
+{
+    uint64_t left   = p_conn->xfer_size - p_conn->xfer_off;
+    ssize_t  budget = (left > JOB_BUDGET) ? JOB_BUDGET : left;
+
+    // a copy still being filled in only has so many bytes to send yet
+    budget = file_cache_ready(p_conn->p_fill, p_conn->xfer_off, budget);
+    ssize_t bytes_sent = (-1 == budget) ? -1 : send_file_some(p_conn->sockfd, p_conn->file_fd, &p_conn->xfer_off, budget);
+    if (-1 == bytes_sent)
+    {
+        fprintf(stderr, "%s sent %" PRId64 " of %" PRIu64 " bytes of %s\n", __func__,
+                (int64_t)p_conn->xfer_off, p_conn->xfer_size, p_conn->filename);
+        p_conn->state = CONN_CLOSE;
+        return;
+    }
+
+    if ((uint64_t)p_conn->xfer_off == p_conn->xfer_size)
+    {
+        close_file(p_conn);
+        p_conn->state = idle_state(p_conn);
+        return;
+    }
+
+    // a short send means the socket buffer is full, wait for EPOLLOUT
+    p_conn->io_wait = (bytes_sent < budget);
+    p_conn->state   = CONN_DL_DATA;
+}
+
+/**
+ * VOID JOB_OPEN_UPLOAD_FILE:
+ * @brief - opens the staging file of the upload (or of the session a chunk
+ *          belongs to), a failed open still has to consume the payload the
+ *          client is about to send
+ */
+static void job_open_upload_file (conn_t * p_conn)
+{
+    uint64_t base = 0;
+
+    p_conn->xfer_off         = p_conn->upload_off;
+    p_conn->chunk_off        = p_conn->upload_off;
+    p_conn->io_wait          = false;
+    p_conn->splice_fell_back = false;
+
+    if (V2_OP_SESSION_CHUNK == p_conn->opcode)
+    {
+        p_conn->file_fd = upload_session_attach(p_conn->filename, p_conn->upload_id, p_conn->upload_off,
+                                                p_conn->xfer_size - p_conn->upload_off, &p_conn->p_session);
+    }
+    else
+    {
+        p_conn->file_fd = storage_backend->create(&p_conn->upload, p_conn->filename, p_conn->upload_id,
+                                                  p_conn->xfer_size, p_conn->upload_off, &base);
+    }
+    p_conn->upload_id  = UPLOAD_ANONYMOUS;
+    p_conn->upload_off = 0;
+    if (-1 == p_conn->file_fd)
+    {
+        int err = errno;
+        fprintf(stderr, "Upload failed...\n");
+        if (V2_OP_UPLOAD_SPARSE == p_conn->opcode)
+        {
+            reject_request(p_conn, err, p_conn->payload_len);
+            return;
+        }
+        if (PROTO_V2 == p_conn->proto)
+        {
+            reject_request(p_conn, err, p_conn->xfer_size - p_conn->xfer_off);
+            return;
+        }
+        p_conn->state = CONN_UL_DISCARD;
+        return;
+    }
+
+    if (V2_OP_UPLOAD_SPARSE == p_conn->opcode)
+    {
+        // the file starts out as one hole (the staging file is preallocated),
+        // the extents are written into it as they arrive
+        if (-1 == punch_range(p_conn->file_fd, base, p_conn->sparse_size))
+        {
+            int err = errno;
+            storage_backend->discard(&p_conn->upload, p_conn->file_fd, 0);
+            close_file(p_conn);
+            reject_request(p_conn, err, p_conn->payload_len);
+            return;
+        }
+        p_conn->file_base  = base;
+        p_conn->extent_end = 0;
+        p_conn->xfer_off   = base;
+        p_conn->xfer_size  = base;
+        p_conn->state      = CONN_UL_DATA;
+        return;
+    }
+
+    // a packed upload is written at its record's place in the segment
+    p_conn->xfer_off  += base;
+    p_conn->xfer_size += base;
+    p_conn->state      = CONN_UL_DATA;
+}
+
+/**
+ * VOID FAIL_UPLOAD:
+ * @brief - keeps what a broken upload stored (if it can be resumed) and
+ *          closes the connection
+ */
+static void fail_upload (conn_t * p_conn)
+{
+    storage_backend->discard(&p_conn->upload, p_conn->file_fd, p_conn->xfer_off);
+    close_file(p_conn);
+    p_conn->state = CONN_CLOSE;
+}
+
+/**
+ * BOOL EXTENTS_PENDING:
+ * @brief - true while a sparse upload has finished one extent and has more to
+ *          receive
+ */
+static bool extents_pending (conn_t * p_conn)
+{
+    return (V2_OP_UPLOAD_SPARSE == p_conn->opcode) && ((uint64_t)p_conn->xfer_off == p_conn->xfer_size) &&
+           (0 < p_conn->payload_len);
+}
+
+/**
+ * INT NEXT_EXTENT:
+ * @brief - reads the record of the next extent of a sparse upload and sets
+ *          the transfer to its byte range
+ * @return - 1 once the extent is set up, 0 if the socket would block before
+ *           the whole record arrived, -1 on error
+ */
+static int next_extent (conn_t * p_conn)
+{
+    uint64_t offset = 0;
+    uint64_t length = 0;
+
+    if (V2_EXTENT_SZ > p_conn->payload_len)
+    {
+        fprintf(stderr, "%s sparse upload of %s ends inside an extent record\n", __func__, p_conn->filename);
+        return -1;
+    }
+    while (V2_EXTENT_SZ > p_conn->in_len)
+    {
+        int ret_val = conn_fill_input(p_conn);
+        if (1 != ret_val)
+        {
+            return ret_val;
+        }
+    }
+
+    v2_decode_extent(p_conn->in_buf, &offset, &length);
+    conn_consume_input(p_conn, V2_EXTENT_SZ);
+    p_conn->payload_len -= V2_EXTENT_SZ;
+    if ((offset < p_conn->extent_end) || (offset > p_conn->sparse_size) ||
+        (length > p_conn->sparse_size - offset) || (length > p_conn->payload_len))
+    {
+        fprintf(stderr, "%s invalid extent %" PRIu64 " + %" PRIu64 " in sparse upload of %s\n",
+                __func__, offset, length, p_conn->filename);
+        return -1;
+    }
+
+    p_conn->payload_len -= length;
+    p_conn->extent_end   = offset + length;
+    p_conn->xfer_off     = p_conn->file_base + offset;
+    p_conn->xfer_size    = p_conn->file_base + offset + length;
+    return 1;
+}
+
+/**
+ * VOID JOB_RECV_FILE:
+ * @brief - writes up to JOB_BUDGET bytes of the upload to its staging file,
+ *          starting with any payload that arrived together with the upload
+ *          header, and publishes the file once it is complete. A sparse
+ *          upload goes through its extents in turn, the ones that arrived
+ *          whole in the input buffer are all written by the same job
+ */
+static void job_recv_file (conn_t * p_conn)
+{
+    uint64_t left = p_conn->xfer_size - p_conn->xfer_off;
+
+    do
+    {
+        if (true == extents_pending(p_conn))
+        {
+            int ret_val = next_extent(p_conn);
+            if (-1 == ret_val)
+            {
+                fail_upload(p_conn);
+                return;
+            }
+            if (0 == ret_val)
+            {
+                p_conn->io_wait = true;
+                p_conn->state   = CONN_UL_DATA;
+                return;
+            }
+            left = p_conn->xfer_size - p_conn->xfer_off;
+        }
+
+        if ((0 < p_conn->in_len) && (0 < left))
+        {
+            size_t chunk = (p_conn->in_len > left) ? left : p_conn->in_len;
+            if (-1 == pwrite_all(p_conn->file_fd, p_conn->in_buf, chunk, p_conn->xfer_off))
+            {
+                fail_upload(p_conn);
+                return;
+            }
+            conn_consume_input(p_conn, chunk);
+            p_conn->xfer_off += chunk;
+            left             -= chunk;
+        }
+    } while ((true == extents_pending(p_conn)) && (0 < p_conn->in_len));
+
+    size_t  budget     = (left > JOB_BUDGET) ? JOB_BUDGET : left;
+    ssize_t bytes_recv = 0;
+    if ((UPLOAD_SPLICE == upload_mode) && (false == p_conn->splice_fell_back))
+    {
+        bytes_recv = recv_file_splice_some(p_conn->sockfd, p_conn->file_fd, &p_conn->xfer_off,
+                                           budget, &p_conn->splice_fell_back);
+    }
+    else if (0 < budget)
+    {
+        bytes_recv = recv_file_some(p_conn->sockfd, p_conn->file_fd, &p_conn->xfer_off, budget);
+    }
+
+    if (-1 == bytes_recv)
+    {
+        fprintf(stderr, "%s could not receive file from client: received %" PRId64 " of %" PRIu64 " bytes\n",
+                __func__, (int64_t)p_conn->xfer_off, p_conn->xfer_size);
+        fail_upload(p_conn);
+        return;
+    }
+
+    if (true == extents_pending(p_conn))
+    {
+        p_conn->io_wait = false;
+        p_conn->state   = CONN_UL_DATA;
+        return;
+    }
+
+    if ((uint64_t)p_conn->xfer_off == p_conn->xfer_size)
+    {
+        if (UPLOAD_SPLICE == upload_mode)
+        {
+            printf("Upload path for %s: %s\n", p_conn->filename,
+                   p_conn->splice_fell_back ? "buffered (splice unsupported)" : UPLOAD_MODE_SPLICE);
+        }
+        else
+        {
+            printf("Upload path for %s: %s\n", p_conn->filename, UPLOAD_MODE_BUFFERED);
+        }
+
+        int err = 0;
+        if (NULL != p_conn->p_session)
+        {
+            // a chunk is only stored, the file is published by the commit
+            if (-1 == upload_session_store(p_conn->p_session, p_conn->file_fd, p_conn->chunk_off))
+            {
+                err = errno;
+            }
+        }
+        else if (-1 == storage_backend->commit(&p_conn->upload, p_conn->file_fd))
+        {
+            err = errno;
+            storage_backend->discard(&p_conn->upload, p_conn->file_fd, p_conn->xfer_off);
+        }
+        close_file(p_conn);
+        printf("Upload %s\n", (0 == err) ? "Complete" : "failed...");
+        if ((PROTO_V2 == p_conn->proto) && (0 != err))
+        {
+            reply_error(p_conn, err);
+            return;
+        }
+        if (PROTO_V2 == p_conn->proto)
+        {
+            size_t len = v2_encode_reply(p_conn->hdr, p_conn->opcode, p_conn->request_id, 0);
+            set_output(p_conn, p_conn->hdr, len, false, CONN_V2_READ_HDR);
+            return;
+        }
+        p_conn->state = CONN_READ_CMD;
+        return;
+    }
+
+    upload_checkpoint(&p_conn->upload, p_conn->file_fd, p_conn->xfer_off, false);
+    p_conn->io_wait = ((size_t)bytes_recv < budget);
+    p_conn->state   = CONN_UL_DATA;
+}
+
+/**
+ * VOID JOB_UPLOAD_QUERY:
+ * @brief - answers an upload query with the number of bytes already staged
+ */
+static void job_upload_query (conn_t * p_conn)
+{
+    uint64_t committed = 0;
+    int      ret_val   = storage_backend->query(p_conn->filename, p_conn->upload_id, p_conn->xfer_size,
+                                                        &committed);
+
+    p_conn->upload_id = UPLOAD_ANONYMOUS;
+    p_conn->xfer_size = 0;
+    if (-1 == ret_val)
+    {
+        reply_error(p_conn, errno);
+        return;
+    }
+
+    printf("Upload of %s can resume at byte %" PRIu64 "\n", p_conn->filename, committed);
+    size_t len = v2_encode_reply(p_conn->hdr, p_conn->opcode, p_conn->request_id, sizeof(committed));
+    committed  = htole64(committed);
+    memcpy(p_conn->hdr + len, &committed, sizeof(committed));
+    set_output(p_conn, p_conn->hdr, len + sizeof(committed), false, CONN_V2_READ_HDR);
+}
+
+/**
+ * VOID JOB_SESSION_OPEN:
+ * @brief - opens (or rejoins) an upload session and answers with the bitmap of
+ *          the chunks already stored
+ */
+static void job_session_open (conn_t * p_conn)
+{
+    size_t reply_len = 0;
+    char * p_reply   = NULL;
+
+    // sessions stage their chunks in the upload journal, a backend without
+    // one refuses them and the client sends the file as a single upload
+    errno = EOPNOTSUPP;
+    if (true == storage_backend->sessions)
+    {
+        p_reply = upload_session_open(p_conn->filename, p_conn->upload_id, p_conn->xfer_size,
+                                      p_conn->chunk_size, &p_conn->arena, V2_HDR_SZ, &reply_len);
+    }
+
+    p_conn->upload_id  = UPLOAD_ANONYMOUS;
+    p_conn->xfer_size  = 0;
+    p_conn->chunk_size = 0;
+    if (NULL == p_reply)
+    {
+        int err = errno;
+        arena_reset(&p_conn->arena);
+        reply_error(p_conn, err);
+        return;
+    }
+
+    v2_encode_reply(p_reply, p_conn->opcode, p_conn->request_id, reply_len - V2_HDR_SZ);
+    set_output(p_conn, p_reply, reply_len, true, CONN_V2_READ_HDR);
+}
+
+/**
+ * VOID JOB_SESSION_COMMIT:
+ * @brief - publishes the file of a complete upload session
+ */
+static void job_session_commit (conn_t * p_conn)
+{
+    int ret_val = upload_session_commit(p_conn->filename, p_conn->upload_id, p_conn->xfer_size);
+
+    p_conn->upload_id = UPLOAD_ANONYMOUS;
+    p_conn->xfer_size = 0;
+    if (-1 == ret_val)
+    {
+        reply_error(p_conn, errno);
+        return;
+    }
+
+    size_t len = v2_encode_reply(p_conn->hdr, p_conn->opcode, p_conn->request_id, 0);
+    set_output(p_conn, p_conn->hdr, len, false, CONN_V2_READ_HDR);
+}
+
+/**
+ * VOID JOB_MAP_EXTENTS:
+ * @brief - answers an extent map request with the data extents of the range,
+ *          at most V2_EXTENTS_MAX of them
+ */
+static void job_map_extents (conn_t * p_conn)
+{
+    uint64_t file_sz  = 0;
+    uint64_t mtime_ns = 0;
+    uint64_t base     = 0;
+    uint64_t length   = p_conn->range_len;
+    uint32_t count    = 0;
+    extent_t extents[EXTENT_BATCH];
+
+    p_conn->file_fd = open_download_file(p_conn->filename, &file_sz, &mtime_ns, &base, &p_conn->p_fill);
+    if (-1 == p_conn->file_fd)
+    {
+        reply_error(p_conn, errno);
+        return;
+    }
+    if (-1 == v2_clip_range(file_sz, p_conn->range_off, &length))
+    {
+        close_file(p_conn);
+        reply_error(p_conn, ERANGE);
+        return;
+    }
+
+    size_t reply_len = V2_HDR_SZ + V2_EXTENTS_HEAD_SZ;
+    char * p_reply   = arena_alloc(&p_conn->arena, reply_len + (V2_EXTENTS_MAX * V2_EXTENT_SZ));
+    if (NULL == p_reply)
+    {
+        close_file(p_conn);
+        reply_error(p_conn, ENOMEM);
+        return;
+    }
+
+    uint64_t map_off = p_conn->range_off;
+    uint64_t map_end = p_conn->range_off + length;
+    if (NULL != p_conn->p_fill)
+    {
+        // the holes of a cache copy still being filled in are bytes not yet
+        // copied, not holes of the file
+        if (0 < length)
+        {
+            reply_len += v2_encode_extent(p_reply + reply_len, map_off, length);
+            count      = 1;
+        }
+        map_off = map_end;
+    }
+    while ((map_off < map_end) && (V2_EXTENTS_MAX > count))
+    {
+        size_t  batch = V2_EXTENTS_MAX - count;
+        ssize_t found = find_extents(p_conn->file_fd, base, &map_off, map_end, extents,
+                                     (batch > EXTENT_BATCH) ? EXTENT_BATCH : batch);
+        if (-1 == found)
+        {
+            int err = errno;
+            close_file(p_conn);
+            arena_reset(&p_conn->arena);
+            reply_error(p_conn, err);
+            return;
+        }
+        for (ssize_t idx = 0; idx < found; idx++)
+        {
+            reply_len += v2_encode_extent(p_reply + reply_len, extents[idx].offset, extents[idx].length);
+        }
+        count += found;
+    }
+    close_file(p_conn);
+
+    printf("Mapped %" PRIu32 " data extent(s) of %s up to byte %" PRIu64 "\n", count, p_conn->filename, map_off);
+    v2_encode_reply(p_reply, p_conn->opcode, p_conn->request_id, reply_len - V2_HDR_SZ);
+    v2_encode_extents_head(p_reply + V2_HDR_SZ, file_sz, mtime_ns, map_off, count);
+    set_output(p_conn, p_reply, reply_len, true, CONN_V2_READ_HDR);
+}
+
+void run_job (conn_t * p_conn)
+{
+    char   * p_list   = NULL;
+    size_t   list_len = 0;
+
+    switch (p_conn->job)
+    {
+        case JOB_LIST:
+            if (PROTO_V2 == p_conn->proto)
+            {
+                if (V2_OP_LIST_PAGE == p_conn->opcode)
+                {
+                    p_list = list_dir_page(&p_conn->arena, V2_HDR_SZ, p_conn->range_off, p_conn->range_len,
+                                           p_conn->filename, &list_len);
+                }
+                else
+                {
+                    p_list = (V2_OP_LIST_DETAIL == p_conn->opcode) ?
+                             list_dir_detail(&p_conn->arena, V2_HDR_SZ, &list_len) :
+                             list_dir_v2(&p_conn->arena, V2_HDR_SZ, &list_len);
+                }
+                if (NULL == p_list)
+                {
+                    int err = errno;
+                    arena_reset(&p_conn->arena);
+                    reply_error(p_conn, err);
+                    break;
+                }
+                v2_encode_reply(p_list, p_conn->opcode, p_conn->request_id, list_len - V2_HDR_SZ);
+                set_output(p_conn, p_list, list_len, true, CONN_V2_READ_HDR);
+                break;
+            }
+            p_list = list_dir(&p_conn->arena, &list_len);
+            if (NULL == p_list)
+            {
+                fprintf(stderr, "%s could not retrieve file list on server\n", __func__);
+                p_conn->state = CONN_CLOSE;
+                break;
+            }
+            set_output(p_conn, p_list, list_len, true, CONN_READ_CMD);
+            break;
+
+        case JOB_OPEN_DOWNLOAD:
+            job_open_download_file(p_conn);
+            break;
+
+        case JOB_SEND_FILE:
+            job_send_file(p_conn);
+            break;
+
+        case JOB_OPEN_UPLOAD:
+            job_open_upload_file(p_conn);
+            break;
+
+        case JOB_RECV_FILE:
+            job_recv_file(p_conn);
+            break;
+
+        case JOB_UPLOAD_QUERY:
+            job_upload_query(p_conn);
+            break;
+
+        case JOB_SESSION_OPEN:
+            job_session_open(p_conn);
+            break;
+
+        case JOB_SESSION_COMMIT:
+            job_session_commit(p_conn);
+            break;
+
+        case JOB_MAP_EXTENTS:
+            job_map_extents(p_conn);
+            break;
+
+        case JOB_MUX:
+            job_mux(p_conn);
+            break;
+
+        default:
+            fprintf(stderr, "%s invalid job queued\n", __func__);
+            p_conn->state = CONN_CLOSE;
+            break;
+    }
+}
+
+/*** end connection.c ***/
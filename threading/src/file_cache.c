@@ -0,0 +1,707 @@
+#include "../includes/file_cache.h"
+#include "../includes/storage_layout.h"
+
+/**
+ * @brief - the FIFO an entry is queued in
+ */
+typedef enum cache_queue
+{
+    QUEUE_SMALL,
+    QUEUE_MAIN,
+} cache_queue_t;
+
+/**
+ * @brief - the copy of a cached file, shared by its entry and by every
+ *          download reading it. It is filled in CACHE_FILL_CHUNK steps by
+ *          whichever download needs the next bytes first
+ * @member lock - held while a chunk is copied
+ * @member refs - the entry and every download holding the copy
+ * @member filled - bytes of the copy that are in place
+ * @member failed - the file could not be read, the copy is never completed
+ * @member src_fd / base - the file being copied and where it starts in
+ *                         src_fd, closed once the copy is complete
+ * @member mem_fd - the copy, written at its file position
+ * @member size - the size of the file
+ */
+struct cache_fill
+{
+    pthread_mutex_t         lock;
+    atomic_uint             refs;
+    atomic_uint_fast64_t    filled;
+    atomic_bool             failed;
+    int                     src_fd;
+    uint64_t                base;
+    int                     mem_fd;
+    uint64_t                size;
+};
+
+/**
+ * @brief - one cached file, chained into its bucket and queued in a FIFO
+ * @member p_next - next entry in the bucket
+ * @member p_newer / p_older - neighbours in its FIFO
+ * @member hash - layout_hash of the name
+ * @member size / mtime_ns / ino - the copy is only served while the index
+ *                                 reports the same
+ * @member fd - memfd holding the copy from offset 0
+ * @member p_fill - the copy, it may still be being filled in
+ * @member queue - the FIFO it is in
+ * @member freq - reads since it last moved, up to CACHE_FREQ_MAX
+ * @member name_len / name - the NUL terminated file name
+ */
+typedef struct cache_entry
+{
+    struct cache_entry  * p_next;
+    struct cache_entry  * p_newer;
+    struct cache_entry  * p_older;
+    uint64_t              hash;
+    uint64_t              size;
+    uint64_t              mtime_ns;
+    uint64_t              ino;
+    int                   fd;
+    cache_fill_t        * p_fill;
+    cache_queue_t         queue;
+    atomic_uint           freq;
+    uint16_t              name_len;
+    char                  name[];
+} cache_entry_t;
+
+/**
+ * @brief - a FIFO of entries, new ones go in at the head
+ * @member p_head / p_tail - newest and oldest entry
+ * @member count / bytes - number of entries and their file bytes
+ */
+typedef struct cache_fifo
+{
+    cache_entry_t   * p_head;
+    cache_entry_t   * p_tail;
+    uint64_t          count;
+    uint64_t          bytes;
+} cache_fifo_t;
+
+/**
+ * @brief - one stripe of the table, readers only take its read lock
+ * @member lock - written under the queue lock only
+ * @member p_buckets - the stripe's share of the buckets
+ */
+typedef struct cache_stripe
+{
+    pthread_rwlock_t    lock;
+    cache_entry_t     * p_buckets[CACHE_STRIPE_BUCKETS];
+} cache_stripe_t;
+
+/**
+ * @brief - the cache
+ * @member enabled - set by file_cache_init with a budget
+ * @member budget / small_budget / max_object - byte limits of the whole cache,
+ *                                              of the small FIFO and of one file
+ * @member stripes - the table
+ * @member queue_lock - held for every change to the table, the FIFOs and the
+ *                      ghosts
+ * @member small / main - the FIFOs
+ * @member ghosts / ghost_head / ghost_count - ring of the hashes of names
+ *                                             dropped from the small FIFO
+ * @member hits ... coalesced - the counters of file_cache_stats_t
+ */
+typedef struct file_cache
+{
+    bool                    enabled;
+    uint64_t                budget;
+    uint64_t                small_budget;
+    uint64_t                max_object;
+    cache_stripe_t          stripes[CACHE_STRIPES];
+    pthread_mutex_t         queue_lock;
+    cache_fifo_t            small;
+    cache_fifo_t            main;
+    uint64_t                ghosts[CACHE_MAX_ENTRIES];
+    size_t                  ghost_head;
+    size_t                  ghost_count;
+    atomic_uint_fast64_t    hits;
+    atomic_uint_fast64_t    misses;
+    atomic_uint_fast64_t    inserts;
+    atomic_uint_fast64_t    evictions;
+    atomic_uint_fast64_t    invalidations;
+    atomic_uint_fast64_t    coalesced;
+} file_cache_t;
+
+static file_cache_t file_cache = { 0 };
+
+/**
+ * CACHE_STRIPE_T * STRIPE_OF:
+ * @brief - the stripe a hash lives in
+ */
+static cache_stripe_t * stripe_of (uint64_t hash)
+{
+    return &file_cache.stripes[hash % CACHE_STRIPES];
+}
+
+/**
+ * CACHE_ENTRY_T ** FIND_SLOT:
+ * @brief - returns the link that points at the entry for a name, or the NULL
+ *          link at the end of its bucket. The caller holds the stripe lock or
+ *          the queue lock
+ */
+static cache_entry_t ** find_slot (const char * p_filename, uint64_t hash)
+{
+    cache_entry_t ** pp_slot = &stripe_of(hash)->p_buckets[(hash / CACHE_STRIPES) % CACHE_STRIPE_BUCKETS];
+
+    while ((NULL != *pp_slot) && ((hash != (*pp_slot)->hash) || (0 != strcmp((*pp_slot)->name, p_filename))))
+    {
+        pp_slot = &(*pp_slot)->p_next;
+    }
+    return pp_slot;
+}
+
+/**
+ * BOOL ENTRY_MATCHES:
+ * @brief - whether a cached copy is the file the index describes, a copy that
+ *          failed matches nothing
+ */
+static bool entry_matches (const cache_entry_t * p_entry, const file_info_t * p_info)
+{
+    return (p_entry->size == p_info->size) && (p_entry->mtime_ns == p_info->mtime_ns) && (p_entry->ino == p_info->ino) &&
+           (false == atomic_load_explicit(&p_entry->p_fill->failed, memory_order_relaxed));
+}
+
+/**
+ * VOID FIFO_PUSH:
+ * @brief - queues an entry at the head of a FIFO
+ */
+static void fifo_push (cache_fifo_t * p_fifo, cache_entry_t * p_entry)
+{
+    p_entry->p_newer = NULL;
+    p_entry->p_older = p_fifo->p_head;
+    if (NULL != p_fifo->p_head)
+    {
+        p_fifo->p_head->p_newer = p_entry;
+    }
+    else
+    {
+        p_fifo->p_tail = p_entry;
+    }
+    p_fifo->p_head = p_entry;
+    p_fifo->count++;
+    p_fifo->bytes += p_entry->size;
+}
+
+/**
+ * VOID FIFO_REMOVE:
+ * @brief - takes an entry out of its FIFO
+ */
+static void fifo_remove (cache_fifo_t * p_fifo, cache_entry_t * p_entry)
+{
+    if (NULL != p_entry->p_newer)
+    {
+        p_entry->p_newer->p_older = p_entry->p_older;
+    }
+    else
+    {
+        p_fifo->p_head = p_entry->p_older;
+    }
+    if (NULL != p_entry->p_older)
+    {
+        p_entry->p_older->p_newer = p_entry->p_newer;
+    }
+    else
+    {
+        p_fifo->p_tail = p_entry->p_newer;
+    }
+    p_entry->p_newer = NULL;
+    p_entry->p_older = NULL;
+    p_fifo->count--;
+    p_fifo->bytes -= p_entry->size;
+}
+
+/**
+ * CACHE_FIFO_T * FIFO_OF:
+ * @brief - the FIFO an entry is queued in
+ */
+static cache_fifo_t * fifo_of (const cache_entry_t * p_entry)
+{
+    return (QUEUE_MAIN == p_entry->queue) ? &file_cache.main : &file_cache.small;
+}
+
+/**
+ * VOID DROP_ENTRY:
+ * @brief - unlinks an entry that is no longer queued from the table and frees
+ *          it. Readers of its stripe are waited out, a descriptor one of them
+ *          dup'd stays valid. The caller holds the queue lock
+ */
+static void drop_entry (cache_entry_t * p_entry)
+{
+    cache_stripe_t * p_stripe = stripe_of(p_entry->hash);
+
+    pthread_rwlock_wrlock(&p_stripe->lock);
+    cache_entry_t ** pp_slot = find_slot(p_entry->name, p_entry->hash);
+    *pp_slot = p_entry->p_next;
+    pthread_rwlock_unlock(&p_stripe->lock);
+
+    close(p_entry->fd);
+    file_cache_release(p_entry->p_fill);
+    free(p_entry);
+}
+
+/**
+ * VOID GHOST_PUSH:
+ * @brief - remembers the hash of a name dropped from the small FIFO, the
+ *          oldest ghost makes way once the ring is full
+ */
+static void ghost_push (uint64_t hash)
+{
+    if (CACHE_MAX_ENTRIES > file_cache.ghost_count)
+    {
+        file_cache.ghosts[(file_cache.ghost_head + file_cache.ghost_count) % CACHE_MAX_ENTRIES] = hash;
+        file_cache.ghost_count++;
+        return;
+    }
+    file_cache.ghosts[file_cache.ghost_head] = hash;
+    file_cache.ghost_head = (file_cache.ghost_head + 1) % CACHE_MAX_ENTRIES;
+}
+
+/**
+ * BOOL GHOST_TAKE:
+ * @brief - whether a hash is a ghost, it is forgotten if so. A taken slot is
+ *          zeroed and left to age out of the ring
+ */
+static bool ghost_take (uint64_t hash)
+{
+    for (size_t idx = 0; idx < file_cache.ghost_count; idx++)
+    {
+        uint64_t * p_ghost = &file_cache.ghosts[(file_cache.ghost_head + idx) % CACHE_MAX_ENTRIES];
+        if (hash == *p_ghost)
+        {
+            *p_ghost = 0;
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * BOOL EVICT_ONE:
+ * @brief - drops one file. The small FIFO is shrunk while it is over its
+ *          share: its oldest file moves on to the main FIFO if it was read
+ *          since it came in, otherwise it is dropped and becomes a ghost. The
+ *          oldest file of the main FIFO gets another round for every read and
+ *          is dropped once it has none left. The caller holds the queue lock.
+ *          False if the cache is empty
+ */
+static bool evict_one ()
+{
+    while ((0 != file_cache.small.count) || (0 != file_cache.main.count))
+    {
+        cache_entry_t * p_entry = NULL;
+
+        if ((0 != file_cache.small.count) &&
+            ((file_cache.small.bytes > file_cache.small_budget) || (0 == file_cache.main.count)))
+        {
+            p_entry = file_cache.small.p_tail;
+            fifo_remove(&file_cache.small, p_entry);
+            if (0 != atomic_exchange_explicit(&p_entry->freq, 0, memory_order_relaxed))
+            {
+                p_entry->queue = QUEUE_MAIN;
+                fifo_push(&file_cache.main, p_entry);
+                continue;
+            }
+            ghost_push(p_entry->hash);
+        }
+        else
+        {
+            p_entry = file_cache.main.p_tail;
+            fifo_remove(&file_cache.main, p_entry);
+            unsigned int freq = atomic_load_explicit(&p_entry->freq, memory_order_relaxed);
+            while ((0 != freq) &&
+                   (false == atomic_compare_exchange_weak_explicit(&p_entry->freq, &freq, freq - 1,
+                                                                  memory_order_relaxed, memory_order_relaxed)))
+            {
+                ;
+            }
+            if (0 != freq)
+            {
+                fifo_push(&file_cache.main, p_entry);
+                continue;
+            }
+        }
+
+        drop_entry(p_entry);
+        atomic_fetch_add_explicit(&file_cache.evictions, 1, memory_order_relaxed);
+        return true;
+    }
+    return false;
+}
+
+/**
+ * CACHE_ENTRY_T * NEW_ENTRY:
+ * @brief - sets up an entry with an empty copy of a file, filled in later
+ *          from a descriptor of its own. NULL on error
+ */
+static cache_entry_t * new_entry (const char * p_filename, uint64_t hash, const file_info_t * p_info, int file_fd,
+                                  uint64_t base)
+{
+    size_t          name_len = strlen(p_filename);
+    int             mem_fd   = -1;
+    cache_entry_t * p_entry  = calloc(1, sizeof(cache_entry_t) + name_len + 1);
+    cache_fill_t  * p_fill   = calloc(1, sizeof(cache_fill_t));
+
+    if ((NULL == p_entry) || (NULL == p_fill))
+    {
+        fprintf(stderr, "%s could not allocate a cache entry: %s\n", __func__, strerror(ENOMEM));
+        goto FAIL;
+    }
+
+    p_fill->src_fd = -1;
+    p_fill->mem_fd = -1;
+    mem_fd         = memfd_create("file_cache", MFD_CLOEXEC);
+    if (-1 != mem_fd)
+    {
+        p_fill->mem_fd = fcntl(mem_fd, F_DUPFD_CLOEXEC, 0);
+        p_fill->src_fd = fcntl(file_fd, F_DUPFD_CLOEXEC, 0);
+    }
+    if ((-1 == mem_fd) || (-1 == p_fill->mem_fd) || (-1 == p_fill->src_fd))
+    {
+        fprintf(stderr, "%s could not set up a copy: %s\n", __func__, strerror(errno));
+        goto FAIL;
+    }
+
+    pthread_mutex_init(&p_fill->lock, NULL);
+    atomic_init(&p_fill->refs, 1);
+    atomic_init(&p_fill->filled, 0);
+    atomic_init(&p_fill->failed, false);
+    p_fill->base = base;
+    p_fill->size = p_info->size;
+
+    p_entry->hash     = hash;
+    p_entry->size     = p_info->size;
+    p_entry->mtime_ns = p_info->mtime_ns;
+    p_entry->ino      = p_info->ino;
+    p_entry->fd       = mem_fd;
+    p_entry->p_fill   = p_fill;
+    p_entry->name_len = name_len;
+    atomic_init(&p_entry->freq, 0);
+    memcpy(p_entry->name, p_filename, name_len + 1);
+    return p_entry;
+
+FAIL:
+    if (NULL != p_fill)
+    {
+        if (-1 != p_fill->src_fd)
+        {
+            close(p_fill->src_fd);
+        }
+        if (-1 != p_fill->mem_fd)
+        {
+            close(p_fill->mem_fd);
+        }
+    }
+    if (-1 != mem_fd)
+    {
+        close(mem_fd);
+    }
+    free(p_fill);
+    free(p_entry);
+    return NULL;
+}
+
+/**
+ * INT ENTRY_OPEN:
+ * @brief - hands out a descriptor of an entry's copy and, while the copy is
+ *          still being filled in, a reference to it. -1 on error
+ */
+static int entry_open (cache_entry_t * p_entry, cache_fill_t ** pp_fill)
+{
+    int file_fd = fcntl(p_entry->fd, F_DUPFD_CLOEXEC, 0);
+
+    if ((-1 != file_fd) &&
+        (p_entry->size > atomic_load_explicit(&p_entry->p_fill->filled, memory_order_acquire)))
+    {
+        atomic_fetch_add_explicit(&p_entry->p_fill->refs, 1, memory_order_relaxed);
+        *pp_fill = p_entry->p_fill;
+    }
+    return file_fd;
+}
+
+/**
+ * VOID FILL_PULL:
+ * @brief - copies chunks of the file until the copy reaches past offset, the
+ *          descriptors used for copying are closed once it is complete. The
+ *          caller holds the fill lock
+ */
+static void fill_pull (cache_fill_t * p_fill, uint64_t offset)
+{
+    uint64_t filled = atomic_load_explicit(&p_fill->filled, memory_order_relaxed);
+
+    while ((filled <= offset) && (filled < p_fill->size) &&
+           (false == atomic_load_explicit(&p_fill->failed, memory_order_relaxed)))
+    {
+        uint64_t chunk   = p_fill->size - filled;
+        off_t    src_off = p_fill->base + filled;
+
+        chunk = (chunk > CACHE_FILL_CHUNK) ? CACHE_FILL_CHUNK : chunk;
+        ssize_t copied = sendfile(p_fill->mem_fd, p_fill->src_fd, &src_off, chunk);
+        if ((-1 == copied) && (EINTR == errno))
+        {
+            continue;
+        }
+        if (0 >= copied)
+        {
+            // a file that shrank under us fails every download of the copy
+            fprintf(stderr, "%s could not copy the file: %s\n", __func__,
+                    (0 == copied) ? "file was truncated" : strerror(errno));
+            atomic_store_explicit(&p_fill->failed, true, memory_order_relaxed);
+            break;
+        }
+        filled += copied;
+        atomic_store_explicit(&p_fill->filled, filled, memory_order_release);
+    }
+
+    if ((filled == p_fill->size) && (-1 != p_fill->src_fd))
+    {
+        close(p_fill->src_fd);
+        close(p_fill->mem_fd);
+        p_fill->src_fd = -1;
+        p_fill->mem_fd = -1;
+    }
+}
+
+int file_cache_init (uint64_t budget)
+{
+    if (0 == budget)
+    {
+        return 0;
+    }
+
+    for (size_t idx = 0; idx < CACHE_STRIPES; idx++)
+    {
+        if (0 != pthread_rwlock_init(&file_cache.stripes[idx].lock, NULL))
+        {
+            fprintf(stderr, "%s could not initialize a stripe lock\n", __func__);
+            while (0 < idx)
+            {
+                pthread_rwlock_destroy(&file_cache.stripes[--idx].lock);
+            }
+            return -1;
+        }
+    }
+    pthread_mutex_init(&file_cache.queue_lock, NULL);
+
+    file_cache.budget       = budget;
+    file_cache.small_budget = (budget / 100) * CACHE_SMALL_PCT;
+    file_cache.max_object   = budget / CACHE_OBJECT_DIV;
+    file_cache.enabled      = true;
+    return 0;
+}
+
+void file_cache_cleanup ()
+{
+    if (false == file_cache.enabled)
+    {
+        return;
+    }
+
+    pthread_mutex_lock(&file_cache.queue_lock);
+    cache_fifo_t * fifos[] = { &file_cache.small, &file_cache.main };
+    for (size_t idx = 0; idx < sizeof(fifos) / sizeof(fifos[0]); idx++)
+    {
+        while (NULL != fifos[idx]->p_tail)
+        {
+            cache_entry_t * p_entry = fifos[idx]->p_tail;
+            fifo_remove(fifos[idx], p_entry);
+            drop_entry(p_entry);
+        }
+    }
+    file_cache.enabled = false;
+    pthread_mutex_unlock(&file_cache.queue_lock);
+
+    for (size_t idx = 0; idx < CACHE_STRIPES; idx++)
+    {
+        pthread_rwlock_destroy(&file_cache.stripes[idx].lock);
+    }
+    pthread_mutex_destroy(&file_cache.queue_lock);
+}
+
+int file_cache_open (const char * p_filename, const file_info_t * p_info, cache_fill_t ** pp_fill)
+{
+    *pp_fill = NULL;
+    if (false == file_cache.enabled)
+    {
+        return -1;
+    }
+
+    int              file_fd  = -1;
+    uint64_t         hash     = layout_hash(p_filename);
+    cache_stripe_t * p_stripe = stripe_of(hash);
+
+    pthread_rwlock_rdlock(&p_stripe->lock);
+    cache_entry_t * p_entry = *find_slot(p_filename, hash);
+    if ((NULL != p_entry) && (true == entry_matches(p_entry, p_info)))
+    {
+        file_fd = entry_open(p_entry, pp_fill);
+        unsigned int freq = atomic_load_explicit(&p_entry->freq, memory_order_relaxed);
+        while ((CACHE_FREQ_MAX > freq) &&
+               (false == atomic_compare_exchange_weak_explicit(&p_entry->freq, &freq, freq + 1,
+                                                              memory_order_relaxed, memory_order_relaxed)))
+        {
+            ;
+        }
+    }
+    pthread_rwlock_unlock(&p_stripe->lock);
+
+    atomic_fetch_add_explicit((-1 == file_fd) ? &file_cache.misses : &file_cache.hits, 1, memory_order_relaxed);
+    if (NULL != *pp_fill)
+    {
+        atomic_fetch_add_explicit(&file_cache.coalesced, 1, memory_order_relaxed);
+    }
+    return file_fd;
+}
+
+int file_cache_fill (const char * p_filename, const file_info_t * p_info, int file_fd, uint64_t base,
+                     cache_fill_t ** pp_fill)
+{
+    *pp_fill = NULL;
+    if ((false == file_cache.enabled) || (0 == p_info->size) || (file_cache.max_object < p_info->size))
+    {
+        return -1;
+    }
+
+    int              cache_fd = -1;
+    uint64_t         hash     = layout_hash(p_filename);
+    cache_stripe_t * p_stripe = stripe_of(hash);
+    cache_entry_t  * p_entry  = new_entry(p_filename, hash, p_info, file_fd, base);
+    if (NULL == p_entry)
+    {
+        return -1;
+    }
+
+    pthread_mutex_lock(&file_cache.queue_lock);
+
+    // a download that missed at the same time got here first, read its copy
+    cache_entry_t * p_found = *find_slot(p_filename, hash);
+    if ((NULL != p_found) && (true == entry_matches(p_found, p_info)))
+    {
+        cache_fd = entry_open(p_found, pp_fill);
+        pthread_mutex_unlock(&file_cache.queue_lock);
+        if (NULL != *pp_fill)
+        {
+            atomic_fetch_add_explicit(&file_cache.coalesced, 1, memory_order_relaxed);
+        }
+        close(p_entry->fd);
+        file_cache_release(p_entry->p_fill);
+        free(p_entry);
+        return cache_fd;
+    }
+    if (NULL != p_found)
+    {
+        fifo_remove(fifo_of(p_found), p_found);
+        drop_entry(p_found);
+        atomic_fetch_add_explicit(&file_cache.invalidations, 1, memory_order_relaxed);
+    }
+
+    // a name that was dropped from the small FIFO not long ago is coming back,
+    // so it is worth keeping for longer
+    p_entry->queue = (true == ghost_take(hash)) ? QUEUE_MAIN : QUEUE_SMALL;
+    while (((file_cache.small.bytes + file_cache.main.bytes + p_entry->size) > file_cache.budget) ||
+           ((file_cache.small.count + file_cache.main.count) >= CACHE_MAX_ENTRIES))
+    {
+        if (false == evict_one())
+        {
+            break;
+        }
+    }
+    fifo_push(fifo_of(p_entry), p_entry);
+
+    pthread_rwlock_wrlock(&p_stripe->lock);
+    cache_entry_t ** pp_slot = find_slot(p_filename, hash);
+    *pp_slot = p_entry;
+    pthread_rwlock_unlock(&p_stripe->lock);
+
+    cache_fd = entry_open(p_entry, pp_fill);
+    pthread_mutex_unlock(&file_cache.queue_lock);
+
+    atomic_fetch_add_explicit(&file_cache.inserts, 1, memory_order_relaxed);
+    return cache_fd;
+}
+
+ssize_t file_cache_ready (cache_fill_t * p_fill, uint64_t offset, size_t count)
+{
+    if (NULL == p_fill)
+    {
+        return count;
+    }
+
+    // only a download that caught up with the copy takes the lock, it copies
+    // the next chunk (or waits for the one being copied) and moves on
+    uint64_t filled = atomic_load_explicit(&p_fill->filled, memory_order_acquire);
+    if (filled <= offset)
+    {
+        pthread_mutex_lock(&p_fill->lock);
+        fill_pull(p_fill, offset);
+        pthread_mutex_unlock(&p_fill->lock);
+
+        filled = atomic_load_explicit(&p_fill->filled, memory_order_acquire);
+        if (filled <= offset)
+        {
+            errno = ENODATA;
+            return -1;
+        }
+    }
+    return ((filled - offset) < count) ? (ssize_t)(filled - offset) : (ssize_t)count;
+}
+
+void file_cache_release (cache_fill_t * p_fill)
+{
+    if ((NULL == p_fill) || (1 != atomic_fetch_sub_explicit(&p_fill->refs, 1, memory_order_acq_rel)))
+    {
+        return;
+    }
+
+    if (-1 != p_fill->src_fd)
+    {
+        close(p_fill->src_fd);
+        close(p_fill->mem_fd);
+    }
+    pthread_mutex_destroy(&p_fill->lock);
+    free(p_fill);
+}
+
+void file_cache_invalidate (const char * p_filename, const file_info_t * p_info)
+{
+    if (false == file_cache.enabled)
+    {
+        return;
+    }
+
+    uint64_t hash = layout_hash(p_filename);
+
+    pthread_mutex_lock(&file_cache.queue_lock);
+    cache_entry_t * p_entry = *find_slot(p_filename, hash);
+    if ((NULL != p_entry) && ((NULL == p_info) || (false == entry_matches(p_entry, p_info))))
+    {
+        fifo_remove(fifo_of(p_entry), p_entry);
+        drop_entry(p_entry);
+        atomic_fetch_add_explicit(&file_cache.invalidations, 1, memory_order_relaxed);
+    }
+    pthread_mutex_unlock(&file_cache.queue_lock);
+}
+
+void file_cache_get_stats (file_cache_stats_t * p_stats)
+{
+    *p_stats = (file_cache_stats_t){ 0 };
+    if (false == file_cache.enabled)
+    {
+        return;
+    }
+
+    p_stats->hits          = atomic_load_explicit(&file_cache.hits, memory_order_relaxed);
+    p_stats->misses        = atomic_load_explicit(&file_cache.misses, memory_order_relaxed);
+    p_stats->inserts       = atomic_load_explicit(&file_cache.inserts, memory_order_relaxed);
+    p_stats->evictions     = atomic_load_explicit(&file_cache.evictions, memory_order_relaxed);
+    p_stats->invalidations = atomic_load_explicit(&file_cache.invalidations, memory_order_relaxed);
+    p_stats->coalesced     = atomic_load_explicit(&file_cache.coalesced, memory_order_relaxed);
+    p_stats->budget        = file_cache.budget;
+
+    pthread_mutex_lock(&file_cache.queue_lock);
+    p_stats->entries = file_cache.small.count + file_cache.main.count;
+    p_stats->bytes   = file_cache.small.bytes + file_cache.main.bytes;
+    pthread_mutex_unlock(&file_cache.queue_lock);
+}
+
+/*** end file_cache.c ***/
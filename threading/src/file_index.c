@@ -0,0 +1,563 @@
+#include "../includes/file_index.h"
+#include "../includes/file_operations.h"
+#include "../includes/storage_layout.h"
+#include "../includes/segment_store.h"
+#include "../includes/file_cache.h"
+
+#define INDEX_EVENTS    (IN_CREATE | IN_CLOSE_WRITE | IN_MODIFY | IN_ATTRIB | IN_DELETE | \
+                         IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF)
+
+/**
+ * @brief - one indexed file, chained into its hash bucket
+ * @member p_next - next entry in the bucket
+ * @member hash - hash of the name
+ * @member size / mtime_ns / ino / packed - as in file_info_t
+ * @member name_len / name - the NUL terminated file name
+ */
+typedef struct index_entry
+{
+    struct index_entry  * p_next;
+    uint64_t              hash;
+    uint64_t              size;
+    uint64_t              mtime_ns;
+    uint64_t              ino;
+    bool                  packed;
+    uint16_t              name_len;
+    char                  name[];
+} index_entry_t;
+
+/**
+ * @brief - the index and its watcher
+ * @member lock - writers are the watcher thread and file_index_refresh
+ * @member pp_buckets / num_buckets - the hash table, a power of two
+ * @member count - number of entries
+ * @member inotify_fd - watches FILE_SERVER_DIR and, when it is sharded, every
+ *                      shard directory
+ * @member stop_fd - eventfd that wakes the watcher to exit
+ * @member watcher - the watcher thread
+ * @member running - the watcher thread was started
+ */
+typedef struct file_index
+{
+    pthread_rwlock_t    lock;
+    index_entry_t    ** pp_buckets;
+    size_t              num_buckets;
+    size_t              count;
+    int                 inotify_fd;
+    int                 stop_fd;
+    pthread_t           watcher;
+    bool                running;
+} file_index_t;
+
+static file_index_t file_index = { .inotify_fd = -1, .stop_fd = -1 };
+
+/**
+ * INDEX_ENTRY_T ** FIND_SLOT:
+ * @brief - returns the link that points at the entry for a name, or the NULL
+ *          link at the end of its bucket. The caller holds the lock
+ */
+static index_entry_t ** find_slot (const char * p_filename, uint64_t hash)
+{
+    index_entry_t ** pp_slot = &file_index.pp_buckets[hash & (file_index.num_buckets - 1)];
+
+    while ((NULL != *pp_slot) && (((*pp_slot)->hash != hash) || (0 != strcmp((*pp_slot)->name, p_filename))))
+    {
+        pp_slot = &(*pp_slot)->p_next;
+    }
+    return pp_slot;
+}
+
+/**
+ * VOID GROW_TABLE:
+ * @brief - doubles the bucket count once there are more entries than buckets,
+ *          the caller holds the write lock. A failed allocation keeps the old
+ *          table, lookups only get slower
+ */
+static void grow_table ()
+{
+    size_t           num_buckets = file_index.num_buckets * 2;
+    index_entry_t ** pp_buckets  = calloc(num_buckets, sizeof(index_entry_t *));
+
+    if (NULL == pp_buckets)
+    {
+        return;
+    }
+
+    for (size_t idx = 0; idx < file_index.num_buckets; idx++)
+    {
+        index_entry_t * p_entry = file_index.pp_buckets[idx];
+        while (NULL != p_entry)
+        {
+            index_entry_t  * p_next  = p_entry->p_next;
+            index_entry_t ** pp_head = &pp_buckets[p_entry->hash & (num_buckets - 1)];
+            p_entry->p_next = *pp_head;
+            *pp_head        = p_entry;
+            p_entry         = p_next;
+        }
+    }
+    free(file_index.pp_buckets);
+    file_index.pp_buckets  = pp_buckets;
+    file_index.num_buckets = num_buckets;
+}
+
+/**
+ * VOID REMOVE_ENTRY:
+ * @brief - drops a name from the index, the caller holds the write lock
+ */
+static void remove_entry (const char * p_filename)
+{
+    index_entry_t ** pp_slot = find_slot(p_filename, layout_hash(p_filename));
+    index_entry_t  * p_entry = *pp_slot;
+
+    if (NULL != p_entry)
+    {
+        *pp_slot = p_entry->p_next;
+        free(p_entry);
+        file_index.count--;
+    }
+}
+
+/**
+ * VOID STAT_INFO:
+ * @brief - describes a stored file from its stat data
+ */
+static void stat_info (const struct stat * p_stat, file_info_t * p_info)
+{
+    p_info->size     = p_stat->st_size;
+    p_info->mtime_ns = ((uint64_t)p_stat->st_mtim.tv_sec * 1000000000ULL) + p_stat->st_mtim.tv_nsec;
+    p_info->ino      = p_stat->st_ino;
+    p_info->packed   = false;
+}
+
+/**
+ * VOID UPDATE_ENTRY:
+ * @brief - adds or updates the entry for a name, the caller holds the write
+ *          lock
+ */
+static void update_entry (const char * p_filename, const file_info_t * p_info)
+{
+    uint64_t         hash    = layout_hash(p_filename);
+    index_entry_t ** pp_slot = find_slot(p_filename, hash);
+    index_entry_t  * p_entry = *pp_slot;
+
+    if (NULL == p_entry)
+    {
+        size_t name_len = strnlen(p_filename, MAX_STR_LEN);
+        p_entry = calloc(1, sizeof(index_entry_t) + name_len + 1);
+        if (NULL == p_entry)
+        {
+            fprintf(stderr, "%s could not index %s: %s\n", __func__, p_filename, strerror(ENOMEM));
+            return;
+        }
+        memcpy(p_entry->name, p_filename, name_len);
+        p_entry->name_len = name_len;
+        p_entry->hash     = hash;
+        *pp_slot          = p_entry;
+        file_index.count++;
+    }
+
+    p_entry->size     = p_info->size;
+    p_entry->mtime_ns = p_info->mtime_ns;
+    p_entry->ino      = p_info->ino;
+    p_entry->packed   = p_info->packed;
+
+    if (file_index.count > file_index.num_buckets)
+    {
+        grow_table();
+    }
+}
+
+/**
+ * VOID APPLY_NAME:
+ * @brief - stats a name and makes its entry match, only regular files (not
+ *          the symlinks or directories list_dir never showed) are indexed.
+ *          The name is looked up wherever the layout keeps it, so an event
+ *          from any watched directory can be applied by name alone. A name
+ *          that is both stored and packed keeps the newer copy, the other one
+ *          is dropped (a stale stored copy is shadowed until it is replaced or
+ *          removed). The stat is done before taking the write lock. Any
+ *          cached copy of an older version of the file is dropped
+ */
+static void apply_name (const char * p_filename)
+{
+    struct stat file_stat = { 0 };
+    file_info_t info      = { 0 };
+    file_info_t packed    = { 0 };
+    bool        present   = (0 == layout_lstat(p_filename, &file_stat)) && S_ISREG(file_stat.st_mode);
+    bool        is_packed = segment_lookup(p_filename, &packed);
+
+    stat_info(&file_stat, &info);
+    if ((true == present) && (true == is_packed))
+    {
+        if (info.mtime_ns >= packed.mtime_ns)
+        {
+            segment_drop(p_filename, info.mtime_ns);
+            is_packed = false;
+        }
+        else
+        {
+            present = false;
+        }
+    }
+
+    const file_info_t * p_current = (true == present) ? &info : ((true == is_packed) ? &packed : NULL);
+
+    pthread_rwlock_wrlock(&file_index.lock);
+    if (NULL != p_current)
+    {
+        update_entry(p_filename, p_current);
+    }
+    else
+    {
+        remove_entry(p_filename);
+    }
+    pthread_rwlock_unlock(&file_index.lock);
+
+    // a cached copy is never served once it stops matching the entry,
+    // dropping it here frees its memory right away
+    file_cache_invalidate(p_filename, p_current);
+}
+
+/**
+ * VOID CLEAR_TABLE:
+ * @brief - frees every entry, the caller holds the write lock
+ */
+static void clear_table ()
+{
+    for (size_t idx = 0; idx < file_index.num_buckets; idx++)
+    {
+        while (NULL != file_index.pp_buckets[idx])
+        {
+            index_entry_t * p_entry = file_index.pp_buckets[idx];
+            file_index.pp_buckets[idx] = p_entry->p_next;
+            free(p_entry);
+        }
+    }
+    file_index.count = 0;
+}
+
+/**
+ * INT SCAN_ONE:
+ * @brief - indexes the regular files of one directory, the caller holds the
+ *          write lock
+ * @return - 0 on success, -1 if the directory could not be read
+ */
+static int scan_one (const char * p_path)
+{
+    DIR           * p_dir     = opendir(p_path);
+    struct dirent * dir       = NULL;
+    struct stat     file_stat = { 0 };
+    file_info_t     info      = { 0 };
+
+    if (NULL == p_dir)
+    {
+        fprintf(stderr, "%s could not open %s: %s\n", __func__, p_path, strerror(errno));
+        return -1;
+    }
+
+    while (NULL != (dir = readdir(p_dir)))
+    {
+        if ((DT_REG == dir->d_type) && is_valid_filename(dir->d_name) &&
+            (0 == fstatat(dirfd(p_dir), dir->d_name, &file_stat, AT_SYMLINK_NOFOLLOW)) &&
+            S_ISREG(file_stat.st_mode))
+        {
+            stat_info(&file_stat, &info);
+            update_entry(dir->d_name, &info);
+        }
+    }
+    closedir(p_dir);
+    return 0;
+}
+
+/**
+ * BOOL KEEP_PACKED:
+ * @brief - indexes a packed file during a scan unless a stored copy of the
+ *          name is at least as new, the caller holds the write lock
+ */
+static bool keep_packed (const file_info_t * p_info, void * p_arg)
+{
+    index_entry_t * p_entry = *find_slot(p_info->p_name, layout_hash(p_info->p_name));
+
+    (void)p_arg;
+    if ((NULL != p_entry) && (p_entry->mtime_ns >= p_info->mtime_ns))
+    {
+        return false;
+    }
+    update_entry(p_info->p_name, p_info);
+    return true;
+}
+
+/**
+ * INT SCAN_DIR:
+ * @brief - rebuilds the index from a full walk of the directory and, when it
+ *          is sharded, of every shard. The shards go last so a file that is
+ *          also still at the top level is described by its shard copy, the
+ *          packed files are merged in after them
+ * @return - 0 on success, -1 if a directory could not be read
+ */
+static int scan_dir ()
+{
+    char p_path[PATH_MAX] = { 0 };
+    int  ret_val          = 0;
+
+    pthread_rwlock_wrlock(&file_index.lock);
+    clear_table();
+    ret_val = scan_one(FILE_SERVER_DIR);
+    for (unsigned shard = 0; (0 == ret_val) && (LAYOUT_SHARDED == storage_layout) && (shard < SHARD_COUNT); shard++)
+    {
+        layout_shard_dir(shard, p_path, sizeof(p_path));
+        ret_val = scan_one(p_path);
+    }
+    if (0 == ret_val)
+    {
+        segment_reconcile(keep_packed, NULL);
+    }
+    pthread_rwlock_unlock(&file_index.lock);
+    return ret_val;
+}
+
+/**
+ * INT WATCH_DIRS:
+ * @brief - adds (or renews) the inotify watch of every directory files live in
+ * @return - 0 on success, -1 if a directory could not be watched
+ */
+static int watch_dirs ()
+{
+    char p_path[PATH_MAX] = { 0 };
+
+    if (-1 == inotify_add_watch(file_index.inotify_fd, FILE_SERVER_DIR, INDEX_EVENTS))
+    {
+        fprintf(stderr, "%s could not watch %s: %s\n", __func__, FILE_SERVER_DIR, strerror(errno));
+        return -1;
+    }
+    for (unsigned shard = 0; (LAYOUT_SHARDED == storage_layout) && (shard < SHARD_COUNT); shard++)
+    {
+        layout_shard_dir(shard, p_path, sizeof(p_path));
+        if (-1 == inotify_add_watch(file_index.inotify_fd, p_path, INDEX_EVENTS))
+        {
+            fprintf(stderr, "%s could not watch %s: %s\n", __func__, p_path, strerror(errno));
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * BOOL HANDLE_EVENTS:
+ * @brief - applies a buffer of inotify events to the index
+ * @return - true if the index has to be rebuilt from a rescan
+ */
+static bool handle_events (const char * p_buf, ssize_t len)
+{
+    bool rescan = false;
+
+    for (ssize_t off = 0; off < len;)
+    {
+        const struct inotify_event * p_event = (const struct inotify_event *)(p_buf + off);
+
+        if (p_event->mask & (IN_Q_OVERFLOW | IN_DELETE_SELF | IN_MOVE_SELF | IN_IGNORED))
+        {
+            rescan = true;
+        }
+        else if ((0 < p_event->len) && (0 == (p_event->mask & IN_ISDIR)))
+        {
+            file_index_refresh(p_event->name);
+        }
+        off += sizeof(struct inotify_event) + p_event->len;
+    }
+    return rescan;
+}
+
+/**
+ * VOID * WATCH_DIR:
+ * @brief - the watcher thread, applies inotify events until stop_fd fires
+ */
+static void * watch_dir (void * p_arg)
+{
+    char          * p_buf      = malloc(INDEX_EVENT_BUF_SZ);
+    struct pollfd   p_fds[2]   = { { .fd = file_index.inotify_fd, .events = POLLIN },
+                                   { .fd = file_index.stop_fd,    .events = POLLIN } };
+
+    (void)p_arg;
+    if (NULL == p_buf)
+    {
+        fprintf(stderr, "%s could not allocate event buffer: %s\n", __func__, strerror(ENOMEM));
+        return NULL;
+    }
+
+    for (;;)
+    {
+        if ((-1 == poll(p_fds, 2, -1)) && (EINTR != errno))
+        {
+            fprintf(stderr, "%s poll failed: %s\n", __func__, strerror(errno));
+            break;
+        }
+        if (p_fds[1].revents & POLLIN)
+        {
+            break;
+        }
+        if (0 == (p_fds[0].revents & POLLIN))
+        {
+            continue;
+        }
+
+        ssize_t len = read(file_index.inotify_fd, p_buf, INDEX_EVENT_BUF_SZ);
+        if ((0 < len) && (true == handle_events(p_buf, len)))
+        {
+            fprintf(stderr, "%s lost track of %s, rescanning\n", __func__, FILE_SERVER_DIR);
+            watch_dirs();
+            scan_dir();
+        }
+    }
+
+    free(p_buf);
+    return NULL;
+}
+
+int file_index_init ()
+{
+    pthread_rwlockattr_t attr;
+    sigset_t             block_set;
+    sigset_t             old_set;
+
+    pthread_rwlockattr_init(&attr);
+    pthread_rwlockattr_setkind_np(&attr, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+    pthread_rwlock_init(&file_index.lock, &attr);
+    pthread_rwlockattr_destroy(&attr);
+
+    file_index.num_buckets = INDEX_MIN_BUCKETS;
+    file_index.pp_buckets  = calloc(file_index.num_buckets, sizeof(index_entry_t *));
+    if (NULL == file_index.pp_buckets)
+    {
+        errno = ENOMEM;
+        fprintf(stderr, "%s could not allocate file index: %s\n", __func__, strerror(errno));
+        return -1;
+    }
+
+    // watch before scanning so nothing changed during the scan is missed, an
+    // event for a file the scan already saw just stats it again
+    file_index.inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    file_index.stop_fd    = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if ((-1 == file_index.inotify_fd) || (-1 == file_index.stop_fd))
+    {
+        fprintf(stderr, "%s could not watch %s: %s\n", __func__, FILE_SERVER_DIR, strerror(errno));
+        file_index_cleanup();
+        return -1;
+    }
+    if ((-1 == watch_dirs()) || (-1 == scan_dir()))
+    {
+        file_index_cleanup();
+        return -1;
+    }
+
+    // like the workers, the watcher must not take the reactor's ctrl+c
+    sigemptyset(&block_set);
+    sigaddset(&block_set, SIGINT);
+    pthread_sigmask(SIG_BLOCK, &block_set, &old_set);
+    file_index.running = (0 == pthread_create(&file_index.watcher, NULL, watch_dir, NULL));
+    pthread_sigmask(SIG_SETMASK, &old_set, NULL);
+    if (false == file_index.running)
+    {
+        fprintf(stderr, "%s could not start the watcher thread\n", __func__);
+        file_index_cleanup();
+        return -1;
+    }
+
+    printf("Indexed %zu file(s) in %s\n", file_index.count, FILE_SERVER_DIR);
+    return 0;
+}
+
+void file_index_cleanup ()
+{
+    uint64_t stop = 1;
+
+    if (true == file_index.running)
+    {
+        if (sizeof(stop) != write(file_index.stop_fd, &stop, sizeof(stop)))
+        {
+            fprintf(stderr, "%s could not wake the watcher: %s\n", __func__, strerror(errno));
+        }
+        pthread_join(file_index.watcher, NULL);
+        file_index.running = false;
+    }
+    if (-1 != file_index.inotify_fd)
+    {
+        close(file_index.inotify_fd);
+        file_index.inotify_fd = -1;
+    }
+    if (-1 != file_index.stop_fd)
+    {
+        close(file_index.stop_fd);
+        file_index.stop_fd = -1;
+    }
+    if (NULL != file_index.pp_buckets)
+    {
+        clear_table();
+        CLEAN(file_index.pp_buckets);
+        pthread_rwlock_destroy(&file_index.lock);
+    }
+}
+
+bool file_index_lookup (const char * p_filename, file_info_t * p_info)
+{
+    bool found = false;
+
+    pthread_rwlock_rdlock(&file_index.lock);
+    index_entry_t * p_entry = *find_slot(p_filename, layout_hash(p_filename));
+    if (NULL != p_entry)
+    {
+        found = true;
+        if (NULL != p_info)
+        {
+            p_info->p_name   = p_filename;
+            p_info->name_len = p_entry->name_len;
+            p_info->size     = p_entry->size;
+            p_info->mtime_ns = p_entry->mtime_ns;
+            p_info->ino      = p_entry->ino;
+            p_info->packed   = p_entry->packed;
+        }
+    }
+    pthread_rwlock_unlock(&file_index.lock);
+    return found;
+}
+
+void file_index_refresh (const char * p_filename)
+{
+    if (true == is_valid_filename(p_filename))
+    {
+        apply_name(p_filename);
+    }
+}
+
+int file_index_walk (file_index_visit_t p_visit, void * p_arg, size_t * p_count)
+{
+    file_info_t info    = { 0 };
+    int         ret_val = 0;
+
+    pthread_rwlock_rdlock(&file_index.lock);
+    if (NULL != p_count)
+    {
+        *p_count = file_index.count;
+    }
+    for (size_t idx = 0; (0 == ret_val) && (idx < file_index.num_buckets); idx++)
+    {
+        for (index_entry_t * p_entry = file_index.pp_buckets[idx]; NULL != p_entry; p_entry = p_entry->p_next)
+        {
+            info.p_name   = p_entry->name;
+            info.name_len = p_entry->name_len;
+            info.size     = p_entry->size;
+            info.mtime_ns = p_entry->mtime_ns;
+            info.ino      = p_entry->ino;
+            info.packed   = p_entry->packed;
+            if (-1 == p_visit(&info, p_arg))
+            {
+                ret_val = -1;
+                break;
+            }
+        }
+    }
+    pthread_rwlock_unlock(&file_index.lock);
+    return ret_val;
+}
+
+/*** end file_index.c ***/
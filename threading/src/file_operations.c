@@ -1,285 +1,271 @@
 #include "../includes/file_operations.h"
+#include "../includes/protocol.h"
+#include "../includes/storage_backend.h"
 
-int get_file_count (int sockfd)
+int list_append (list_ctx_t * p_ctx, const void * p_data, size_t len)
 {
-    if (0 > sockfd)
+    if (p_ctx->list_len + len > p_ctx->list_cap)
     {
-        return -1;
-    }
-
-    ssize_t     bytes_sent = 0;
-    int         file_count = 0;
-    DIR       * p_dir      = NULL;
-
-    struct dirent * dir;
+        size_t new_cap = (0 == p_ctx->list_cap) ? LIST_BUF_SZ : p_ctx->list_cap;
+        while (p_ctx->list_len + len > new_cap)
+        {
+            new_cap *= 2;
+        }
 
-    p_dir = opendir("FileServer/");
-    if (p_dir)
-    {
-        while (NULL != (dir = readdir(p_dir)))
+        char * p_new = arena_grow(p_ctx->p_arena, p_ctx->p_list, p_ctx->list_len, new_cap);
+        if (NULL == p_new)
         {
-            if (DT_REG == dir->d_type)
-            {
-                file_count++;
-            }
-            else
-            {
-                continue;
-            }
+            errno = ENOMEM;
+            return -1;
         }
-        closedir(p_dir);
+        p_ctx->p_list   = p_new;
+        p_ctx->list_cap = new_cap;
     }
 
-    bytes_sent = send(sockfd, &file_count, sizeof(int), 0);
-    if (0 > bytes_sent)
+    memcpy(p_ctx->p_list + p_ctx->list_len, p_data, len);
+    p_ctx->list_len += len;
+    return 0;
+}
+
+/**
+ * INT APPEND_ENTRY:
+ * @brief - storage_backend walk callback for list_dir, a size_t name length then
+ *          the name
+ */
+static int append_entry (const file_info_t * p_info, void * p_arg)
+{
+    list_ctx_t * p_ctx    = p_arg;
+    size_t       name_len = p_info->name_len;
+
+    if ((-1 == list_append(p_ctx, &name_len, sizeof(size_t))) ||
+        (-1 == list_append(p_ctx, p_info->p_name, name_len)))
     {
-        printf("Error sending file count\n");
         return -1;
     }
-    return file_count;
+    p_ctx->file_count++;
+    return 0;
 }
 
-void list_dir (int sockfd)
+/**
+ * INT APPEND_ENTRY_V2:
+ * @brief - storage_backend walk callback for list_dir_v2, a u16 name length then
+ *          the name
+ */
+static int append_entry_v2 (const file_info_t * p_info, void * p_arg)
 {
-    ssize_t     bytes_sent  = 0;
-    ssize_t     name_sent   = 0;
-    DIR       * p_dir       = NULL;
-    size_t      name_len    = 0;
-    char     ** file_list   = NULL;
-
-    int num_files = get_file_count(sockfd);
-    if (-1 == num_files)
-    {
-        fprintf(stderr, "%s could not retrieve file count on server\n", __func__);
-        return;
-    }
-    
-    if (0 == num_files)
-    {
-        num_files = 1;
-    }
+    list_ctx_t * p_ctx    = p_arg;
+    uint16_t     wire_len = htole16(p_info->name_len);
 
-    if ((p_dir = opendir("FileServer/")) == NULL)
+    if ((-1 == list_append(p_ctx, &wire_len, sizeof(wire_len))) ||
+        (-1 == list_append(p_ctx, p_info->p_name, p_info->name_len)))
     {
-        errno = ENOTDIR;
-        perror("Could not open directory");
-        CLEAN(file_list);
-        return;
+        return -1;
     }
+    p_ctx->file_count++;
+    return 0;
+}
 
-    int iter = 0;
-    struct dirent * dir;
+char * list_dir (arena_t * p_arena, size_t * p_len)
+{
+    list_ctx_t ctx        = { .p_arena = p_arena };
+    int        file_count = 0;
 
-    while (NULL != (dir = readdir(p_dir)) && num_files > iter)
+    // the count is patched in once the backend has been walked
+    if ((-1 == list_append(&ctx, &file_count, sizeof(int))) ||
+        (-1 == storage_backend->walk(append_entry, &ctx, NULL)))
     {
-        // if file type is "regular"
-        if (DT_REG == dir->d_type)
-        {
-            name_len = strnlen(dir->d_name, MAX_STR_LEN);
-            bytes_sent = send(sockfd, &name_len, sizeof(size_t), 0);
-            if (0 > bytes_sent)
-            {
-                printf("Error sending file name length\n");
-                return;
-            }
-
-            name_sent = send(sockfd, dir->d_name, name_len, 0);
-            if (0 > name_sent)
-            {
-                printf("Error sending directory list\n");
-                return;
-            }
-
-            iter++;
-        }
+        fprintf(stderr, "%s could not build directory list: %s\n", __func__, strerror(ENOMEM));
+        errno = ENOMEM;
+        return NULL;
     }
-    closedir(p_dir);
+
+    file_count = ctx.file_count;
+    memcpy(ctx.p_list, &file_count, sizeof(int));
+    *p_len = ctx.list_len;
+    return ctx.p_list;
 }
 
-bool is_file (char * p_filename)
+char * list_dir_v2 (arena_t * p_arena, size_t reserve, size_t * p_len)
 {
-    char   file_path[] = "FileServer/";
-    char * p_fullpath  = NULL;
+    list_ctx_t ctx        = { .p_arena = p_arena };
+    uint32_t   file_count = 0;
 
-    p_fullpath = calloc(((strlen(file_path) + strlen(p_filename)) + 1), sizeof(char));
-    if (NULL == p_fullpath)
+    if (reserve + sizeof(file_count) > LIST_BUF_SZ)
     {
-        errno = ENOMEM;
-        perror("Could not allocate memory for full path");
-        return false;
+        errno = EINVAL;
+        fprintf(stderr, "%s reserved header space is too large\n", __func__);
+        return NULL;
     }
 
-    strncpy(p_fullpath, file_path, strlen(file_path));
-    strncat(p_fullpath, p_filename, strlen(p_filename));
+    // frame header room and the count are patched in once the walk is done
+    ctx.p_list = arena_alloc(p_arena, LIST_BUF_SZ);
+    if (NULL == ctx.p_list)
+    {
+        return NULL;
+    }
+    memset(ctx.p_list, 0, reserve + sizeof(file_count));
+    ctx.list_cap = LIST_BUF_SZ;
+    ctx.list_len = reserve + sizeof(file_count);
 
-    if (access(p_fullpath, F_OK) == 0)
+    if (-1 == storage_backend->walk(append_entry_v2, &ctx, NULL))
     {
-        CLEAN(p_fullpath);
-        return true;
+        fprintf(stderr, "%s could not grow directory list: %s\n", __func__, strerror(ENOMEM));
+        errno = ENOMEM;
+        return NULL;
     }
 
-    CLEAN(p_fullpath);
-    return false;
+    file_count = htole32(ctx.file_count);
+    memcpy(ctx.p_list + reserve, &file_count, sizeof(file_count));
+    *p_len = ctx.list_len;
+    return ctx.p_list;
 }
 
-void download_file (char * p_file_passed, int sockfd)
+/**
+ * @brief - a detailed listing being serialized during a walk of the backend
+ * @member records - the fixed size records, with reserve bytes and room for
+ *                   the V2_LIST_HEAD_SZ counts in front of them
+ * @member names - the name table, appended to the records once complete
+ */
+typedef struct detail_ctx
 {
-    FILE* fp = NULL;
-    char file_path[] = "FileServer/";
-    signed int err_code = -1;
-    char * p_buffer = NULL;
-    char * p_fullpath = NULL;
-
-    printf("p_file_passed: %s\n", p_file_passed);
-
-    p_fullpath = calloc(1, (strlen(file_path) + strlen(p_file_passed)) + 1);
-    if (NULL == p_fullpath)
+    list_ctx_t  records;
+    list_ctx_t  names;
+} detail_ctx_t;
+
+/**
+ * INT APPEND_DETAIL:
+ * @brief - storage_backend walk and list callback for list_dir_detail and
+ *          list_dir_page, a record for the file and its name in the name table
+ */
+static int append_detail (const file_info_t * p_info, void * p_arg)
+{
+    detail_ctx_t * p_ctx                    = p_arg;
+    char           record[V2_LIST_ENTRY_SZ] = { 0 };
+    uint64_t       size                     = htole64(p_info->size);
+    uint64_t       mtime_ns                 = htole64(p_info->mtime_ns);
+    uint16_t       name_len                 = htole16(p_info->name_len);
+
+    memcpy(record, &size, sizeof(size));
+    memcpy(record + sizeof(size), &mtime_ns, sizeof(mtime_ns));
+    memcpy(record + sizeof(size) + sizeof(mtime_ns), &name_len, sizeof(name_len));
+    if ((-1 == list_append(&p_ctx->records, record, sizeof(record))) ||
+        (-1 == list_append(&p_ctx->names, p_info->p_name, p_info->name_len)))
     {
-        errno = ENOMEM;
-        perror("Could not allocate memory for full path");
-        return;
+        return -1;
     }
+    p_ctx->records.file_count++;
+    return 0;
+}
 
-    strncpy(p_fullpath, file_path, strlen(file_path));
-    strncat(p_fullpath, p_file_passed,strlen(p_file_passed));
+/**
+ * CHAR * FINISH_DETAIL:
+ * @brief - appends the name table to the records and fills in the counts at
+ *          head, returns the finished buffer
+ */
+static char * finish_detail (detail_ctx_t * p_ctx, size_t head, size_t * p_len)
+{
+    uint32_t file_count = htole32(p_ctx->records.file_count);
+    uint32_t names_len  = htole32(p_ctx->names.list_len);
 
-    fp = fopen(p_fullpath, "rb");
-    if (NULL == fp)
+    if (-1 == list_append(&p_ctx->records, p_ctx->names.p_list, p_ctx->names.list_len))
     {
-        errno = ENOENT;
-        perror("Could not open file passed");
-        send(sockfd, &err_code, sizeof(int), 0);
-        CLEAN(p_fullpath);
-        return;
+        errno = ENOMEM;
+        return NULL;
     }
 
-    if (fseek(fp, 0L, SEEK_END) == 0)
-    {
-        long file_sz = ftell(fp);
-        if (-1 == file_sz)
-        {
-            perror("ftell error on file");
-            CLEAN(p_fullpath);
-            return;
-        }
-
-        p_buffer = calloc(file_sz, sizeof(char));
-        if (NULL == p_buffer)
-        {
-            errno = ENOMEM;
-            perror("Could not allocate memory for p_buffer");
-            CLEAN(p_fullpath);
-            return;
-        }
-
-        if (fseek(fp, 0L, SEEK_SET) != 0)
-        {
-            perror("Could not rewind file");
-            CLEAN(p_fullpath);
-            CLEAN(p_buffer);
-            return;
-        }
-
-        long bytes_left = file_sz;
-        size_t length = 0;
-        printf("Sending file of size %ld to client...\n", file_sz);
-        file_sz = htobe64(file_sz);
-        send(sockfd, &file_sz, sizeof(long), 0);
+    memcpy(p_ctx->records.p_list + head, &file_count, sizeof(file_count));
+    memcpy(p_ctx->records.p_list + head + sizeof(file_count), &names_len, sizeof(names_len));
+    *p_len = p_ctx->records.list_len;
+    return p_ctx->records.p_list;
+}
 
-        while (bytes_left > 0)
-        {
-            length = fread(p_buffer, sizeof(char), 1024, fp);
-            if (ferror(fp) != 0)
-            {
-                fprintf(stderr, "Error reading file: %s\n", p_file_passed);
-                CLEAN(p_fullpath);
-                CLEAN(p_buffer);
-                return;
-            }
-
-            send(sockfd, p_buffer, length, 0);
-            bytes_left -= 1024;
-        }      
+char * list_dir_detail (arena_t * p_arena, size_t reserve, size_t * p_len)
+{
+    detail_ctx_t ctx    = { .records.p_arena = p_arena, .names.p_arena = p_arena };
+    char       * p_list = NULL;
+
+    // room for the frame header and the counts, patched in after the walk
+    ctx.records.list_cap = reserve + V2_LIST_HEAD_SZ + LIST_BUF_SZ;
+    ctx.records.list_len = reserve + V2_LIST_HEAD_SZ;
+    ctx.records.p_list   = arena_alloc(p_arena, ctx.records.list_cap);
+    if ((NULL == ctx.records.p_list) || (-1 == storage_backend->walk(append_detail, &ctx, NULL)) ||
+        (NULL == (p_list = finish_detail(&ctx, reserve, p_len))))
+    {
+        fprintf(stderr, "%s could not build directory list: %s\n", __func__, strerror(ENOMEM));
+        errno = ENOMEM;
+        return NULL;
     }
 
-    fclose(fp);
-    CLEAN(p_fullpath);
-    CLEAN(p_buffer);
+    return p_list;
 }
 
-void upload_file (char * p_file_passed, int file_size, int sockfd)
+char * list_dir_page (arena_t * p_arena, size_t reserve, uint64_t cursor, uint32_t page_size, const char * p_pattern,
+                      size_t * p_len)
 {
-    if ((-1 == file_size) || (NULL == p_file_passed))
+    detail_ctx_t ctx     = { .records.p_arena = p_arena, .names.p_arena = p_arena };
+    char       * p_list  = NULL;
+    uint64_t     next    = 0;
+    int          ret_val = -1;
+
+    if ((0 == page_size) || (V2_LIST_PAGE_MAX < page_size))
     {
-        fprintf(stderr, "Error received from client\n");
-        fprintf(stderr, "Upload failed...\n");
-        return;
+        page_size = (0 == page_size) ? V2_LIST_PAGE_DEFAULT : V2_LIST_PAGE_MAX;
     }
 
-    FILE* fp = NULL;
-    char file_path[] = "FileServer/";
-    ssize_t bytes_recv = 0;
-    signed int err_code = -1;
-    char * p_buffer = NULL;
-    char * p_fullpath = NULL;
-    p_fullpath = calloc(1, (strlen(file_path) + strlen(p_file_passed)) + 1);
-    if (NULL == p_fullpath)
+    // room for the frame header, the next cursor and the counts
+    ctx.records.list_cap = reserve + sizeof(next) + V2_LIST_HEAD_SZ + LIST_BUF_SZ;
+    ctx.records.list_len = reserve + sizeof(next) + V2_LIST_HEAD_SZ;
+    ctx.records.p_list   = arena_alloc(p_arena, ctx.records.list_cap);
+    if (NULL != ctx.records.p_list)
     {
-        errno = ENOMEM;
-        perror("Could not allocate memory for full path");
-        return;
+        ret_val = storage_backend->list(p_arena, cursor, page_size, p_pattern, append_detail, &ctx, &next);
     }
 
-    strncpy(p_fullpath, file_path, strlen(file_path));
-    strncat(p_fullpath, p_file_passed, strlen(p_file_passed));
-    strncat(p_fullpath, "\0", sizeof(char));
-    printf("Saving Client File as: %s\n", p_fullpath);
-    if (true == is_file(p_file_passed))
+    if ((-1 == ret_val) || (NULL == (p_list = finish_detail(&ctx, reserve + sizeof(next), p_len))))
     {
-        printf("Overwriting existing file...\n");
-        fclose(fopen(p_fullpath, "w"));
+        fprintf(stderr, "%s could not build directory page: %s\n", __func__, strerror(errno));
+        return NULL;
     }
 
-    fp = fopen(p_fullpath, "wb+");
-    if (NULL == fp)
+    next = htole64(next);
+    memcpy(p_list + reserve, &next, sizeof(next));
+    return p_list;
+}
+
+bool is_valid_filename (const char * p_filename)
+{
+    if ((NULL == p_filename) || ('\0' == p_filename[0]))
     {
-        errno = ENOENT;
-        fprintf(stderr, "%s() - Could not open file for writing: %s\n", __func__, strerror(errno));
-        send(sockfd, &err_code, sizeof(int), 0);
-        CLEAN(p_fullpath);
-        return;
+        return false;
     }
 
-    p_buffer = calloc(file_size, sizeof(char));
-    if (NULL == p_buffer)
+    // the layout marker is not a stored file
+    if ((0 == strcmp(p_filename, ".")) || (0 == strcmp(p_filename, "..")) ||
+        (0 == strcmp(p_filename, LAYOUT_MARKER_NAME)))
     {
-        errno = ENOMEM;
-        perror("Could not allocate memory for p_buffer in upload");
-        CLEAN(p_fullpath);
-        return;
+        return false;
     }
 
-    long bytes_left = file_size;
-    while (bytes_left > 0)
-    {
-        bytes_recv = recv(sockfd, p_buffer, sizeof(char), 0);
-        if (0 >= bytes_recv)
-        {
-            errno = EINVAL;
-            fprintf(stderr, "%s could not receive file from client: %s\n", __func__, strerror(errno));
-            CLEAN(p_buffer);
-            CLEAN(p_fullpath);
-            return;
-        }
+    return NULL == strchr(p_filename, '/');
+}
 
-        fprintf(fp, "%c", *p_buffer);
-        bytes_left -= 1;
+bool is_file (char * p_filename)
+{
+    return (true == is_valid_filename(p_filename)) && (true == storage_backend->stat(p_filename, NULL));
+}
+
+int open_download_file (const char * p_filename, uint64_t * p_size, uint64_t * p_mtime_ns, uint64_t * p_base,
+                        cache_fill_t ** pp_fill)
+{
+    *pp_fill = NULL;
+    if (false == is_valid_filename(p_filename))
+    {
+        fprintf(stderr, "%s invalid file name requested\n", __func__);
+        errno = EINVAL;
+        return -1;
     }
 
-    fclose(fp);
-    CLEAN(p_buffer);
-    CLEAN(p_fullpath);
-    printf("Upload Complete\n");
+    return storage_backend->open(p_filename, p_size, p_mtime_ns, p_base, pp_fill);
 }
 
 /*** end file_operations.c ***/
@@ -1,16 +1,15 @@
 #include "../includes/global_data.h"
 
 bool            serv_running;
-bool            exiting;
-size_t          clients_con;
+_Atomic size_t  clients_con;
 threadpool_t  * p_tpool;
-queue         * p_queue;
+upload_mode_t   upload_mode;
 
 int init_globals ()
 {
     serv_running = true;
-    exiting      = false;
-    clients_con  = 0;
+    upload_mode  = UPLOAD_BUFFERED;
+    atomic_init(&clients_con, 0);
     
     p_tpool = calloc(1, sizeof(threadpool_t));
     if (NULL == p_tpool)
@@ -20,23 +19,15 @@ int init_globals ()
         return -1;
     }
 
-    p_queue = init_queue();
-    if (NULL == p_queue)
-    {
-        fprintf(stderr, "%s error occurred initializing queue data structure\n", __func__);
-        CLEAN(p_tpool);
-        return -1;
-    }
-
     return 0;
 }
 
-int init_threadpool(threadpool_t * p_tpool, size_t num_of_clients)
+int init_threadpool(threadpool_t * p_tpool, size_t num_of_clients, reactor_t * p_reactors, size_t num_reactors)
 {
-    if (NULL == p_tpool)
+    if ((NULL == p_tpool) || (NULL == p_reactors) || (0 == num_reactors))
     {
         errno = EINVAL;
-        perror("Pool passed is NULL");
+        perror("Pool or reactors passed are NULL");
         return -1;
     }
     printf("num_of_clients: %ld\n", num_of_clients);
@@ -44,6 +35,10 @@ int init_threadpool(threadpool_t * p_tpool, size_t num_of_clients)
     {
         num_of_clients = MAX_CLIENTS;
     }
+    if (num_of_clients < num_reactors)
+    {
+        num_of_clients = num_reactors;
+    }
 
     p_tpool->threads = calloc(num_of_clients, sizeof(pthread_t));
     if (NULL == p_tpool->threads)
@@ -56,18 +51,30 @@ int init_threadpool(threadpool_t * p_tpool, size_t num_of_clients)
     }
 
     p_tpool->max_thread_cnt = num_of_clients;
-    pthread_mutex_init(&p_tpool->lock, NULL);
-    pthread_cond_init(&p_tpool->condition, NULL);
+    p_tpool->p_reactors     = p_reactors;
+    p_tpool->num_reactors   = num_reactors;
+    atomic_init(&p_tpool->thread_cnt, 0);
+
+    // workers inherit a mask with SIGINT blocked so ctrl+c always interrupts
+    // the reactor's epoll_wait on the main thread
+    sigset_t block_set;
+    sigset_t old_set;
+    sigemptyset(&block_set);
+    sigaddset(&block_set, SIGINT);
+    pthread_sigmask(SIG_BLOCK, &block_set, &old_set);
 
     for (size_t idx = 0; idx < num_of_clients; idx++)
     {
-        if (0 != pthread_create(&p_tpool->threads[idx], NULL, server_func, NULL))
+        reactor_t * p_reactor = &p_reactors[idx % num_reactors];
+        if (0 != pthread_create(&p_tpool->threads[idx], NULL, server_func, p_reactor))
         {
             errno = EINVAL;
             perror("Error creating thread");
         }
     }
 
+    pthread_sigmask(SIG_SETMASK, &old_set, NULL);
+
     return 0;
 }
 
@@ -78,7 +85,10 @@ void pool_cleanup (size_t num_threads)
         fprintf(stderr, "%s pointer to the threadpool is NULL\n", __func__);
         return;
     }
-    pthread_cond_broadcast(&p_tpool->condition);
+    for (size_t idx = 0; idx < p_tpool->num_reactors; idx++)
+    {
+        wake_all(p_tpool->p_reactors[idx].p_jobs);
+    }
     for (size_t idx = 0; idx < num_threads; idx++)
     {
         if (p_tpool->threads[idx])
@@ -87,9 +97,6 @@ void pool_cleanup (size_t num_threads)
         }
     }
 
-    clear(p_queue);
     CLEAN(p_tpool->threads);
-    pthread_mutex_destroy(&p_tpool->lock);
-    pthread_cond_destroy(&p_tpool->condition);
     CLEAN(p_tpool);
 }
\ No newline at end of file
@@ -0,0 +1,864 @@
+#include "../includes/mux.h"
+#include "../includes/server.h"
+
+#define MUX_BLOCKED 0
+#define MUX_MOVED   1
+#define MUX_IDLE    2
+
+mux_t * mux_create (arena_t * p_arena)
+{
+    mux_t * p_mux = calloc(1, sizeof(mux_t));
+    if (NULL == p_mux)
+    {
+        errno = ENOMEM;
+        fprintf(stderr, "%s could not allocate stream table: %s\n", __func__, strerror(errno));
+        return NULL;
+    }
+
+    for (size_t idx = 0; idx < V2_MAX_STREAMS; idx++)
+    {
+        p_mux->streams[idx].file_fd = -1;
+        upload_init(&p_mux->streams[idx].upload);
+    }
+    p_mux->in_stream  = -1;
+    p_mux->out_stream = -1;
+    p_mux->p_arena    = p_arena;
+
+    return p_mux;
+}
+
+/**
+ * VOID RELEASE_STREAM:
+ * @brief - closes the stream's file, drops its reply and frees the slot. The
+ *          arena is reset once no stream's reply lives in it
+ */
+static void release_stream (mux_t * p_mux, mux_stream_t * p_stream)
+{
+    if (-1 != p_stream->file_fd)
+    {
+        close(p_stream->file_fd);
+    }
+    file_cache_release(p_stream->p_fill);
+    if (true == p_stream->reply_owned)
+    {
+        p_mux->arena_replies--;
+    }
+    if (0 == p_mux->arena_replies)
+    {
+        arena_reset(p_mux->p_arena);
+    }
+    upload_release(&p_stream->upload);
+
+    memset(p_stream, 0, sizeof(mux_stream_t));
+    p_stream->file_fd = -1;
+    upload_init(&p_stream->upload);
+}
+
+/**
+ * BOOL IS_UPLOAD:
+ * @brief - whether the stream receives a file rather than sending a reply
+ */
+static bool is_upload (const mux_stream_t * p_stream)
+{
+    return (V2_OP_UPLOAD == p_stream->opcode) || (V2_OP_UPLOAD_RESUME == p_stream->opcode);
+}
+
+void mux_destroy (mux_t * p_mux)
+{
+    if (NULL == p_mux)
+    {
+        return;
+    }
+
+    for (size_t idx = 0; idx < V2_MAX_STREAMS; idx++)
+    {
+        release_stream(p_mux, &p_mux->streams[idx]);
+    }
+    free(p_mux);
+}
+
+/**
+ * INT FIND_STREAM:
+ * @brief - looks up the slot of an active stream
+ * @return - the slot index, -1 if no stream has that id
+ */
+static int find_stream (mux_t * p_mux, uint32_t id)
+{
+    for (int idx = 0; idx < V2_MAX_STREAMS; idx++)
+    {
+        if ((true == p_mux->streams[idx].active) && (id == p_mux->streams[idx].id))
+        {
+            return idx;
+        }
+    }
+    return -1;
+}
+
+/**
+ * MUX_STREAM_T * OPEN_STREAM:
+ * @brief - claims a free slot for a new request
+ * @return - the stream, NULL if every slot is in use
+ */
+static mux_stream_t * open_stream (mux_t * p_mux, uint32_t id, uint16_t opcode)
+{
+    for (size_t idx = 0; idx < V2_MAX_STREAMS; idx++)
+    {
+        mux_stream_t * p_stream = &p_mux->streams[idx];
+        if (false == p_stream->active)
+        {
+            p_stream->active      = true;
+            p_stream->id          = id;
+            p_stream->opcode      = opcode;
+            p_stream->send_window = V2_MUX_WINDOW;
+            p_stream->recv_window = V2_MUX_WINDOW;
+            return p_stream;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * VOID QUEUE_CTRL:
+ * @brief - appends a small frame to the control buffer, callers make sure
+ *          MUX_CTRL_RESERVE bytes are free before parsing a frame
+ */
+static void queue_ctrl (mux_t * p_mux, uint16_t opcode, uint16_t flags, uint32_t id,
+                        const void * p_payload, uint32_t payload_len)
+{
+    v2_hdr_t hdr = { 0 };
+    hdr.opcode      = opcode;
+    hdr.flags       = flags;
+    hdr.request_id  = id;
+    hdr.payload_len = payload_len;
+
+    v2_encode_hdr(p_mux->ctrl + p_mux->ctrl_len, &hdr);
+    memcpy(p_mux->ctrl + p_mux->ctrl_len + V2_HDR_SZ, p_payload, payload_len);
+    p_mux->ctrl_len += V2_HDR_SZ + payload_len;
+}
+
+/**
+ * VOID QUEUE_ERROR:
+ * @brief - answers a request with an error frame
+ */
+static void queue_error (mux_t * p_mux, uint16_t opcode, uint32_t id, int err)
+{
+    uint32_t wire_err = htole32((uint32_t)err);
+
+    queue_ctrl(p_mux, opcode, V2_FLAG_REPLY | V2_FLAG_ERROR | V2_FLAG_END, id, &wire_err, sizeof(wire_err));
+}
+
+/**
+ * VOID FINISH_UPLOAD:
+ * @brief - publishes a fully received upload, answers the request and frees
+ *          the stream
+ */
+static void finish_upload (mux_t * p_mux, mux_stream_t * p_stream)
+{
+    if (-1 == storage_backend->commit(&p_stream->upload, p_stream->file_fd))
+    {
+        int err = errno;
+        storage_backend->discard(&p_stream->upload, p_stream->file_fd, p_stream->xfer_off);
+        queue_error(p_mux, p_stream->opcode, p_stream->id, err);
+    }
+    else
+    {
+        printf("Upload Complete\n");
+        queue_ctrl(p_mux, p_stream->opcode, V2_FLAG_REPLY | V2_FLAG_END, p_stream->id, NULL, 0);
+    }
+    release_stream(p_mux, p_stream);
+}
+
+/**
+ * VOID START_REQUEST:
+ * @brief - runs the disk work of a new request (LIST, the downloads, the
+ *          uploads or an upload query) and sets its stream up to be served
+ * @return - 0 on success, -1 on a protocol error that ends the connection
+ */
+static int start_request (conn_t * p_conn, const v2_hdr_t * p_hdr, const char * p_payload)
+{
+    mux_t        * p_mux         = p_conn->p_mux;
+    mux_stream_t * p_stream      = NULL;
+    char           filename[MAXNAMLEN + 1];
+    uint64_t       file_sz       = 0;
+    uint64_t       mtime_ns      = 0;
+    uint64_t       base          = 0;
+    uint64_t       range_off     = 0;
+    uint64_t       range_len     = 0;
+    uint32_t       page_size     = 0;
+    uint64_t       upload_id     = UPLOAD_ANONYMOUS;
+    uint64_t       payload_len   = p_hdr->payload_len;
+    uint16_t       name_len      = 0;
+
+    if (-1 != find_stream(p_mux, p_hdr->request_id))
+    {
+        fprintf(stderr, "%s stream %u is already in use\n", __func__, p_hdr->request_id);
+        return -1;
+    }
+
+    p_stream = open_stream(p_mux, p_hdr->request_id, p_hdr->opcode);
+    if (NULL == p_stream)
+    {
+        queue_error(p_mux, p_hdr->opcode, p_hdr->request_id, EBUSY);
+        return 0;
+    }
+
+    switch (p_hdr->opcode)
+    {
+        case V2_OP_LIST:
+        case V2_OP_LIST_DETAIL:
+            p_stream->p_reply = (V2_OP_LIST_DETAIL == p_hdr->opcode) ?
+                                list_dir_detail(p_mux->p_arena, 0, &p_stream->reply_len) :
+                                list_dir_v2(p_mux->p_arena, 0, &p_stream->reply_len);
+            if (NULL == p_stream->p_reply)
+            {
+                break;
+            }
+            p_stream->reply_owned = true;
+            p_mux->arena_replies++;
+            return 0;
+
+        case V2_OP_LIST_PAGE:
+            if ((V2_LIST_PAGE_REQ_SZ > payload_len) || (V2_LIST_PAGE_REQ_SZ + MAXNAMLEN < payload_len))
+            {
+                errno = EINVAL;
+                break;
+            }
+            v2_decode_list_page(p_payload, &range_off, &page_size);
+            memcpy(filename, p_payload + V2_LIST_PAGE_REQ_SZ, payload_len - V2_LIST_PAGE_REQ_SZ);
+            filename[payload_len - V2_LIST_PAGE_REQ_SZ] = '\0';
+            p_stream->p_reply = list_dir_page(p_mux->p_arena, 0, range_off, page_size, filename,
+                                              &p_stream->reply_len);
+            if (NULL == p_stream->p_reply)
+            {
+                break;
+            }
+            p_stream->reply_owned = true;
+            p_mux->arena_replies++;
+            return 0;
+
+        case V2_OP_DOWNLOAD:
+            if ((0 == p_hdr->payload_len) || (MAXNAMLEN < p_hdr->payload_len))
+            {
+                errno = ENAMETOOLONG;
+                break;
+            }
+            memcpy(filename, p_payload, p_hdr->payload_len);
+            filename[p_hdr->payload_len] = '\0';
+            printf("Sending client %s contents on stream %u ...\n", filename, p_stream->id);
+
+            p_stream->file_fd = open_download_file(filename, &file_sz, NULL, &base, &p_stream->p_fill);
+            if (-1 == p_stream->file_fd)
+            {
+                break;
+            }
+            p_stream->xfer_off  = base;
+            p_stream->xfer_size = base + file_sz;
+            file_sz = htole64(file_sz);
+            memcpy(p_stream->head, &file_sz, sizeof(file_sz));
+            p_stream->p_reply   = p_stream->head;
+            p_stream->reply_len = sizeof(file_sz);
+            return 0;
+
+        case V2_OP_DOWNLOAD_RANGE:
+            if ((V2_RANGE_REQ_SZ >= p_hdr->payload_len) || (V2_RANGE_REQ_SZ + MAXNAMLEN < p_hdr->payload_len))
+            {
+                errno = EINVAL;
+                break;
+            }
+            v2_decode_range(p_payload, &range_off, &range_len);
+            memcpy(filename, p_payload + V2_RANGE_REQ_SZ, p_hdr->payload_len - V2_RANGE_REQ_SZ);
+            filename[p_hdr->payload_len - V2_RANGE_REQ_SZ] = '\0';
+            printf("Sending client %s from offset %" PRIu64 " on stream %u ...\n",
+                   filename, range_off, p_stream->id);
+
+            p_stream->file_fd = open_download_file(filename, &file_sz, &mtime_ns, &base, &p_stream->p_fill);
+            if (-1 == p_stream->file_fd)
+            {
+                break;
+            }
+            if (-1 == v2_clip_range(file_sz, range_off, &range_len))
+            {
+                break;
+            }
+            p_stream->reply_len = v2_encode_range_head(p_stream->head, file_sz, mtime_ns, range_len);
+            p_stream->p_reply   = p_stream->head;
+            p_stream->xfer_off  = base + range_off;
+            p_stream->xfer_size = base + range_off + range_len;
+            return 0;
+
+        case V2_OP_UPLOAD_QUERY:
+            if ((V2_UPLOAD_REQ_SZ >= payload_len) || (V2_UPLOAD_REQ_SZ + MAXNAMLEN < payload_len))
+            {
+                errno = EINVAL;
+                break;
+            }
+            v2_decode_upload(p_payload, &upload_id, &file_sz);
+            memcpy(filename, p_payload + V2_UPLOAD_REQ_SZ, payload_len - V2_UPLOAD_REQ_SZ);
+            filename[payload_len - V2_UPLOAD_REQ_SZ] = '\0';
+            if (-1 == storage_backend->query(filename, upload_id, file_sz, &range_off))
+            {
+                break;
+            }
+            printf("Upload of %s can resume at byte %" PRIu64 "\n", filename, range_off);
+            range_off = htole64(range_off);
+            memcpy(p_stream->head, &range_off, sizeof(range_off));
+            p_stream->p_reply   = p_stream->head;
+            p_stream->reply_len = sizeof(range_off);
+            return 0;
+
+        case V2_OP_UPLOAD_RESUME:
+            if (V2_UPLOAD_REQ_SZ > payload_len)
+            {
+                errno = EINVAL;
+                break;
+            }
+            v2_decode_upload(p_payload, &upload_id, &range_off);
+            if (UPLOAD_ANONYMOUS == upload_id)
+            {
+                errno = EINVAL;
+                break;
+            }
+            p_payload   += V2_UPLOAD_REQ_SZ;
+            payload_len -= V2_UPLOAD_REQ_SZ;
+            // fall through
+
+        case V2_OP_UPLOAD:
+            if (sizeof(file_sz) + sizeof(name_len) <= payload_len)
+            {
+                memcpy(&file_sz, p_payload, sizeof(file_sz));
+                memcpy(&name_len, p_payload + sizeof(file_sz), sizeof(name_len));
+                name_len = le16toh(name_len);
+            }
+            if ((0 == name_len) || (MAXNAMLEN < name_len) ||
+                (sizeof(file_sz) + sizeof(name_len) + name_len != payload_len))
+            {
+                errno = EINVAL;
+                break;
+            }
+            memcpy(filename, p_payload + sizeof(file_sz) + sizeof(name_len), name_len);
+            filename[name_len] = '\0';
+            p_stream->xfer_size = le64toh(file_sz);
+            p_stream->xfer_off  = range_off;
+            printf("Uploading %s of size %" PRIu64 " from client on stream %u\n",
+                   filename, p_stream->xfer_size, p_stream->id);
+
+            p_stream->file_fd = storage_backend->create(&p_stream->upload, filename, upload_id, p_stream->xfer_size,
+                                                        range_off, &base);
+            if (-1 == p_stream->file_fd)
+            {
+                break;
+            }
+            p_stream->xfer_off  += base;
+            p_stream->xfer_size += base;
+            if ((uint64_t)p_stream->xfer_off == p_stream->xfer_size)
+            {
+                finish_upload(p_mux, p_stream);
+            }
+            return 0;
+
+        default:
+            errno = ENOSYS;
+            break;
+    }
+
+    queue_error(p_mux, p_hdr->opcode, p_hdr->request_id, errno);
+    release_stream(p_mux, p_stream);
+    return 0;
+}
+
+/**
+ * INT START_DATA:
+ * @brief - routes the payload of an upload DATA frame to its stream, frames for
+ *          streams that no longer exist (a failed upload) are discarded
+ * @return - 0 on success, -1 if the client overran the stream's credit or size
+ */
+static int start_data (mux_t * p_mux, const v2_hdr_t * p_hdr)
+{
+    int idx = find_stream(p_mux, p_hdr->request_id);
+
+    p_mux->in_stream = -1;
+    p_mux->in_left   = p_hdr->payload_len;
+    if ((-1 == idx) || (false == is_upload(&p_mux->streams[idx])))
+    {
+        return 0;
+    }
+
+    mux_stream_t * p_stream = &p_mux->streams[idx];
+    uint64_t       left     = p_stream->xfer_size - p_stream->xfer_off;
+    if ((p_hdr->payload_len > p_stream->recv_window) || (p_hdr->payload_len > left))
+    {
+        fprintf(stderr, "%s client overran stream %u\n", __func__, p_stream->id);
+        return -1;
+    }
+
+    p_stream->recv_window -= p_hdr->payload_len;
+    p_mux->in_stream       = idx;
+    return 0;
+}
+
+/**
+ * INT PARSE_FRAME:
+ * @brief - handles the next complete frame header (and, for requests and
+ *          window updates, its payload) in the input buffer
+ * @return - 1 if a frame was consumed, 0 if more input is needed, -1 if the
+ *           connection must be closed
+ */
+static int parse_frame (conn_t * p_conn)
+{
+    mux_t    * p_mux = p_conn->p_mux;
+    v2_hdr_t   hdr   = { 0 };
+    uint32_t   grant = 0;
+    int        idx   = -1;
+
+    if (V2_HDR_SZ > p_conn->in_len)
+    {
+        return 0;
+    }
+    v2_decode_hdr(p_conn->in_buf, &hdr);
+
+    if (V2_OP_DATA == hdr.opcode)
+    {
+        conn_consume_input(p_conn, V2_HDR_SZ);
+        return (-1 == start_data(p_mux, &hdr)) ? -1 : 1;
+    }
+
+    // everything else is small and handled in one piece
+    if (CONN_IN_BUF_SZ - V2_HDR_SZ < hdr.payload_len)
+    {
+        fprintf(stderr, "%s request payload of %" PRIu64 " bytes is too large\n", __func__, hdr.payload_len);
+        return -1;
+    }
+    if (V2_HDR_SZ + hdr.payload_len > p_conn->in_len)
+    {
+        return 0;
+    }
+
+    int ret_val = 0;
+    switch (hdr.opcode)
+    {
+        case V2_OP_WINDOW:
+            idx = find_stream(p_mux, hdr.request_id);
+            if ((sizeof(grant) == hdr.payload_len) && (-1 != idx))
+            {
+                memcpy(&grant, p_conn->in_buf + V2_HDR_SZ, sizeof(grant));
+                p_mux->streams[idx].send_window += le32toh(grant);
+            }
+            break;
+
+        case V2_OP_BYE:
+            printf("Client has ended the connection...\n");
+            ret_val = -1;
+            break;
+
+        default:
+            ret_val = start_request(p_conn, &hdr, p_conn->in_buf + V2_HDR_SZ);
+            break;
+    }
+
+    conn_consume_input(p_conn, V2_HDR_SZ + hdr.payload_len);
+    return (-1 == ret_val) ? -1 : 1;
+}
+
+/**
+ * VOID UPLOAD_STORED:
+ * @brief - accounts for upload bytes written to disk, returns credit to the
+ *          client and answers the request once the file is complete
+ */
+static void upload_stored (mux_t * p_mux, mux_stream_t * p_stream, uint64_t stored)
+{
+    p_mux->in_left         -= stored;
+    p_stream->recv_unacked += stored;
+
+    if ((uint64_t)p_stream->xfer_off == p_stream->xfer_size)
+    {
+        finish_upload(p_mux, p_stream);
+        p_mux->in_stream = -1;
+        return;
+    }
+    upload_checkpoint(&p_stream->upload, p_stream->file_fd, p_stream->xfer_off, false);
+
+    if (V2_MUX_WINDOW / 2 <= p_stream->recv_unacked)
+    {
+        uint32_t grant = htole32((uint32_t)p_stream->recv_unacked);
+        queue_ctrl(p_mux, V2_OP_WINDOW, 0, p_stream->id, &grant, sizeof(grant));
+        p_stream->recv_window  += p_stream->recv_unacked;
+        p_stream->recv_unacked  = 0;
+    }
+}
+
+/**
+ * INT RECV_PAYLOAD:
+ * @brief - moves payload of the current DATA frame into its upload file (or
+ *          drops it), starting with whatever is already buffered
+ * @return - 1 if bytes were consumed, 0 if the socket would block, -1 on error
+ */
+static int recv_payload (conn_t * p_conn, size_t * p_budget)
+{
+    mux_t        * p_mux    = p_conn->p_mux;
+    mux_stream_t * p_stream = NULL;
+    ssize_t        moved    = 0;
+
+    if (-1 != p_mux->in_stream)
+    {
+        p_stream = &p_mux->streams[p_mux->in_stream];
+    }
+
+    if (0 < p_conn->in_len)
+    {
+        size_t chunk = (p_conn->in_len > p_mux->in_left) ? p_mux->in_left : p_conn->in_len;
+        if ((NULL != p_stream) &&
+            (-1 == pwrite_all(p_stream->file_fd, p_conn->in_buf, chunk, p_stream->xfer_off)))
+        {
+            return -1;
+        }
+        conn_consume_input(p_conn, chunk);
+        moved = chunk;
+    }
+    else if (NULL == p_stream)
+    {
+        int ret_val = conn_fill_input(p_conn);
+        return (1 == ret_val) ? 1 : ret_val;
+    }
+    else
+    {
+        size_t count = (p_mux->in_left > *p_budget) ? *p_budget : p_mux->in_left;
+        off_t  off   = p_stream->xfer_off;
+        bool   fell  = false;
+
+        if (UPLOAD_SPLICE == upload_mode)
+        {
+            moved = recv_file_splice_some(p_conn->sockfd, p_stream->file_fd, &off, count, &fell);
+        }
+        else
+        {
+            moved = recv_file_some(p_conn->sockfd, p_stream->file_fd, &off, count);
+        }
+        if (-1 == moved)
+        {
+            return -1;
+        }
+        if (0 == moved)
+        {
+            return 0;
+        }
+    }
+
+    *p_budget = ((size_t)moved > *p_budget) ? 0 : *p_budget - moved;
+    if (NULL == p_stream)
+    {
+        p_mux->in_left -= moved;
+        return 1;
+    }
+
+    p_stream->xfer_off += moved;
+    upload_stored(p_mux, p_stream, moved);
+    return 1;
+}
+
+/**
+ * INT MUX_READ:
+ * @brief - consumes input: parses every buffered frame and moves upload data
+ * @return - 1 if progress was made, 0 if nothing more can be read right now,
+ *           -1 if the connection must be closed
+ */
+static int mux_read (conn_t * p_conn, size_t * p_budget)
+{
+    mux_t * p_mux    = p_conn->p_mux;
+    int     progress = 0;
+    int     ret_val  = -1;
+
+    while (0 < *p_budget)
+    {
+        if (0 < p_mux->in_left)
+        {
+            ret_val = recv_payload(p_conn, p_budget);
+            if (1 != ret_val)
+            {
+                return (-1 == ret_val) ? -1 : progress;
+            }
+            progress = 1;
+            continue;
+        }
+
+        // replies and window updates must be able to drain before more
+        // requests are taken on
+        if (MUX_CTRL_RESERVE > MUX_CTRL_SZ - p_mux->ctrl_len)
+        {
+            return progress;
+        }
+
+        ret_val = parse_frame(p_conn);
+        if (-1 == ret_val)
+        {
+            return -1;
+        }
+        if (1 == ret_val)
+        {
+            progress = 1;
+            continue;
+        }
+
+        ret_val = conn_fill_input(p_conn);
+        if (1 != ret_val)
+        {
+            return (-1 == ret_val) ? -1 : progress;
+        }
+        progress = 1;
+    }
+
+    return progress;
+}
+
+/**
+ * INT NEXT_READY_STREAM:
+ * @brief - picks the next stream, round robin, with reply bytes left to send
+ *          and credit to send them with
+ * @return - the slot index, -1 if no stream can send
+ */
+static int next_ready_stream (mux_t * p_mux)
+{
+    for (size_t step = 1; step <= V2_MAX_STREAMS; step++)
+    {
+        size_t         idx      = (p_mux->next_stream + step) % V2_MAX_STREAMS;
+        mux_stream_t * p_stream = &p_mux->streams[idx];
+
+        if ((false == p_stream->active) || (true == is_upload(p_stream)) || (0 == p_stream->send_window))
+        {
+            continue;
+        }
+        if ((p_stream->reply_off < p_stream->reply_len) ||
+            ((-1 != p_stream->file_fd) && ((uint64_t)p_stream->xfer_off < p_stream->xfer_size)))
+        {
+            p_mux->next_stream = idx;
+            return idx;
+        }
+    }
+    return -1;
+}
+
+/**
+ * VOID START_FRAME:
+ * @brief - sizes the next reply frame of a stream from its credit and encodes
+ *          its header. A frame carries either in-memory reply bytes or file
+ *          bytes, never both
+ */
+static void start_frame (mux_t * p_mux, int idx)
+{
+    mux_stream_t * p_stream  = &p_mux->streams[idx];
+    uint64_t       mem_left  = p_stream->reply_len - p_stream->reply_off;
+    uint64_t       file_left = (-1 == p_stream->file_fd) ? 0 : p_stream->xfer_size - p_stream->xfer_off;
+    uint64_t       body      = (0 < mem_left) ? mem_left : file_left;
+
+    body = (body > V2_MAX_FRAME) ? V2_MAX_FRAME : body;
+    body = (body > p_stream->send_window) ? p_stream->send_window : body;
+
+    v2_hdr_t hdr = { 0 };
+    hdr.opcode      = p_stream->opcode;
+    hdr.flags       = V2_FLAG_REPLY;
+    hdr.request_id  = p_stream->id;
+    hdr.payload_len = body;
+    if (mem_left + file_left == body)
+    {
+        hdr.flags |= V2_FLAG_END;
+    }
+    v2_encode_hdr(p_mux->out_hdr, &hdr);
+
+    p_stream->send_window -= body;
+    p_mux->out_stream      = idx;
+    p_mux->out_hdr_off     = 0;
+    p_mux->out_body_left   = body;
+}
+
+/**
+ * INT SEND_BYTES:
+ * @brief - send() that reports a full socket as 0
+ * @return - bytes sent, 0 if the socket would block, -1 on error
+ */
+static ssize_t send_bytes (int sockfd, const char * p_buf, size_t len, int flags)
+{
+    for (;;)
+    {
+        ssize_t bytes_sent = send(sockfd, p_buf, len, flags | MSG_NOSIGNAL);
+        if (-1 != bytes_sent)
+        {
+            return bytes_sent;
+        }
+        if (EINTR == errno)
+        {
+            continue;
+        }
+        if ((EAGAIN == errno) || (EWOULDBLOCK == errno))
+        {
+            return 0;
+        }
+        fprintf(stderr, "%s could not send to client: %s\n", __func__, strerror(errno));
+        return -1;
+    }
+}
+
+/**
+ * INT SEND_FRAME:
+ * @brief - continues sending the frame in progress
+ * @return - MUX_MOVED once the frame is complete, MUX_BLOCKED if the socket
+ *           filled up first, -1 on error
+ */
+static int send_frame (conn_t * p_conn, size_t * p_budget)
+{
+    mux_t        * p_mux    = p_conn->p_mux;
+    mux_stream_t * p_stream = &p_mux->streams[p_mux->out_stream];
+    ssize_t        sent     = 0;
+
+    while (V2_HDR_SZ > p_mux->out_hdr_off)
+    {
+        int flags = (0 < p_mux->out_body_left) ? MSG_MORE : 0;
+        sent = send_bytes(p_conn->sockfd, p_mux->out_hdr + p_mux->out_hdr_off,
+                          V2_HDR_SZ - p_mux->out_hdr_off, flags);
+        if (0 >= sent)
+        {
+            return (0 == sent) ? MUX_BLOCKED : -1;
+        }
+        p_mux->out_hdr_off += sent;
+    }
+
+    while (0 < p_mux->out_body_left)
+    {
+        if (p_stream->reply_off < p_stream->reply_len)
+        {
+            sent = send_bytes(p_conn->sockfd, p_stream->p_reply + p_stream->reply_off, p_mux->out_body_left, 0);
+            if (0 < sent)
+            {
+                p_stream->reply_off += sent;
+            }
+        }
+        else
+        {
+            // a copy still being filled in only has so many bytes to send yet
+            sent = file_cache_ready(p_stream->p_fill, p_stream->xfer_off, p_mux->out_body_left);
+            if (0 < sent)
+            {
+                sent = send_file_some(p_conn->sockfd, p_stream->file_fd, &p_stream->xfer_off, sent);
+            }
+        }
+        if (0 >= sent)
+        {
+            return (0 == sent) ? MUX_BLOCKED : -1;
+        }
+        p_mux->out_body_left -= sent;
+        *p_budget = ((size_t)sent > *p_budget) ? 0 : *p_budget - sent;
+    }
+
+    p_mux->out_stream = -1;
+    bool mem_done  = (p_stream->reply_off == p_stream->reply_len);
+    bool file_done = (-1 == p_stream->file_fd) || ((uint64_t)p_stream->xfer_off == p_stream->xfer_size);
+    if (mem_done && file_done)
+    {
+        release_stream(p_mux, p_stream);
+    }
+    return MUX_MOVED;
+}
+
+/**
+ * INT MUX_WRITE:
+ * @brief - sends control frames and reply frames until the socket fills up,
+ *          the budget runs out or no stream has credit left
+ * @return - MUX_MOVED if bytes were sent, MUX_BLOCKED if the socket is full,
+ *           MUX_IDLE if there was nothing to send, -1 on error
+ */
+static int mux_write (conn_t * p_conn, size_t * p_budget)
+{
+    mux_t * p_mux   = p_conn->p_mux;
+    int     ret_val = MUX_IDLE;
+
+    while (0 < *p_budget)
+    {
+        if (-1 != p_mux->out_stream)
+        {
+            int sent = send_frame(p_conn, p_budget);
+            if (MUX_MOVED != sent)
+            {
+                return sent;
+            }
+            ret_val = MUX_MOVED;
+            continue;
+        }
+
+        if (p_mux->ctrl_off < p_mux->ctrl_len)
+        {
+            ssize_t sent = send_bytes(p_conn->sockfd, p_mux->ctrl + p_mux->ctrl_off,
+                                      p_mux->ctrl_len - p_mux->ctrl_off, 0);
+            if (0 >= sent)
+            {
+                return (0 == sent) ? MUX_BLOCKED : -1;
+            }
+            p_mux->ctrl_off += sent;
+            if (p_mux->ctrl_off == p_mux->ctrl_len)
+            {
+                p_mux->ctrl_off = 0;
+                p_mux->ctrl_len = 0;
+            }
+            ret_val = MUX_MOVED;
+            continue;
+        }
+
+        int idx = next_ready_stream(p_mux);
+        if (-1 == idx)
+        {
+            return ret_val;
+        }
+        start_frame(p_mux, idx);
+    }
+
+    return MUX_MOVED;
+}
+
+/**
+ * VOID ABANDON_UPLOADS:
+ * @brief - records how far every unfinished upload got before the connection
+ *          is closed, so the client can resume them
+ */
+static void abandon_uploads (mux_t * p_mux)
+{
+    for (size_t idx = 0; idx < V2_MAX_STREAMS; idx++)
+    {
+        mux_stream_t * p_stream = &p_mux->streams[idx];
+        if ((true == p_stream->active) && (true == is_upload(p_stream)))
+        {
+            storage_backend->discard(&p_stream->upload, p_stream->file_fd, p_stream->xfer_off);
+        }
+    }
+}
+
+void job_mux (conn_t * p_conn)
+{
+    mux_t  * p_mux  = p_conn->p_mux;
+    size_t   budget = JOB_BUDGET;
+
+    for (;;)
+    {
+        int read_ret  = mux_read(p_conn, &budget);
+        int write_ret = (-1 == read_ret) ? -1 : mux_write(p_conn, &budget);
+        if (-1 == write_ret)
+        {
+            abandon_uploads(p_mux);
+            p_conn->state = CONN_CLOSE;
+            return;
+        }
+
+        p_conn->state = CONN_MUX;
+        if (0 == budget)
+        {
+            // more to do, let the reactor serve other connections first
+            p_conn->io_wait = false;
+            return;
+        }
+
+        if ((0 == read_ret) && (MUX_MOVED != write_ret))
+        {
+            p_mux->wait_events = EPOLLIN | ((MUX_BLOCKED == write_ret) ? EPOLLOUT : 0);
+            p_conn->io_wait    = true;
+            return;
+        }
+    }
+}
+
+/*** end mux.c ***/
@@ -1,119 +1,225 @@
 #include "../includes/my_queue.h"
 
-queue * init_queue()
+#include <unistd.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+
+/**
+ * VOID FUTEX_WAIT / FUTEX_WAKE:
+ * @brief - thin wrappers, glibc does not export futex()
+ */
+static void futex_wait (_Atomic uint32_t * p_word, uint32_t expected)
 {
-    queue * fd_queue = calloc(1, sizeof(queue));
+    syscall(SYS_futex, p_word, FUTEX_WAIT_PRIVATE, expected, NULL, NULL, 0);
+}
+
+static void futex_wake (_Atomic uint32_t * p_word, int count)
+{
+    syscall(SYS_futex, p_word, FUTEX_WAKE_PRIVATE, count, NULL, NULL, 0);
+}
+
+queue * init_queue(size_t capacity)
+{
+    size_t slots = 2;
+    while (slots < capacity)
+    {
+        slots <<= 1;
+    }
+
+    size_t alloc_sz = sizeof(queue) + (slots * sizeof(cell));
+    alloc_sz = (alloc_sz + CACHE_LINE - 1) & ~((size_t)CACHE_LINE - 1);
+
+    queue * fd_queue = aligned_alloc(CACHE_LINE, alloc_sz);
     if (NULL == fd_queue)
     {
         errno = ENOMEM;
         perror("Could not allocate memory for queue in init");
         return NULL;
     }
+    memset(fd_queue, 0, alloc_sz);
 
-    fd_queue->head = fd_queue->tail = NULL;
-    fd_queue->queue_len = 0;
+    fd_queue->capacity = slots;
+    fd_queue->mask     = slots - 1;
+    for (size_t idx = 0; idx < slots; idx++)
+    {
+        atomic_init(&fd_queue->cells[idx].sequence, idx);
+    }
+    atomic_init(&fd_queue->enqueue_pos, 0);
+    atomic_init(&fd_queue->dequeue_pos, 0);
+    atomic_init(&fd_queue->waiters, 0);
+    atomic_init(&fd_queue->wake_seq, 0);
 
     return fd_queue;
 }
 
-bool is_full (const queue * fd_queue)
+size_t get_queue_len(const queue * fd_queue)
 {
-    return fd_queue->queue_len == MAXQUEUE;
+    size_t tail = atomic_load_explicit(&((queue *)fd_queue)->enqueue_pos, memory_order_relaxed);
+    size_t head = atomic_load_explicit(&((queue *)fd_queue)->dequeue_pos, memory_order_relaxed);
+
+    return (tail > head) ? (tail - head) : 0;
 }
 
-bool is_empty(const queue* fd_queue)
+bool is_full (const queue * fd_queue)
 {
-    return fd_queue->queue_len == 0;
+    return get_queue_len(fd_queue) >= fd_queue->capacity;
 }
 
-size_t get_queue_len(const queue * fd_queue)
+bool is_empty(const queue* fd_queue)
 {
-    return fd_queue->queue_len;
+    return get_queue_len(fd_queue) == 0;
 }
 
 bool enqueue(queue * fd_queue, item q_item)
 {
-    if (is_full(fd_queue))
-    {
-        return false;
-    }
+    cell   * p_cell = NULL;
+    size_t   pos    = atomic_load_explicit(&fd_queue->enqueue_pos, memory_order_relaxed);
 
-    node* new_node = calloc(1, sizeof(node));
-    if (NULL == new_node)
+    for (;;)
     {
-        errno = ENOMEM;
-        perror("Could not allocate memory for new_node");
-        exit(-1);
+        p_cell = &fd_queue->cells[pos & fd_queue->mask];
+        size_t   seq  = atomic_load_explicit(&p_cell->sequence, memory_order_acquire);
+        intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+
+        if (0 == diff)
+        {
+            // slot is free, try to claim it
+            if (atomic_compare_exchange_weak_explicit(&fd_queue->enqueue_pos, &pos, pos + 1,
+                                                      memory_order_relaxed, memory_order_relaxed))
+            {
+                break;
+            }
+        }
+        else if (0 > diff)
+        {
+            // the consumer a full lap behind has not freed the slot yet
+            return false;
+        }
+        else
+        {
+            pos = atomic_load_explicit(&fd_queue->enqueue_pos, memory_order_relaxed);
+        }
     }
 
-    new_node->item = q_item;
-    new_node->next = NULL;
+    p_cell->item = q_item;
+    atomic_store_explicit(&p_cell->sequence, pos + 1, memory_order_release);
 
-    if (is_empty(fd_queue))
-    {
-        fd_queue->head = fd_queue->tail = new_node;
-        fd_queue->queue_len++;
-        return true;
-    }
-    
-    node * p_current = fd_queue->head;
-    while (p_current)
+    // pairs with the fence in dequeue_wait, either the parked consumer sees the
+    // item or we see the consumer and wake it
+    atomic_thread_fence(memory_order_seq_cst);
+    if (0 < atomic_load_explicit(&fd_queue->waiters, memory_order_relaxed))
     {
-        p_current = p_current->next;
+        atomic_fetch_add_explicit(&fd_queue->wake_seq, 1, memory_order_release);
+        futex_wake(&fd_queue->wake_seq, 1);
     }
 
-    p_current->next = new_node;
-    fd_queue->tail  = new_node;
-    fd_queue->queue_len++;
-
-    return true;    
+    return true;
 }
 
 void peek(queue * fd_queue)
 {
-    printf("Head of queue: %d\n", fd_queue->head->item.data);
+    size_t pos    = atomic_load_explicit(&fd_queue->dequeue_pos, memory_order_relaxed);
+    cell * p_cell = &fd_queue->cells[pos & fd_queue->mask];
+
+    if (atomic_load_explicit(&p_cell->sequence, memory_order_acquire) != pos + 1)
+    {
+        printf("Queue is empty\n");
+        return;
+    }
+    printf("Head of queue: %d\n", p_cell->item.data);
 }
 
 int dequeue(queue * fd_queue)
 {
-    if (is_empty(fd_queue))
+    cell   * p_cell = NULL;
+    size_t   pos    = atomic_load_explicit(&fd_queue->dequeue_pos, memory_order_relaxed);
+
+    for (;;)
     {
-        errno = EINVAL;
-        perror("queue is empty");
-        return -1;
-    }
+        p_cell = &fd_queue->cells[pos & fd_queue->mask];
+        size_t   seq  = atomic_load_explicit(&p_cell->sequence, memory_order_acquire);
+        intptr_t diff = (intptr_t)seq - (intptr_t)(pos + 1);
 
-    item   p_item = fd_queue->head->item;
-    node * p_temp = fd_queue->head;
+        if (0 == diff)
+        {
+            if (atomic_compare_exchange_weak_explicit(&fd_queue->dequeue_pos, &pos, pos + 1,
+                                                      memory_order_relaxed, memory_order_relaxed))
+            {
+                break;
+            }
+        }
+        else if (0 > diff)
+        {
+            return -1;
+        }
+        else
+        {
+            pos = atomic_load_explicit(&fd_queue->dequeue_pos, memory_order_relaxed);
+        }
+    }
 
-    fd_queue->head = fd_queue->head->next;
+    item p_item = p_cell->item;
+    // hand the slot to the producer one lap ahead
+    atomic_store_explicit(&p_cell->sequence, pos + fd_queue->mask + 1, memory_order_release);
 
-    CLEAN(p_temp);
-    fd_queue->queue_len--;
+    return p_item.data;
+}
 
-    if (true == is_empty(fd_queue))
+int dequeue_wait(queue * fd_queue, const bool * p_running)
+{
+    for (;;)
     {
-        fd_queue->head = fd_queue->tail = NULL;
+        int data = dequeue(fd_queue);
+        if ((-1 != data) || (false == *p_running))
+        {
+            return data;
+        }
+
+        atomic_fetch_add_explicit(&fd_queue->waiters, 1, memory_order_relaxed);
+        uint32_t seq = atomic_load_explicit(&fd_queue->wake_seq, memory_order_acquire);
+        atomic_thread_fence(memory_order_seq_cst);
+
+        // recheck after announcing ourselves so a concurrent enqueue is not missed
+        data = dequeue(fd_queue);
+        if ((-1 == data) && (true == *p_running))
+        {
+            futex_wait(&fd_queue->wake_seq, seq);
+        }
+        atomic_fetch_sub_explicit(&fd_queue->waiters, 1, memory_order_relaxed);
+
+        if (-1 != data)
+        {
+            return data;
+        }
     }
+}
 
-    return p_item.data;
+void wake_all(queue * fd_queue)
+{
+    atomic_fetch_add_explicit(&fd_queue->wake_seq, 1, memory_order_release);
+    futex_wake(&fd_queue->wake_seq, INT_MAX);
 }
 
 void traverse_queue(const queue * fd_queue, void (*func_ptr)(item q_item))
 {
-    if ((NULL == fd_queue) || (NULL == fd_queue->head) || NULL == (func_ptr))
+    if ((NULL == fd_queue) || NULL == (func_ptr))
     {
         errno = EINVAL;
         fprintf(stderr, "%s one or more parameters passed are NULL: %s\n", __func__, strerror(errno));
         return;
     }
 
-    node * cursor = fd_queue->head;
+    queue * p_queue = (queue *)fd_queue;
+    size_t  head    = atomic_load_explicit(&p_queue->dequeue_pos, memory_order_acquire);
+    size_t  tail    = atomic_load_explicit(&p_queue->enqueue_pos, memory_order_acquire);
 
-    while (cursor)
+    for (size_t pos = head; pos != tail; pos++)
     {
-        (*func_ptr)(cursor->item);
-        cursor = cursor->next;
+        const cell * p_cell = &p_queue->cells[pos & p_queue->mask];
+        if (atomic_load_explicit(&((cell *)p_cell)->sequence, memory_order_acquire) == pos + 1)
+        {
+            (*func_ptr)(p_cell->item);
+        }
     }
 }
 
@@ -125,21 +231,8 @@ void clear(queue * fd_queue)
         return;
     }
 
-    node * p_temp = NULL;
-
-    while (false == is_empty(fd_queue))
+    while (-1 != dequeue(fd_queue))
     {
-        if (fd_queue->head == fd_queue->tail)
-        {
-            p_temp = fd_queue->head;
-            CLEAN(p_temp);
-            fd_queue->head = NULL;
-            fd_queue->tail = NULL;
-            return;
-        }
-        p_temp = fd_queue->head;
-        fd_queue->head = fd_queue->head->next;
-        dequeue(fd_queue);
-        CLEAN(p_temp);
+        continue;
     }
-}
\ No newline at end of file
+}
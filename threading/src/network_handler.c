@@ -8,13 +8,22 @@ setup_info_t * handle_setup (int argc, char ** argv)
         // set errno value and error message
         errno = EINVAL;
         perror("Invalid arguments passed\nRequired Argument\n\t-p [SRV_PORT]:"
-				"Optional Argument\n\t-t [MAX_ALLOWED_CLIENTS]\n");
+				"Optional Argument\n\t-t [WORKER_THREADS]\n"
+				"Optional Argument\n\t-u [buffered|splice]\n"
+				"Optional Argument\n\t-r [LISTENERS]\n"
+				"Optional Argument\n\t-b [BACKLOG]\n"
+				"Optional Argument\n\t-l [flat|sharded]\n"
+				"Optional Argument\n\t-d [posix|ram]\n"
+				"Optional Argument\n\t-c [CACHE_MB]\n"
+				"Optional Argument\n\t-i [IO_BUFFER_MB]\n"
+				"Optional Argument\n\t-H\n");
         return NULL;
     }
 
     int    opt          = -1;
     long   port         = -1;
     size_t thread_cnt   = 0;
+    long   num_value    = -1;
 
     setup_info_t * p_setup = calloc(1, sizeof(setup_info_t));
     if (NULL == p_setup)
@@ -23,8 +32,12 @@ setup_info_t * handle_setup (int argc, char ** argv)
         fprintf(stderr, "%s could not allocate setup info container: %s\n", __func__, strerror(errno));
         return NULL;
     }
+    p_setup->num_reactors = 1;
+    p_setup->backlog      = DEFAULT_BACKLOG;
+    p_setup->p_backend    = &posix_backend;
+    p_setup->pool_mb      = POOL_DEFAULT_MB;
 
-    while ((opt = getopt(argc, argv, ":p:t:")) != -1)
+    while ((opt = getopt(argc, argv, ":p:t:u:r:b:l:s:d:c:i:H")) != -1)
     {
         switch(opt)
         {
@@ -62,15 +75,126 @@ setup_info_t * handle_setup (int argc, char ** argv)
 
                 if (MAX_CLIENTS < p_setup->num_allowable_clients)
                 {
-                    printf("Server cannot contain more than %d clients\n"
+                    printf("Server cannot run more than %d worker threads\n"
                             "Setting default to: %d\n", MAX_CLIENTS, MAX_CLIENTS);
                     p_setup->num_allowable_clients = MAX_CLIENTS;
                 }
                 break;
 
+            case 'u':
+                if (0 == strncmp(optarg, UPLOAD_MODE_SPLICE, sizeof(UPLOAD_MODE_SPLICE)))
+                {
+                    p_setup->upload_mode = UPLOAD_SPLICE;
+                }
+                else if (0 == strncmp(optarg, UPLOAD_MODE_BUFFERED, sizeof(UPLOAD_MODE_BUFFERED)))
+                {
+                    p_setup->upload_mode = UPLOAD_BUFFERED;
+                }
+                else
+                {
+                    errno = EINVAL;
+                    perror("invalid upload mode passed, must be buffered or splice");
+                    exit(EXIT_FAILURE);
+                }
+                break;
+
+            case 'r':
+                num_value = strtol(optarg, NULL, BASE_10);
+                if ((1 > num_value) || (MAX_REACTORS < num_value))
+                {
+                    errno = EINVAL;
+                    perror("invalid listener count passed, must be 1 - 64");
+                    exit(EXIT_FAILURE);
+                }
+                p_setup->num_reactors = num_value;
+                break;
+
+            case 'b':
+                num_value = strtol(optarg, NULL, BASE_10);
+                if ((1 > num_value) || (INT_MAX < num_value))
+                {
+                    errno = EINVAL;
+                    perror("invalid backlog passed, must be >= 1");
+                    exit(EXIT_FAILURE);
+                }
+                p_setup->backlog = num_value;
+                break;
+
+            case 'l':
+                if (0 == strncmp(optarg, LAYOUT_NAME_SHARDED, sizeof(LAYOUT_NAME_SHARDED)))
+                {
+                    p_setup->layout = LAYOUT_SHARDED;
+                }
+                else if (0 == strncmp(optarg, LAYOUT_NAME_FLAT, sizeof(LAYOUT_NAME_FLAT)))
+                {
+                    p_setup->layout = LAYOUT_FLAT;
+                }
+                else
+                {
+                    errno = EINVAL;
+                    perror("invalid storage layout passed, must be flat or sharded");
+                    exit(EXIT_FAILURE);
+                }
+                break;
+
+            case 's':
+                num_value = strtol(optarg, NULL, BASE_10);
+                if ((0 > num_value) || (SEGMENT_MAX_FILE < num_value))
+                {
+                    errno = EINVAL;
+                    perror("invalid packed file size passed, must be 0 - 65536");
+                    exit(EXIT_FAILURE);
+                }
+                p_setup->pack_max = num_value;
+                break;
+
+            case 'd':
+                p_setup->p_backend = storage_backend_find(optarg);
+                if (NULL == p_setup->p_backend)
+                {
+                    perror("invalid storage backend passed, must be posix or ram");
+                    exit(EXIT_FAILURE);
+                }
+                break;
+
+            case 'c':
+                num_value = strtol(optarg, NULL, BASE_10);
+                if ((0 > num_value) || (CACHE_MAX_MB < num_value))
+                {
+                    errno = EINVAL;
+                    perror("invalid cache size passed, must be 0 - 65536 MiB");
+                    exit(EXIT_FAILURE);
+                }
+                p_setup->cache_mb = num_value;
+                break;
+
+            case 'i':
+                num_value = strtol(optarg, NULL, BASE_10);
+                if ((POOL_MIN_MB > num_value) || (POOL_MAX_MB < num_value))
+                {
+                    errno = EINVAL;
+                    perror("invalid I/O buffer budget passed, must be 1 - 4096 MiB");
+                    exit(EXIT_FAILURE);
+                }
+                p_setup->pool_mb = num_value;
+                break;
+
+            case 'H':
+                p_setup->huge_pages = true;
+                break;
+
             default:
                 printf("Invalid cmdline argument passed\nRequired Argument\n\t-p [SRV_PORT]:\n"
-                        "Optional Argument\n\t-t [CLIENT_AMOUNT] (argument optional)\n");
+                        "Optional Argument\n\t-t [WORKER_THREADS] (argument optional)\n"
+                        "Optional Argument\n\t-u [buffered|splice] (argument optional)\n"
+                        "Optional Argument\n\t-r [LISTENERS] (argument optional)\n"
+                        "Optional Argument\n\t-b [BACKLOG] (argument optional)\n"
+                        "Optional Argument\n\t-l [flat|sharded] (argument optional)\n"
+                        "Optional Argument\n\t-s [PACKED_FILE_MAX] (argument optional)\n"
+                        "Optional Argument\n\t-d [posix|ram] (argument optional)\n"
+                        "Optional Argument\n\t-c [CACHE_MB] (argument optional)\n"
+                        "Optional Argument\n\t-i [IO_BUFFER_MB] (argument optional)\n"
+                        "Optional Argument\n\t-H (huge pages for the I/O buffers)\n");
                 exit(-1);
         }
     }
@@ -87,7 +211,7 @@ struct addrinfo setup_server (struct addrinfo * p_serv)
     return * p_serv;
 }
 
-int setup_socket (struct addrinfo * p_serv, char * p_port)
+int setup_socket (struct addrinfo * p_serv, char * p_port, bool reuse_port)
 {
     int sock_fd     = -1;
     int ret_val     = -1;
@@ -119,6 +243,15 @@ int setup_socket (struct addrinfo * p_serv, char * p_port)
             return -1;
         }
 
+        int enable = 1;
+        if (reuse_port && (-1 == setsockopt(sock_fd, SOL_SOCKET, SO_REUSEPORT, &enable, sizeof(enable))))
+        {
+            fprintf(stderr, "%s could not set SO_REUSEPORT: %s\n", __func__, strerror(errno));
+            close(sock_fd);
+            freeaddrinfo(serv_info);
+            return -1;
+        }
+
         if (-1 == bind(sock_fd, p_addr->ai_addr, p_addr->ai_addrlen))
         {
             close(sock_fd);
@@ -132,30 +265,23 @@ int setup_socket (struct addrinfo * p_serv, char * p_port)
     return sock_fd;
 }
 
-void handle_incoming_client(int client_fd)
+void handle_incoming_client(reactor_t * p_reactor, int client_fd)
 {
-    item * q_item = NULL;
-    q_item = calloc(1, sizeof(item));
-    if (NULL == q_item)
+    // replies are written whole, do not let Nagle hold back the last segment
+    int enable = 1;
+    if (-1 == setsockopt(client_fd, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable)))
     {
-        errno = ENOMEM;
-        perror("Could not allocate memory for q_item");
-        exit(-1);
+        fprintf(stderr, "%s could not set TCP_NODELAY: %s\n", __func__, strerror(errno));
     }
-    q_item->data = client_fd;
-    pthread_mutex_lock(&p_tpool->lock);
-    enqueue(p_queue, *q_item);
-    pthread_mutex_unlock(&p_tpool->lock);
-    pthread_cond_broadcast(&p_tpool->condition);
 
-    CLEAN(q_item);
+    if (0 == reactor_add_conn(p_reactor, client_fd))
+    {
+        printf("Number of current connections: %zu\n", atomic_load(&clients_con));
+    }
 }
 
 void end_connection()
 {
-    pthread_mutex_lock(&p_tpool->lock);
-    p_tpool->thread_cnt--;
-    pthread_mutex_unlock(&p_tpool->lock);
-    clients_con--;
-    printf("Number of current connections: %ld\n", clients_con);
+    size_t remaining = atomic_fetch_sub(&clients_con, 1) - 1;
+    printf("Number of current connections: %zu\n", remaining);
 }
\ No newline at end of file
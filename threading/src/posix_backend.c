@@ -0,0 +1,609 @@
+#include "../includes/file_operations.h"
+#include "../includes/storage_backend.h"
+#include "../includes/segment_store.h"
+#include "../includes/file_cache.h"
+
+#define PAGE_PACKED     (1ULL << 63)
+
+/**
+ * @brief - a page being filled
+ * @member p_visit / p_arg - receive every file of the page
+ * @member p_pattern - fnmatch() pattern the names must match, "" for all
+ * @member p_arena - arena of the request, holds the shard candidates
+ * @member p_batch - XFER_BUF_SZ buffer for the getdents64 batches
+ * @member page_size / taken - most files to return and files returned so far
+ */
+typedef struct page_ctx
+{
+    file_index_visit_t  p_visit;
+    void              * p_arg;
+    const char        * p_pattern;
+    arena_t           * p_arena;
+    char              * p_batch;
+    uint32_t            page_size;
+    uint32_t            taken;
+} page_ctx_t;
+
+/**
+ * INT POSIX_INIT:
+ * @brief - sets up the layout of FILE_SERVER_DIR, loads the segments and
+ *          indexes the directory
+ */
+static int posix_init (layout_t layout, size_t pack_max)
+{
+    if (-1 == layout_init(layout))
+    {
+        return -1;
+    }
+
+    // the segments are loaded first, the index lists the packed files too
+    if (-1 == segment_init(pack_max))
+    {
+        fprintf(stderr, "%s could not load %s\n", __func__, SEGMENT_DIR);
+        return -1;
+    }
+
+    if (-1 == file_index_init())
+    {
+        fprintf(stderr, "%s could not index %s\n", __func__, FILE_SERVER_DIR);
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * VOID POSIX_CLEANUP:
+ * @brief - releases what posix_init set up, whatever part of it succeeded
+ */
+static void posix_cleanup ()
+{
+    upload_session_cleanup();
+    file_index_cleanup();
+    segment_cleanup();
+    layout_cleanup();
+}
+
+/**
+ * BOOL ENTRY_INFO:
+ * @brief - describes a directory entry for a page if it is a stored regular
+ *          file whose name matches, from the index or, for a name the watcher
+ *          has not caught up with (or an unknown d_type), from fstatat. A name
+ *          the index serves from a segment is listed with the packed files
+ */
+static bool entry_info (int dir_fd, const struct dirent64 * p_ent, const char * p_pattern, file_info_t * p_info)
+{
+    struct stat file_stat = { 0 };
+
+    if (((DT_REG != p_ent->d_type) && (DT_UNKNOWN != p_ent->d_type)) || (false == is_valid_filename(p_ent->d_name)))
+    {
+        return false;
+    }
+
+    if (('\0' != p_pattern[0]) && (0 != fnmatch(p_pattern, p_ent->d_name, 0)))
+    {
+        return false;
+    }
+
+    if (file_index_lookup(p_ent->d_name, p_info))
+    {
+        if (true == p_info->packed)
+        {
+            return false;
+        }
+    }
+    else
+    {
+        if ((-1 == fstatat(dir_fd, p_ent->d_name, &file_stat, AT_SYMLINK_NOFOLLOW)) ||
+            (!S_ISREG(file_stat.st_mode)))
+        {
+            return false;
+        }
+
+        p_info->size     = file_stat.st_size;
+        p_info->mtime_ns = (uint64_t)file_stat.st_mtim.tv_sec * 1000000000ULL + file_stat.st_mtim.tv_nsec;
+        p_info->packed   = false;
+    }
+
+    p_info->p_name   = p_ent->d_name;
+    p_info->name_len = strnlen(p_ent->d_name, MAXNAMLEN);
+    return true;
+}
+
+/**
+ * INT PAGE_FLAT:
+ * @brief - fills a page of a flat directory in getdents64 order, the cursor is
+ *          the d_off of the last entry examined
+ * @return - 0 on success, -1 on error
+ */
+static int page_flat (page_ctx_t * p_ctx, uint64_t cursor, uint64_t * p_next)
+{
+    file_info_t info     = { 0 };
+    size_t      examined = 0;
+    ssize_t     batch    = 0;
+    bool        full     = false;
+    int         dir_fd   = open(FILE_SERVER_DIR, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+
+    if (-1 == dir_fd)
+    {
+        return -1;
+    }
+
+    if ((0 != cursor) && (-1 == lseek(dir_fd, (off_t)cursor, SEEK_SET)))
+    {
+        fprintf(stderr, "%s bad cursor %" PRIu64 ": %s\n", __func__, cursor, strerror(errno));
+        close(dir_fd);
+        errno = EINVAL;
+        return -1;
+    }
+
+    // the end of the directory leaves the cursor at 0, there is no next page
+    *p_next = 0;
+    while (!full)
+    {
+        batch = getdents64(dir_fd, p_ctx->p_batch, XFER_BUF_SZ);
+        if (0 >= batch)
+        {
+            *p_next = 0;
+            break;
+        }
+
+        for (ssize_t offset = 0; offset < batch;)
+        {
+            struct dirent64 * p_ent = (struct dirent64 *)(p_ctx->p_batch + offset);
+
+            if (true == entry_info(dir_fd, p_ent, p_ctx->p_pattern, &info))
+            {
+                if (-1 == p_ctx->p_visit(&info, p_ctx->p_arg))
+                {
+                    batch = -1;
+                    break;
+                }
+                p_ctx->taken++;
+            }
+
+            *p_next  = p_ent->d_off;
+            offset  += p_ent->d_reclen;
+            examined++;
+            if ((p_ctx->page_size == p_ctx->taken) || (LIST_SCAN_MAX <= examined))
+            {
+                full = true;
+                break;
+            }
+        }
+        if (-1 == batch)
+        {
+            break;
+        }
+    }
+
+    int err = errno;
+    close(dir_fd);
+    errno = err;
+    return (-1 == batch) ? -1 : 0;
+}
+
+/**
+ * @brief - a file found while paging one shard, its name is kept in the
+ *          shard's name buffer
+ * @member hash - layout_hash of the name, the order of a sharded listing
+ * @member size / mtime_ns - as in file_info_t
+ * @member name_off / name_len - the name in the name buffer
+ */
+typedef struct page_cand
+{
+    uint64_t    hash;
+    uint64_t    size;
+    uint64_t    mtime_ns;
+    size_t      name_off;
+    uint16_t    name_len;
+} page_cand_t;
+
+/**
+ * @brief - the files of the shard being paged
+ * @member cands - page_cand_t array, file_count is the number of candidates
+ * @member names - their names back to back
+ */
+typedef struct shard_ctx
+{
+    list_ctx_t  cands;
+    list_ctx_t  names;
+} shard_ctx_t;
+
+/**
+ * INT COMPARE_CAND:
+ * @brief - qsort order of page candidates, by name hash
+ */
+static int compare_cand (const void * p_lhs, const void * p_rhs)
+{
+    uint64_t lhs = ((const page_cand_t *)p_lhs)->hash;
+    uint64_t rhs = ((const page_cand_t *)p_rhs)->hash;
+
+    return (lhs > rhs) - (lhs < rhs);
+}
+
+/**
+ * INT COLLECT_SHARD:
+ * @brief - adds the files of one shard found in p_path past the cursor to the
+ *          candidates. The top level is read for the files of the shard that
+ *          have not been migrated yet
+ * @return - 0 on success, -1 on error
+ */
+static int collect_shard (shard_ctx_t * p_ctx, const char * p_path, unsigned shard, uint64_t cursor,
+                          const char * p_pattern, char * p_batch, size_t * p_examined)
+{
+    file_info_t info   = { 0 };
+    page_cand_t cand   = { 0 };
+    ssize_t     batch  = 0;
+    int         dir_fd = open(p_path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+
+    if (-1 == dir_fd)
+    {
+        return -1;
+    }
+
+    while (0 < (batch = getdents64(dir_fd, p_batch, XFER_BUF_SZ)))
+    {
+        for (ssize_t offset = 0; offset < batch; offset += ((struct dirent64 *)(p_batch + offset))->d_reclen)
+        {
+            struct dirent64 * p_ent = (struct dirent64 *)(p_batch + offset);
+
+            (*p_examined)++;
+            cand.hash = layout_hash(p_ent->d_name);
+            if ((shard != layout_shard(cand.hash)) || ((0 != cursor) && (cand.hash <= cursor)) ||
+                (false == entry_info(dir_fd, p_ent, p_pattern, &info)))
+            {
+                continue;
+            }
+
+            cand.size     = info.size;
+            cand.mtime_ns = info.mtime_ns;
+            cand.name_off = p_ctx->names.list_len;
+            cand.name_len = info.name_len;
+            if ((-1 == list_append(&p_ctx->names, info.p_name, info.name_len)) ||
+                (-1 == list_append(&p_ctx->cands, &cand, sizeof(cand))))
+            {
+                batch = -1;
+                break;
+            }
+            p_ctx->cands.file_count++;
+        }
+        if (-1 == batch)
+        {
+            break;
+        }
+    }
+
+    int err = errno;
+    close(dir_fd);
+    errno = err;
+    return (-1 == batch) ? -1 : 0;
+}
+
+/**
+ * @brief - the state of collect_packed while it walks the packed files of a
+ *          shard
+ * @member p_shard - the candidates
+ * @member cursor / p_pattern / p_examined - as in collect_shard
+ * @member packed_only - the candidates are keyed by hash | 1, see page_sharded
+ */
+typedef struct packed_ctx
+{
+    shard_ctx_t   * p_shard;
+    uint64_t        cursor;
+    const char    * p_pattern;
+    size_t        * p_examined;
+    bool            packed_only;
+} packed_ctx_t;
+
+/**
+ * INT COLLECT_PACKED:
+ * @brief - segment_walk callback, adds a packed file past the cursor to the
+ *          candidates
+ */
+static int collect_packed (const file_info_t * p_info, void * p_arg)
+{
+    packed_ctx_t * p_ctx   = p_arg;
+    shard_ctx_t  * p_shard = p_ctx->p_shard;
+    page_cand_t    cand    = { 0 };
+
+    (*p_ctx->p_examined)++;
+    cand.hash = layout_hash(p_info->p_name) | ((true == p_ctx->packed_only) ? 1 : 0);
+    if (((0 != p_ctx->cursor) && (cand.hash <= p_ctx->cursor)) ||
+        (('\0' != p_ctx->p_pattern[0]) && (0 != fnmatch(p_ctx->p_pattern, p_info->p_name, 0))))
+    {
+        return 0;
+    }
+
+    cand.size     = p_info->size;
+    cand.mtime_ns = p_info->mtime_ns;
+    cand.name_off = p_shard->names.list_len;
+    cand.name_len = p_info->name_len;
+    if ((-1 == list_append(&p_shard->names, p_info->p_name, p_info->name_len)) ||
+        (-1 == list_append(&p_shard->cands, &cand, sizeof(cand))))
+    {
+        errno = ENOMEM;
+        return -1;
+    }
+    p_shard->cands.file_count++;
+    return 0;
+}
+
+/**
+ * INT PAGE_SHARDED:
+ * @brief - fills a page of a sharded store. Directory offsets cannot tell the
+ *          shards apart, so the listing is ordered by name hash instead: its
+ *          top byte is the shard, and the cursor is the hash of the last file
+ *          returned. Every shard visited is read whole and sorted, together
+ *          with its packed files, a page only ends between two different
+ *          hashes. With packed_only the directories are skipped and the files
+ *          are keyed by hash | 1, so the key fits the 63 bits left to a flat
+ *          listing's packed cursor
+ * @return - 0 on success, -1 on error
+ */
+static int page_sharded (page_ctx_t * p_ctx, uint64_t cursor, bool packed_only, uint64_t * p_next)
+{
+    shard_ctx_t   shard_ctx        = { .cands.p_arena = p_ctx->p_arena, .names.p_arena = p_ctx->p_arena };
+    file_info_t   info             = { 0 };
+    char          p_path[PATH_MAX] = { 0 };
+    size_t        examined         = 0;
+    int           ret_val          = 0;
+    unsigned      shard            = (0 == cursor) ? 0 : layout_shard(cursor + 1);
+    packed_ctx_t  packed_ctx       = { .p_shard = &shard_ctx, .cursor = cursor, .p_pattern = p_ctx->p_pattern,
+                                       .p_examined = &examined, .packed_only = packed_only };
+
+    *p_next = 0;
+    for (; (0 == ret_val) && (shard < SHARD_COUNT); shard++)
+    {
+        page_cand_t * p_cands = NULL;
+        size_t        room    = p_ctx->page_size - p_ctx->taken;
+        size_t        taken   = 0;
+
+        shard_ctx.cands.list_len   = 0;
+        shard_ctx.cands.file_count = 0;
+        shard_ctx.names.list_len   = 0;
+        layout_shard_dir(shard, p_path, sizeof(p_path));
+        if (((false == packed_only) &&
+             ((-1 == collect_shard(&shard_ctx, FILE_SERVER_DIR, shard, cursor, p_ctx->p_pattern, p_ctx->p_batch,
+                                   &examined)) ||
+              (-1 == collect_shard(&shard_ctx, p_path, shard, cursor, p_ctx->p_pattern, p_ctx->p_batch,
+                                   &examined)))) ||
+            (-1 == segment_walk(shard, collect_packed, &packed_ctx)))
+        {
+            ret_val = -1;
+            break;
+        }
+
+        p_cands = (page_cand_t *)shard_ctx.cands.p_list;
+        qsort(p_cands, shard_ctx.cands.file_count, sizeof(page_cand_t), compare_cand);
+        for (size_t idx = 0; idx < shard_ctx.cands.file_count; idx++)
+        {
+            const char * p_name = shard_ctx.names.p_list + p_cands[idx].name_off;
+
+            if ((taken >= room) && (p_cands[idx].hash != p_cands[idx - 1].hash))
+            {
+                *p_next = p_cands[idx - 1].hash;
+                break;
+            }
+
+            // a file still at the top level and already in its shard is listed once
+            if ((0 < idx) && (p_cands[idx].hash == p_cands[idx - 1].hash) &&
+                (p_cands[idx].name_len == p_cands[idx - 1].name_len) &&
+                (0 == memcmp(p_name, shard_ctx.names.p_list + p_cands[idx - 1].name_off, p_cands[idx].name_len)))
+            {
+                continue;
+            }
+
+            info.p_name   = p_name;
+            info.name_len = p_cands[idx].name_len;
+            info.size     = p_cands[idx].size;
+            info.mtime_ns = p_cands[idx].mtime_ns;
+            if (-1 == p_ctx->p_visit(&info, p_ctx->p_arg))
+            {
+                ret_val = -1;
+                break;
+            }
+            taken++;
+            p_ctx->taken++;
+        }
+
+        if ((0 != *p_next) || (-1 == ret_val))
+        {
+            break;
+        }
+        if ((p_ctx->page_size <= p_ctx->taken) || (LIST_SCAN_MAX <= examined))
+        {
+            // continue after the last hash of this shard, the last shard ends it
+            *p_next = (SHARD_COUNT - 1 == shard) ? 0 : ((uint64_t)(shard + 1) << SHARD_SHIFT) - 1;
+            break;
+        }
+    }
+
+    return ret_val;
+}
+
+/**
+ * INT POSIX_LIST:
+ * @brief - pages through the directory (getdents64 in XFER_BUF_SZ batches).
+ *          In the flat layout the cursor is the directory offset of the last
+ *          entry examined, which stays valid while files come and go, in the
+ *          sharded layout it is the name hash of the last file returned. A
+ *          page stops after page_size files or (at a shard boundary)
+ *          LIST_SCAN_MAX entries, so a sparse filter can return a short page.
+ *          Packed files are listed with their shard in the sharded layout,
+ *          after the directory (with the top bit of the cursor set) in the
+ *          flat one
+ */
+static int posix_list (arena_t * p_arena, uint64_t cursor, uint32_t page_size, const char * p_pattern,
+                       file_index_visit_t p_visit, void * p_arg, uint64_t * p_next)
+{
+    int        ret_val = 0;
+    page_ctx_t ctx     = { .p_visit = p_visit, .p_arg = p_arg, .p_pattern = p_pattern, .p_arena = p_arena,
+                           .p_batch = buffer_get(), .page_size = page_size };
+
+    if (NULL == ctx.p_batch)
+    {
+        return -1;
+    }
+
+    if (LAYOUT_SHARDED == storage_layout)
+    {
+        ret_val = page_sharded(&ctx, cursor, false, p_next);
+        buffer_put(ctx.p_batch);
+        return ret_val;
+    }
+
+    // a flat listing pages through the directory, then through the packed
+    // files in hash order. PAGE_PACKED marks a cursor of the second part,
+    // directory offsets never have the top bit set
+    ret_val = (0 == (cursor & PAGE_PACKED)) ? page_flat(&ctx, cursor, p_next) : 0;
+    if ((0 == ret_val) && ((0 != (cursor & PAGE_PACKED)) || (0 == *p_next)))
+    {
+        cursor  = (0 == (cursor & PAGE_PACKED)) ? 0 : ((cursor << 1) | 1);
+        ret_val = page_sharded(&ctx, cursor, true, p_next);
+        *p_next = (0 == *p_next) ? 0 : (PAGE_PACKED | (*p_next >> 1));
+    }
+    buffer_put(ctx.p_batch);
+    return ret_val;
+}
+
+/**
+ * INT SERVE_FILE:
+ * @brief - offers an opened file to the hot-file cache and sets what
+ *          posix_open returns. The download reads the cache's copy if the
+ *          file is cached, file_fd otherwise
+ */
+static int serve_file (const char * p_filename, const file_info_t * p_info, int file_fd, uint64_t base,
+                       uint64_t * p_size, uint64_t * p_mtime_ns, uint64_t * p_base, cache_fill_t ** pp_fill)
+{
+    int cache_fd = file_cache_fill(p_filename, p_info, file_fd, base, pp_fill);
+    if (-1 != cache_fd)
+    {
+        close(file_fd);
+        file_fd = cache_fd;
+        base    = 0;
+    }
+
+    *p_size = p_info->size;
+    *p_base = base;
+    if (NULL != p_mtime_ns)
+    {
+        *p_mtime_ns = p_info->mtime_ns;
+    }
+    return file_fd;
+}
+
+/**
+ * INT POSIX_OPEN:
+ * @brief - opens a stored file for sendfile(), or the segment of a packed one.
+ *          A file with a current copy in the hot-file cache is served from
+ *          that, any other file is offered to the cache once it is open
+ */
+static int posix_open (const char * p_filename, uint64_t * p_size, uint64_t * p_mtime_ns, uint64_t * p_base,
+                       cache_fill_t ** pp_fill)
+{
+    int         file_fd   = -1;
+    uint64_t    base      = 0;
+    struct stat file_stat = { 0 };
+    file_info_t info      = { 0 };
+
+    // a name the index does not know is refused without a path lookup
+    if (false == file_index_lookup(p_filename, &info))
+    {
+        fprintf(stderr, "Could not open file passed: %s\n", strerror(ENOENT));
+        errno = ENOENT;
+        return -1;
+    }
+
+    // a hot file is served from its cached copy without opening it, and so is
+    // one that a concurrent download is copying in right now
+    file_fd = file_cache_open(p_filename, &info, pp_fill);
+    if (-1 != file_fd)
+    {
+        *p_size = info.size;
+        *p_base = 0;
+        if (NULL != p_mtime_ns)
+        {
+            *p_mtime_ns = info.mtime_ns;
+        }
+        return file_fd;
+    }
+
+    // a packed file is read from its segment, unless a stored copy replaced
+    // it since the lookup
+    if (true == info.packed)
+    {
+        file_fd = segment_open(p_filename, &info.size, &info.mtime_ns, &base);
+        if (-1 != file_fd)
+        {
+            posix_fadvise(file_fd, base, info.size, POSIX_FADV_WILLNEED);
+            info.ino = 0;
+            return serve_file(p_filename, &info, file_fd, base, p_size, p_mtime_ns, p_base, pp_fill);
+        }
+        if (ENOENT != errno)
+        {
+            int err = errno;
+            fprintf(stderr, "Could not open file passed: %s\n", strerror(err));
+            errno = err;
+            return -1;
+        }
+    }
+
+    // errno is left describing the failure, v2 clients receive it in the reply
+    file_fd = layout_open(p_filename, O_RDONLY | O_CLOEXEC);
+    if (-1 == file_fd)
+    {
+        int err = errno;
+        fprintf(stderr, "Could not open file passed: %s\n", strerror(err));
+        errno = err;
+        return -1;
+    }
+
+    if ((-1 == fstat(file_fd, &file_stat)) || (false == S_ISREG(file_stat.st_mode)))
+    {
+        fprintf(stderr, "Could not stat file passed: %s\n", strerror(EINVAL));
+        close(file_fd);
+        errno = EINVAL;
+        return -1;
+    }
+
+    // hint the kernel to read ahead aggressively, we only walk the file once
+    posix_fadvise(file_fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    info.size     = file_stat.st_size;
+    info.mtime_ns = ((uint64_t)file_stat.st_mtim.tv_sec * 1000000000ULL) + file_stat.st_mtim.tv_nsec;
+    info.ino      = file_stat.st_ino;
+    return serve_file(p_filename, &info, file_fd, 0, p_size, p_mtime_ns, p_base, pp_fill);
+}
+
+/**
+ * INT POSIX_CREATE:
+ * @brief - upload_begin, a packed upload is written at its record's place in
+ *          the segment
+ */
+static int posix_create (upload_t * p_upload, const char * p_filename, uint64_t upload_id, uint64_t size,
+                         uint64_t offset, uint64_t * p_base)
+{
+    int file_fd = upload_begin(p_upload, p_filename, upload_id, size, offset);
+
+    *p_base = p_upload->slot.base;
+    return file_fd;
+}
+
+const storage_backend_t posix_backend =
+{
+    .p_name   = BACKEND_NAME_POSIX,
+    .sessions = true,
+    .init     = posix_init,
+    .cleanup  = posix_cleanup,
+    .stat     = file_index_lookup,
+    .walk     = file_index_walk,
+    .list     = posix_list,
+    .open     = posix_open,
+    .create   = posix_create,
+    .commit   = upload_finish,
+    .discard  = upload_abandon,
+    .query    = upload_query,
+};
+
+/*** end posix_backend.c ***/
@@ -0,0 +1,165 @@
+#include "../includes/protocol.h"
+
+void v2_encode_hdr (char * p_buf, const v2_hdr_t * p_hdr)
+{
+    uint16_t opcode      = htole16(p_hdr->opcode);
+    uint16_t flags       = htole16(p_hdr->flags);
+    uint32_t request_id  = htole32(p_hdr->request_id);
+    uint64_t payload_len = htole64(p_hdr->payload_len);
+
+    memcpy(p_buf, &opcode, sizeof(opcode));
+    memcpy(p_buf + 2, &flags, sizeof(flags));
+    memcpy(p_buf + 4, &request_id, sizeof(request_id));
+    memcpy(p_buf + 8, &payload_len, sizeof(payload_len));
+}
+
+void v2_decode_hdr (const char * p_buf, v2_hdr_t * p_hdr)
+{
+    uint16_t opcode      = 0;
+    uint16_t flags       = 0;
+    uint32_t request_id  = 0;
+    uint64_t payload_len = 0;
+
+    memcpy(&opcode, p_buf, sizeof(opcode));
+    memcpy(&flags, p_buf + 2, sizeof(flags));
+    memcpy(&request_id, p_buf + 4, sizeof(request_id));
+    memcpy(&payload_len, p_buf + 8, sizeof(payload_len));
+
+    p_hdr->opcode      = le16toh(opcode);
+    p_hdr->flags       = le16toh(flags);
+    p_hdr->request_id  = le32toh(request_id);
+    p_hdr->payload_len = le64toh(payload_len);
+}
+
+size_t v2_encode_hello (char * p_buf, uint16_t flags)
+{
+    uint16_t version = htole16(V2_VERSION);
+
+    flags = htole16(flags);
+    memcpy(p_buf, V2_MAGIC, V2_MAGIC_LEN);
+    memcpy(p_buf + V2_MAGIC_LEN, &version, sizeof(version));
+    memcpy(p_buf + V2_MAGIC_LEN + 2, &flags, sizeof(flags));
+    return V2_HELLO_SZ;
+}
+
+bool v2_is_hello (const char * p_buf)
+{
+    return 0 == memcmp(p_buf, V2_MAGIC, V2_MAGIC_LEN);
+}
+
+size_t v2_encode_reply (char * p_buf, uint16_t opcode, uint32_t request_id, uint64_t payload_len)
+{
+    v2_hdr_t hdr = { 0 };
+    hdr.opcode      = opcode;
+    hdr.flags       = V2_FLAG_REPLY;
+    hdr.request_id  = request_id;
+    hdr.payload_len = payload_len;
+
+    v2_encode_hdr(p_buf, &hdr);
+    return V2_HDR_SZ;
+}
+
+size_t v2_encode_error (char * p_buf, uint16_t opcode, uint32_t request_id, int err)
+{
+    v2_hdr_t hdr = { 0 };
+    hdr.opcode      = opcode;
+    hdr.flags       = V2_FLAG_REPLY | V2_FLAG_ERROR;
+    hdr.request_id  = request_id;
+    hdr.payload_len = sizeof(uint32_t);
+
+    uint32_t wire_err = htole32((uint32_t)err);
+    v2_encode_hdr(p_buf, &hdr);
+    memcpy(p_buf + V2_HDR_SZ, &wire_err, sizeof(wire_err));
+    return V2_HDR_SZ + sizeof(wire_err);
+}
+
+void v2_decode_range (const char * p_buf, uint64_t * p_offset, uint64_t * p_length)
+{
+    uint64_t offset = 0;
+    uint64_t length = 0;
+
+    memcpy(&offset, p_buf, sizeof(offset));
+    memcpy(&length, p_buf + sizeof(offset), sizeof(length));
+    *p_offset = le64toh(offset);
+    *p_length = le64toh(length);
+}
+
+int v2_clip_range (uint64_t file_size, uint64_t offset, uint64_t * p_length)
+{
+    if (offset > file_size)
+    {
+        errno = ERANGE;
+        return -1;
+    }
+
+    if (*p_length > file_size - offset)
+    {
+        *p_length = file_size - offset;
+    }
+    return 0;
+}
+
+size_t v2_encode_range_head (char * p_buf, uint64_t file_size, uint64_t mtime_ns, uint64_t length)
+{
+    file_size = htole64(file_size);
+    mtime_ns  = htole64(mtime_ns);
+    length    = htole64(length);
+
+    memcpy(p_buf, &file_size, sizeof(file_size));
+    memcpy(p_buf + 8, &mtime_ns, sizeof(mtime_ns));
+    memcpy(p_buf + 16, &length, sizeof(length));
+    return V2_RANGE_HEAD_SZ;
+}
+
+void v2_decode_upload (const char * p_buf, uint64_t * p_upload_id, uint64_t * p_value)
+{
+    // same wire layout as a range request, two little-endian u64 values
+    v2_decode_range(p_buf, p_upload_id, p_value);
+}
+
+void v2_decode_list_page (const char * p_buf, uint64_t * p_cursor, uint32_t * p_page_size)
+{
+    uint64_t cursor    = 0;
+    uint32_t page_size = 0;
+
+    memcpy(&cursor, p_buf, sizeof(cursor));
+    memcpy(&page_size, p_buf + sizeof(cursor), sizeof(page_size));
+    *p_cursor    = le64toh(cursor);
+    *p_page_size = le32toh(page_size);
+}
+
+void v2_decode_session (const char * p_buf, uint64_t * p_upload_id, uint64_t * p_size, uint64_t * p_chunk_size)
+{
+    uint64_t chunk_size = 0;
+
+    v2_decode_upload(p_buf, p_upload_id, p_size);
+    memcpy(&chunk_size, p_buf + V2_UPLOAD_REQ_SZ, sizeof(chunk_size));
+    *p_chunk_size = le64toh(chunk_size);
+}
+
+size_t v2_encode_extents_head (char * p_buf, uint64_t file_size, uint64_t mtime_ns, uint64_t map_end,
+                               uint32_t count)
+{
+    v2_encode_range_head(p_buf, file_size, mtime_ns, map_end);
+    count = htole32(count);
+    memcpy(p_buf + V2_RANGE_HEAD_SZ, &count, sizeof(count));
+    return V2_EXTENTS_HEAD_SZ;
+}
+
+size_t v2_encode_extent (char * p_buf, uint64_t offset, uint64_t length)
+{
+    offset = htole64(offset);
+    length = htole64(length);
+
+    memcpy(p_buf, &offset, sizeof(offset));
+    memcpy(p_buf + 8, &length, sizeof(length));
+    return V2_EXTENT_SZ;
+}
+
+void v2_decode_extent (const char * p_buf, uint64_t * p_offset, uint64_t * p_length)
+{
+    // same wire layout as a range request
+    v2_decode_range(p_buf, p_offset, p_length);
+}
+
+/*** end protocol.c ***/
@@ -0,0 +1,891 @@
+#include "../includes/storage_backend.h"
+#include "../includes/file_operations.h"
+
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+
+#define RAM_FILE_NAME   "ram_file"
+
+typedef struct ram_file ram_file_t;
+
+/**
+ * @brief - a memfd holding the contents of files
+ * @member p_next - next block
+ * @member fd - the memfd
+ * @member used - bytes handed out, a shared block is RAM_BLOCK_SIZE long
+ * @member dead - bytes of files that were replaced since
+ * @member p_files - the files stored in it
+ * @member shared - small files are packed into it, otherwise it holds a
+ *                  single file
+ */
+typedef struct ram_block
+{
+    struct ram_block  * p_next;
+    int                 fd;
+    uint64_t            used;
+    uint64_t            dead;
+    ram_file_t        * p_files;
+    bool                shared;
+} ram_block_t;
+
+/**
+ * @brief - a file held in memory, chained into its hash bucket
+ * @member p_next - next file in the bucket
+ * @member p_block_prev / p_block_next - the other files of its block
+ * @member hash - layout_hash of the name
+ * @member p_block / base - where the contents are
+ * @member size / mtime_ns - as in file_info_t
+ * @member name_len / name - the NUL terminated file name
+ */
+struct ram_file
+{
+    ram_file_t        * p_next;
+    ram_file_t        * p_block_prev;
+    ram_file_t        * p_block_next;
+    uint64_t            hash;
+    ram_block_t       * p_block;
+    uint64_t            base;
+    uint64_t            size;
+    uint64_t            mtime_ns;
+    uint16_t            name_len;
+    char                name[];
+};
+
+/**
+ * @brief - every file of the ram backend
+ * @member lock - guards the table and the blocks, writers are published
+ *                uploads
+ * @member pp_buckets / num_buckets - the hash table, a power of two. Buckets
+ *                                   are picked by the top bits of the hash so
+ *                                   a listing can page through them in hash
+ *                                   order
+ * @member bucket_shift - 64 minus log2 of num_buckets
+ * @member count - number of files
+ * @member p_blocks - every block
+ * @member p_active - the shared block small files are appended to, NULL until
+ *                    the first one is stored
+ */
+typedef struct ram_store
+{
+    pthread_rwlock_t    lock;
+    ram_file_t       ** pp_buckets;
+    size_t              num_buckets;
+    unsigned            bucket_shift;
+    size_t              count;
+    ram_block_t       * p_blocks;
+    ram_block_t       * p_active;
+} ram_store_t;
+
+static ram_store_t ram = { .lock = PTHREAD_RWLOCK_INITIALIZER };
+
+/**
+ * RAM_FILE_T ** FIND_SLOT:
+ * @brief - returns the link that points at the file of a name, or the NULL
+ *          link at the end of its bucket. The caller holds the lock
+ */
+static ram_file_t ** find_slot (const char * p_filename, uint64_t hash)
+{
+    ram_file_t ** pp_slot = &ram.pp_buckets[hash >> ram.bucket_shift];
+
+    while ((NULL != *pp_slot) && (((*pp_slot)->hash != hash) || (0 != strcmp((*pp_slot)->name, p_filename))))
+    {
+        pp_slot = &(*pp_slot)->p_next;
+    }
+    return pp_slot;
+}
+
+/**
+ * VOID GROW_TABLE:
+ * @brief - doubles the bucket count once there are more files than buckets,
+ *          every bucket splits into the two that follow its hash prefix. The
+ *          caller holds the write lock, a failed allocation keeps the old table
+ */
+static void grow_table ()
+{
+    size_t        num_buckets = ram.num_buckets * 2;
+    ram_file_t ** pp_buckets  = calloc(num_buckets, sizeof(ram_file_t *));
+
+    if (NULL == pp_buckets)
+    {
+        return;
+    }
+
+    for (size_t idx = 0; idx < ram.num_buckets; idx++)
+    {
+        ram_file_t * p_file = ram.pp_buckets[idx];
+        while (NULL != p_file)
+        {
+            ram_file_t  * p_next  = p_file->p_next;
+            ram_file_t ** pp_head = &pp_buckets[p_file->hash >> (ram.bucket_shift - 1)];
+            p_file->p_next = *pp_head;
+            *pp_head       = p_file;
+            p_file         = p_next;
+        }
+    }
+    free(ram.pp_buckets);
+    ram.pp_buckets  = pp_buckets;
+    ram.num_buckets = num_buckets;
+    ram.bucket_shift--;
+}
+
+/**
+ * VOID FILE_INFO:
+ * @brief - describes a file the way the file index does
+ */
+static void file_info (const ram_file_t * p_file, file_info_t * p_info)
+{
+    p_info->p_name   = p_file->name;
+    p_info->name_len = p_file->name_len;
+    p_info->size     = p_file->size;
+    p_info->mtime_ns = p_file->mtime_ns;
+    p_info->ino      = 0;
+    p_info->packed   = false;
+}
+
+/**
+ * INT NEW_MEMFD:
+ * @brief - creates an empty memfd of the given size, its memory is only
+ *          allocated as it is written
+ * @return - (int) the descriptor, -1 with errno set on error
+ */
+static int new_memfd (uint64_t size)
+{
+    int file_fd = memfd_create(RAM_FILE_NAME, MFD_CLOEXEC);
+
+    if ((-1 != file_fd) && (-1 == ftruncate(file_fd, (off_t)size)))
+    {
+        int err = errno;
+        close(file_fd);
+        errno = err;
+        return -1;
+    }
+    return file_fd;
+}
+
+/**
+ * RAM_BLOCK_T * NEW_BLOCK:
+ * @brief - adds a block, either a new shared one or one made of a complete
+ *          file's memfd (which the block then owns). The caller holds the
+ *          write lock
+ * @return - the block, NULL with errno set on error
+ */
+static ram_block_t * new_block (int file_fd, uint64_t size)
+{
+    ram_block_t * p_block = calloc(1, sizeof(ram_block_t));
+
+    if (NULL == p_block)
+    {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    p_block->shared = (-1 == file_fd);
+    p_block->used   = (true == p_block->shared) ? 0 : size;
+    p_block->fd     = (true == p_block->shared) ? new_memfd(RAM_BLOCK_SIZE) : file_fd;
+    if (-1 == p_block->fd)
+    {
+        int err = errno;
+        free(p_block);
+        errno = err;
+        return NULL;
+    }
+
+    p_block->p_next = ram.p_blocks;
+    ram.p_blocks    = p_block;
+    return p_block;
+}
+
+/**
+ * VOID DROP_BLOCK:
+ * @brief - removes a block that holds no file any more. Its memory is freed
+ *          once the downloads still reading it closed their descriptors
+ */
+static void drop_block (ram_block_t * p_block)
+{
+    ram_block_t ** pp_link = &ram.p_blocks;
+
+    while (p_block != *pp_link)
+    {
+        pp_link = &(*pp_link)->p_next;
+    }
+    *pp_link = p_block->p_next;
+    if (ram.p_active == p_block)
+    {
+        ram.p_active = NULL;
+    }
+    close(p_block->fd);
+    free(p_block);
+}
+
+/**
+ * VOID LINK_FILE:
+ * @brief - records that a file is stored in a block
+ */
+static void link_file (ram_block_t * p_block, ram_file_t * p_file, uint64_t base)
+{
+    p_file->p_block      = p_block;
+    p_file->base         = base;
+    p_file->p_block_prev = NULL;
+    p_file->p_block_next = p_block->p_files;
+    if (NULL != p_block->p_files)
+    {
+        p_block->p_files->p_block_prev = p_file;
+    }
+    p_block->p_files = p_file;
+}
+
+/**
+ * VOID UNLINK_FILE:
+ * @brief - removes a file from its block's list
+ */
+static void unlink_file (ram_file_t * p_file)
+{
+    ram_block_t * p_block = p_file->p_block;
+
+    if (NULL != p_file->p_block_prev)
+    {
+        p_file->p_block_prev->p_block_next = p_file->p_block_next;
+    }
+    else
+    {
+        p_block->p_files = p_file->p_block_next;
+    }
+    if (NULL != p_file->p_block_next)
+    {
+        p_file->p_block_next->p_block_prev = p_file->p_block_prev;
+    }
+    p_file->p_block = NULL;
+}
+
+/**
+ * INT COPY_RANGE:
+ * @brief - copies len bytes between two memfds inside the kernel
+ * @return - 0 on success, -1 on error
+ */
+static int copy_range (int in_fd, uint64_t in_off, int out_fd, uint64_t out_off, uint64_t len)
+{
+    loff_t in_pos  = (loff_t)in_off;
+    loff_t out_pos = (loff_t)out_off;
+
+    while (0 < len)
+    {
+        ssize_t copied = copy_file_range(in_fd, &in_pos, out_fd, &out_pos, len, 0);
+        if (0 >= copied)
+        {
+            errno = (0 == copied) ? EIO : errno;
+            return -1;
+        }
+        len -= copied;
+    }
+    return 0;
+}
+
+static void check_block (ram_block_t * p_block);
+
+/**
+ * INT PLACE:
+ * @brief - copies a small file to the end of the active block, sealing it
+ *          and starting a new one when it is full. The caller holds the write
+ *          lock, the file is in no block yet
+ * @return - 0 on success, -1 on error
+ */
+static int place (ram_file_t * p_file, int src_fd, uint64_t src_off)
+{
+    ram_block_t * p_full = NULL;
+
+    if ((NULL == ram.p_active) || (RAM_BLOCK_SIZE < ram.p_active->used + p_file->size))
+    {
+        p_full       = ram.p_active;
+        ram.p_active = new_block(-1, RAM_BLOCK_SIZE);
+        if (NULL == ram.p_active)
+        {
+            ram.p_active = p_full;
+            return -1;
+        }
+    }
+
+    if (-1 == copy_range(src_fd, src_off, ram.p_active->fd, ram.p_active->used, p_file->size))
+    {
+        return -1;
+    }
+    link_file(ram.p_active, p_file, ram.p_active->used);
+    ram.p_active->used += p_file->size;
+    if (NULL != p_full)
+    {
+        check_block(p_full);
+    }
+    return 0;
+}
+
+/**
+ * VOID COMPACT_BLOCK:
+ * @brief - copies the files of a mostly dead block into the active one and
+ *          drops it, a file that cannot be moved keeps the block alive
+ */
+static void compact_block (ram_block_t * p_block)
+{
+    uint64_t live = p_block->used - p_block->dead;
+
+    while (NULL != p_block->p_files)
+    {
+        ram_file_t * p_file = p_block->p_files;
+        uint64_t     base   = p_file->base;
+
+        unlink_file(p_file);
+        if (-1 == place(p_file, p_block->fd, base))
+        {
+            fprintf(stderr, "%s could not move %s: %s\n", __func__, p_file->name, strerror(errno));
+            link_file(p_block, p_file, base);
+            return;
+        }
+    }
+
+    printf("Compacted a memory block: moved %" PRIu64 " of its %" PRIu64 " bytes\n", live, p_block->used);
+    drop_block(p_block);
+}
+
+/**
+ * VOID CHECK_BLOCK:
+ * @brief - drops a sealed block that holds no file, or compacts it once at
+ *          least RAM_COMPACT_PCT percent of it was replaced
+ */
+static void check_block (ram_block_t * p_block)
+{
+    if (ram.p_active == p_block)
+    {
+        return;
+    }
+
+    if (NULL == p_block->p_files)
+    {
+        drop_block(p_block);
+    }
+    else if ((true == p_block->shared) && (p_block->dead * 100 >= p_block->used * RAM_COMPACT_PCT))
+    {
+        compact_block(p_block);
+    }
+}
+
+/**
+ * VOID RELEASE:
+ * @brief - takes a replaced file out of its block and frees it
+ */
+static void release (ram_file_t * p_file)
+{
+    ram_block_t * p_block = p_file->p_block;
+
+    unlink_file(p_file);
+    p_block->dead += p_file->size;
+    check_block(p_block);
+    free(p_file);
+}
+
+/**
+ * INT PUBLISH:
+ * @brief - makes the complete memfd of a file the one served under its name. A
+ *          small file is copied into the active block, a larger one keeps a
+ *          duplicate of the memfd as a block of its own, the caller keeps
+ *          file_fd either way. The file it replaces is released
+ * @return - 0 on success, -1 on error
+ */
+static int publish (const char * p_filename, int file_fd, uint64_t size, uint64_t mtime_ns)
+{
+    size_t        name_len = strnlen(p_filename, MAXNAMLEN);
+    ram_file_t  * p_file   = calloc(1, sizeof(ram_file_t) + name_len + 1);
+    ram_block_t * p_block  = NULL;
+    int           ret_val  = 0;
+
+    if (NULL == p_file)
+    {
+        errno = ENOMEM;
+        return -1;
+    }
+    p_file->hash     = layout_hash(p_filename);
+    p_file->size     = size;
+    p_file->mtime_ns = mtime_ns;
+    p_file->name_len = name_len;
+    memcpy(p_file->name, p_filename, name_len);
+
+    pthread_rwlock_wrlock(&ram.lock);
+    if (RAM_PACK_MAX >= size)
+    {
+        ret_val = place(p_file, file_fd, 0);
+    }
+    else
+    {
+        int block_fd = fcntl(file_fd, F_DUPFD_CLOEXEC, 0);
+        if ((-1 == block_fd) || (NULL == (p_block = new_block(block_fd, size))))
+        {
+            int err = errno;
+            if (-1 != block_fd)
+            {
+                close(block_fd);
+            }
+            errno   = err;
+            ret_val = -1;
+        }
+        else
+        {
+            link_file(p_block, p_file, 0);
+        }
+    }
+
+    if (-1 == ret_val)
+    {
+        int err = errno;
+        pthread_rwlock_unlock(&ram.lock);
+        free(p_file);
+        errno = err;
+        return -1;
+    }
+
+    ram_file_t ** pp_slot = find_slot(p_filename, p_file->hash);
+    ram_file_t  * p_old   = *pp_slot;
+    if (NULL != p_old)
+    {
+        p_file->p_next = p_old->p_next;
+        *pp_slot       = p_file;
+        release(p_old);
+    }
+    else
+    {
+        *pp_slot = p_file;
+        ram.count++;
+        if (ram.count > ram.num_buckets)
+        {
+            grow_table();
+        }
+    }
+    pthread_rwlock_unlock(&ram.lock);
+    return 0;
+}
+
+/**
+ * INT LOAD_FILE:
+ * @brief - copies one stored file into memory
+ * @return - 0 on success or if the entry is not a regular file, -1 on error
+ */
+static int load_file (int dir_fd, const char * p_filename, uint64_t * p_bytes)
+{
+    struct stat file_stat = { 0 };
+    off_t       offset    = 0;
+    int         mem_fd    = -1;
+    int         file_fd   = openat(dir_fd, p_filename, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+
+    if ((-1 == file_fd) || (-1 == fstat(file_fd, &file_stat)) || (!S_ISREG(file_stat.st_mode)))
+    {
+        if (-1 != file_fd)
+        {
+            close(file_fd);
+        }
+        return 0;
+    }
+
+    mem_fd = new_memfd(file_stat.st_size);
+    for (ssize_t sent = 1; (-1 != mem_fd) && (offset < file_stat.st_size) && (0 < sent);)
+    {
+        sent = sendfile(mem_fd, file_fd, &offset, file_stat.st_size - offset);
+    }
+
+    // a file cut short while it was copied is left out
+    int ret_val = (-1 == mem_fd) ? -1 : 0;
+    if ((-1 != mem_fd) && (offset == file_stat.st_size))
+    {
+        ret_val = publish(p_filename, mem_fd, file_stat.st_size,
+                          ((uint64_t)file_stat.st_mtim.tv_sec * 1000000000ULL) + file_stat.st_mtim.tv_nsec);
+        *p_bytes += (0 == ret_val) ? (uint64_t)offset : 0;
+    }
+    if (-1 != mem_fd)
+    {
+        close(mem_fd);
+    }
+    close(file_fd);
+    return ret_val;
+}
+
+/**
+ * INT LOAD_DIR:
+ * @brief - copies the regular files of one directory into memory, a missing
+ *          directory holds none
+ * @return - 0 on success, -1 on error
+ */
+static int load_dir (const char * p_path, uint64_t * p_bytes)
+{
+    DIR           * p_dir   = opendir(p_path);
+    struct dirent * p_ent   = NULL;
+    int             ret_val = 0;
+
+    if (NULL == p_dir)
+    {
+        return (ENOENT == errno) ? 0 : -1;
+    }
+
+    while ((0 == ret_val) && (NULL != (p_ent = readdir(p_dir))))
+    {
+        if (((DT_REG == p_ent->d_type) || (DT_UNKNOWN == p_ent->d_type)) && (true == is_valid_filename(p_ent->d_name)))
+        {
+            ret_val = load_file(dirfd(p_dir), p_ent->d_name, p_bytes);
+        }
+    }
+
+    int err = errno;
+    closedir(p_dir);
+    errno = err;
+    return ret_val;
+}
+
+/**
+ * INT RAM_INIT:
+ * @brief - sets up the table and copies the stored files into it, from every
+ *          shard if the directory is sharded
+ */
+static int ram_init (layout_t layout, size_t pack_max)
+{
+    char     p_path[PATH_MAX] = { 0 };
+    uint64_t bytes            = 0;
+
+    if ((LAYOUT_AUTO != layout) || (0 != pack_max))
+    {
+        printf("The %s backend keeps no files on disk, -l and -s are ignored\n", BACKEND_NAME_RAM);
+    }
+
+    ram.pp_buckets = calloc(RAM_MIN_BUCKETS, sizeof(ram_file_t *));
+    if (NULL == ram.pp_buckets)
+    {
+        errno = ENOMEM;
+        fprintf(stderr, "%s could not allocate the file table: %s\n", __func__, strerror(errno));
+        return -1;
+    }
+    ram.num_buckets  = RAM_MIN_BUCKETS;
+    ram.bucket_shift = 64 - __builtin_ctzll(RAM_MIN_BUCKETS);
+
+    if (-1 == load_dir(FILE_SERVER_DIR, &bytes))
+    {
+        goto FAIL;
+    }
+    for (unsigned shard = 0; (LAYOUT_SHARDED == layout_read()) && (shard < SHARD_COUNT); shard++)
+    {
+        if ((-1 == layout_shard_dir(shard, p_path, sizeof(p_path))) || (-1 == load_dir(p_path, &bytes)))
+        {
+            goto FAIL;
+        }
+    }
+
+    printf("Serving %zu files (%" PRIu64 " bytes) from memory, nothing is written back to %s\n",
+           ram.count, bytes, FILE_SERVER_DIR);
+    return 0;
+
+FAIL:
+    fprintf(stderr, "%s could not load %s into memory: %s\n", __func__, FILE_SERVER_DIR, strerror(errno));
+    return -1;
+}
+
+/**
+ * VOID RAM_CLEANUP:
+ * @brief - frees every file, every block and the table
+ */
+static void ram_cleanup ()
+{
+    pthread_rwlock_wrlock(&ram.lock);
+    for (size_t idx = 0; idx < ram.num_buckets; idx++)
+    {
+        ram_file_t * p_file = ram.pp_buckets[idx];
+        while (NULL != p_file)
+        {
+            ram_file_t * p_next = p_file->p_next;
+            free(p_file);
+            p_file = p_next;
+        }
+    }
+    while (NULL != ram.p_blocks)
+    {
+        ram_block_t * p_next = ram.p_blocks->p_next;
+        close(ram.p_blocks->fd);
+        free(ram.p_blocks);
+        ram.p_blocks = p_next;
+    }
+    ram.p_active = NULL;
+    CLEAN(ram.pp_buckets);
+    ram.num_buckets = 0;
+    ram.count       = 0;
+    pthread_rwlock_unlock(&ram.lock);
+}
+
+/**
+ * BOOL RAM_STAT:
+ * @brief - looks a file up by name, p_name is set to p_filename
+ */
+static bool ram_stat (const char * p_filename, file_info_t * p_info)
+{
+    pthread_rwlock_rdlock(&ram.lock);
+    ram_file_t * p_file = *find_slot(p_filename, layout_hash(p_filename));
+    if ((NULL != p_file) && (NULL != p_info))
+    {
+        file_info(p_file, p_info);
+        p_info->p_name = p_filename;
+    }
+    pthread_rwlock_unlock(&ram.lock);
+    return NULL != p_file;
+}
+
+/**
+ * INT RAM_WALK:
+ * @brief - calls p_visit for every file with the table locked for reading
+ */
+static int ram_walk (file_index_visit_t p_visit, void * p_arg, size_t * p_count)
+{
+    file_info_t info    = { 0 };
+    int         ret_val = 0;
+
+    pthread_rwlock_rdlock(&ram.lock);
+    for (size_t idx = 0; (0 == ret_val) && (idx < ram.num_buckets); idx++)
+    {
+        for (ram_file_t * p_file = ram.pp_buckets[idx]; (0 == ret_val) && (NULL != p_file); p_file = p_file->p_next)
+        {
+            file_info(p_file, &info);
+            ret_val = p_visit(&info, p_arg);
+        }
+    }
+    if (NULL != p_count)
+    {
+        *p_count = ram.count;
+    }
+    pthread_rwlock_unlock(&ram.lock);
+    return ret_val;
+}
+
+/**
+ * BOOL RAM_MATCHES:
+ * @brief - whether a file lies past the last hash listed and matches the
+ *          pattern
+ */
+static bool ram_matches (const ram_file_t * p_file, bool started, uint64_t last, const char * p_pattern)
+{
+    return ((false == started) || (p_file->hash > last)) &&
+           (('\0' == p_pattern[0]) || (0 == fnmatch(p_pattern, p_file->name, 0)));
+}
+
+/**
+ * INT RAM_LIST:
+ * @brief - pages through the files in name hash order, the cursor is the hash
+ *          of the last file returned. A bucket holds a range of hashes, its
+ *          few files are listed smallest hash first and a page only ends
+ *          between two different hashes. After LIST_SCAN_MAX files without
+ *          filling the page it ends at a bucket boundary
+ */
+static int ram_list (arena_t * p_arena, uint64_t cursor, uint32_t page_size, const char * p_pattern,
+                     file_index_visit_t p_visit, void * p_arg, uint64_t * p_next)
+{
+    file_info_t info     = { 0 };
+    bool        started  = (0 != cursor);
+    uint64_t    last     = cursor;
+    uint32_t    taken    = 0;
+    size_t      examined = 0;
+    int         ret_val  = 0;
+
+    // the files are listed straight out of the table, no scratch memory needed
+    (void)p_arena;
+    *p_next = 0;
+    pthread_rwlock_rdlock(&ram.lock);
+    for (size_t idx = started ? ((cursor + 1) >> ram.bucket_shift) : 0; idx < ram.num_buckets; idx++)
+    {
+        while (0 == ret_val)
+        {
+            ram_file_t * p_first = NULL;
+            for (ram_file_t * p_file = ram.pp_buckets[idx]; NULL != p_file; p_file = p_file->p_next)
+            {
+                if ((true == ram_matches(p_file, started, last, p_pattern)) &&
+                    ((NULL == p_first) || (p_file->hash < p_first->hash)))
+                {
+                    p_first = p_file;
+                }
+            }
+            if (NULL == p_first)
+            {
+                break;
+            }
+            if (taken >= page_size)
+            {
+                *p_next = last;
+                goto DONE;
+            }
+
+            for (ram_file_t * p_file = ram.pp_buckets[idx]; NULL != p_file; p_file = p_file->p_next)
+            {
+                if ((p_file->hash == p_first->hash) && (true == ram_matches(p_file, started, last, p_pattern)))
+                {
+                    file_info(p_file, &info);
+                    if (-1 == (ret_val = p_visit(&info, p_arg)))
+                    {
+                        goto DONE;
+                    }
+                    taken++;
+                }
+            }
+            started = true;
+            last    = p_first->hash;
+        }
+
+        for (ram_file_t * p_file = ram.pp_buckets[idx]; NULL != p_file; p_file = p_file->p_next)
+        {
+            examined++;
+        }
+        if ((LIST_SCAN_MAX <= examined) && (taken < page_size) && (idx + 1 < ram.num_buckets))
+        {
+            // continue after the last hash of this bucket
+            *p_next = ((uint64_t)(idx + 1) << ram.bucket_shift) - 1;
+            break;
+        }
+    }
+
+DONE:
+    pthread_rwlock_unlock(&ram.lock);
+    return ret_val;
+}
+
+/**
+ * INT RAM_OPEN:
+ * @brief - hands out a descriptor of the block a file is in, it keeps the
+ *          contents even if the file is replaced or moved during the download
+ */
+static int ram_open (const char * p_filename, uint64_t * p_size, uint64_t * p_mtime_ns, uint64_t * p_base,
+                     cache_fill_t ** pp_fill)
+{
+    int file_fd = -1;
+
+    *pp_fill = NULL;
+
+    pthread_rwlock_rdlock(&ram.lock);
+    ram_file_t * p_file = *find_slot(p_filename, layout_hash(p_filename));
+    if (NULL == p_file)
+    {
+        errno = ENOENT;
+    }
+    else if (-1 != (file_fd = fcntl(p_file->p_block->fd, F_DUPFD_CLOEXEC, 0)))
+    {
+        *p_size = p_file->size;
+        *p_base = p_file->base;
+        if (NULL != p_mtime_ns)
+        {
+            *p_mtime_ns = p_file->mtime_ns;
+        }
+    }
+    pthread_rwlock_unlock(&ram.lock);
+
+    if (-1 == file_fd)
+    {
+        int err = errno;
+        fprintf(stderr, "Could not open file passed: %s\n", strerror(err));
+        errno = err;
+    }
+    return file_fd;
+}
+
+/**
+ * INT RAM_CREATE:
+ * @brief - receives an upload into a new memfd of its full size. Nothing of
+ *          an interrupted upload is kept, so it cannot be resumed
+ */
+static int ram_create (upload_t * p_upload, const char * p_filename, uint64_t upload_id, uint64_t size,
+                       uint64_t offset, uint64_t * p_base)
+{
+    int file_fd = -1;
+
+    upload_init(p_upload);
+    *p_base = 0;
+    if (false == is_valid_filename(p_filename))
+    {
+        fprintf(stderr, "%s invalid file name received\n", __func__);
+        errno = EINVAL;
+        return -1;
+    }
+    if (0 < offset)
+    {
+        fprintf(stderr, "%s no staged upload of %s to resume at %" PRIu64 "\n", __func__, p_filename, offset);
+        errno = ESTALE;
+        return -1;
+    }
+
+    file_fd = new_memfd(size);
+    if (-1 == file_fd)
+    {
+        int err = errno;
+        fprintf(stderr, "%s could not allocate %" PRIu64 " bytes: %s\n", __func__, size, strerror(err));
+        errno = err;
+        return -1;
+    }
+
+    snprintf(p_upload->filename, sizeof(p_upload->filename), "%s", p_filename);
+    p_upload->upload_id = upload_id;
+    p_upload->size      = size;
+    printf("Saving Client File in memory as: %s\n", p_filename);
+    return file_fd;
+}
+
+/**
+ * INT RAM_COMMIT:
+ * @brief - publishes a complete upload, memory needs no flush
+ */
+static int ram_commit (upload_t * p_upload, int file_fd)
+{
+    struct timespec now = { 0 };
+
+    clock_gettime(CLOCK_REALTIME, &now);
+    if (-1 == publish(p_upload->filename, file_fd, p_upload->size,
+                      ((uint64_t)now.tv_sec * 1000000000ULL) + now.tv_nsec))
+    {
+        int err = errno;
+        fprintf(stderr, "%s could not publish %s: %s\n", __func__, p_upload->filename, strerror(err));
+        errno = err;
+        return -1;
+    }
+
+    upload_init(p_upload);
+    return 0;
+}
+
+/**
+ * VOID RAM_DISCARD:
+ * @brief - an unfinished upload is freed with its last descriptor
+ */
+static void ram_discard (upload_t * p_upload, int file_fd, uint64_t stored)
+{
+    (void)file_fd;
+    (void)stored;
+    upload_init(p_upload);
+}
+
+/**
+ * INT RAM_QUERY:
+ * @brief - nothing of an interrupted upload is kept, every upload starts at 0
+ */
+static int ram_query (const char * p_filename, uint64_t upload_id, uint64_t size, uint64_t * p_committed)
+{
+    (void)upload_id;
+    (void)size;
+    *p_committed = 0;
+    if (false == is_valid_filename(p_filename))
+    {
+        errno = EINVAL;
+        return -1;
+    }
+    return 0;
+}
+
+const storage_backend_t ram_backend =
+{
+    .p_name   = BACKEND_NAME_RAM,
+    .sessions = false,
+    .init     = ram_init,
+    .cleanup  = ram_cleanup,
+    .stat     = ram_stat,
+    .walk     = ram_walk,
+    .list     = ram_list,
+    .open     = ram_open,
+    .create   = ram_create,
+    .commit   = ram_commit,
+    .discard  = ram_discard,
+    .query    = ram_query,
+};
+
+/*** end ram_backend.c ***/
@@ -0,0 +1,433 @@
+#include "../includes/reactor.h"
+#include "../includes/connection.h"
+#include "../includes/global_data.h"
+
+static conn_t ** p_conns   = NULL;
+static size_t    max_conns = 0;
+
+conn_t * get_conn (int fd)
+{
+    if ((0 > fd) || ((size_t)fd >= max_conns))
+    {
+        return NULL;
+    }
+    return p_conns[fd];
+}
+
+/**
+ * INT INIT_CONN_TABLE:
+ * @brief - raises the open file limit as far as allowed and sizes the fd indexed
+ *          connection table to match
+ */
+static int init_conn_table ()
+{
+    struct rlimit limit = { 0 };
+
+    if (0 == getrlimit(RLIMIT_NOFILE, &limit))
+    {
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+        getrlimit(RLIMIT_NOFILE, &limit);
+    }
+    else
+    {
+        limit.rlim_cur = 1024;
+    }
+
+    max_conns = (RLIM_INFINITY == limit.rlim_cur) ? (1024 * 1024) : limit.rlim_cur;
+    p_conns   = calloc(max_conns, sizeof(conn_t *));
+    if (NULL == p_conns)
+    {
+        errno = ENOMEM;
+        fprintf(stderr, "%s could not allocate connection table: %s\n", __func__, strerror(errno));
+        return -1;
+    }
+
+    printf("Connection table sized for %zu descriptors\n", max_conns);
+    return 0;
+}
+
+int reactor_init (reactor_t * p_reactor, size_t id, int listen_fd)
+{
+    if ((NULL == p_reactor) || (-1 == listen_fd))
+    {
+        errno = EINVAL;
+        fprintf(stderr, "%s one or more parameters passed are invalid: %s\n", __func__, strerror(errno));
+        return -1;
+    }
+
+    if ((NULL == p_conns) && (-1 == init_conn_table()))
+    {
+        return -1;
+    }
+
+    p_reactor->id             = id;
+    p_reactor->epoll_fd       = -1;
+    p_reactor->event_fd       = -1;
+    p_reactor->listen_fd      = listen_fd;
+    p_reactor->p_pending      = NULL;
+    p_reactor->p_pending_tail = NULL;
+    p_reactor->p_jobs         = init_queue(JOB_QUEUE_LEN);
+    p_reactor->p_done         = init_queue(JOB_QUEUE_LEN + MAX_CLIENTS);
+    if ((NULL == p_reactor->p_jobs) || (NULL == p_reactor->p_done))
+    {
+        return -1;
+    }
+
+    p_reactor->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    p_reactor->event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if ((-1 == p_reactor->epoll_fd) || (-1 == p_reactor->event_fd))
+    {
+        fprintf(stderr, "%s could not create epoll/eventfd: %s\n", __func__, strerror(errno));
+        return -1;
+    }
+
+    struct epoll_event event = { 0 };
+    event.events  = EPOLLIN;
+    event.data.fd = listen_fd;
+    if (-1 == epoll_ctl(p_reactor->epoll_fd, EPOLL_CTL_ADD, listen_fd, &event))
+    {
+        fprintf(stderr, "%s could not register listening socket: %s\n", __func__, strerror(errno));
+        return -1;
+    }
+
+    event.data.fd = p_reactor->event_fd;
+    if (-1 == epoll_ctl(p_reactor->epoll_fd, EPOLL_CTL_ADD, p_reactor->event_fd, &event))
+    {
+        fprintf(stderr, "%s could not register eventfd: %s\n", __func__, strerror(errno));
+        return -1;
+    }
+
+    return 0;
+}
+
+int reactor_add_conn (reactor_t * p_reactor, int client_fd)
+{
+    if ((size_t)client_fd >= max_conns)
+    {
+        fprintf(stderr, "%s connection table is full, refusing client\n", __func__);
+        close(client_fd);
+        return -1;
+    }
+
+    conn_t * p_conn = conn_create(p_reactor, client_fd);
+    if (NULL == p_conn)
+    {
+        close(client_fd);
+        return -1;
+    }
+
+    struct epoll_event event = { 0 };
+    event.events  = EPOLLIN | EPOLLONESHOT;
+    event.data.fd = client_fd;
+    if (-1 == epoll_ctl(p_reactor->epoll_fd, EPOLL_CTL_ADD, client_fd, &event))
+    {
+        fprintf(stderr, "%s could not register client socket: %s\n", __func__, strerror(errno));
+        conn_destroy(p_conn);
+        close(client_fd);
+        return -1;
+    }
+
+    p_conns[client_fd] = p_conn;
+    atomic_fetch_add(&clients_con, 1);
+    return 0;
+}
+
+int reactor_arm (conn_t * p_conn, uint32_t events)
+{
+    struct epoll_event event = { 0 };
+    event.events  = events | EPOLLONESHOT;
+    event.data.fd = p_conn->sockfd;
+
+    if (-1 == epoll_ctl(p_conn->p_reactor->epoll_fd, EPOLL_CTL_MOD, p_conn->sockfd, &event))
+    {
+        fprintf(stderr, "%s could not arm client socket: %s\n", __func__, strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+void reactor_close_conn (conn_t * p_conn)
+{
+    int sockfd = p_conn->sockfd;
+
+    printf("ending client connection\n");
+    epoll_ctl(p_conn->p_reactor->epoll_fd, EPOLL_CTL_DEL, sockfd, NULL);
+    p_conns[sockfd] = NULL;
+    conn_destroy(p_conn);
+    close(sockfd);
+    end_connection();
+}
+
+/**
+ * BOOL QUEUE_JOB:
+ * @brief - places a connection's fd on its reactor's worker queue
+ * @return - true on success, false if the queue is full
+ */
+static bool queue_job (conn_t * p_conn)
+{
+    item q_item = { .data = p_conn->sockfd };
+
+    return enqueue(p_conn->p_reactor->p_jobs, q_item);
+}
+
+void reactor_submit_job (conn_t * p_conn)
+{
+    reactor_t * p_reactor = p_conn->p_reactor;
+
+    // keep jobs in order behind any that are already waiting for queue space
+    if ((NULL == p_reactor->p_pending) && (true == queue_job(p_conn)))
+    {
+        return;
+    }
+
+    p_conn->p_next_pending = NULL;
+    if (NULL == p_reactor->p_pending)
+    {
+        p_reactor->p_pending = p_conn;
+    }
+    else
+    {
+        p_reactor->p_pending_tail->p_next_pending = p_conn;
+    }
+    p_reactor->p_pending_tail = p_conn;
+}
+
+void reactor_wake (reactor_t * p_reactor)
+{
+    uint64_t wake = 1;
+
+    if (-1 == write(p_reactor->event_fd, &wake, sizeof(wake)))
+    {
+        fprintf(stderr, "%s could not wake reactor: %s\n", __func__, strerror(errno));
+    }
+}
+
+void reactor_complete_job (conn_t * p_conn)
+{
+    reactor_t * p_reactor = p_conn->p_reactor;
+    item        q_item    = { .data = p_conn->sockfd };
+
+    // cannot fail, the done queue has room for every job that can be in flight
+    enqueue(p_reactor->p_done, q_item);
+    reactor_wake(p_reactor);
+}
+
+/**
+ * VOID RETRY_PENDING:
+ * @brief - moves jobs that did not fit the worker queue onto it
+ */
+static void retry_pending (reactor_t * p_reactor)
+{
+    while (NULL != p_reactor->p_pending)
+    {
+        conn_t * p_conn = p_reactor->p_pending;
+        if (false == queue_job(p_conn))
+        {
+            return;
+        }
+        p_reactor->p_pending   = p_conn->p_next_pending;
+        p_conn->p_next_pending = NULL;
+        if (NULL == p_reactor->p_pending)
+        {
+            p_reactor->p_pending_tail = NULL;
+        }
+    }
+}
+
+/**
+ * VOID DRAIN_COMPLETIONS:
+ * @brief - resumes every connection whose job has finished
+ */
+static void drain_completions (reactor_t * p_reactor)
+{
+    uint64_t wakeups = 0;
+
+    if (-1 == read(p_reactor->event_fd, &wakeups, sizeof(wakeups)) && (EAGAIN != errno))
+    {
+        fprintf(stderr, "%s could not read eventfd: %s\n", __func__, strerror(errno));
+    }
+
+    for (;;)
+    {
+        int fd = dequeue(p_reactor->p_done);
+        if (-1 == fd)
+        {
+            return;
+        }
+
+        conn_t * p_conn = get_conn(fd);
+        if (NULL != p_conn)
+        {
+            conn_job_done(p_conn);
+        }
+    }
+}
+
+/**
+ * VOID ACCEPT_CLIENTS:
+ * @brief - drains the listen backlog, every accepted socket is non-blocking
+ */
+static void accept_clients (reactor_t * p_reactor)
+{
+    for (;;)
+    {
+        int client_fd = accept4(p_reactor->listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (-1 == client_fd)
+        {
+            if ((EINTR == errno) || (ECONNABORTED == errno))
+            {
+                continue;
+            }
+            if ((EAGAIN != errno) && (EWOULDBLOCK != errno))
+            {
+                fprintf(stderr, "%s could not accept client: %s\n", __func__, strerror(errno));
+            }
+            return;
+        }
+
+        handle_incoming_client(p_reactor, client_fd);
+    }
+}
+
+int reactor_run (reactor_t * p_reactor)
+{
+    struct epoll_event events[MAX_EVENTS];
+
+    while (serv_running)
+    {
+        int num_events = epoll_wait(p_reactor->epoll_fd, events, MAX_EVENTS, -1);
+        if (-1 == num_events)
+        {
+            if (EINTR == errno)
+            {
+                continue;
+            }
+            fprintf(stderr, "%s epoll_wait failed: %s\n", __func__, strerror(errno));
+            return -1;
+        }
+
+        for (int idx = 0; idx < num_events; idx++)
+        {
+            int fd = events[idx].data.fd;
+
+            if (fd == p_reactor->listen_fd)
+            {
+                accept_clients(p_reactor);
+            }
+            else if (fd == p_reactor->event_fd)
+            {
+                drain_completions(p_reactor);
+            }
+            else
+            {
+                conn_t * p_conn = get_conn(fd);
+                if (NULL != p_conn)
+                {
+                    conn_handle_event(p_conn, events[idx].events);
+                }
+            }
+        }
+
+        retry_pending(p_reactor);
+    }
+
+    return 0;
+}
+
+int pin_to_core (size_t id)
+{
+    long num_cores = sysconf(_SC_NPROCESSORS_ONLN);
+    if (1 > num_cores)
+    {
+        num_cores = 1;
+    }
+
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(id % (size_t)num_cores, &cpus);
+
+    int ret_val = pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+    if (0 != ret_val)
+    {
+        fprintf(stderr, "%s could not pin reactor %zu: %s\n", __func__, id, strerror(ret_val));
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * VOID * REACTOR_THREAD:
+ * @brief - thread body for every reactor except the one running on main
+ */
+static void * reactor_thread (void * p_arg)
+{
+    reactor_t * p_reactor = p_arg;
+
+    pin_to_core(p_reactor->id);
+    reactor_run(p_reactor);
+    return NULL;
+}
+
+int reactor_start (reactor_t * p_reactor)
+{
+    sigset_t block_set;
+    sigset_t old_set;
+    sigemptyset(&block_set);
+    sigaddset(&block_set, SIGINT);
+    pthread_sigmask(SIG_BLOCK, &block_set, &old_set);
+
+    int ret_val = pthread_create(&p_reactor->thread, NULL, reactor_thread, p_reactor);
+
+    pthread_sigmask(SIG_SETMASK, &old_set, NULL);
+    if (0 != ret_val)
+    {
+        fprintf(stderr, "%s could not start reactor %zu: %s\n", __func__, p_reactor->id, strerror(ret_val));
+        return -1;
+    }
+    return 0;
+}
+
+void reactor_stop (reactor_t * p_reactor)
+{
+    reactor_wake(p_reactor);
+    pthread_join(p_reactor->thread, NULL);
+}
+
+void reactor_cleanup (reactor_t * p_reactor)
+{
+    if (NULL == p_reactor)
+    {
+        return;
+    }
+
+    for (size_t fd = 0; fd < max_conns; fd++)
+    {
+        if ((NULL != p_conns[fd]) && (p_reactor == p_conns[fd]->p_reactor))
+        {
+            reactor_close_conn(p_conns[fd]);
+        }
+    }
+
+    if (-1 != p_reactor->epoll_fd)
+    {
+        close(p_reactor->epoll_fd);
+    }
+    if (-1 != p_reactor->event_fd)
+    {
+        close(p_reactor->event_fd);
+    }
+    close(p_reactor->listen_fd);
+    if (NULL != p_reactor->p_jobs)
+    {
+        clear(p_reactor->p_jobs);
+    }
+    if (NULL != p_reactor->p_done)
+    {
+        clear(p_reactor->p_done);
+    }
+    CLEAN(p_reactor->p_jobs);
+    CLEAN(p_reactor->p_done);
+}
+
+/*** end reactor.c ***/
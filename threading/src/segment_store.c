@@ -0,0 +1,1081 @@
+#include "../includes/segment_store.h"
+#include "../includes/file_operations.h"
+
+#define SEGMENT_MAGIC   0x4d474553
+#define SEGMENT_SUFFIX  ".seg"
+#define SEGMENT_ID_LEN  8
+#define RECORD_PENDING  1
+#define RECORD_LIVE     2
+#define RECORD_DEAD     3
+
+/**
+ * @brief - the on disk record header, every field little-endian. The name and
+ *          the contents follow it
+ * @member magic - SEGMENT_MAGIC
+ * @member state - RECORD_PENDING, RECORD_LIVE or RECORD_DEAD
+ * @member name_len - length of the name
+ * @member seq - publish order of a LIVE record, the highest one of a name wins
+ * @member size - length of the contents
+ * @member mtime_ns - when the record was published, in nanoseconds since the
+ *                    epoch
+ */
+typedef struct record_hdr
+{
+    uint32_t    magic;
+    uint16_t    state;
+    uint16_t    name_len;
+    uint64_t    seq;
+    uint64_t    size;
+    uint64_t    mtime_ns;
+} record_hdr_t;
+
+_Static_assert(SEGMENT_HDR_SZ == sizeof(record_hdr_t), "record header must match SEGMENT_HDR_SZ");
+
+/**
+ * @brief - one segment file
+ * @member p_next - next segment, the list is newest first
+ * @member id - the file is SEGMENT_DIR/<id in hex>.seg
+ * @member fd - the segment, open for reading and writing
+ * @member used - where the next record goes
+ * @member dead - bytes of records that are no longer served
+ * @member writers - records still being uploaded into the segment
+ */
+struct segment
+{
+    segment_t * p_next;
+    uint32_t    id;
+    int         fd;
+    uint64_t    used;
+    uint64_t    dead;
+    size_t      writers;
+};
+
+/**
+ * @brief - the newest LIVE record of a name, chained into its hash bucket
+ * @member p_next - next entry in the bucket
+ * @member hash - layout_hash of the name
+ * @member p_segment / record_off - where the record is
+ * @member seq / size / mtime_ns - as in the record header
+ * @member name_len / name - the NUL terminated file name
+ */
+typedef struct pack_entry
+{
+    struct pack_entry * p_next;
+    uint64_t            hash;
+    segment_t         * p_segment;
+    uint64_t            record_off;
+    uint64_t            seq;
+    uint64_t            size;
+    uint64_t            mtime_ns;
+    uint16_t            name_len;
+    char                name[];
+} pack_entry_t;
+
+/**
+ * @brief - the index, the segments and the compactor
+ * @member lock - guards the index and the segments, writers are uploads being
+ *                reserved or published, drops and the compactor
+ * @member pp_buckets / num_buckets - the hash table, a power of two. Buckets
+ *                                   are picked by the top bits of the hash so
+ *                                   the files of a shard sit in a run of
+ *                                   buckets and can be walked in hash order
+ * @member bucket_shift - 64 minus log2 of num_buckets
+ * @member count - number of entries
+ * @member p_segments - every segment, newest first
+ * @member p_active - the segment new records are appended to, NULL until the
+ *                    first one is created
+ * @member next_id / next_seq - for the next segment and the next LIVE record
+ * @member max_file - largest upload packed, 0 if packing is off
+ * @member wake_lock / wake / stop - stop the compactor at shutdown
+ * @member compactor / running - the compactor thread
+ */
+typedef struct segment_store
+{
+    pthread_rwlock_t    lock;
+    pack_entry_t     ** pp_buckets;
+    size_t              num_buckets;
+    unsigned            bucket_shift;
+    size_t              count;
+    segment_t         * p_segments;
+    segment_t         * p_active;
+    uint32_t            next_id;
+    uint64_t            next_seq;
+    size_t              max_file;
+    pthread_mutex_t     wake_lock;
+    pthread_cond_t      wake;
+    bool                stop;
+    pthread_t           compactor;
+    bool                running;
+} segment_store_t;
+
+static segment_store_t store = { .lock      = PTHREAD_RWLOCK_INITIALIZER,
+                                 .wake_lock = PTHREAD_MUTEX_INITIALIZER,
+                                 .wake      = PTHREAD_COND_INITIALIZER,
+                                 .next_seq  = 1 };
+
+/**
+ * UINT64_T RECORD_LEN:
+ * @brief - bytes a record takes in its segment
+ */
+static uint64_t record_len (uint16_t name_len, uint64_t size)
+{
+    return SEGMENT_HDR_SZ + name_len + size;
+}
+
+/**
+ * VOID SEGMENT_PATH:
+ * @brief - builds the path of a segment file
+ */
+static void segment_path (uint32_t id, char * p_path, size_t path_len)
+{
+    snprintf(p_path, path_len, "%s%0*" PRIx32 "%s", SEGMENT_DIR, SEGMENT_ID_LEN, id, SEGMENT_SUFFIX);
+}
+
+/**
+ * PACK_ENTRY_T ** FIND_SLOT:
+ * @brief - returns the link that points at the entry for a name, or the NULL
+ *          link at the end of its bucket. The caller holds the lock
+ */
+static pack_entry_t ** find_slot (const char * p_filename, uint64_t hash)
+{
+    pack_entry_t ** pp_slot = &store.pp_buckets[hash >> store.bucket_shift];
+
+    while ((NULL != *pp_slot) && (((*pp_slot)->hash != hash) || (0 != strcmp((*pp_slot)->name, p_filename))))
+    {
+        pp_slot = &(*pp_slot)->p_next;
+    }
+    return pp_slot;
+}
+
+/**
+ * VOID GROW_TABLE:
+ * @brief - doubles the bucket count once there are more entries than buckets,
+ *          every bucket splits into the two that follow its hash prefix. The
+ *          caller holds the write lock, a failed allocation keeps the old table
+ */
+static void grow_table ()
+{
+    size_t          num_buckets = store.num_buckets * 2;
+    pack_entry_t ** pp_buckets  = calloc(num_buckets, sizeof(pack_entry_t *));
+
+    if (NULL == pp_buckets)
+    {
+        return;
+    }
+
+    for (size_t idx = 0; idx < store.num_buckets; idx++)
+    {
+        pack_entry_t * p_entry = store.pp_buckets[idx];
+        while (NULL != p_entry)
+        {
+            pack_entry_t  * p_next  = p_entry->p_next;
+            pack_entry_t ** pp_head = &pp_buckets[p_entry->hash >> (store.bucket_shift - 1)];
+            p_entry->p_next = *pp_head;
+            *pp_head        = p_entry;
+            p_entry         = p_next;
+        }
+    }
+    free(store.pp_buckets);
+    store.pp_buckets  = pp_buckets;
+    store.num_buckets = num_buckets;
+    store.bucket_shift--;
+}
+
+/**
+ * VOID ENTRY_INFO:
+ * @brief - describes an entry the way the file index does
+ */
+static void entry_info (const pack_entry_t * p_entry, const char * p_name, file_info_t * p_info)
+{
+    p_info->p_name   = p_name;
+    p_info->name_len = p_entry->name_len;
+    p_info->size     = p_entry->size;
+    p_info->mtime_ns = p_entry->mtime_ns;
+    p_info->ino      = 0;
+    p_info->packed   = true;
+}
+
+/**
+ * INT WRITE_HEADER:
+ * @brief - writes the header and the name of a record
+ * @return - 0 on success, -1 on error
+ */
+static int write_header (int segment_fd, uint64_t record_off, uint16_t state, const char * p_filename,
+                         uint16_t name_len, uint64_t seq, uint64_t size, uint64_t mtime_ns)
+{
+    char         p_buf[SEGMENT_HDR_SZ + MAXNAMLEN] = { 0 };
+    record_hdr_t hdr                               = { 0 };
+
+    hdr.magic    = htole32(SEGMENT_MAGIC);
+    hdr.state    = htole16(state);
+    hdr.name_len = htole16(name_len);
+    hdr.seq      = htole64(seq);
+    hdr.size     = htole64(size);
+    hdr.mtime_ns = htole64(mtime_ns);
+    memcpy(p_buf, &hdr, sizeof(hdr));
+    memcpy(p_buf + sizeof(hdr), p_filename, name_len);
+    return (-1 == pwrite_all(segment_fd, p_buf, sizeof(hdr) + name_len, record_off)) ? -1 : 0;
+}
+
+/**
+ * BOOL READ_HEADER:
+ * @brief - decodes and checks a record header, the caller checks that the
+ *          record fits the segment
+ * @return - true if it is a record, false at the end of the segment
+ */
+static bool read_header (const char * p_buf, record_hdr_t * p_hdr)
+{
+    memcpy(p_hdr, p_buf, sizeof(record_hdr_t));
+    p_hdr->magic    = le32toh(p_hdr->magic);
+    p_hdr->state    = le16toh(p_hdr->state);
+    p_hdr->name_len = le16toh(p_hdr->name_len);
+    p_hdr->seq      = le64toh(p_hdr->seq);
+    p_hdr->size     = le64toh(p_hdr->size);
+    p_hdr->mtime_ns = le64toh(p_hdr->mtime_ns);
+
+    return (SEGMENT_MAGIC == p_hdr->magic) && (RECORD_PENDING <= p_hdr->state) && (RECORD_DEAD >= p_hdr->state) &&
+           (0 < p_hdr->name_len) && (MAXNAMLEN >= p_hdr->name_len) && (SEGMENT_MAX_FILE >= p_hdr->size);
+}
+
+/**
+ * VOID KILL_RECORD:
+ * @brief - marks a record DEAD, the caller holds the write lock. A lost mark
+ *          is harmless, a restart keeps the newest copy of every name anyway
+ */
+static void kill_record (segment_t * p_segment, uint64_t record_off, uint64_t len)
+{
+    uint16_t state = htole16(RECORD_DEAD);
+
+    pwrite_all(p_segment->fd, &state, sizeof(state), record_off + offsetof(record_hdr_t, state));
+    p_segment->dead += len;
+}
+
+/**
+ * VOID FORGET_ENTRY:
+ * @brief - marks the record of an entry DEAD and drops the entry, the caller
+ *          holds the write lock
+ */
+static void forget_entry (pack_entry_t ** pp_slot)
+{
+    pack_entry_t * p_entry = *pp_slot;
+
+    kill_record(p_entry->p_segment, p_entry->record_off, record_len(p_entry->name_len, p_entry->size));
+    *pp_slot = p_entry->p_next;
+    free(p_entry);
+    store.count--;
+}
+
+/**
+ * INT PLACE_RECORD:
+ * @brief - makes a LIVE record the served copy of its name, the record it
+ *          replaces is marked DEAD. The caller holds the write lock
+ * @return - 0 on success, -1 if the entry could not be allocated
+ */
+static int place_record (pack_entry_t ** pp_slot, const char * p_filename, uint64_t hash, segment_t * p_segment,
+                         uint64_t record_off, const record_hdr_t * p_hdr)
+{
+    pack_entry_t * p_entry = *pp_slot;
+
+    if (NULL == p_entry)
+    {
+        p_entry = calloc(1, sizeof(pack_entry_t) + p_hdr->name_len + 1);
+        if (NULL == p_entry)
+        {
+            fprintf(stderr, "%s could not index %s: %s\n", __func__, p_filename, strerror(ENOMEM));
+            return -1;
+        }
+        memcpy(p_entry->name, p_filename, p_hdr->name_len);
+        p_entry->name_len = p_hdr->name_len;
+        p_entry->hash     = hash;
+        *pp_slot          = p_entry;
+        store.count++;
+    }
+    else
+    {
+        kill_record(p_entry->p_segment, p_entry->record_off, record_len(p_entry->name_len, p_entry->size));
+    }
+
+    p_entry->p_segment  = p_segment;
+    p_entry->record_off = record_off;
+    p_entry->seq        = p_hdr->seq;
+    p_entry->size       = p_hdr->size;
+    p_entry->mtime_ns   = p_hdr->mtime_ns;
+
+    if (store.count > store.num_buckets)
+    {
+        grow_table();
+    }
+    return 0;
+}
+
+/**
+ * SEGMENT_T * NEW_SEGMENT:
+ * @brief - creates the next segment file and makes it the active segment, the
+ *          caller holds the write lock. The file is preallocated so appending
+ *          never changes its size, a zeroed header ends the segment
+ * @return - the segment, NULL with errno set on error
+ */
+static segment_t * new_segment ()
+{
+    char        p_path[PATH_MAX] = { 0 };
+    int         err              = 0;
+    segment_t * p_segment        = calloc(1, sizeof(segment_t));
+
+    if (NULL == p_segment)
+    {
+        errno = ENOMEM;
+        fprintf(stderr, "%s could not allocate segment: %s\n", __func__, strerror(errno));
+        return NULL;
+    }
+
+    segment_path(store.next_id, p_path, sizeof(p_path));
+    if ((-1 == mkdir(SEGMENT_DIR, 0755)) && (EEXIST != errno))
+    {
+        p_segment->fd = -1;
+    }
+    else
+    {
+        p_segment->fd = open(p_path, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+    }
+    if ((-1 == p_segment->fd) ||
+        ((-1 == fallocate(p_segment->fd, 0, 0, SEGMENT_SIZE)) && (EOPNOTSUPP != errno) && (ENOSYS != errno)))
+    {
+        err = errno;
+        fprintf(stderr, "%s could not create %s: %s\n", __func__, p_path, strerror(err));
+        if (-1 != p_segment->fd)
+        {
+            close(p_segment->fd);
+            unlink(p_path);
+        }
+        free(p_segment);
+        errno = err;
+        return NULL;
+    }
+
+    p_segment->id    = store.next_id++;
+    p_segment->p_next = store.p_segments;
+    store.p_segments  = p_segment;
+    store.p_active    = p_segment;
+    return p_segment;
+}
+
+/**
+ * SEGMENT_T * CLAIM_SPACE:
+ * @brief - takes len bytes at the end of the active segment, moving on to a
+ *          new segment when it is full. The caller holds the write lock
+ * @return - the segment with *p_off set to the space, NULL on error
+ */
+static segment_t * claim_space (uint64_t len, uint64_t * p_off)
+{
+    if (((NULL == store.p_active) || (SEGMENT_SIZE < store.p_active->used + len)) && (NULL == new_segment()))
+    {
+        return NULL;
+    }
+
+    *p_off                 = store.p_active->used;
+    store.p_active->used  += len;
+    return store.p_active;
+}
+
+/**
+ * VOID LOAD_RECORD:
+ * @brief - indexes a record found while loading a segment, a name seen before
+ *          keeps the copy with the higher sequence number. A compacted copy
+ *          has the sequence number of its original, the original (in the
+ *          older segment) is kept since the copy may not have been flushed
+ */
+static void load_record (segment_t * p_segment, uint64_t record_off, const record_hdr_t * p_hdr, const char * p_name)
+{
+    uint64_t        hash    = layout_hash(p_name);
+    uint64_t        len     = record_len(p_hdr->name_len, p_hdr->size);
+    pack_entry_t ** pp_slot = NULL;
+
+    // a PENDING record is an upload that never finished
+    if ((RECORD_LIVE != p_hdr->state) || (false == is_valid_filename(p_name)))
+    {
+        if (RECORD_PENDING == p_hdr->state)
+        {
+            kill_record(p_segment, record_off, len);
+            return;
+        }
+        p_segment->dead += len;
+        return;
+    }
+
+    if (p_hdr->seq >= store.next_seq)
+    {
+        store.next_seq = p_hdr->seq + 1;
+    }
+
+    pp_slot = find_slot(p_name, hash);
+    if (((NULL != *pp_slot) && ((*pp_slot)->seq >= p_hdr->seq)) ||
+        (-1 == place_record(pp_slot, p_name, hash, p_segment, record_off, p_hdr)))
+    {
+        kill_record(p_segment, record_off, len);
+    }
+}
+
+/**
+ * VOID LOAD_SEGMENT:
+ * @brief - indexes every record of a segment, reading it in XFER_BUF_SZ
+ *          windows. The first header that is not a record ends the segment
+ */
+static void load_segment (segment_t * p_segment, char * p_buf)
+{
+    struct stat   file_stat               = { 0 };
+    record_hdr_t  hdr                     = { 0 };
+    char          p_name[MAXNAMLEN + 1]   = { 0 };
+    uint64_t      win_off                 = 0;
+    ssize_t       win_len                 = 0;
+    uint64_t      off                     = 0;
+
+    if (-1 == fstat(p_segment->fd, &file_stat))
+    {
+        return;
+    }
+
+    while (off + SEGMENT_HDR_SZ <= (uint64_t)file_stat.st_size)
+    {
+        // a window always holds a whole header and name, the contents are
+        // never read
+        if (off + SEGMENT_HDR_SZ + MAXNAMLEN > win_off + win_len)
+        {
+            win_off = off;
+            win_len = pread(p_segment->fd, p_buf, XFER_BUF_SZ, off);
+            if (SEGMENT_HDR_SZ > win_len)
+            {
+                break;
+            }
+        }
+
+        const char * p_rec = p_buf + (off - win_off);
+        if ((false == read_header(p_rec, &hdr)) ||
+            (off + record_len(hdr.name_len, hdr.size) > (uint64_t)file_stat.st_size) ||
+            (off - win_off + SEGMENT_HDR_SZ + hdr.name_len > (uint64_t)win_len))
+        {
+            break;
+        }
+
+        memcpy(p_name, p_rec + SEGMENT_HDR_SZ, hdr.name_len);
+        p_name[hdr.name_len] = '\0';
+        load_record(p_segment, off, &hdr, p_name);
+        off += record_len(hdr.name_len, hdr.size);
+    }
+    p_segment->used = off;
+}
+
+/**
+ * INT COMPARE_ID:
+ * @brief - qsort order of segment ids, oldest first
+ */
+static int compare_id (const void * p_lhs, const void * p_rhs)
+{
+    uint32_t lhs = *(const uint32_t *)p_lhs;
+    uint32_t rhs = *(const uint32_t *)p_rhs;
+
+    return (lhs > rhs) - (lhs < rhs);
+}
+
+/**
+ * INT LOAD_SEGMENTS:
+ * @brief - opens and indexes every segment in SEGMENT_DIR, oldest first, the
+ *          newest one stays the active segment
+ * @return - 0 on success, -1 on error
+ */
+static int load_segments ()
+{
+    char            p_path[PATH_MAX] = { 0 };
+    char          * p_buf            = NULL;
+    uint32_t      * p_ids            = NULL;
+    size_t          num_ids          = 0;
+    size_t          cap              = 0;
+    struct dirent * p_ent            = NULL;
+    DIR           * p_dir            = opendir(SEGMENT_DIR);
+
+    if (NULL == p_dir)
+    {
+        if (ENOENT == errno)
+        {
+            return 0;
+        }
+        fprintf(stderr, "%s could not open %s: %s\n", __func__, SEGMENT_DIR, strerror(errno));
+        return -1;
+    }
+
+    while (NULL != (p_ent = readdir(p_dir)))
+    {
+        char * p_end = NULL;
+        unsigned long id = strtoul(p_ent->d_name, &p_end, 16);
+
+        if ((p_ent->d_name + SEGMENT_ID_LEN != p_end) || (0 != strcmp(p_end, SEGMENT_SUFFIX)))
+        {
+            continue;
+        }
+        if (num_ids == cap)
+        {
+            uint32_t * p_grown = realloc(p_ids, ((0 == cap) ? 16 : cap * 2) * sizeof(uint32_t));
+            if (NULL == p_grown)
+            {
+                fprintf(stderr, "%s could not list segments: %s\n", __func__, strerror(ENOMEM));
+                closedir(p_dir);
+                free(p_ids);
+                return -1;
+            }
+            p_ids = p_grown;
+            cap   = (0 == cap) ? 16 : cap * 2;
+        }
+        p_ids[num_ids++] = (uint32_t)id;
+    }
+    closedir(p_dir);
+
+    qsort(p_ids, num_ids, sizeof(uint32_t), compare_id);
+    p_buf = (0 == num_ids) ? NULL : buffer_get();
+    if ((0 != num_ids) && (NULL == p_buf))
+    {
+        free(p_ids);
+        return -1;
+    }
+    for (size_t idx = 0; idx < num_ids; idx++)
+    {
+        segment_t * p_segment = calloc(1, sizeof(segment_t));
+
+        segment_path(p_ids[idx], p_path, sizeof(p_path));
+        if ((NULL == p_segment) || (-1 == (p_segment->fd = open(p_path, O_RDWR | O_CLOEXEC))))
+        {
+            fprintf(stderr, "%s could not open %s: %s\n", __func__, p_path, strerror((NULL == p_segment) ? ENOMEM : errno));
+            free(p_segment);
+            free(p_ids);
+            buffer_put(p_buf);
+            return -1;
+        }
+
+        p_segment->id     = p_ids[idx];
+        p_segment->p_next = store.p_segments;
+        store.p_segments  = p_segment;
+        store.p_active    = p_segment;
+        store.next_id     = p_ids[idx] + 1;
+        load_segment(p_segment, p_buf);
+    }
+
+    free(p_ids);
+    buffer_put(p_buf);
+    return 0;
+}
+
+/**
+ * SEGMENT_T * PICK_VICTIM:
+ * @brief - finds a sealed segment nobody is uploading into whose records are
+ *          at least SEGMENT_COMPACT_PCT percent dead
+ * @return - the segment, NULL if there is nothing to compact
+ */
+static segment_t * pick_victim ()
+{
+    segment_t * p_victim = NULL;
+
+    pthread_rwlock_rdlock(&store.lock);
+    for (segment_t * p_segment = store.p_segments; NULL != p_segment; p_segment = p_segment->p_next)
+    {
+        if ((p_segment != store.p_active) && (0 == p_segment->writers) &&
+            (p_segment->dead * 100 >= p_segment->used * SEGMENT_COMPACT_PCT))
+        {
+            p_victim = p_segment;
+            break;
+        }
+    }
+    pthread_rwlock_unlock(&store.lock);
+    return p_victim;
+}
+
+/**
+ * INT MOVE_RECORD:
+ * @brief - copies a LIVE record read from the victim to the end of the active
+ *          segment if it is still the served copy of its name, and repoints
+ *          the index at the copy. The copy keeps the header of the original
+ * @return - 0 on success (*p_moved counts the bytes copied), -1 on error
+ */
+static int move_record (segment_t * p_victim, uint64_t record_off, const char * p_rec, uint64_t len,
+                        const char * p_name, segment_t ** pp_dest, uint64_t * p_moved)
+{
+    uint64_t        hash    = layout_hash(p_name);
+    uint64_t        new_off = 0;
+    segment_t     * p_dest  = NULL;
+    int             ret_val = 0;
+
+    pthread_rwlock_wrlock(&store.lock);
+    pack_entry_t * p_entry = *find_slot(p_name, hash);
+    if ((NULL != p_entry) && (p_victim == p_entry->p_segment) && (record_off == p_entry->record_off))
+    {
+        p_dest = claim_space(len, &new_off);
+        if ((NULL == p_dest) || (-1 == pwrite_all(p_dest->fd, p_rec, len, new_off)))
+        {
+            if (NULL != p_dest)
+            {
+                p_dest->used = new_off;
+            }
+            ret_val = -1;
+        }
+        else
+        {
+            p_entry->p_segment  = p_dest;
+            p_entry->record_off = new_off;
+            p_victim->dead     += len;
+            *p_moved           += len;
+        }
+    }
+    pthread_rwlock_unlock(&store.lock);
+
+    // every segment copied into is flushed before the victim is removed
+    if ((0 == ret_val) && (NULL != p_dest) && (p_dest != *pp_dest))
+    {
+        if ((NULL != *pp_dest) && (-1 == fdatasync((*pp_dest)->fd)))
+        {
+            ret_val = -1;
+        }
+        *pp_dest = p_dest;
+    }
+    return ret_val;
+}
+
+/**
+ * INT COMPACT_SEGMENT:
+ * @brief - moves the live records out of a segment, flushes their copies and
+ *          removes the segment. Downloads still reading it keep their own
+ *          descriptor
+ * @param p_buf - XFER_BUF_SZ pool buffer the records are read into
+ * @return - 0 on success, -1 if the segment has to stay for now
+ */
+static int compact_segment (segment_t * p_victim, char * p_buf)
+{
+    char          p_path[PATH_MAX]      = { 0 };
+    char          p_name[MAXNAMLEN + 1] = { 0 };
+    record_hdr_t  hdr                   = { 0 };
+    segment_t   * p_dest                = NULL;
+    uint64_t      moved                 = 0;
+
+    for (uint64_t off = 0; off < p_victim->used;)
+    {
+        // a record is never larger than the buffer
+        uint64_t want = p_victim->used - off;
+        ssize_t  got  = pread(p_victim->fd, p_buf, (XFER_BUF_SZ < want) ? XFER_BUF_SZ : want, off);
+        if ((SEGMENT_HDR_SZ > got) || (false == read_header(p_buf, &hdr)) ||
+            (record_len(hdr.name_len, hdr.size) > (uint64_t)got))
+        {
+            fprintf(stderr, "%s could not read segment %08" PRIx32 " at %" PRIu64 ": %s\n", __func__,
+                    p_victim->id, off, (-1 == got) ? strerror(errno) : "bad record");
+            return -1;
+        }
+
+        uint64_t len = record_len(hdr.name_len, hdr.size);
+        if (RECORD_LIVE == hdr.state)
+        {
+            memcpy(p_name, p_buf + SEGMENT_HDR_SZ, hdr.name_len);
+            p_name[hdr.name_len] = '\0';
+            if (-1 == move_record(p_victim, off, p_buf, len, p_name, &p_dest, &moved))
+            {
+                return -1;
+            }
+        }
+        off += len;
+    }
+
+    if ((NULL != p_dest) && (-1 == fdatasync(p_dest->fd)))
+    {
+        fprintf(stderr, "%s could not flush compacted records: %s\n", __func__, strerror(errno));
+        return -1;
+    }
+
+    segment_path(p_victim->id, p_path, sizeof(p_path));
+    if (-1 == unlink(p_path))
+    {
+        fprintf(stderr, "%s could not remove %s: %s\n", __func__, p_path, strerror(errno));
+        return -1;
+    }
+
+    pthread_rwlock_wrlock(&store.lock);
+    segment_t ** pp_link = &store.p_segments;
+    while (*pp_link != p_victim)
+    {
+        pp_link = &(*pp_link)->p_next;
+    }
+    *pp_link = p_victim->p_next;
+    pthread_rwlock_unlock(&store.lock);
+
+    printf("Compacted segment %08" PRIx32 ": moved %" PRIu64 " of its %" PRIu64 " bytes\n",
+           p_victim->id, moved, p_victim->used);
+    close(p_victim->fd);
+    free(p_victim);
+    return 0;
+}
+
+/**
+ * BOOL STOPPING:
+ * @brief - whether segment_cleanup asked the compactor to exit
+ */
+static bool stopping ()
+{
+    pthread_mutex_lock(&store.wake_lock);
+    bool stop = store.stop;
+    pthread_mutex_unlock(&store.wake_lock);
+    return stop;
+}
+
+/**
+ * VOID * COMPACT_LOOP:
+ * @brief - the compactor thread, looks for segments to compact every
+ *          SEGMENT_COMPACT_SECS seconds until segment_cleanup stops it. A
+ *          segment that fails is tried again on the next round
+ */
+static void * compact_loop (void * p_arg)
+{
+    struct timespec deadline = { 0 };
+    segment_t     * p_victim = NULL;
+
+    (void)p_arg;
+    while (false == stopping())
+    {
+        pthread_mutex_lock(&store.wake_lock);
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += SEGMENT_COMPACT_SECS;
+        while ((false == store.stop) &&
+               (ETIMEDOUT != pthread_cond_timedwait(&store.wake, &store.wake_lock, &deadline)))
+        {
+        }
+        pthread_mutex_unlock(&store.wake_lock);
+
+        // one pool buffer per segment, so compaction never holds one for long
+        while ((false == stopping()) && (NULL != (p_victim = pick_victim())))
+        {
+            char * p_buf = buffer_get();
+            int    ret   = (NULL == p_buf) ? -1 : compact_segment(p_victim, p_buf);
+
+            buffer_put(p_buf);
+            if (-1 == ret)
+            {
+                break;
+            }
+        }
+    }
+    return NULL;
+}
+
+int segment_init (size_t max_file)
+{
+    sigset_t block_set;
+    sigset_t old_set;
+
+    store.max_file     = max_file;
+    store.num_buckets  = SEGMENT_MIN_BUCKETS;
+    store.bucket_shift = 64 - __builtin_ctzll(SEGMENT_MIN_BUCKETS);
+    store.pp_buckets   = calloc(store.num_buckets, sizeof(pack_entry_t *));
+    if (NULL == store.pp_buckets)
+    {
+        errno = ENOMEM;
+        fprintf(stderr, "%s could not allocate segment index: %s\n", __func__, strerror(errno));
+        return -1;
+    }
+
+    if (-1 == load_segments())
+    {
+        segment_cleanup();
+        return -1;
+    }
+
+    // like the workers, the compactor must not take the reactor's ctrl+c
+    sigemptyset(&block_set);
+    sigaddset(&block_set, SIGINT);
+    pthread_sigmask(SIG_BLOCK, &block_set, &old_set);
+    store.running = (0 == pthread_create(&store.compactor, NULL, compact_loop, NULL));
+    pthread_sigmask(SIG_SETMASK, &old_set, NULL);
+    if (false == store.running)
+    {
+        fprintf(stderr, "%s could not start the compactor thread\n", __func__);
+        segment_cleanup();
+        return -1;
+    }
+
+    if ((0 < store.max_file) || (0 < store.count))
+    {
+        printf("Packing files up to %zu bytes, %zu packed file(s) in %s\n", store.max_file, store.count, SEGMENT_DIR);
+    }
+    return 0;
+}
+
+void segment_cleanup ()
+{
+    if (true == store.running)
+    {
+        pthread_mutex_lock(&store.wake_lock);
+        store.stop = true;
+        pthread_cond_signal(&store.wake);
+        pthread_mutex_unlock(&store.wake_lock);
+        pthread_join(store.compactor, NULL);
+        store.running = false;
+    }
+
+    for (size_t idx = 0; (NULL != store.pp_buckets) && (idx < store.num_buckets); idx++)
+    {
+        while (NULL != store.pp_buckets[idx])
+        {
+            pack_entry_t * p_entry = store.pp_buckets[idx];
+            store.pp_buckets[idx] = p_entry->p_next;
+            free(p_entry);
+        }
+    }
+    CLEAN(store.pp_buckets);
+    store.count = 0;
+
+    while (NULL != store.p_segments)
+    {
+        segment_t * p_segment = store.p_segments;
+        store.p_segments = p_segment->p_next;
+        close(p_segment->fd);
+        free(p_segment);
+    }
+    store.p_active = NULL;
+}
+
+bool segment_packs (uint64_t size)
+{
+    return (0 < store.max_file) && (store.max_file >= size);
+}
+
+int segment_reserve (const char * p_filename, uint64_t size, segment_slot_t * p_slot)
+{
+    uint16_t    name_len   = strnlen(p_filename, MAXNAMLEN);
+    uint64_t    len        = record_len(name_len, size);
+    uint64_t    record_off = 0;
+    int         file_fd    = -1;
+    int         err        = 0;
+
+    memset(p_slot, 0, sizeof(segment_slot_t));
+    pthread_rwlock_wrlock(&store.lock);
+
+    // the header is written before the lock is dropped, so the headers of a
+    // segment never have a gap in front of them
+    segment_t * p_segment = claim_space(len, &record_off);
+    if (NULL == p_segment)
+    {
+        err = errno;
+    }
+    else if (-1 == write_header(p_segment->fd, record_off, RECORD_PENDING, p_filename, name_len, 0, size, 0))
+    {
+        err             = errno;
+        p_segment->used = record_off;
+    }
+    else if (-1 == (file_fd = fcntl(p_segment->fd, F_DUPFD_CLOEXEC, 0)))
+    {
+        err = errno;
+        kill_record(p_segment, record_off, len);
+    }
+    else
+    {
+        p_segment->writers++;
+        p_slot->p_segment  = p_segment;
+        p_slot->record_off = record_off;
+        p_slot->base       = record_off + SEGMENT_HDR_SZ + name_len;
+        p_slot->size       = size;
+    }
+    pthread_rwlock_unlock(&store.lock);
+
+    if (-1 == file_fd)
+    {
+        fprintf(stderr, "%s could not pack %s: %s\n", __func__, p_filename, strerror(err));
+        errno = err;
+    }
+    return file_fd;
+}
+
+int segment_commit (segment_slot_t * p_slot, const char * p_filename, int file_fd)
+{
+    segment_t       * p_segment = p_slot->p_segment;
+    record_hdr_t      hdr       = { 0 };
+    struct timespec   now       = { 0 };
+    uint64_t          hash      = layout_hash(p_filename);
+    int               err       = 0;
+
+    // the contents must be on disk before the record claims them
+    if (-1 == fdatasync(file_fd))
+    {
+        err = errno;
+        fprintf(stderr, "%s could not flush %s: %s\n", __func__, p_filename, strerror(err));
+        segment_abandon(p_slot);
+        errno = err;
+        return -1;
+    }
+
+    clock_gettime(CLOCK_REALTIME, &now);
+    hdr.name_len = strnlen(p_filename, MAXNAMLEN);
+    hdr.size     = p_slot->size;
+    hdr.mtime_ns = ((uint64_t)now.tv_sec * 1000000000ULL) + now.tv_nsec;
+
+    pthread_rwlock_wrlock(&store.lock);
+    hdr.seq = store.next_seq++;
+    if ((-1 == write_header(p_segment->fd, p_slot->record_off, RECORD_LIVE, p_filename, hdr.name_len, hdr.seq,
+                            hdr.size, hdr.mtime_ns)) ||
+        (-1 == place_record(find_slot(p_filename, hash), p_filename, hash, p_segment, p_slot->record_off, &hdr)))
+    {
+        err = (0 == errno) ? ENOMEM : errno;
+        kill_record(p_segment, p_slot->record_off, record_len(hdr.name_len, hdr.size));
+    }
+    p_segment->writers--;
+    pthread_rwlock_unlock(&store.lock);
+
+    memset(p_slot, 0, sizeof(segment_slot_t));
+    if (0 != err)
+    {
+        errno = err;
+        return -1;
+    }
+    return 0;
+}
+
+void segment_abandon (segment_slot_t * p_slot)
+{
+    if (NULL == p_slot->p_segment)
+    {
+        return;
+    }
+
+    pthread_rwlock_wrlock(&store.lock);
+    kill_record(p_slot->p_segment, p_slot->record_off, (p_slot->base - p_slot->record_off) + p_slot->size);
+    p_slot->p_segment->writers--;
+    pthread_rwlock_unlock(&store.lock);
+    memset(p_slot, 0, sizeof(segment_slot_t));
+}
+
+bool segment_lookup (const char * p_filename, file_info_t * p_info)
+{
+    bool found = false;
+
+    if (NULL == store.pp_buckets)
+    {
+        return false;
+    }
+
+    pthread_rwlock_rdlock(&store.lock);
+    pack_entry_t * p_entry = *find_slot(p_filename, layout_hash(p_filename));
+    if (NULL != p_entry)
+    {
+        found = true;
+        if (NULL != p_info)
+        {
+            entry_info(p_entry, p_filename, p_info);
+        }
+    }
+    pthread_rwlock_unlock(&store.lock);
+    return found;
+}
+
+int segment_open (const char * p_filename, uint64_t * p_size, uint64_t * p_mtime_ns, uint64_t * p_base)
+{
+    int file_fd = -1;
+    int err     = ENOENT;
+
+    if (NULL == store.pp_buckets)
+    {
+        errno = ENOENT;
+        return -1;
+    }
+
+    // every download gets its own descriptor, so a compacted segment stays
+    // readable until the last download from it is closed
+    pthread_rwlock_rdlock(&store.lock);
+    pack_entry_t * p_entry = *find_slot(p_filename, layout_hash(p_filename));
+    if (NULL != p_entry)
+    {
+        file_fd = fcntl(p_entry->p_segment->fd, F_DUPFD_CLOEXEC, 0);
+        err     = errno;
+        *p_size = p_entry->size;
+        *p_base = p_entry->record_off + SEGMENT_HDR_SZ + p_entry->name_len;
+        if (NULL != p_mtime_ns)
+        {
+            *p_mtime_ns = p_entry->mtime_ns;
+        }
+    }
+    pthread_rwlock_unlock(&store.lock);
+
+    if (-1 == file_fd)
+    {
+        errno = err;
+    }
+    return file_fd;
+}
+
+void segment_drop (const char * p_filename, uint64_t mtime_ns)
+{
+    if (NULL == store.pp_buckets)
+    {
+        return;
+    }
+
+    pthread_rwlock_wrlock(&store.lock);
+    pack_entry_t ** pp_slot = find_slot(p_filename, layout_hash(p_filename));
+    if ((NULL != *pp_slot) && ((*pp_slot)->mtime_ns <= mtime_ns))
+    {
+        forget_entry(pp_slot);
+    }
+    pthread_rwlock_unlock(&store.lock);
+}
+
+int segment_walk (unsigned shard, file_index_visit_t p_visit, void * p_arg)
+{
+    file_info_t info    = { 0 };
+    size_t      first   = 0;
+    size_t      last    = 0;
+    int         ret_val = 0;
+
+    if (NULL == store.pp_buckets)
+    {
+        return 0;
+    }
+
+    pthread_rwlock_rdlock(&store.lock);
+
+    // the shard is the top byte of the hash, there are always more buckets
+    // than shards
+    first = (SEGMENT_ALL_SHARDS == shard) ? 0 : shard * (store.num_buckets / SHARD_COUNT);
+    last  = (SEGMENT_ALL_SHARDS == shard) ? store.num_buckets : first + (store.num_buckets / SHARD_COUNT);
+    for (size_t idx = first; (0 == ret_val) && (idx < last); idx++)
+    {
+        for (pack_entry_t * p_entry = store.pp_buckets[idx]; NULL != p_entry; p_entry = p_entry->p_next)
+        {
+            entry_info(p_entry, p_entry->name, &info);
+            if (-1 == p_visit(&info, p_arg))
+            {
+                ret_val = -1;
+                break;
+            }
+        }
+    }
+    pthread_rwlock_unlock(&store.lock);
+    return ret_val;
+}
+
+void segment_reconcile (segment_keep_t p_keep, void * p_arg)
+{
+    file_info_t info = { 0 };
+
+    if (NULL == store.pp_buckets)
+    {
+        return;
+    }
+
+    pthread_rwlock_wrlock(&store.lock);
+    for (size_t idx = 0; idx < store.num_buckets; idx++)
+    {
+        pack_entry_t ** pp_slot = &store.pp_buckets[idx];
+        while (NULL != *pp_slot)
+        {
+            entry_info(*pp_slot, (*pp_slot)->name, &info);
+            if (false == p_keep(&info, p_arg))
+            {
+                forget_entry(pp_slot);
+                continue;
+            }
+            pp_slot = &(*pp_slot)->p_next;
+        }
+    }
+    pthread_rwlock_unlock(&store.lock);
+}
+
+/*** end segment_store.c ***/
@@ -0,0 +1,21 @@
+#include "../includes/storage_backend.h"
+
+const storage_backend_t * storage_backend = &posix_backend;
+
+const storage_backend_t * storage_backend_find (const char * p_name)
+{
+    static const storage_backend_t * const backends[] = { &posix_backend, &ram_backend };
+
+    for (size_t idx = 0; (NULL != p_name) && (idx < sizeof(backends) / sizeof(backends[0])); idx++)
+    {
+        if (0 == strcmp(p_name, backends[idx]->p_name))
+        {
+            return backends[idx];
+        }
+    }
+
+    errno = EINVAL;
+    return NULL;
+}
+
+/*** end storage_backend.c ***/
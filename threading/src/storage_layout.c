@@ -0,0 +1,262 @@
+#include "../includes/storage_layout.h"
+#include "../includes/file_operations.h"
+
+#define SHARD_DIGITS    "0123456789abcdef"
+
+layout_t storage_layout = LAYOUT_FLAT;
+
+static int layout_lock_fd = -1;
+
+/**
+ * INT FLAT_PATH:
+ * @brief - joins the file server directory and a file name
+ * @return - 0 on success, -1 if the path does not fit
+ */
+static int flat_path (const char * p_filename, char * p_path, size_t path_len)
+{
+    if ((int)path_len <= snprintf(p_path, path_len, "%s%s", FILE_SERVER_DIR, p_filename))
+    {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * INT MAKE_DIR:
+ * @brief - mkdir() that accepts a directory that already exists
+ * @return - 0 on success, -1 on error
+ */
+static int make_dir (const char * p_path)
+{
+    return ((-1 == mkdir(p_path, 0755)) && (EEXIST != errno)) ? -1 : 0;
+}
+
+/**
+ * INT SHARD_PATH:
+ * @brief - builds the path of a file in its shard
+ * @return - 0 on success, -1 if the path does not fit
+ */
+static int shard_path (const char * p_filename, char * p_path, size_t path_len)
+{
+    unsigned shard = layout_shard(layout_hash(p_filename));
+
+    if ((int)path_len <= snprintf(p_path, path_len, "%s%c/%c/%s", FILE_SERVER_DIR,
+                                  SHARD_DIGITS[shard / SHARD_FANOUT], SHARD_DIGITS[shard % SHARD_FANOUT], p_filename))
+    {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    return 0;
+}
+
+int layout_init (layout_t requested)
+{
+    layout_t on_disk = LAYOUT_FLAT;
+
+    layout_lock_fd = open(FILE_SERVER_DIR, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if ((-1 == layout_lock_fd) || (-1 == flock(layout_lock_fd, LOCK_SH)))
+    {
+        fprintf(stderr, "%s could not lock %s: %s\n", __func__, FILE_SERVER_DIR, strerror(errno));
+        layout_cleanup();
+        return -1;
+    }
+
+    on_disk = layout_read();
+    if ((LAYOUT_FLAT == requested) && (LAYOUT_SHARDED == on_disk))
+    {
+        fprintf(stderr, "%s %s is sharded, convert it with bin/migrate_layout %s first\n",
+                __func__, FILE_SERVER_DIR, LAYOUT_NAME_FLAT);
+        layout_cleanup();
+        return -1;
+    }
+
+    if ((LAYOUT_SHARDED == requested) && (LAYOUT_FLAT == on_disk))
+    {
+        if (-1 == layout_create_shards())
+        {
+            layout_cleanup();
+            return -1;
+        }
+        printf("%s is now sharded, run bin/migrate_layout %s to move the existing files into their shards\n",
+               FILE_SERVER_DIR, LAYOUT_NAME_SHARDED);
+        on_disk = LAYOUT_SHARDED;
+    }
+
+    storage_layout = on_disk;
+    printf("Storage layout: %s\n", (LAYOUT_SHARDED == storage_layout) ? LAYOUT_NAME_SHARDED : LAYOUT_NAME_FLAT);
+    return 0;
+}
+
+void layout_cleanup ()
+{
+    if (-1 != layout_lock_fd)
+    {
+        close(layout_lock_fd);
+        layout_lock_fd = -1;
+    }
+}
+
+layout_t layout_read ()
+{
+    return (0 == access(LAYOUT_MARKER, F_OK)) ? LAYOUT_SHARDED : LAYOUT_FLAT;
+}
+
+int layout_create_shards ()
+{
+    char   p_path[PATH_MAX]   = { 0 };
+    char   p_parent[PATH_MAX] = { 0 };
+    size_t parent_len         = strlen(FILE_SERVER_DIR) + 2;
+    int    marker_fd          = -1;
+    int    err                = 0;
+
+    for (unsigned shard = 0; shard < SHARD_COUNT; shard++)
+    {
+        // the first level directory is made on the way to its first shard
+        layout_shard_dir(shard, p_path, sizeof(p_path));
+        memcpy(p_parent, p_path, parent_len);
+        p_parent[parent_len] = '\0';
+        if (((0 == shard % SHARD_FANOUT) && (-1 == make_dir(p_parent))) || (-1 == make_dir(p_path)))
+        {
+            goto FAIL;
+        }
+    }
+
+    // the marker goes last, a sharded directory always has all its shards
+    marker_fd = open(LAYOUT_MARKER, O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+    if ((-1 == marker_fd) || (-1 == fsync(marker_fd)))
+    {
+        goto FAIL;
+    }
+    close(marker_fd);
+    return 0;
+
+FAIL:
+    err = errno;
+    fprintf(stderr, "%s could not create the shards of %s: %s\n", __func__, FILE_SERVER_DIR, strerror(err));
+    if (-1 != marker_fd)
+    {
+        close(marker_fd);
+    }
+    errno = err;
+    return -1;
+}
+
+uint64_t layout_hash (const char * p_filename)
+{
+    uint64_t hash = 0xcbf29ce484222325ULL;
+
+    for (; '\0' != *p_filename; p_filename++)
+    {
+        hash ^= (unsigned char)*p_filename;
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+unsigned layout_shard (uint64_t hash)
+{
+    return (unsigned)(hash >> SHARD_SHIFT);
+}
+
+int layout_shard_dir (unsigned shard, char * p_path, size_t path_len)
+{
+    if ((int)path_len <= snprintf(p_path, path_len, "%s%c/%c/", FILE_SERVER_DIR,
+                                  SHARD_DIGITS[(shard / SHARD_FANOUT) % SHARD_FANOUT],
+                                  SHARD_DIGITS[shard % SHARD_FANOUT]))
+    {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    return 0;
+}
+
+int layout_path (const char * p_filename, char * p_path, size_t path_len)
+{
+    return (LAYOUT_SHARDED == storage_layout) ? shard_path(p_filename, p_path, path_len) :
+                                                flat_path(p_filename, p_path, path_len);
+}
+
+int layout_open (const char * p_filename, int flags)
+{
+    char p_shard[PATH_MAX] = { 0 };
+    char p_flat[PATH_MAX]  = { 0 };
+    int  file_fd           = -1;
+
+    if (LAYOUT_FLAT == storage_layout)
+    {
+        return (-1 == flat_path(p_filename, p_flat, sizeof(p_flat))) ? -1 : open(p_flat, flags);
+    }
+
+    if ((-1 == shard_path(p_filename, p_shard, sizeof(p_shard))) ||
+        (-1 == flat_path(p_filename, p_flat, sizeof(p_flat))))
+    {
+        return -1;
+    }
+
+    // a migration only ever moves files from the top level into the shards,
+    // checking the shard again closes the window where the file was in flight
+    file_fd = open(p_shard, flags);
+    if ((-1 == file_fd) && (ENOENT == errno))
+    {
+        file_fd = open(p_flat, flags);
+        if ((-1 == file_fd) && (ENOENT == errno))
+        {
+            file_fd = open(p_shard, flags);
+        }
+    }
+    return file_fd;
+}
+
+int layout_lstat (const char * p_filename, struct stat * p_stat)
+{
+    char p_shard[PATH_MAX] = { 0 };
+    char p_flat[PATH_MAX]  = { 0 };
+    int  ret_val           = -1;
+
+    if (LAYOUT_FLAT == storage_layout)
+    {
+        return (-1 == flat_path(p_filename, p_flat, sizeof(p_flat))) ? -1 : lstat(p_flat, p_stat);
+    }
+
+    if ((-1 == shard_path(p_filename, p_shard, sizeof(p_shard))) ||
+        (-1 == flat_path(p_filename, p_flat, sizeof(p_flat))))
+    {
+        return -1;
+    }
+
+    ret_val = lstat(p_shard, p_stat);
+    if ((-1 == ret_val) && (ENOENT == errno))
+    {
+        ret_val = lstat(p_flat, p_stat);
+        if ((-1 == ret_val) && (ENOENT == errno))
+        {
+            ret_val = lstat(p_shard, p_stat);
+        }
+    }
+    return ret_val;
+}
+
+void layout_drop_flat_copy (const char * p_filename)
+{
+    char p_flat[PATH_MAX] = { 0 };
+
+    if ((LAYOUT_SHARDED == storage_layout) && (0 == flat_path(p_filename, p_flat, sizeof(p_flat))) &&
+        (-1 == unlink(p_flat)) && (ENOENT != errno))
+    {
+        fprintf(stderr, "%s could not remove the old copy of %s: %s\n", __func__, p_filename, strerror(errno));
+    }
+}
+
+void layout_unlink (const char * p_filename)
+{
+    char p_path[PATH_MAX] = { 0 };
+
+    if ((0 == layout_path(p_filename, p_path, sizeof(p_path))) && (-1 == unlink(p_path)) && (ENOENT != errno))
+    {
+        fprintf(stderr, "%s could not remove %s: %s\n", __func__, p_filename, strerror(errno));
+    }
+    layout_drop_flat_copy(p_filename);
+}
+
+/*** end storage_layout.c ***/
@@ -0,0 +1,453 @@
+#include "../includes/transfer.h"
+
+static _Thread_local int xfer_pipe[2] = { -1, -1 };
+
+/**
+ * INT * GET_XFER_PIPE:
+ * @brief - returns the calling thread's splice pipe, creating it on first use.
+ *          The pipe is always left empty between calls
+ */
+static int * get_xfer_pipe ()
+{
+    if (-1 == xfer_pipe[0])
+    {
+        if (-1 == pipe2(xfer_pipe, O_CLOEXEC))
+        {
+            fprintf(stderr, "%s could not create splice pipe: %s\n", __func__, strerror(errno));
+            return NULL;
+        }
+        // a larger pipe means fewer splice round trips, the default is 64 KiB
+        fcntl(xfer_pipe[1], F_SETPIPE_SZ, SPLICE_PIPE_SZ);
+    }
+    return xfer_pipe;
+}
+
+/**
+ * BOOL WOULD_BLOCK:
+ * @brief - errno values a non-blocking socket returns when it is not ready
+ */
+static bool would_block (int err)
+{
+    return (EAGAIN == err) || (EWOULDBLOCK == err);
+}
+
+/**
+ * BOOL UNSUPPORTED:
+ * @brief - errno values sendfile()/splice() return when either end cannot be
+ *          used, and lseek()/fallocate() when the file system has no holes
+ */
+static bool unsupported (int err)
+{
+    return (EINVAL == err) || (ENOSYS == err) || (EOPNOTSUPP == err);
+}
+
+ssize_t pwrite_all (int file_fd, const void * p_buf, size_t len, off_t offset)
+{
+    const char * p_cursor   = p_buf;
+    size_t       bytes_left = len;
+
+    while (bytes_left > 0)
+    {
+        ssize_t bytes_written = pwrite(file_fd, p_cursor, bytes_left, offset);
+        if (-1 == bytes_written)
+        {
+            if (EINTR == errno)
+            {
+                continue;
+            }
+            fprintf(stderr, "%s could not write file: %s\n", __func__, strerror(errno));
+            return -1;
+        }
+
+        p_cursor   += bytes_written;
+        offset     += bytes_written;
+        bytes_left -= bytes_written;
+    }
+
+    return len;
+}
+
+/**
+ * SSIZE_T SEND_WITH_BUFFER:
+ * @brief - send_file_buffered through the given XFER_BUF_SZ buffer
+ */
+static ssize_t send_with_buffer (int sockfd, int file_fd, off_t * p_offset, size_t count, char * p_buffer)
+{
+    size_t total_sent = 0;
+    while (total_sent < count)
+    {
+        size_t chunk = count - total_sent;
+        chunk = (chunk > XFER_BUF_SZ) ? XFER_BUF_SZ : chunk;
+
+        ssize_t bytes_read = pread(file_fd, p_buffer, chunk, *p_offset);
+        if (-1 == bytes_read)
+        {
+            if (EINTR == errno)
+            {
+                continue;
+            }
+            fprintf(stderr, "%s could not read file: %s\n", __func__, strerror(errno));
+            return -1;
+        }
+        if (0 == bytes_read)
+        {
+            errno = ENODATA;
+            fprintf(stderr, "%s file was truncated during transfer\n", __func__);
+            return -1;
+        }
+
+        ssize_t bytes_sent = send(sockfd, p_buffer, bytes_read, MSG_NOSIGNAL);
+        if (-1 == bytes_sent)
+        {
+            if (EINTR == errno)
+            {
+                continue;
+            }
+            if (would_block(errno))
+            {
+                break;
+            }
+            fprintf(stderr, "%s could not send data to client: %s\n", __func__, strerror(errno));
+            return -1;
+        }
+
+        // anything read but not sent is simply read again on the next call
+        *p_offset  += bytes_sent;
+        total_sent += bytes_sent;
+        if (bytes_sent < bytes_read)
+        {
+            break;
+        }
+    }
+
+    return total_sent;
+}
+
+/**
+ * SSIZE_T SEND_FILE_BUFFERED:
+ * @brief - fallback for send_file_some when sendfile is unsupported, moves the
+ *          range through a pool buffer so memory use stays flat
+ */
+static ssize_t send_file_buffered (int sockfd, int file_fd, off_t * p_offset, size_t count)
+{
+    char * p_buffer = buffer_get();
+    if (NULL == p_buffer)
+    {
+        return -1;
+    }
+
+    ssize_t total_sent = send_with_buffer(sockfd, file_fd, p_offset, count, p_buffer);
+    buffer_put(p_buffer);
+    return total_sent;
+}
+
+ssize_t send_file_some (int sockfd, int file_fd, off_t * p_offset, size_t count)
+{
+    size_t total_sent = 0;
+
+    while (total_sent < count)
+    {
+        size_t chunk = count - total_sent;
+        chunk = (chunk > SENDFILE_MAX) ? SENDFILE_MAX : chunk;
+
+        ssize_t bytes_sent = sendfile(sockfd, file_fd, p_offset, chunk);
+        if (-1 == bytes_sent)
+        {
+            if (EINTR == errno)
+            {
+                continue;
+            }
+            if (would_block(errno))
+            {
+                break;
+            }
+            if (unsupported(errno))
+            {
+                ssize_t rest = send_file_buffered(sockfd, file_fd, p_offset, count - total_sent);
+                if (-1 == rest)
+                {
+                    return -1;
+                }
+                return total_sent + rest;
+            }
+            fprintf(stderr, "%s sendfile failed: %s\n", __func__, strerror(errno));
+            return -1;
+        }
+
+        if (0 == bytes_sent)
+        {
+            errno = ENODATA;
+            fprintf(stderr, "%s file was truncated during transfer\n", __func__);
+            return -1;
+        }
+        total_sent += bytes_sent;
+    }
+
+    return total_sent;
+}
+
+/**
+ * SSIZE_T RECV_WITH_BUFFER:
+ * @brief - recv_file_some through the given XFER_BUF_SZ buffer
+ */
+static ssize_t recv_with_buffer (int sockfd, int file_fd, off_t * p_offset, size_t count, char * p_buffer)
+{
+    size_t total_recv = 0;
+    bool   drained    = false;
+    while ((total_recv < count) && (false == drained))
+    {
+        size_t chunk = count - total_recv;
+        chunk = (chunk > XFER_BUF_SZ) ? XFER_BUF_SZ : chunk;
+
+        // fill the whole buffer before touching the file so each pwrite is large
+        size_t filled = 0;
+        while (filled < chunk)
+        {
+            ssize_t bytes_recv = recv(sockfd, p_buffer + filled, chunk - filled, 0);
+            if (0 == bytes_recv)
+            {
+                errno = ECONNRESET;
+                return -1;
+            }
+            if (-1 == bytes_recv)
+            {
+                if (EINTR == errno)
+                {
+                    continue;
+                }
+                if (would_block(errno))
+                {
+                    drained = true;
+                    break;
+                }
+                fprintf(stderr, "%s could not receive file from client: %s\n", __func__, strerror(errno));
+                return -1;
+            }
+            filled += bytes_recv;
+        }
+
+        if ((filled > 0) && (-1 == pwrite_all(file_fd, p_buffer, filled, *p_offset)))
+        {
+            return -1;
+        }
+        *p_offset  += filled;
+        total_recv += filled;
+    }
+
+    return total_recv;
+}
+
+ssize_t recv_file_some (int sockfd, int file_fd, off_t * p_offset, size_t count)
+{
+    char * p_buffer = buffer_get();
+    if (NULL == p_buffer)
+    {
+        return -1;
+    }
+
+    ssize_t total_recv = recv_with_buffer(sockfd, file_fd, p_offset, count, p_buffer);
+    buffer_put(p_buffer);
+    return total_recv;
+}
+
+/**
+ * SSIZE_T DRAIN_PIPE:
+ * @brief - copies whatever is sitting in the pipe into the file with read/pwrite
+ *          so a failed pipe -> file splice does not lose data
+ */
+static ssize_t drain_pipe (int pipe_fd, size_t pending, int file_fd, off_t offset)
+{
+    char * p_buffer = buffer_get();
+    if (NULL == p_buffer)
+    {
+        return -1;
+    }
+
+    size_t  drained = 0;
+    ssize_t ret     = 0;
+    while ((drained < pending) && (-1 != ret))
+    {
+        size_t chunk = pending - drained;
+        chunk = (chunk > XFER_BUF_SZ) ? XFER_BUF_SZ : chunk;
+
+        ssize_t bytes_read = read(pipe_fd, p_buffer, chunk);
+        if ((-1 == bytes_read) && (EINTR == errno))
+        {
+            continue;
+        }
+        if ((-1 == bytes_read) || (-1 == pwrite_all(file_fd, p_buffer, bytes_read, offset + drained)))
+        {
+            ret = -1;
+            break;
+        }
+        drained += bytes_read;
+    }
+
+    buffer_put(p_buffer);
+    return (-1 == ret) ? -1 : (ssize_t)drained;
+}
+
+ssize_t recv_file_splice_some (int sockfd, int file_fd, off_t * p_offset, size_t count, bool * p_fell_back)
+{
+    int    * p_pipe     = get_xfer_pipe();
+    size_t   total_recv = 0;
+
+    if (NULL == p_pipe)
+    {
+        *p_fell_back = true;
+        return recv_file_some(sockfd, file_fd, p_offset, count);
+    }
+
+    while (total_recv < count)
+    {
+        size_t chunk = count - total_recv;
+        chunk = (chunk > SPLICE_PIPE_SZ) ? SPLICE_PIPE_SZ : chunk;
+
+        ssize_t in_pipe = splice(sockfd, NULL, p_pipe[1], NULL, chunk, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if (-1 == in_pipe)
+        {
+            if (EINTR == errno)
+            {
+                continue;
+            }
+            if (would_block(errno))
+            {
+                break;
+            }
+            if (unsupported(errno))
+            {
+                *p_fell_back = true;
+                ssize_t rest = recv_file_some(sockfd, file_fd, p_offset, count - total_recv);
+                if (-1 == rest)
+                {
+                    return -1;
+                }
+                return total_recv + rest;
+            }
+            fprintf(stderr, "%s could not splice from socket: %s\n", __func__, strerror(errno));
+            return -1;
+        }
+        if (0 == in_pipe)
+        {
+            errno = ECONNRESET;
+            return -1;
+        }
+
+        // always empty the pipe before returning so it can be reused by the next job
+        size_t pending = in_pipe;
+        while (pending > 0)
+        {
+            loff_t  file_off = *p_offset;
+            ssize_t out_pipe = splice(p_pipe[0], NULL, file_fd, &file_off, pending, SPLICE_F_MOVE);
+            if (-1 == out_pipe)
+            {
+                if (EINTR == errno)
+                {
+                    continue;
+                }
+                if (unsupported(errno))
+                {
+                    *p_fell_back = true;
+                    if (-1 == drain_pipe(p_pipe[0], pending, file_fd, *p_offset))
+                    {
+                        return -1;
+                    }
+                    *p_offset  += pending;
+                    total_recv += pending;
+                    return total_recv;
+                }
+                fprintf(stderr, "%s could not splice to file: %s\n", __func__, strerror(errno));
+                return -1;
+            }
+            pending    -= out_pipe;
+            *p_offset  += out_pipe;
+            total_recv += out_pipe;
+        }
+    }
+
+    return total_recv;
+}
+
+ssize_t find_extents (int file_fd, uint64_t base, uint64_t * p_offset, uint64_t end, extent_t * p_extents,
+                      size_t max)
+{
+    size_t count = 0;
+
+    while ((*p_offset < end) && (count < max))
+    {
+        off_t data = lseek(file_fd, (off_t)(base + *p_offset), SEEK_DATA);
+        if ((-1 == data) && (ENXIO == errno))
+        {
+            // nothing but holes up to the end of the file
+            *p_offset = end;
+            break;
+        }
+        if ((-1 == data) && unsupported(errno))
+        {
+            p_extents[count].offset = *p_offset;
+            p_extents[count].length = end - *p_offset;
+            *p_offset = end;
+            return count + 1;
+        }
+        if (-1 == data)
+        {
+            fprintf(stderr, "%s could not find data: %s\n", __func__, strerror(errno));
+            return -1;
+        }
+        if ((uint64_t)data >= base + end)
+        {
+            *p_offset = end;
+            break;
+        }
+
+        // there is always a hole at the end of the file
+        off_t hole = lseek(file_fd, data, SEEK_HOLE);
+        if (-1 == hole)
+        {
+            fprintf(stderr, "%s could not find hole: %s\n", __func__, strerror(errno));
+            return -1;
+        }
+        if ((uint64_t)hole > base + end)
+        {
+            hole = (off_t)(base + end);
+        }
+
+        p_extents[count].offset = (uint64_t)data - base;
+        p_extents[count].length = (uint64_t)(hole - data);
+        count++;
+        *p_offset = (uint64_t)hole - base;
+    }
+
+    return count;
+}
+
+int punch_range (int file_fd, uint64_t offset, uint64_t length)
+{
+    struct stat file_stat = { 0 };
+
+    if (0 == length)
+    {
+        return 0;
+    }
+
+    if ((-1 == fallocate(file_fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, (off_t)offset, (off_t)length)) &&
+        (!unsupported(errno)))
+    {
+        fprintf(stderr, "%s could not punch hole: %s\n", __func__, strerror(errno));
+        return -1;
+    }
+
+    if (-1 == fstat(file_fd, &file_stat))
+    {
+        fprintf(stderr, "%s could not stat file: %s\n", __func__, strerror(errno));
+        return -1;
+    }
+    if (((uint64_t)file_stat.st_size < offset + length) && (-1 == ftruncate(file_fd, (off_t)(offset + length))))
+    {
+        fprintf(stderr, "%s could not extend file: %s\n", __func__, strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+/*** end transfer.c ***/
@@ -0,0 +1,819 @@
+#include "../includes/upload_journal.h"
+#include "../includes/file_operations.h"
+#include "../includes/file_index.h"
+#include "../includes/storage_layout.h"
+
+#define JOURNAL_MAGIC   0x4a4c5546
+#define JOURNAL_SUFFIX  ".journal"
+#define STAGING_SUFFIX  ".part"
+
+/**
+ * @brief - the on disk journal, every field little-endian. A session journal
+ *          is followed by its chunk bitmap
+ * @member magic - JOURNAL_MAGIC
+ * @member chunk_size - chunk size of a session, 0 for a sequential upload
+ * @member upload_id / size - identify the upload
+ * @member committed - bytes of the staging file known to be on disk, a session
+ *                     keeps this in its bitmap instead
+ */
+typedef struct journal_rec
+{
+    uint32_t    magic;
+    uint32_t    chunk_size;
+    uint64_t    upload_id;
+    uint64_t    size;
+    uint64_t    committed;
+} journal_rec_t;
+
+/**
+ * @brief - an upload session, shared by every connection sending it chunks
+ * @member p_next - link in the session list
+ * @member upload - the locked journal, id, size and published name
+ * @member file_fd - the staging file, chunks are written at their own offsets
+ * @member chunk_size / num_chunks - how the file is split
+ * @member stored - chunks known to be on disk
+ * @member p_bitmap - one bit per chunk, set once the chunk is on disk
+ * @member writers - chunks being received right now
+ * @member committing - the file is being published, no more chunks are taken
+ */
+struct upload_session
+{
+    upload_session_t  * p_next;
+    upload_t            upload;
+    int                 file_fd;
+    uint64_t            chunk_size;
+    uint64_t            num_chunks;
+    uint64_t            stored;
+    uint8_t           * p_bitmap;
+    size_t              writers;
+    bool                committing;
+};
+
+static pthread_mutex_t    session_lock = PTHREAD_MUTEX_INITIALIZER;
+static upload_session_t * p_sessions   = NULL;
+
+/**
+ * INT BUILD_STAGING_PATH:
+ * @brief - joins the staging directory, a file name and a suffix
+ * @return - 0 on success, -1 if the path does not fit
+ */
+static int build_staging_path (char * p_path, size_t path_len, const char * p_filename, const char * p_suffix)
+{
+    if ((int)path_len <= snprintf(p_path, path_len, "%s%s%s", UPLOAD_STAGING_DIR, p_filename, p_suffix))
+    {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * INT READ_JOURNAL:
+ * @brief - reads and validates the journal record
+ * @return - 0 on success, -1 if the journal is empty, short or corrupt
+ */
+static int read_journal (int journal_fd, journal_rec_t * p_rec)
+{
+    if (sizeof(journal_rec_t) != pread(journal_fd, p_rec, sizeof(journal_rec_t), 0))
+    {
+        return -1;
+    }
+
+    p_rec->magic      = le32toh(p_rec->magic);
+    p_rec->chunk_size = le32toh(p_rec->chunk_size);
+    p_rec->upload_id  = le64toh(p_rec->upload_id);
+    p_rec->size       = le64toh(p_rec->size);
+    p_rec->committed  = le64toh(p_rec->committed);
+    if ((JOURNAL_MAGIC != p_rec->magic) || (p_rec->committed > p_rec->size))
+    {
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * INT WRITE_JOURNAL:
+ * @brief - overwrites the journal record, the record is small enough to land
+ *          in a single sector
+ * @return - 0 on success, -1 on error
+ */
+static int write_journal (int journal_fd, uint64_t upload_id, uint64_t size, uint64_t committed, uint32_t chunk_size)
+{
+    journal_rec_t rec = { 0 };
+
+    rec.magic      = htole32(JOURNAL_MAGIC);
+    rec.chunk_size = htole32(chunk_size);
+    rec.upload_id  = htole64(upload_id);
+    rec.size       = htole64(size);
+    rec.committed  = htole64(committed);
+    if (-1 == pwrite_all(journal_fd, &rec, sizeof(rec), 0))
+    {
+        return -1;
+    }
+    return 0;
+}
+
+void upload_init (upload_t * p_upload)
+{
+    memset(p_upload, 0, sizeof(upload_t));
+    p_upload->journal_fd = -1;
+}
+
+int upload_query (const char * p_filename, uint64_t upload_id, uint64_t size, uint64_t * p_committed)
+{
+    char          p_journal[PATH_MAX] = { 0 };
+    journal_rec_t rec                 = { 0 };
+
+    *p_committed = 0;
+    if (false == is_valid_filename(p_filename))
+    {
+        errno = EINVAL;
+        return -1;
+    }
+    if (-1 == build_staging_path(p_journal, sizeof(p_journal), p_filename, JOURNAL_SUFFIX))
+    {
+        return -1;
+    }
+
+    int journal_fd = open(p_journal, O_RDONLY | O_CLOEXEC);
+    if (-1 == journal_fd)
+    {
+        // nothing staged under this name, the upload starts from the beginning
+        return (ENOENT == errno) ? 0 : -1;
+    }
+
+    if ((UPLOAD_ANONYMOUS != upload_id) && (0 == read_journal(journal_fd, &rec)) &&
+        (0 == rec.chunk_size) && (rec.upload_id == upload_id) && (rec.size == size))
+    {
+        *p_committed = rec.committed;
+    }
+    close(journal_fd);
+    return 0;
+}
+
+/**
+ * INT LOCK_JOURNAL:
+ * @brief - builds the staging paths of a name, then opens and locks its
+ *          journal into p_upload->journal_fd
+ * @return - 0 on success, -1 with errno set on error (EBUSY if another upload
+ *           holds the journal), the slot is released again
+ */
+static int lock_journal (upload_t * p_upload, const char * p_filename, char * p_journal, char * p_staging)
+{
+    int err = 0;
+
+    upload_init(p_upload);
+    if (false == is_valid_filename(p_filename))
+    {
+        fprintf(stderr, "%s invalid file name received\n", __func__);
+        errno = EINVAL;
+        return -1;
+    }
+    if ((-1 == build_staging_path(p_journal, PATH_MAX, p_filename, JOURNAL_SUFFIX)) ||
+        (-1 == build_staging_path(p_staging, PATH_MAX, p_filename, STAGING_SUFFIX)))
+    {
+        fprintf(stderr, "Could not build staging path: %s\n", strerror(ENAMETOOLONG));
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+
+    if ((-1 == mkdir(UPLOAD_STAGING_DIR, 0755)) && (EEXIST != errno))
+    {
+        err = errno;
+        fprintf(stderr, "%s could not create %s: %s\n", __func__, UPLOAD_STAGING_DIR, strerror(err));
+        errno = err;
+        return -1;
+    }
+
+    p_upload->journal_fd = open(p_journal, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (-1 == p_upload->journal_fd)
+    {
+        err = errno;
+        fprintf(stderr, "%s could not open journal: %s\n", __func__, strerror(err));
+        errno = err;
+        return -1;
+    }
+    if (-1 == flock(p_upload->journal_fd, LOCK_EX | LOCK_NB))
+    {
+        err = (EWOULDBLOCK == errno) ? EBUSY : errno;
+        fprintf(stderr, "%s %s is already being uploaded\n", __func__, p_filename);
+        upload_release(p_upload);
+        errno = err;
+        return -1;
+    }
+
+    snprintf(p_upload->filename, sizeof(p_upload->filename), "%s", p_filename);
+    return 0;
+}
+
+/**
+ * INT CREATE_STAGING:
+ * @brief - creates an empty staging file and preallocates it, so the file is
+ *          laid out contiguously and a full disk is reported before the
+ *          transfer rather than half way through
+ * @return - the staging file opened for writing, -1 with errno set on error
+ */
+static int create_staging (const char * p_staging, uint64_t size)
+{
+    int err     = 0;
+    int file_fd = open(p_staging, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+
+    if (-1 == file_fd)
+    {
+        err = errno;
+        fprintf(stderr, "%s() - Could not open file for writing: %s\n", __func__, strerror(err));
+        errno = err;
+        return -1;
+    }
+
+    if ((0 < size) && (-1 == fallocate(file_fd, 0, 0, size)) &&
+        (EOPNOTSUPP != errno) && (ENOSYS != errno))
+    {
+        err = errno;
+        fprintf(stderr, "%s could not preallocate %" PRIu64 " bytes: %s\n", __func__, size, strerror(err));
+        close(file_fd);
+        unlink(p_staging);
+        errno = err;
+        return -1;
+    }
+    return file_fd;
+}
+
+int upload_begin (upload_t * p_upload, const char * p_filename, uint64_t upload_id, uint64_t size, uint64_t offset)
+{
+    char          p_journal[PATH_MAX] = { 0 };
+    char          p_staging[PATH_MAX] = { 0 };
+    int           file_fd             = -1;
+    int           err                 = 0;
+    journal_rec_t rec                 = { 0 };
+
+    // a small file is packed, it needs no journal. It is cheap to send again,
+    // so it is never resumed
+    if ((0 == offset) && (true == segment_packs(size)))
+    {
+        upload_init(p_upload);
+        if (false == is_valid_filename(p_filename))
+        {
+            fprintf(stderr, "%s invalid file name received\n", __func__);
+            errno = EINVAL;
+            return -1;
+        }
+        file_fd = segment_reserve(p_filename, size, &p_upload->slot);
+        if (-1 == file_fd)
+        {
+            return -1;
+        }
+        snprintf(p_upload->filename, sizeof(p_upload->filename), "%s", p_filename);
+        p_upload->size = size;
+        printf("Packing Client File %s into %s\n", p_filename, SEGMENT_DIR);
+        return file_fd;
+    }
+
+    if (-1 == lock_journal(p_upload, p_filename, p_journal, p_staging))
+    {
+        return -1;
+    }
+
+    if (0 < offset)
+    {
+        if ((UPLOAD_ANONYMOUS == upload_id) || (-1 == read_journal(p_upload->journal_fd, &rec)) ||
+            (0 != rec.chunk_size) || (rec.upload_id != upload_id) || (rec.size != size) || (rec.committed < offset))
+        {
+            err = ESTALE;
+            fprintf(stderr, "%s no staged upload of %s to resume at %" PRIu64 "\n", __func__, p_filename, offset);
+            goto FAIL;
+        }
+
+        file_fd = open(p_staging, O_WRONLY | O_CLOEXEC);
+        if (-1 == file_fd)
+        {
+            err = errno;
+            fprintf(stderr, "%s could not open staged upload: %s\n", __func__, strerror(err));
+            goto FAIL;
+        }
+        printf("Resuming upload of %s at byte %" PRIu64 "\n", p_filename, offset);
+    }
+    else
+    {
+        // reset the journal before the staging file so it never claims data
+        // that the truncate below is about to throw away
+        if (-1 == write_journal(p_upload->journal_fd, upload_id, size, 0, 0))
+        {
+            err = errno;
+            goto FAIL;
+        }
+
+        file_fd = create_staging(p_staging, size);
+        if (-1 == file_fd)
+        {
+            err = errno;
+            unlink(p_journal);
+            goto FAIL;
+        }
+    }
+
+    p_upload->upload_id = upload_id;
+    p_upload->size      = size;
+    p_upload->committed = offset;
+    printf("Saving Client File as: %s%s\n", FILE_SERVER_DIR, p_filename);
+    return file_fd;
+
+FAIL:
+    upload_release(p_upload);
+    errno = err;
+    return -1;
+}
+
+int upload_checkpoint (upload_t * p_upload, int file_fd, uint64_t stored, bool force)
+{
+    if ((-1 == p_upload->journal_fd) || (UPLOAD_ANONYMOUS == p_upload->upload_id) ||
+        (stored == p_upload->committed))
+    {
+        return 0;
+    }
+    if ((false == force) && (UPLOAD_CHECKPOINT_SZ > stored - p_upload->committed))
+    {
+        return 0;
+    }
+
+    if ((-1 == fdatasync(file_fd)) ||
+        (-1 == write_journal(p_upload->journal_fd, p_upload->upload_id, p_upload->size, stored, 0)))
+    {
+        fprintf(stderr, "%s could not record upload progress: %s\n", __func__, strerror(errno));
+        return -1;
+    }
+    p_upload->committed = stored;
+    return 0;
+}
+
+int upload_finish (upload_t * p_upload, int file_fd)
+{
+    char p_journal[PATH_MAX]  = { 0 };
+    char p_staging[PATH_MAX]  = { 0 };
+    char p_fullpath[PATH_MAX] = { 0 };
+
+    // the stored copy goes once the packed one is served, so the name is never
+    // missing in between
+    if (NULL != p_upload->slot.p_segment)
+    {
+        if (-1 == segment_commit(&p_upload->slot, p_upload->filename, file_fd))
+        {
+            int err = errno;
+            fprintf(stderr, "%s could not publish %s: %s\n", __func__, p_upload->filename, strerror(err));
+            errno = err;
+            return -1;
+        }
+        file_index_refresh(p_upload->filename);
+        layout_unlink(p_upload->filename);
+        return 0;
+    }
+
+    // the paths were checked by upload_begin, they cannot fail to fit here
+    build_staging_path(p_journal, sizeof(p_journal), p_upload->filename, JOURNAL_SUFFIX);
+    build_staging_path(p_staging, sizeof(p_staging), p_upload->filename, STAGING_SUFFIX);
+    layout_path(p_upload->filename, p_fullpath, sizeof(p_fullpath));
+
+    if (true == is_file(p_upload->filename))
+    {
+        printf("Overwriting existing file...\n");
+    }
+
+    // the contents must be on disk before the name points at them
+    if ((-1 == fdatasync(file_fd)) || (-1 == rename(p_staging, p_fullpath)))
+    {
+        int err = errno;
+        fprintf(stderr, "%s could not publish %s: %s\n", __func__, p_upload->filename, strerror(err));
+        errno = err;
+        return -1;
+    }
+
+    // publish the new size and mtime now rather than when the watcher sees it
+    layout_drop_flat_copy(p_upload->filename);
+    segment_drop(p_upload->filename, UINT64_MAX);
+    file_index_refresh(p_upload->filename);
+    unlink(p_journal);
+    return 0;
+}
+
+void upload_abandon (upload_t * p_upload, int file_fd, uint64_t stored)
+{
+    char p_path[PATH_MAX] = { 0 };
+
+    segment_abandon(&p_upload->slot);
+    if (-1 == p_upload->journal_fd)
+    {
+        return;
+    }
+
+    if (UPLOAD_ANONYMOUS != p_upload->upload_id)
+    {
+        upload_checkpoint(p_upload, file_fd, stored, true);
+        printf("Upload of %s stopped at byte %" PRIu64 ", it can be resumed\n", p_upload->filename, stored);
+        return;
+    }
+
+    build_staging_path(p_path, sizeof(p_path), p_upload->filename, STAGING_SUFFIX);
+    unlink(p_path);
+    build_staging_path(p_path, sizeof(p_path), p_upload->filename, JOURNAL_SUFFIX);
+    unlink(p_path);
+}
+
+void upload_release (upload_t * p_upload)
+{
+    segment_abandon(&p_upload->slot);
+    if (-1 != p_upload->journal_fd)
+    {
+        close(p_upload->journal_fd);
+    }
+    upload_init(p_upload);
+}
+
+/**
+ * UPLOAD_SESSION_T * FIND_SESSION:
+ * @brief - looks a session up by the name it publishes, the caller holds
+ *          session_lock
+ */
+static upload_session_t * find_session (const char * p_filename)
+{
+    for (upload_session_t * p_session = p_sessions; NULL != p_session; p_session = p_session->p_next)
+    {
+        if (0 == strcmp(p_session->upload.filename, p_filename))
+        {
+            return p_session;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * VOID FREE_SESSION:
+ * @brief - closes the files of a session that is no longer listed and frees it
+ */
+static void free_session (upload_session_t * p_session)
+{
+    if (-1 != p_session->file_fd)
+    {
+        close(p_session->file_fd);
+    }
+    upload_release(&p_session->upload);
+    CLEAN(p_session->p_bitmap);
+    free(p_session);
+}
+
+/**
+ * CHAR * COPY_BITMAP:
+ * @brief - copies the chunk bitmap behind reserve free bytes into the arena,
+ *          the caller holds session_lock
+ */
+static char * copy_bitmap (const upload_session_t * p_session, arena_t * p_arena, size_t reserve, size_t * p_len)
+{
+    size_t bitmap_len = (p_session->num_chunks + 7) / 8;
+    char * p_buf      = arena_alloc(p_arena, reserve + bitmap_len + 1);
+
+    if (NULL == p_buf)
+    {
+        return NULL;
+    }
+    memcpy(p_buf + reserve, p_session->p_bitmap, bitmap_len);
+    *p_len = reserve + bitmap_len;
+    return p_buf;
+}
+
+/**
+ * INT LOAD_SESSION:
+ * @brief - continues the session recorded in the journal if it has the same
+ *          id, size and chunk size
+ * @return - the staging file, -1 if there is nothing to continue
+ */
+static int load_session (upload_session_t * p_session, const char * p_staging)
+{
+    journal_rec_t rec        = { 0 };
+    size_t        bitmap_len = (p_session->num_chunks + 7) / 8;
+    int           file_fd    = -1;
+
+    if ((-1 == read_journal(p_session->upload.journal_fd, &rec)) ||
+        (rec.chunk_size != p_session->chunk_size) || (rec.upload_id != p_session->upload.upload_id) ||
+        (rec.size != p_session->upload.size) ||
+        ((ssize_t)bitmap_len != pread(p_session->upload.journal_fd, p_session->p_bitmap, bitmap_len, sizeof(rec))))
+    {
+        return -1;
+    }
+
+    file_fd = open(p_staging, O_WRONLY | O_CLOEXEC);
+    if (-1 == file_fd)
+    {
+        return -1;
+    }
+
+    p_session->stored = 0;
+    for (uint64_t idx = 0; idx < p_session->num_chunks; idx++)
+    {
+        p_session->stored += (p_session->p_bitmap[idx / 8] >> (idx % 8)) & 1;
+    }
+    printf("Resuming upload session of %s with %" PRIu64 " of %" PRIu64 " chunks stored\n",
+           p_session->upload.filename, p_session->stored, p_session->num_chunks);
+    return file_fd;
+}
+
+/**
+ * INT START_SESSION:
+ * @brief - resets the journal to an empty bitmap and creates the staging file
+ * @return - the staging file, -1 with errno set on error
+ */
+static int start_session (upload_session_t * p_session, const char * p_journal, const char * p_staging)
+{
+    int    journal_fd = p_session->upload.journal_fd;
+    size_t bitmap_len = (p_session->num_chunks + 7) / 8;
+    int    file_fd    = -1;
+    int    err        = 0;
+
+    memset(p_session->p_bitmap, 0, bitmap_len);
+    p_session->stored = 0;
+
+    // clear the old bitmap before the record names the new session
+    if ((-1 == ftruncate(journal_fd, sizeof(journal_rec_t))) ||
+        (-1 == ftruncate(journal_fd, sizeof(journal_rec_t) + bitmap_len)) ||
+        (-1 == write_journal(journal_fd, p_session->upload.upload_id, p_session->upload.size, 0,
+                             p_session->chunk_size)))
+    {
+        err = errno;
+        fprintf(stderr, "%s could not reset journal: %s\n", __func__, strerror(err));
+        errno = err;
+        return -1;
+    }
+
+    file_fd = create_staging(p_staging, p_session->upload.size);
+    if (-1 == file_fd)
+    {
+        err = errno;
+        unlink(p_journal);
+        errno = err;
+    }
+    return file_fd;
+}
+
+/**
+ * UPLOAD_SESSION_T * CREATE_SESSION:
+ * @brief - locks the journal of a name and opens its staging file, continuing
+ *          a matching session left on disk or starting an empty one
+ * @return - the session, NULL with errno set on error
+ */
+static upload_session_t * create_session (const char * p_filename, uint64_t upload_id, uint64_t size,
+                                          uint64_t chunk_size, uint64_t num_chunks)
+{
+    char               p_journal[PATH_MAX] = { 0 };
+    char               p_staging[PATH_MAX] = { 0 };
+    int                err                 = 0;
+    upload_session_t * p_session           = calloc(1, sizeof(upload_session_t));
+
+    if ((NULL == p_session) || (NULL == (p_session->p_bitmap = calloc(1, (num_chunks + 7) / 8 + 1))))
+    {
+        if (NULL != p_session)
+        {
+            free(p_session);
+        }
+        errno = ENOMEM;
+        fprintf(stderr, "%s could not allocate upload session: %s\n", __func__, strerror(errno));
+        return NULL;
+    }
+    p_session->file_fd    = -1;
+    p_session->chunk_size = chunk_size;
+    p_session->num_chunks = num_chunks;
+
+    if (-1 == lock_journal(&p_session->upload, p_filename, p_journal, p_staging))
+    {
+        err = errno;
+        goto FAIL;
+    }
+    p_session->upload.upload_id = upload_id;
+    p_session->upload.size      = size;
+
+    p_session->file_fd = load_session(p_session, p_staging);
+    if (-1 == p_session->file_fd)
+    {
+        p_session->file_fd = start_session(p_session, p_journal, p_staging);
+    }
+    if (-1 == p_session->file_fd)
+    {
+        err = errno;
+        goto FAIL;
+    }
+    return p_session;
+
+FAIL:
+    free_session(p_session);
+    errno = err;
+    return NULL;
+}
+
+char * upload_session_open (const char * p_filename, uint64_t upload_id, uint64_t size, uint64_t chunk_size,
+                            arena_t * p_arena, size_t reserve, size_t * p_len)
+{
+    upload_session_t * p_session  = NULL;
+    char             * p_reply    = NULL;
+    uint64_t           num_chunks = 0;
+
+    if ((UPLOAD_ANONYMOUS == upload_id) || (SESSION_MIN_CHUNK > chunk_size) || (UINT32_MAX < chunk_size))
+    {
+        errno = EINVAL;
+        return NULL;
+    }
+    num_chunks = (size / chunk_size) + ((0 != size % chunk_size) ? 1 : 0);
+    if (SESSION_MAX_CHUNKS < num_chunks)
+    {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    pthread_mutex_lock(&session_lock);
+    p_session = find_session(p_filename);
+    if (NULL != p_session)
+    {
+        if ((p_session->upload.upload_id != upload_id) || (p_session->upload.size != size) ||
+            (p_session->chunk_size != chunk_size) || (true == p_session->committing))
+        {
+            pthread_mutex_unlock(&session_lock);
+            fprintf(stderr, "%s %s is already being uploaded\n", __func__, p_filename);
+            errno = EBUSY;
+            return NULL;
+        }
+        p_reply = copy_bitmap(p_session, p_arena, reserve, p_len);
+        pthread_mutex_unlock(&session_lock);
+        return p_reply;
+    }
+    pthread_mutex_unlock(&session_lock);
+
+    // the journal lock keeps anyone else from creating the same session while
+    // the staging file is being preallocated outside session_lock
+    p_session = create_session(p_filename, upload_id, size, chunk_size, num_chunks);
+    if (NULL == p_session)
+    {
+        return NULL;
+    }
+    printf("Upload session of %s opened: %" PRIu64 " bytes in %" PRIu64 " chunks\n",
+           p_filename, size, num_chunks);
+
+    pthread_mutex_lock(&session_lock);
+    p_session->p_next = p_sessions;
+    p_sessions        = p_session;
+    p_reply           = copy_bitmap(p_session, p_arena, reserve, p_len);
+    pthread_mutex_unlock(&session_lock);
+    return p_reply;
+}
+
+int upload_session_attach (const char * p_filename, uint64_t upload_id, uint64_t offset, uint64_t length,
+                           upload_session_t ** pp_session)
+{
+    int file_fd = -1;
+    int err     = 0;
+
+    pthread_mutex_lock(&session_lock);
+    upload_session_t * p_session = find_session(p_filename);
+    if (NULL == p_session)
+    {
+        err = ENOENT;
+    }
+    else if (p_session->upload.upload_id != upload_id)
+    {
+        err = ESTALE;
+    }
+    else if (true == p_session->committing)
+    {
+        err = EBUSY;
+    }
+    else if ((0 != offset % p_session->chunk_size) || (offset >= p_session->upload.size) ||
+             (length != ((p_session->upload.size - offset > p_session->chunk_size) ?
+                         p_session->chunk_size : p_session->upload.size - offset)))
+    {
+        err = EINVAL;
+    }
+    else
+    {
+        // every connection gets its own descriptor so it can close it like any
+        // other upload, the writes all land in the one staging file
+        file_fd = fcntl(p_session->file_fd, F_DUPFD_CLOEXEC, 0);
+        err     = errno;
+    }
+
+    if (-1 != file_fd)
+    {
+        p_session->writers++;
+        *pp_session = p_session;
+    }
+    pthread_mutex_unlock(&session_lock);
+
+    if (-1 == file_fd)
+    {
+        fprintf(stderr, "%s cannot take chunk %" PRIu64 " of %s: %s\n", __func__, offset, p_filename, strerror(err));
+        errno = err;
+    }
+    return file_fd;
+}
+
+int upload_session_store (upload_session_t * p_session, int file_fd, uint64_t offset)
+{
+    uint64_t idx     = offset / p_session->chunk_size;
+    uint8_t  bit     = 1 << (idx % 8);
+    int      ret_val = 0;
+
+    // the chunk must be on disk before the bitmap claims it
+    if (-1 == fdatasync(file_fd))
+    {
+        fprintf(stderr, "%s could not flush chunk: %s\n", __func__, strerror(errno));
+        return -1;
+    }
+
+    pthread_mutex_lock(&session_lock);
+    if (0 == (p_session->p_bitmap[idx / 8] & bit))
+    {
+        p_session->p_bitmap[idx / 8] |= bit;
+        p_session->stored++;
+    }
+    if (-1 == pwrite_all(p_session->upload.journal_fd, &p_session->p_bitmap[idx / 8], 1,
+                         sizeof(journal_rec_t) + (idx / 8)))
+    {
+        ret_val = -1;
+    }
+    pthread_mutex_unlock(&session_lock);
+    return ret_val;
+}
+
+void upload_session_detach (upload_session_t * p_session)
+{
+    pthread_mutex_lock(&session_lock);
+    p_session->writers--;
+    pthread_mutex_unlock(&session_lock);
+}
+
+int upload_session_commit (const char * p_filename, uint64_t upload_id, uint64_t size)
+{
+    int err = 0;
+
+    pthread_mutex_lock(&session_lock);
+    upload_session_t * p_session = find_session(p_filename);
+    if (NULL == p_session)
+    {
+        err = ENOENT;
+    }
+    else if ((p_session->upload.upload_id != upload_id) || (p_session->upload.size != size))
+    {
+        err = ESTALE;
+    }
+    else if ((true == p_session->committing) || (0 < p_session->writers))
+    {
+        err = EBUSY;
+    }
+    else if (p_session->stored < p_session->num_chunks)
+    {
+        err = ENODATA;
+    }
+    else
+    {
+        p_session->committing = true;
+    }
+    pthread_mutex_unlock(&session_lock);
+
+    if (0 != err)
+    {
+        fprintf(stderr, "%s cannot publish %s: %s\n", __func__, p_filename, strerror(err));
+        errno = err;
+        return -1;
+    }
+
+    if (-1 == upload_finish(&p_session->upload, p_session->file_fd))
+    {
+        err = errno;
+        pthread_mutex_lock(&session_lock);
+        p_session->committing = false;
+        pthread_mutex_unlock(&session_lock);
+        errno = err;
+        return -1;
+    }
+
+    pthread_mutex_lock(&session_lock);
+    upload_session_t ** pp_link = &p_sessions;
+    while (*pp_link != p_session)
+    {
+        pp_link = &(*pp_link)->p_next;
+    }
+    *pp_link = p_session->p_next;
+    pthread_mutex_unlock(&session_lock);
+
+    printf("Upload session of %s complete\n", p_filename);
+    free_session(p_session);
+    return 0;
+}
+
+void upload_session_cleanup ()
+{
+    pthread_mutex_lock(&session_lock);
+    while (NULL != p_sessions)
+    {
+        upload_session_t * p_session = p_sessions;
+        p_sessions = p_session->p_next;
+        free_session(p_session);
+    }
+    pthread_mutex_unlock(&session_lock);
+}
+
+/*** end upload_journal.c ***/
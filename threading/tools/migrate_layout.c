@@ -0,0 +1,299 @@
+#define _XOPEN_SOURCE 700
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <limits.h>
+#include <time.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+
+#include "../includes/file_operations.h"
+#include "../includes/storage_layout.h"
+
+/*
+ * Converts the file server directory between the flat and the sharded storage
+ * layout. Run it from the directory holding FileServer/, like the server.
+ *
+ * usage: ./bin/migrate_layout [sharded|flat]
+ *
+ * Moving to the sharded layout works offline, or online while the server runs
+ * with -l sharded: the server keeps serving every file from the top level
+ * until it has been renamed into its shard. A server running flat would lose
+ * sight of the moved files, so the tool refuses. Every move is a rename()
+ * within the same filesystem, an interrupted migration is simply run again.
+ *
+ * Moving back to the flat layout needs the server stopped.
+ */
+
+#define PROGRESS_EVERY  100000
+
+/**
+ * @brief - what a migration did
+ * @member moved - files renamed into place
+ * @member stale - top level copies dropped because their shard copy is newer
+ */
+typedef struct migrate_stats
+{
+    size_t  moved;
+    size_t  stale;
+} migrate_stats_t;
+
+/**
+ * BOOL IS_STORED_FILE:
+ * @brief - true for a regular file of a directory that is a stored file
+ */
+static bool is_stored_file (DIR * p_dir, const struct dirent * p_ent)
+{
+    struct stat file_stat = { 0 };
+
+    if ((DT_REG != p_ent->d_type) && (DT_UNKNOWN != p_ent->d_type))
+    {
+        return false;
+    }
+    if (0 == strcmp(p_ent->d_name, LAYOUT_MARKER_NAME))
+    {
+        return false;
+    }
+    return (0 == fstatat(dirfd(p_dir), p_ent->d_name, &file_stat, AT_SYMLINK_NOFOLLOW)) && S_ISREG(file_stat.st_mode);
+}
+
+/**
+ * VOID REPORT_PROGRESS:
+ * @brief - prints a line every PROGRESS_EVERY files
+ */
+static void report_progress (const migrate_stats_t * p_stats)
+{
+    size_t done = p_stats->moved + p_stats->stale;
+
+    if (0 == done % PROGRESS_EVERY)
+    {
+        printf("%zu file(s) migrated ...\n", done);
+    }
+}
+
+/**
+ * INT MOVE_TO_SHARDS:
+ * @brief - renames every file at the top level into its shard. An entry
+ *          removed while the directory is being read may or may not be
+ *          returned again, so passes are repeated until one moves nothing
+ * @return - 0 on success, -1 on error
+ */
+static int move_to_shards (migrate_stats_t * p_stats)
+{
+    char   p_from[PATH_MAX] = { 0 };
+    char   p_to[PATH_MAX]   = { 0 };
+    size_t before           = 0;
+
+    do
+    {
+        DIR           * p_dir = opendir(FILE_SERVER_DIR);
+        struct dirent * p_ent = NULL;
+
+        if (NULL == p_dir)
+        {
+            fprintf(stderr, "%s could not open %s: %s\n", __func__, FILE_SERVER_DIR, strerror(errno));
+            return -1;
+        }
+
+        before = p_stats->moved + p_stats->stale;
+        while (NULL != (p_ent = readdir(p_dir)))
+        {
+            if (false == is_stored_file(p_dir, p_ent))
+            {
+                continue;
+            }
+
+            snprintf(p_from, sizeof(p_from), "%s%s", FILE_SERVER_DIR, p_ent->d_name);
+            layout_shard_dir(layout_shard(layout_hash(p_ent->d_name)), p_to, sizeof(p_to));
+            strncat(p_to, p_ent->d_name, sizeof(p_to) - strlen(p_to) - 1);
+
+            // a file already in its shard was uploaded after the switch, the
+            // top level copy is the stale one
+            if (0 == renameat2(AT_FDCWD, p_from, AT_FDCWD, p_to, RENAME_NOREPLACE))
+            {
+                p_stats->moved++;
+            }
+            else if ((EEXIST == errno) && (0 == unlink(p_from)))
+            {
+                p_stats->stale++;
+            }
+            else if (ENOENT != errno)
+            {
+                fprintf(stderr, "%s could not move %s: %s\n", __func__, p_from, strerror(errno));
+                closedir(p_dir);
+                return -1;
+            }
+            report_progress(p_stats);
+        }
+        closedir(p_dir);
+    } while (before != p_stats->moved + p_stats->stale);
+
+    return 0;
+}
+
+/**
+ * INT MOVE_TO_TOP:
+ * @brief - renames every file of every shard to the top level, a shard copy
+ *          replaces a top level copy of the same name
+ * @return - 0 on success, -1 on error
+ */
+static int move_to_top (migrate_stats_t * p_stats)
+{
+    char p_shard[PATH_MAX] = { 0 };
+    char p_from[PATH_MAX]  = { 0 };
+    char p_to[PATH_MAX]    = { 0 };
+
+    for (unsigned shard = 0; shard < SHARD_COUNT; shard++)
+    {
+        DIR           * p_dir = NULL;
+        struct dirent * p_ent = NULL;
+
+        layout_shard_dir(shard, p_shard, sizeof(p_shard));
+        p_dir = opendir(p_shard);
+        if (NULL == p_dir)
+        {
+            if (ENOENT == errno)
+            {
+                continue;
+            }
+            fprintf(stderr, "%s could not open %s: %s\n", __func__, p_shard, strerror(errno));
+            return -1;
+        }
+
+        while (NULL != (p_ent = readdir(p_dir)))
+        {
+            if (false == is_stored_file(p_dir, p_ent))
+            {
+                continue;
+            }
+
+            memcpy(p_from, p_shard, sizeof(p_from));
+            strncat(p_from, p_ent->d_name, sizeof(p_from) - strlen(p_from) - 1);
+            snprintf(p_to, sizeof(p_to), "%s%s", FILE_SERVER_DIR, p_ent->d_name);
+            if (-1 == rename(p_from, p_to))
+            {
+                fprintf(stderr, "%s could not move %s: %s\n", __func__, p_from, strerror(errno));
+                closedir(p_dir);
+                return -1;
+            }
+            p_stats->moved++;
+            report_progress(p_stats);
+        }
+        closedir(p_dir);
+    }
+    return 0;
+}
+
+/**
+ * VOID REMOVE_SHARDS:
+ * @brief - removes the emptied shard directories, anything left in one is
+ *          reported and kept
+ */
+static void remove_shards ()
+{
+    char p_path[PATH_MAX] = { 0 };
+
+    for (unsigned shard = 0; shard < SHARD_COUNT; shard++)
+    {
+        layout_shard_dir(shard, p_path, sizeof(p_path));
+        if ((-1 == rmdir(p_path)) && (ENOENT != errno))
+        {
+            fprintf(stderr, "%s could not remove %s: %s\n", __func__, p_path, strerror(errno));
+        }
+
+        // the first level directory goes with its last shard
+        if (SHARD_FANOUT - 1 == shard % SHARD_FANOUT)
+        {
+            p_path[strlen(FILE_SERVER_DIR) + 2] = '\0';
+            if ((-1 == rmdir(p_path)) && (ENOENT != errno))
+            {
+                fprintf(stderr, "%s could not remove %s: %s\n", __func__, p_path, strerror(errno));
+            }
+        }
+    }
+}
+
+int main (int argc, char ** argv)
+{
+    migrate_stats_t stats   = { 0 };
+    struct timespec start   = { 0 };
+    struct timespec end     = { 0 };
+    bool            sharded = false;
+    bool            online  = false;
+    int             dir_fd  = -1;
+    int             ret_val = -1;
+
+    if ((2 != argc) ||
+        ((0 != strcmp(argv[1], LAYOUT_NAME_SHARDED)) && (0 != strcmp(argv[1], LAYOUT_NAME_FLAT))))
+    {
+        fprintf(stderr, "usage: %s [%s|%s]\n", argv[0], LAYOUT_NAME_SHARDED, LAYOUT_NAME_FLAT);
+        return EXIT_FAILURE;
+    }
+    sharded = (0 == strcmp(argv[1], LAYOUT_NAME_SHARDED));
+
+    // a running server holds a shared lock on the directory
+    dir_fd = open(FILE_SERVER_DIR, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (-1 == dir_fd)
+    {
+        fprintf(stderr, "%s could not open %s: %s\n", __func__, FILE_SERVER_DIR, strerror(errno));
+        return EXIT_FAILURE;
+    }
+    online = (-1 == flock(dir_fd, LOCK_EX | LOCK_NB)) && (EWOULDBLOCK == errno);
+
+    storage_layout = layout_read();
+    if ((true == online) && (false == sharded))
+    {
+        fprintf(stderr, "%s the server is running, stop it first\n", __func__);
+        close(dir_fd);
+        return EXIT_FAILURE;
+    }
+    if ((true == online) && (LAYOUT_FLAT == storage_layout))
+    {
+        fprintf(stderr, "%s the server is running with the flat layout, restart it with -l %s first\n",
+                __func__, LAYOUT_NAME_SHARDED);
+        close(dir_fd);
+        return EXIT_FAILURE;
+    }
+
+    printf("Migrating %s to the %s layout (%s) ...\n", FILE_SERVER_DIR, argv[1], (true == online) ? "online" : "offline");
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if (true == sharded)
+    {
+        ret_val = (-1 == layout_create_shards()) ? -1 : move_to_shards(&stats);
+    }
+    else if (LAYOUT_SHARDED == storage_layout)
+    {
+        // the marker goes before the shards, an interrupted run stays sharded
+        // and finds the files at either place
+        ret_val = move_to_top(&stats);
+        if ((0 == ret_val) && (-1 == (ret_val = unlink(LAYOUT_MARKER))))
+        {
+            fprintf(stderr, "%s could not remove %s: %s\n", __func__, LAYOUT_MARKER, strerror(errno));
+        }
+        if (0 == ret_val)
+        {
+            remove_shards();
+        }
+    }
+    else
+    {
+        ret_val = 0;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    double elapsed = (double)(end.tv_sec - start.tv_sec) + ((double)(end.tv_nsec - start.tv_nsec) / 1e9);
+    printf("%zu file(s) moved, %zu stale top level cop(ies) removed in %.2fs\n", stats.moved, stats.stale, elapsed);
+
+    close(dir_fd);
+    return (-1 == ret_val) ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+/*** end migrate_layout.c ***/